@@ -0,0 +1,76 @@
+//
+// This is a microbenchmark of the BTFNT branch predictor. It measures the
+// time per prediction as the number of unique branches grows, which should
+// stay roughly flat since BTFNT looks branches up in a hash index.
+//
+// Usage:
+//
+//      ./bench/btfnt_bench [NUM_PREDICTIONS]
+//
+// The results are printed as CSV.
+//
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "branch_predictors.h"
+
+#define NUM_ADDRESSES (1 << 16)
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// A small deterministic generator so that every run uses the same branches.
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t num_predictions = argc > 1 ? strtoull(argv[1], NULL, 10) : 50000000;
+
+    printf("num_branches,num_predictions,ns_per_prediction,taken\n");
+    for (uint32_t num_branches = 16; num_branches <= (1 << 20); num_branches <<= 2) {
+        uint32_t seed = 0x12345678;
+        struct branch_metadata *branch_metadatas =
+            calloc(num_branches, sizeof(struct branch_metadata));
+        for (uint32_t i = 0; i < num_branches; i++) {
+            branch_metadatas[i].address = xorshift32(&seed) & ~3u;
+            branch_metadatas[i].target = xorshift32(&seed) & ~3u;
+        }
+
+        // Predict branches picked uniformly from the metadata.
+        uint32_t *addresses = malloc(NUM_ADDRESSES * sizeof(uint32_t));
+        for (uint32_t i = 0; i < NUM_ADDRESSES; i++)
+            addresses[i] = branch_metadatas[xorshift32(&seed) % num_branches].address;
+
+        struct branch_predictor *bp = btfnt_branch_predictor_new(num_branches, branch_metadatas);
+
+        uint64_t taken = 0;
+        double start = now_ns();
+        for (uint64_t i = 0; i < num_predictions; i++)
+            taken += bp->predict(bp, addresses[i & (NUM_ADDRESSES - 1)]);
+        double elapsed = now_ns() - start;
+
+        printf("%u,%" PRIu64 ",%.3f,%" PRIu64 "\n", num_branches, num_predictions,
+               elapsed / num_predictions, taken);
+
+        bp->cleanup(bp);
+        free(bp);
+        free(addresses);
+        free(branch_metadatas);
+    }
+
+    return 0;
+}
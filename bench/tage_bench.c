@@ -0,0 +1,90 @@
+//
+// This is a microbenchmark of the TAGE branch predictor. It measures the time
+// per branch and the prediction rate as the number of tagged tables grows,
+// which costs a table lookup and three folded history updates per table.
+//
+// Usage:
+//
+//      ./bench/tage_bench [NUM_BRANCHES]
+//
+// The results are printed as CSV.
+//
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "branch_predictors.h"
+
+#define NUM_RECORDS (1 << 20)
+#define NUM_ADDRESSES 4096
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// A small deterministic generator so that every run uses the same branches.
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t num_branches = argc > 1 ? strtoull(argv[1], NULL, 10) : 20000000;
+
+    // Loops of varying trip counts with branches in their bodies that depend
+    // on the previous branches, so that longer histories are worth having.
+    uint32_t seed = 0x12345678;
+    uint32_t *addresses = malloc(NUM_RECORDS * sizeof(uint32_t));
+    uint8_t *directions = malloc(NUM_RECORDS);
+    for (uint32_t i = 0; i < NUM_RECORDS;) {
+        uint32_t loop = xorshift32(&seed) % NUM_ADDRESSES & ~7u;
+        uint32_t trips = 2 + loop % 29;
+        for (uint32_t trip = 0; trip < trips && i < NUM_RECORDS; trip++) {
+            for (uint32_t b = 1; b < 4 && i < NUM_RECORDS; b++, i++) {
+                addresses[i] = (loop + b) << 2;
+                directions[i] = i > 3 ? directions[i - 3] ^ (xorshift32(&seed) % 16 == 0)
+                                      : TAKEN;
+            }
+            if (i == NUM_RECORDS) break;
+            addresses[i] = loop << 2;
+            directions[i++] = trip + 1 < trips ? TAKEN : NOT_TAKEN;
+        }
+    }
+
+    printf("tables,num_branches,ns_per_branch,rate\n");
+    for (uint32_t tables = 1; tables <= TAGE_MAX_TABLES; tables++) {
+        char spec[64];
+        snprintf(spec, sizeof(spec), "TAGE:tables=%u", tables);
+        struct branch_index *branch_index = branch_index_new(0, NULL);
+        struct branch_predictor *bp = branch_predictor_new(spec, branch_index);
+        branch_index_free(branch_index);
+
+        uint64_t correct = 0;
+        double start = now_ns();
+        for (uint64_t i = 0; i < num_branches; i += NUM_RECORDS) {
+            uint32_t n = num_branches - i < NUM_RECORDS ? num_branches - i : NUM_RECORDS;
+            bp->simulate_batch(bp, addresses, directions, n, &correct);
+        }
+        double elapsed = now_ns() - start;
+
+        printf("%u,%" PRIu64 ",%.3f,%.6f\n", tables, num_branches, elapsed / num_branches,
+               (double)correct / num_branches);
+
+        bp->cleanup(bp);
+        free(bp);
+    }
+
+    free(addresses);
+    free(directions);
+    return 0;
+}
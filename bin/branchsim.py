@@ -0,0 +1,178 @@
+#! /usr/bin/env python3
+
+# A ctypes wrapper around libbranchsim.so, for simulating traces from Python
+# without running ./branchsim and parsing its output. Build the library with
+# `make libbranchsim.so` first.
+#
+#   import branchsim
+#   with branchsim.Trace("inputs/trace1") as trace:
+#       stats = trace.simulate(["2BG", "2BL:lhr=8"])
+#
+# Run as a script it prints the same OUTPUT lines as ./branchsim for a trace
+# file: ./bin/branchsim.py TRACE SPEC...
+
+import ctypes
+import os
+import sys
+
+MAX_COUNTERS = 16
+ERRORS = {
+    1: "the trace has already been read",
+    2: "too many predictors",
+    3: "the trace is malformed",
+}
+
+
+class Counter(ctypes.Structure):
+    _fields_ = [("name", ctypes.c_char * 64), ("value", ctypes.c_uint64)]
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [
+        ("predictions", ctypes.c_uint64),
+        ("correct", ctypes.c_uint64),
+        ("incorrect", ctypes.c_uint64),
+        ("rate", ctypes.c_double),
+        ("num_counters", ctypes.c_uint32),
+        ("counters", Counter * MAX_COUNTERS),
+    ]
+
+    def to_dict(self):
+        return {
+            "predictions": self.predictions,
+            "correct": self.correct,
+            "incorrect": self.incorrect,
+            "rate": self.rate,
+            "counters": {
+                c.name.decode(): c.value for c in self.counters[: self.num_counters]
+            },
+        }
+
+
+def load(path=None):
+    if path is None:
+        path = os.environ.get("LIBBRANCHSIM") or os.path.join(
+            os.path.dirname(os.path.abspath(__file__)), "..", "libbranchsim.so"
+        )
+    lib = ctypes.CDLL(path)
+    lib.branchsim_trace_open.argtypes = [ctypes.c_char_p]
+    lib.branchsim_trace_open.restype = ctypes.c_void_p
+    lib.branchsim_trace_open_fd.argtypes = [ctypes.c_int]
+    lib.branchsim_trace_open_fd.restype = ctypes.c_void_p
+    lib.branchsim_trace_num_branches.argtypes = [ctypes.c_void_p]
+    lib.branchsim_trace_num_branches.restype = ctypes.c_uint32
+    lib.branchsim_trace_close.argtypes = [ctypes.c_void_p]
+    lib.branchsim_trace_close.restype = None
+    lib.branchsim_predictor_new.argtypes = [ctypes.c_char_p, ctypes.c_void_p]
+    lib.branchsim_predictor_new.restype = ctypes.c_void_p
+    lib.branchsim_predictor_free.argtypes = [ctypes.c_void_p]
+    lib.branchsim_predictor_free.restype = None
+    lib.branchsim_num_predictor_types.argtypes = []
+    lib.branchsim_num_predictor_types.restype = ctypes.c_uint32
+    lib.branchsim_predictor_type_name.argtypes = [ctypes.c_uint32]
+    lib.branchsim_predictor_type_name.restype = ctypes.c_char_p
+    lib.branchsim_simulate.argtypes = [
+        ctypes.c_void_p,
+        ctypes.POINTER(ctypes.c_void_p),
+        ctypes.c_uint32,
+    ]
+    lib.branchsim_simulate.restype = ctypes.c_int
+    lib.branchsim_predictor_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(Stats)]
+    lib.branchsim_predictor_stats.restype = None
+    return lib
+
+
+_lib = None
+
+
+def library():
+    global _lib
+    if _lib is None:
+        _lib = load()
+    return _lib
+
+
+def predictor_types():
+    lib = library()
+    return [
+        lib.branchsim_predictor_type_name(i).decode()
+        for i in range(lib.branchsim_num_predictor_types())
+    ]
+
+
+class Trace:
+    def __init__(self, path):
+        self.lib = library()
+        self.handle = self.lib.branchsim_trace_open(os.fsencode(path))
+        if not self.handle:
+            raise ValueError(f"cannot open trace {path}")
+
+    @property
+    def num_branches(self):
+        return self.lib.branchsim_trace_num_branches(self.handle)
+
+    def simulate(self, specs):
+        """Simulate the trace on fresh predictors, returning {spec: stats}."""
+        duplicates = sorted({spec for spec in specs if specs.count(spec) > 1})
+        if duplicates:
+            raise ValueError(f"duplicate predictor {', '.join(duplicates)}")
+
+        predictors = []
+        try:
+            for spec in specs:
+                predictor = self.lib.branchsim_predictor_new(spec.encode(), self.handle)
+                if not predictor:
+                    raise ValueError(f"invalid predictor {spec}")
+                predictors.append(predictor)
+
+            array = (ctypes.c_void_p * len(predictors))(*predictors)
+            error = self.lib.branchsim_simulate(self.handle, array, len(predictors))
+            if error:
+                raise RuntimeError(ERRORS.get(error, f"error {error}"))
+
+            results = {}
+            for spec, predictor in zip(specs, predictors):
+                stats = Stats()
+                self.lib.branchsim_predictor_stats(predictor, ctypes.byref(stats))
+                results[spec] = stats.to_dict()
+            return results
+        finally:
+            for predictor in predictors:
+                self.lib.branchsim_predictor_free(predictor)
+
+    def close(self):
+        if self.handle:
+            self.lib.branchsim_trace_close(self.handle)
+            self.handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(f"Usage: {sys.argv[0]} TRACE SPEC...", file=sys.stderr)
+        print("Predictors: " + " ".join(predictor_types()), file=sys.stderr)
+        return 1
+
+    specs = sys.argv[2:]
+    with Trace(sys.argv[1]) as trace:
+        results = trace.simulate(specs)
+
+    for spec in specs:
+        stats = results[spec]
+        prefix = f"{spec} " if len(specs) > 1 else ""
+        print(f"{prefix}OUTPUT PREDICTIONS {stats['predictions']}")
+        print(f"{prefix}OUTPUT CORRECT {stats['correct']}")
+        print(f"{prefix}OUTPUT INCORRECT {stats['incorrect']}")
+        print(f"{prefix}OUTPUT BRANCH PREDICTION RATE {stats['rate']:.8f}")
+        for name, value in stats["counters"].items():
+            print(f"{prefix}OUTPUT {name} {value}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,95 @@
+#! /usr/bin/env python3
+
+# A client for ./branchsim --server=PATH (see src/server.h for the protocol).
+#
+#   import branchsim_client
+#   with branchsim_client.Client("/tmp/branchsim.sock") as client:
+#       stats = client.run("2BG", path="inputs/trace1")
+#       stats = client.run("2BG", data=open("inputs/trace1", "rb").read())
+#
+# Run as a script it prints one response per trace and spec:
+# ./bin/branchsim_client.py [--inline] [--repeat=N] SOCKET TRACE SPEC...
+# With --repeat, every job is sent N times and the mean latency of a job is
+# printed to stderr.
+
+import os
+import socket
+import sys
+import time
+
+
+class ServerError(Exception):
+    pass
+
+
+def parse_response(line):
+    status, _, rest = line.partition(" ")
+    if status != "OK":
+        raise ServerError(rest)
+    stats = {}
+    for field in rest.split():
+        key, _, value = field.partition("=")
+        stats[key] = float(value) if key == "RATE" else int(value)
+    return stats
+
+
+class Client:
+    def __init__(self, path):
+        self.socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.socket.connect(path)
+        self.responses = self.socket.makefile("r")
+
+    def close(self):
+        self.responses.close()
+        self.socket.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def run(self, spec, path=None, data=None):
+        if data is None:
+            self.socket.sendall(f"RUN {spec} {os.path.abspath(path)}\n".encode())
+        else:
+            self.socket.sendall(f"RUN {spec} - {len(data)}\n".encode() + data)
+        return parse_response(self.responses.readline().rstrip("\n"))
+
+
+def main(argv):
+    inline = "--inline" in argv
+    repeat = 1
+    args = []
+    for arg in argv[1:]:
+        if arg.startswith("--repeat="):
+            repeat = int(arg.split("=", 1)[1])
+        elif arg != "--inline":
+            args.append(arg)
+    if len(args) < 3:
+        print(
+            f"Usage: {argv[0]} [--inline] [--repeat=N] SOCKET TRACE SPEC...",
+            file=sys.stderr,
+        )
+        return 1
+
+    path, trace, specs = args[0], args[1], args[2:]
+    data = open(trace, "rb").read() if inline else None
+    with Client(path) as client:
+        for spec in specs:
+            start = time.perf_counter()
+            for _ in range(repeat):
+                try:
+                    stats = client.run(spec, path=trace, data=data)
+                except ServerError as e:
+                    print(f"{spec}: {e}", file=sys.stderr)
+                    return 1
+            elapsed = time.perf_counter() - start
+            print(spec, " ".join(f"{key}={value}" for key, value in stats.items()))
+            if repeat > 1:
+                print(f"{spec}: {elapsed / repeat * 1e6:.1f} us/job", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,112 @@
+#! /usr/bin/env python3
+
+import csv
+import os
+import subprocess
+import sys
+import time
+from datetime import datetime
+from pathlib import Path
+
+root = os.getcwd()
+traces_dir = Path(root, "bench_results", "traces")
+results_dir = Path(root, "bench_results")
+
+# The synthetic traces to benchmark on: (name, tracegen arguments). The traces are
+# deterministic, so they are only generated once.
+traces = [
+    ("mixed-1k", ["--branches", "1024", "--records", "20000000"]),
+    ("mixed-64k", ["--branches", "65536", "--records", "20000000"]),
+    ("loops-256", ["--branches", "256", "--records", "20000000", "--mix", "1,0,0,0"]),
+    ("random-16k", ["--branches", "16384", "--records", "20000000", "--mix", "0,0,1,0"]),
+]
+
+if "--fast" in sys.argv:
+    traces = [(name, args[:3] + ["2000000"] + args[4:]) for name, args in traces]
+    traces_dir = Path(traces_dir, "fast")
+
+
+class bcolors:
+    BOLD = "\033[1m"
+    ENDC = "\033[0m"
+
+
+def generate_trace(name, args):
+    path = Path(traces_dir, f"{name}.bin")
+    if not path.exists():
+        traces_dir.mkdir(exist_ok=True, parents=True)
+        print(f"  Generating {path}")
+        subprocess.run(["./tools/tracegen", *args, str(path)], check=True)
+    return path
+
+
+def run_sim(predictor, trace_path):
+    # Time one simulation and get its peak RSS from wait4.
+    with open(trace_path, "rb") as trace:
+        start = time.perf_counter()
+        sim_process = subprocess.Popen(
+            ["./branchsim", predictor], stdin=trace, stdout=subprocess.PIPE
+        )
+        stdout = sim_process.stdout.read()
+        _, status, rusage = os.wait4(sim_process.pid, 0)
+        elapsed = time.perf_counter() - start
+    sim_process.returncode = os.waitstatus_to_exitcode(status)
+    if sim_process.returncode != 0:
+        raise RuntimeError(f"branchsim {predictor} failed on {trace_path}")
+
+    outputs = {}
+    for line in stdout.decode().split("\n"):
+        if line.startswith("OUTPUT "):
+            key, value = line[len("OUTPUT ") :].rsplit(" ", 1)
+            outputs[key] = value
+    return elapsed, rusage.ru_maxrss, outputs
+
+
+predictors = (
+    subprocess.run(["./branchsim", "--list-predictors"], check=True, stdout=subprocess.PIPE)
+    .stdout.decode()
+    .split()
+)
+
+print(f"{bcolors.BOLD}Preparing traces.{bcolors.ENDC}")
+trace_paths = [(name, generate_trace(name, args)) for name, args in traces]
+
+results_dir.mkdir(exist_ok=True, parents=True)
+results_filename = results_dir.joinpath(datetime.now().strftime("%Y-%m-%d-%H-%M-%S.csv"))
+
+print(f"{bcolors.BOLD}Running benchmarks.{bcolors.ENDC}")
+with open(results_filename, "w", newline="") as f:
+    writer = csv.writer(f)
+    writer.writerow(
+        [
+            "predictor",
+            "trace",
+            "predictions",
+            "seconds",
+            "ns_per_branch",
+            "max_rss_kib",
+            "prediction_rate",
+        ]
+    )
+    for trace_name, trace_path in trace_paths:
+        for predictor in predictors:
+            elapsed, max_rss, outputs = run_sim(predictor, trace_path)
+            predictions = int(outputs["PREDICTIONS"])
+            ns_per_branch = elapsed * 1e9 / predictions
+            print(
+                f"  {predictor:>6} {trace_name:>12}: {ns_per_branch:8.3f} ns/branch "
+                f"{max_rss:8d} KiB"
+            )
+            writer.writerow(
+                [
+                    predictor,
+                    trace_name,
+                    predictions,
+                    f"{elapsed:.6f}",
+                    f"{ns_per_branch:.3f}",
+                    max_rss,
+                    outputs["BRANCH PREDICTION RATE"],
+                ]
+            )
+
+print(f"{bcolors.BOLD}Writing results to {results_filename}{bcolors.ENDC}")
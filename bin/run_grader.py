@@ -43,10 +43,10 @@ def test_results_add(number, name, output, score, max_score=1):
     )
 
 
-def run_sim(args, inputfile):
-    # Run the simulation.
+def run_sim(predictors, inputfile):
+    # Run the simulation for all of the predictors in a single pass over the trace.
     sim_process = subprocess.Popen(
-        ["./branchsim", *args],
+        ["./branchsim", ",".join(predictors)],
         stdin=subprocess.PIPE,
         stdout=subprocess.PIPE,
     )
@@ -55,8 +55,17 @@ def run_sim(args, inputfile):
     with open(inputfile, "rb") as i:
         stdout, _ = sim_process.communicate(i.read())
 
-    # Return the lines that have OUTPUT at the beginning
-    return list(filter(lambda l: l.startswith("OUTPUT"), stdout.decode().split("\n")))
+    # Return the lines that have OUTPUT at the beginning for each predictor. When
+    # more than one predictor is simulated, the lines are prefixed by its name.
+    output_lines = defaultdict(list)
+    for line in stdout.decode().split("\n"):
+        if len(predictors) == 1 and line.startswith("OUTPUT"):
+            output_lines[predictors[0]].append(line)
+        elif len(predictors) > 1 and " OUTPUT" in line:
+            predictor, output = line.split(" ", 1)
+            if output.startswith("OUTPUT"):
+                output_lines[predictor].append(output)
+    return output_lines
 
 
 # Simple static predictor functionality
@@ -70,12 +79,20 @@ max_scores = {"ant": 1, "at": 1, "btfnt": 1, "ltg": 1, "ltl": 1, "2bg": 1, "2bl"
 # run the simulation with the parameters specified by the expected fie.
 for infile in sorted(inputs_dir.iterdir()):
     print(f"  Checking {infile}")
-    for expected_file_path in sorted(expected_dir.glob(f"*-{infile.name}")):
+    expected_file_paths = sorted(expected_dir.glob(f"*-{infile.name}"))
+    predictors = [
+        re.match(rf"(ant|at|btfnt|ltg|ltl|2bg|2bl)-{infile.name}", p.name).group(1)
+        for p in expected_file_paths
+    ]
+    if not predictors:
+        continue
+    all_output_lines = run_sim(list(map(str.upper, predictors)), infile)
+
+    for expected_file_path, predictor in zip(expected_file_paths, predictors):
         file_parts = re.match(
             rf"(ant|at|btfnt|ltg|ltl|2bg|2bl)-{infile.name}",
             expected_file_path.name,
         )
-        predictor = file_parts.group(1)
         print(
             f"    with parameters {' '.join(map(str.upper, file_parts.groups()))}...",
             end=" ",
@@ -95,7 +112,7 @@ for infile in sorted(inputs_dir.iterdir()):
         test_indices[predictor] += 1
         test_name = expected_file_path.name
 
-        output_lines = run_sim(map(str.upper, file_parts.groups()), infile)
+        output_lines = all_output_lines[predictor.upper()]
 
         # Get the expected output.
         with open(expected_file_path) as ef:
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+bool arena_huge_pages = false;
+
+static size_t round_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+void *arena_new(size_t size)
+{
+    if (size >= ARENA_HUGE_PAGE_SIZE) {
+        // map one huge page more than needed and trim the mapping so that it
+        // starts on a huge page boundary.
+        size_t mapped_size = round_up(size, ARENA_HUGE_PAGE_SIZE);
+        char *mapping = mmap(NULL, mapped_size + ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) return NULL;
+        char *arena = (char *)round_up((uintptr_t)mapping, ARENA_HUGE_PAGE_SIZE);
+        if (arena > mapping) munmap(mapping, arena - mapping);
+        munmap(arena + mapped_size, mapping + ARENA_HUGE_PAGE_SIZE - arena);
+#ifdef MADV_HUGEPAGE
+        if (arena_huge_pages) madvise(arena, mapped_size, MADV_HUGEPAGE);
+#endif
+        return arena;
+    }
+
+    size_t allocated_size = round_up(size ? size : 1, ARENA_ALIGNMENT);
+    void *arena = aligned_alloc(ARENA_ALIGNMENT, allocated_size);
+    if (arena) memset(arena, 0, allocated_size);
+    return arena;
+}
+
+void *arena_copy(const void *arena, size_t size)
+{
+    void *copy = arena_new(size);
+    if (copy) memcpy(copy, arena, size);
+    return copy;
+}
+
+void arena_free(void *arena, size_t size)
+{
+    if (!arena) return;
+    if (size >= ARENA_HUGE_PAGE_SIZE)
+        munmap(arena, round_up(size, ARENA_HUGE_PAGE_SIZE));
+    else
+        free(arena);
+}
@@ -0,0 +1,82 @@
+//
+// This file defines the arenas that hold the tables of a branch predictor.
+//
+// All of the tables of a predictor instance (PHT, history registers and so
+// on) are carved out of a single zeroed block of memory, each of them
+// starting on its own cache line. The predictor owns the arena and frees it
+// in cleanup; the pointers to the tables point into it, so copying a
+// predictor is a memcpy of the arena followed by moving the pointers (see
+// branch_predictor_clone).
+//
+// Arenas of at least ARENA_HUGE_PAGE_SIZE bytes are mapped directly from the
+// kernel. When huge pages are enabled with --huge-pages they are also backed
+// by transparent huge pages, which saves TLB misses with large tables.
+//
+// A predictor lays out its arena with arena_layout_add and then allocates it:
+//
+//      struct arena_layout layout = {0};
+//      size_t pht_offset = arena_layout_add(&layout, pht_size);
+//      size_t history_offset = arena_layout_add(&layout, history_size);
+//      char *arena = arena_new(layout.size);
+//      uint64_t *pht = (uint64_t *)(arena + pht_offset);
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Every table in an arena starts on a cache line.
+#define ARENA_ALIGNMENT 64
+
+// Arenas of at least this size are mapped, and may use huge pages.
+#define ARENA_HUGE_PAGE_SIZE (2 << 20)
+
+// Whether large arenas are backed by huge pages. Set by --huge-pages.
+extern bool arena_huge_pages;
+
+// The size of an arena, grown by each table that is added to it.
+struct arena_layout {
+    size_t size;
+};
+
+//
+// Add a table to an arena layout.
+//
+// Arguments
+//  * layout: the layout.
+//  * size: the size of the table in bytes.
+//
+// Returns (size_t): the offset of the table in the arena.
+static inline size_t arena_layout_add(struct arena_layout *layout, size_t size)
+{
+    size_t offset = (layout->size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    layout->size = offset + size;
+    return offset;
+}
+
+//
+// Allocate a zeroed arena.
+//
+// Arguments
+//  * size: the size of the arena (the size of its layout).
+//
+// Returns (void *): the arena, aligned to ARENA_ALIGNMENT bytes.
+void *arena_new(size_t size);
+
+//
+// Allocate an arena holding a copy of another one.
+//
+// Returns (void *): the copy.
+void *arena_copy(const void *arena, size_t size);
+
+//
+// Free an arena.
+//
+// Arguments
+//  * arena: the arena, may be NULL.
+//  * size: the size it was allocated with.
+void arena_free(void *arena, size_t size);
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "branch_index.h"
+
+static inline uint32_t branch_index_entry_value(uint32_t position, uint32_t address,
+                                                uint32_t target)
+{
+    bool backward = target != BRANCH_TARGET_UNKNOWN && target <= address;
+    return (position << 1) | (backward ? BRANCH_INDEX_BACKWARD : 0);
+}
+
+// Allocate an empty table of 2^bits entries, where bits is at most 31.
+//
+// Returns (bool): false if the table cannot be allocated.
+static bool branch_index_allocate(struct branch_index *branch_index, uint32_t bits)
+{
+    struct branch_index_entry *entries =
+        malloc((1ull << bits) * sizeof(struct branch_index_entry));
+    if (!entries) return false;
+    branch_index->entries = entries;
+    branch_index->mask = (uint32_t)((1ull << bits) - 1);
+    branch_index->shift = 32 - bits;
+    for (uint64_t i = 0; i <= branch_index->mask; i++)
+        branch_index->entries[i].value = BRANCH_INDEX_NONE;
+    return true;
+}
+
+// Find the slot of an address, or the empty slot where it belongs.
+static inline uint32_t branch_index_find(const struct branch_index *branch_index,
+                                         uint32_t address)
+{
+    uint32_t slot = branch_index_slot(branch_index, address);
+    while (branch_index->entries[slot].value != BRANCH_INDEX_NONE &&
+           branch_index->entries[slot].address != address)
+        slot = (slot + 1) & branch_index->mask;
+    return slot;
+}
+
+// Double the table and put every entry back in its new slot.
+//
+// Returns (bool): false if the table already has 2^31 entries or the larger
+// table cannot be allocated, in which case the index is left as it was.
+static bool branch_index_grow(struct branch_index *branch_index)
+{
+    struct branch_index_entry *entries = branch_index->entries;
+    uint64_t size = (uint64_t)branch_index->mask + 1;
+    uint32_t bits = 32 - branch_index->shift + 1;
+    if (bits > 31 || !branch_index_allocate(branch_index, bits)) return false;
+    for (uint64_t i = 0; i < size; i++) {
+        if (entries[i].value == BRANCH_INDEX_NONE) continue;
+        branch_index->entries[branch_index_find(branch_index, entries[i].address)] = entries[i];
+    }
+    free(entries);
+    return true;
+}
+
+struct branch_index *branch_index_new(uint32_t num_branches,
+                                      const struct branch_metadata *branch_metadatas)
+{
+    if (num_branches > BRANCH_INDEX_MAX_BRANCHES) return NULL;
+
+    // Use a power-of-two table that is at most half full.
+    uint32_t bits = 4;
+    while ((1ull << bits) < 2ull * num_branches) bits++;
+
+    struct branch_index *branch_index = calloc(1, sizeof(struct branch_index));
+    if (!branch_index) return NULL;
+    branch_index->capacity = num_branches > 16 ? num_branches : 16;
+    branch_index->branches = malloc(branch_index->capacity * sizeof(struct branch_metadata));
+    if (!branch_index->branches || !branch_index_allocate(branch_index, bits)) {
+        free(branch_index->branches);
+        free(branch_index);
+        return NULL;
+    }
+    branch_index->references = 1;
+
+    for (uint32_t i = 0; i < num_branches; i++) {
+        uint32_t address = branch_metadatas[i].address;
+        uint32_t slot = branch_index_find(branch_index, address);
+        if (branch_index->entries[slot].value != BRANCH_INDEX_NONE) continue;
+
+        uint32_t position = branch_index->num_branches++;
+        branch_index->branches[position] = branch_metadatas[i];
+        branch_index->entries[slot].address = address;
+        branch_index->entries[slot].value =
+            branch_index_entry_value(position, address, branch_metadatas[i].target);
+    }
+
+    return branch_index;
+}
+
+struct branch_index *branch_index_ref(struct branch_index *branch_index)
+{
+    branch_index->references++;
+    return branch_index;
+}
+
+void branch_index_free(struct branch_index *branch_index)
+{
+    if (--branch_index->references > 0) return;
+    free(branch_index->entries);
+    free(branch_index->branches);
+    free(branch_index);
+}
+
+uint32_t branch_index_insert(struct branch_index *branch_index, uint32_t address,
+                             uint32_t target)
+{
+    uint32_t slot = branch_index_find(branch_index, address);
+    struct branch_index_entry *entry = &branch_index->entries[slot];
+    if (entry->value != BRANCH_INDEX_NONE) {
+        struct branch_metadata *branch = &branch_index->branches[entry->value >> 1];
+        if (branch->target == BRANCH_TARGET_UNKNOWN && target != BRANCH_TARGET_UNKNOWN) {
+            branch->target = target;
+            entry->value = branch_index_entry_value(entry->value >> 1, address, target);
+        }
+        return entry->value;
+    }
+
+    // A new branch is only added once there is room for it everywhere.
+    if (branch_index->num_branches == BRANCH_INDEX_MAX_BRANCHES) return BRANCH_INDEX_NONE;
+    if (branch_index->num_branches == branch_index->capacity) {
+        uint32_t capacity = branch_index->capacity < BRANCH_INDEX_MAX_BRANCHES / 2
+                                ? branch_index->capacity * 2
+                                : BRANCH_INDEX_MAX_BRANCHES;
+        struct branch_metadata *branches =
+            realloc(branch_index->branches, (size_t)capacity * sizeof(struct branch_metadata));
+        if (!branches) return BRANCH_INDEX_NONE;
+        branch_index->branches = branches;
+        branch_index->capacity = capacity;
+    }
+    // Keep the table at most half full.
+    if (2ull * (branch_index->num_branches + 1) > (uint64_t)branch_index->mask + 1) {
+        if (!branch_index_grow(branch_index)) return BRANCH_INDEX_NONE;
+        entry = &branch_index->entries[branch_index_find(branch_index, address)];
+    }
+
+    uint32_t position = branch_index->num_branches++;
+    branch_index->branches[position] = (struct branch_metadata){address, target};
+    entry->address = address;
+    entry->value = branch_index_entry_value(position, address, target);
+    return entry->value;
+}
@@ -0,0 +1,139 @@
+//
+// This file defines the branch index, a hash table that maps the address of
+// each unique branch to its position in the list of unique branches that the
+// index keeps.
+//
+// The table uses open addressing with linear probing and is kept at most half
+// full, so a lookup usually touches a single cache line. Each entry also
+// stores whether the branch is a backward branch (target <= address), which
+// is all that BTFNT needs to make a prediction.
+//
+// The index is either built from the branch metadata at the start of a trace,
+// or grown one branch at a time with branch_index_insert as the branches of a
+// trace without metadata are discovered. The table and the branch list double
+// when they fill up, so their size follows the number of unique branches seen
+// so far. An index is shared by the trace, the predictors and the profiles
+// that use it and is freed with its last reference.
+//
+
+#ifndef BRANCH_INDEX_H
+#define BRANCH_INDEX_H
+
+#include <stdint.h>
+
+#include "branch_metadata.h"
+
+// The value of an empty entry, and the value returned by a failed lookup.
+#define BRANCH_INDEX_NONE UINT32_MAX
+
+// Set in the value of an entry if the branch target is not after the branch.
+#define BRANCH_INDEX_BACKWARD 1u
+
+// The most unique branches an index holds. Their positions fit in the value
+// of an entry next to BRANCH_INDEX_BACKWARD, and the table, which is kept at
+// most half full, has at most 2^31 entries.
+#define BRANCH_INDEX_MAX_BRANCHES (1u << 30)
+
+// The target of a branch whose target is not known (yet). Such a branch is
+// not a backward branch. Since the value cannot be told apart from a real
+// target, the traces reject it as the target of a branch.
+#define BRANCH_TARGET_UNKNOWN UINT32_MAX
+
+struct branch_index_entry {
+    uint32_t address;
+    // (position in the branch list << 1) | BRANCH_INDEX_BACKWARD
+    uint32_t value;
+};
+
+struct branch_index {
+    uint32_t mask;
+    uint32_t shift;
+    struct branch_index_entry *entries;
+
+    // The unique branches in the order in which they were added.
+    uint32_t num_branches;
+    uint32_t capacity;
+    struct branch_metadata *branches;
+
+    uint32_t references;
+};
+
+//
+// Build the index for a list of branch metadata. Like a scan of the list,
+// the first entry for an address wins.
+//
+// Arguments
+//  * num_branches: the number of unique branches, may be 0.
+//  * branch_metadatas: the metadata of each of the unique branches.
+//
+// Returns (struct branch_index *): the new index, with one reference, or NULL
+// if num_branches is larger than BRANCH_INDEX_MAX_BRANCHES or the index
+// cannot be allocated.
+struct branch_index *branch_index_new(uint32_t num_branches,
+                                      const struct branch_metadata *branch_metadatas);
+
+//
+// Take another reference to an index.
+//
+// Returns (struct branch_index *): the index.
+struct branch_index *branch_index_ref(struct branch_index *branch_index);
+
+//
+// Drop a reference to an index, and free it with its table if it was the
+// last one.
+void branch_index_free(struct branch_index *branch_index);
+
+//
+// Add a branch to the index, or give a branch whose target is unknown its
+// target. The index grows as needed. A branch whose target is known keeps it.
+//
+// Arguments
+//  * branch_index: the index.
+//  * address: the branch instruction address.
+//  * target: the branch target, or BRANCH_TARGET_UNKNOWN.
+//
+// Returns (uint32_t): the value of the entry of the branch, or
+// BRANCH_INDEX_NONE if the branch is new and the index already holds
+// BRANCH_INDEX_MAX_BRANCHES branches or cannot grow. The branch is not added
+// then, and the index is left as it was.
+uint32_t branch_index_insert(struct branch_index *branch_index, uint32_t address,
+                             uint32_t target);
+
+static inline uint32_t branch_index_slot(const struct branch_index *branch_index,
+                                         uint32_t address)
+{
+    // Fibonacci hashing: the top bits of the product are well mixed even when
+    // the addresses only differ in a few low bits.
+    return (uint32_t)(address * 2654435769u) >> branch_index->shift;
+}
+
+//
+// Look up the value stored for a branch address.
+//
+// Returns (uint32_t): the value of the entry, or BRANCH_INDEX_NONE if the
+// address is not in the index.
+static inline uint32_t branch_index_lookup(const struct branch_index *branch_index,
+                                           uint32_t address)
+{
+    uint32_t slot = branch_index_slot(branch_index, address);
+    for (;;) {
+        const struct branch_index_entry *entry = &branch_index->entries[slot];
+        if (entry->value == BRANCH_INDEX_NONE || entry->address == address) return entry->value;
+        slot = (slot + 1) & branch_index->mask;
+    }
+}
+
+//
+// Look up the target of a branch.
+//
+// Returns (uint32_t): the target, or BRANCH_TARGET_UNKNOWN if the address is
+// not in the index or its target is not known.
+static inline uint32_t branch_index_target(const struct branch_index *branch_index,
+                                           uint32_t address)
+{
+    uint32_t value = branch_index_lookup(branch_index, address);
+    return value == BRANCH_INDEX_NONE ? BRANCH_TARGET_UNKNOWN
+                                      : branch_index->branches[value >> 1].target;
+}
+
+#endif
@@ -14,7 +14,26 @@
 // ============================================================================
 //
 
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include "branch_predictors.h"
+#include "counter_table.h"
+
+// The largest delay of the delayed update of the two-level predictors.
+#define TWO_LEVEL_MAX_DELAY 65536
+// The perceptron weights saturate at +-PERCEPTRON_MAX_WEIGHT.
+#define PERCEPTRON_MAX_WEIGHT 127
+// The longest perceptron history.
+#define PERCEPTRON_MAX_HISTORY 256
+// Each row of perceptron weights is padded to a multiple of this many bytes.
+#define PERCEPTRON_ALIGNMENT 32
 
 // ANT Branch Predictor
 // ============================================================================
@@ -32,6 +51,16 @@ void ant_branch_predictor_handle_result(struct branch_predictor *branch_predicto
     // Do not need for ANT
 }
 
+void ant_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                         const uint32_t *addresses, const uint8_t *directions,
+                                         uint32_t n, uint64_t *correct)
+{
+    // Correct whenever the branch was not taken
+    uint64_t taken = 0;
+    for (uint32_t i = 0; i < n; i++) taken += directions[i];
+    *correct += n - taken;
+}
+
 void ant_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
 {
     //no necessary cleanup
@@ -44,6 +73,7 @@ struct branch_predictor *ant_branch_predictor_new(uint32_t num_branches,
     ant_bp->cleanup = &ant_branch_predictor_cleanup;
     ant_bp->predict = &ant_branch_predictor_predict;
     ant_bp->handle_result = &ant_branch_predictor_handle_result;
+    ant_bp->simulate_batch = &ant_branch_predictor_simulate_batch;
 
     return ant_bp;
 }
@@ -64,6 +94,16 @@ void at_branch_predictor_handle_result(struct branch_predictor *branch_predictor
     // Not needed for AT
 }
 
+void at_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                        const uint32_t *addresses, const uint8_t *directions,
+                                        uint32_t n, uint64_t *correct)
+{
+    // Correct whenever the branch was taken
+    uint64_t taken = 0;
+    for (uint32_t i = 0; i < n; i++) taken += directions[i];
+    *correct += taken;
+}
+
 void at_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
 {
     // No necessary cleanup
@@ -76,6 +116,7 @@ struct branch_predictor *at_branch_predictor_new(uint32_t num_branches,
     at_bp->cleanup = &at_branch_predictor_cleanup;
     at_bp->predict = &at_branch_predictor_predict;
     at_bp->handle_result = &at_branch_predictor_handle_result;
+    at_bp->simulate_batch = &at_branch_predictor_simulate_batch;
 
     return at_bp;
 }
@@ -86,105 +127,375 @@ struct branch_predictor *at_branch_predictor_new(uint32_t num_branches,
 enum branch_direction btfnt_branch_predictor_predict(struct branch_predictor *branch_predictor,
                                                      uint32_t address)
 {
-    // return this branch predictors prediction for the branch at the
-    // given address.
-    uint32_t i = 0;
-    while(branch_predictor->data[i].address != NULL) {
-        if(branch_predictor->data[i].address == address){
-            if(branch_predictor->data[i].target > address) {
-                return NOT_TAKEN;
-            } else {
-                return TAKEN;
-            }
-        }
-        i++;
+    // The direction of each branch is precomputed in the branch index, so
+    // this is a single hash table lookup. Unknown branches are predicted not
+    // taken.
+    uint32_t value = branch_index_lookup(branch_predictor->branch_index, address);
+    if (value != BRANCH_INDEX_NONE && (value & BRANCH_INDEX_BACKWARD)) {
+        return TAKEN;
+    } else {
+        return NOT_TAKEN;
     }
 }
 
 void btfnt_branch_predictor_handle_result(struct branch_predictor *branch_predictor,
                                           uint32_t address, enum branch_direction branch_direction)
 {
-    // use this function to update the state of the branch predictor
-    // given the most recent branch direction.
+    // BTFNT is static, so there is no state to update.
+}
+
+void btfnt_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                           const uint32_t *addresses, const uint8_t *directions,
+                                           uint32_t n, uint64_t *correct)
+{
+    const struct branch_index *branch_index = branch_predictor->branch_index;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t value = branch_index_lookup(branch_index, addresses[i]);
+        enum branch_direction prediction =
+            value != BRANCH_INDEX_NONE && (value & BRANCH_INDEX_BACKWARD);
+        count += prediction == directions[i];
+    }
+    *correct += count;
 }
 
 void btfnt_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
 {
-    // cleanup data
-    free(branch_predictor->data);
+    // cleanup
+    branch_index_free(branch_predictor->branch_index);
 }
 
-struct branch_predictor *btfnt_branch_predictor_new(uint32_t num_branches,
-                                                    struct branch_metadata *branch_metadatas)
+// Branches that are added to the index later, as a trace without branch
+// metadata is read, are predicted from then on.
+static struct branch_predictor *btfnt_branch_predictor_new_from_index(
+    struct branch_index *branch_index)
 {
     struct branch_predictor *btfnt_bp = calloc(1, sizeof(struct branch_predictor));
     btfnt_bp->cleanup = &btfnt_branch_predictor_cleanup;
     btfnt_bp->predict = &btfnt_branch_predictor_predict;
     btfnt_bp->handle_result = &btfnt_branch_predictor_handle_result;
+    btfnt_bp->simulate_batch = &btfnt_branch_predictor_simulate_batch;
 
-    // allocate storage for any data necessary for this branch predictor
-    btfnt_bp->data = calloc(num_branches, sizeof(struct branch_metadata));
-    btfnt_bp->data = branch_metadatas;
+    btfnt_bp->branch_index = branch_index_ref(branch_index);
 
     return btfnt_bp;
 }
 
-// LTG Branch Predictor
+struct branch_predictor *btfnt_branch_predictor_new(uint32_t num_branches,
+                                                    struct branch_metadata *branch_metadatas)
+{
+    // index the branch metadata by address
+    struct branch_index *branch_index = branch_index_new(num_branches, branch_metadatas);
+    if (!branch_index) return NULL;
+    struct branch_predictor *btfnt_bp = btfnt_branch_predictor_new_from_index(branch_index);
+    branch_index_free(branch_index);
+    return btfnt_bp;
+}
+
+// Two-Level Branch Predictors
 // ============================================================================
+//
+// LTG, LTL, 2BG and 2BL share their layout. There is a power-of-two number of
+// history registers, selected by the least-significant bits of the branch
+// address (the global predictors have exactly one). The PHT is indexed by the
+// number of the history register followed by its history bits, so by default
+// each local history register has its own PHT. The counters are packed into
+// 64-bit words (see counter_table.h).
 
-enum branch_direction ltg_branch_predictor_predict(struct branch_predictor *branch_predictor,
-                                                   uint32_t address)
+static inline uint32_t global_pht_index(struct branch_predictor *branch_predictor)
 {
-    // return this branch predictors prediction for the branch at the
-    // given address.
-    uint32_t index = branch_predictor->history_register;
-    if(branch_predictor->pht[index] == 0) {
-        return NOT_TAKEN;
+    return branch_predictor->history_register[0] & branch_predictor->pht_mask;
+}
+
+static inline uint32_t local_history_register(struct branch_predictor *branch_predictor,
+                                              uint32_t address)
+{
+    return address & branch_predictor->history_register_mask;
+}
+
+static inline uint32_t local_pht_index(struct branch_predictor *branch_predictor, uint32_t lhr)
+{
+    return ((lhr << branch_predictor->history_bits) | branch_predictor->history_register[lhr]) &
+           branch_predictor->pht_mask;
+}
+
+static inline void shift_history(struct branch_predictor *branch_predictor, uint32_t hr,
+                                 enum branch_direction branch_direction)
+{
+    branch_predictor->history_register[hr] =
+        ((branch_predictor->history_register[hr] << 1) | branch_direction) &
+        branch_predictor->history_mask;
+}
+
+uint32_t global_branch_predictor_pht_index(struct branch_predictor *branch_predictor,
+                                           uint32_t address)
+{
+    return global_pht_index(branch_predictor);
+}
+
+uint32_t local_branch_predictor_pht_index(struct branch_predictor *branch_predictor,
+                                          uint32_t address)
+{
+    return local_pht_index(branch_predictor, local_history_register(branch_predictor, address));
+}
+
+uint32_t two_level_branch_predictor_state_regions(struct branch_predictor *branch_predictor,
+                                                  struct branch_predictor_state_region *regions)
+{
+    regions[0].data = branch_predictor->pht;
+    regions[0].size = branch_predictor->pht_size;
+    regions[1].data = branch_predictor->history_register;
+    regions[1].size = ((size_t)branch_predictor->history_register_mask + 1) * sizeof(uint32_t);
+    return 2;
+}
+
+void two_level_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+{
+    arena_free(branch_predictor->arena, branch_predictor->arena_size);
+}
+
+// Allocate a two-level predictor. The geometry is read from the options, and
+// defaults to the geometry required by the README (default_history_bits
+// history bits).
+//
+// Returns NULL if the geometry is invalid.
+static struct branch_predictor *two_level_branch_predictor_new(
+    bool global, uint32_t counter_bits, uint32_t default_history_bits,
+    struct branch_predictor_options *options)
+{
+    uint64_t history_bits, num_history_registers, pht_entries;
+    if (global) {
+        history_bits = branch_predictor_option(options, "ghr", default_history_bits);
+        num_history_registers = 1;
     } else {
-        return TAKEN;
+        history_bits = branch_predictor_option(options, "lhr", default_history_bits);
+        num_history_registers = branch_predictor_option(options, "lhrs", 16);
+    }
+    // The default PHT size is only computed from a valid history length, so
+    // that the shift stays defined.
+    pht_entries = branch_predictor_option(
+        options, "pht", history_bits <= 31 ? num_history_registers << history_bits : 0);
+    uint64_t delay = branch_predictor_option(options, "delay", 0);
+
+    if (history_bits > 31 || !is_power_of_two(num_history_registers) ||
+        num_history_registers > (1u << 31) || !is_power_of_two(pht_entries) ||
+        pht_entries > (1ull << 32)) {
+        fprintf(stderr, "Invalid geometry: ghr/lhr must be at most 31 and lhrs and pht must "
+                        "be powers of two no larger than 2^31 and 2^32\n");
+        return NULL;
+    }
+    if (delay > TWO_LEVEL_MAX_DELAY) {
+        fprintf(stderr, "Invalid delay: must be at most %u\n", TWO_LEVEL_MAX_DELAY);
+        return NULL;
     }
 
+    struct branch_predictor *bp = calloc(1, sizeof(struct branch_predictor));
+    bp->cleanup = &two_level_branch_predictor_cleanup;
+    bp->state_regions = &two_level_branch_predictor_state_regions;
+    bp->pht_index =
+        global ? &global_branch_predictor_pht_index : &local_branch_predictor_pht_index;
+
+    // allocate storage for any data necessary for this branch predictor
+    bp->history_bits = history_bits;
+    bp->history_mask = (1u << history_bits) - 1;
+    bp->history_register_mask = num_history_registers - 1;
+    bp->pht_mask = pht_entries - 1;
+    bp->counter_bits = counter_bits;
+    bp->delay = delay;
+    bp->pht_size = counter_table_words(pht_entries, counter_bits) * sizeof(uint64_t);
+
+    // the history registers come first since they are read for every
+    // prediction, then the PHT and the tables of the delayed update.
+    size_t history_registers_size = num_history_registers * sizeof(uint32_t);
+    struct arena_layout layout = {0};
+    size_t history_register_offset = arena_layout_add(&layout, history_registers_size);
+    size_t pht_offset = arena_layout_add(&layout, bp->pht_size);
+    size_t in_flight_offset = 0;
+    if (delay) {
+        in_flight_offset = arena_layout_add(&layout, sizeof(struct in_flight_branches) +
+                                                         (delay + 1) *
+                                                             sizeof(struct in_flight_branch));
+    }
+    char *arena = arena_new(layout.size);
+    if (!arena) {
+        fprintf(stderr, "Cannot allocate %zu bytes for the predictor state\n", layout.size);
+        free(bp);
+        return NULL;
+    }
+    bp->arena = arena;
+    bp->arena_size = layout.size;
+    bp->history_register = (uint32_t *)(arena + history_register_offset);
+    bp->pht = (uint64_t *)(arena + pht_offset);
+    if (delay) {
+        bp->in_flight = (struct in_flight_branches *)(arena + in_flight_offset);
+    }
+
+    return bp;
+}
+
+// Delayed Update
+// ============================================================================
+//
+// With delay=N, a two-level predictor keeps the last N + 1 predicted
+// branches in a ring. A prediction reads the PHT entry selected by the
+// speculative history, and the predicted direction is shifted into the
+// speculative history right away. When a branch leaves the ring, N branches
+// later, it trains the PHT entry that it was predicted from, like a PHT that
+// is updated when branches retire.
+//
+// The branches fetched after a mispredicted branch are on the wrong path,
+// which is not in the trace, and are flushed when it resolves. Fetching then
+// resumes on the right path with its history bit repaired, so the next branch
+// of the trace is predicted from the actual history. Only the PHT updates lag
+// behind.
+
+static inline uint32_t delayed_pht_index(struct branch_predictor *branch_predictor,
+                                         uint32_t address)
+{
+    uint32_t hr = address & branch_predictor->history_register_mask;
+    return (((hr << branch_predictor->history_bits) | branch_predictor->history_register[hr]) ^
+            (address & branch_predictor->pht_address_mask)) &
+           branch_predictor->pht_mask;
+}
+
+uint32_t delayed_branch_predictor_pht_index(struct branch_predictor *branch_predictor,
+                                            uint32_t address)
+{
+    return delayed_pht_index(branch_predictor, address);
+}
+
+enum branch_direction delayed_branch_predictor_predict(struct branch_predictor *branch_predictor,
+                                                       uint32_t address)
+{
+    uint32_t index = delayed_pht_index(branch_predictor, address);
+    enum branch_direction prediction = branch_predictor->counter_bits == 1
+                                           ? counter1_get(branch_predictor->pht, index)
+                                           : counter2_get(branch_predictor->pht, index) >> 1;
+
+    struct in_flight_branches *in_flight = branch_predictor->in_flight;
+    uint32_t slot = (in_flight->head + in_flight->count++) % (branch_predictor->delay + 1);
+    in_flight->branches[slot] = (struct in_flight_branch){
+        .pht_index = index,
+        .prediction = prediction,
+    };
+    shift_history(branch_predictor, address & branch_predictor->history_register_mask,
+                  prediction);
+    return prediction;
+}
+
+// Train the predictor with the oldest in-flight branch and remove it.
+static void delayed_resolve(struct branch_predictor *branch_predictor)
+{
+    struct in_flight_branches *in_flight = branch_predictor->in_flight;
+    struct in_flight_branch branch = in_flight->branches[in_flight->head];
+    in_flight->head = (in_flight->head + 1) % (branch_predictor->delay + 1);
+    in_flight->count--;
+
+    if (branch_predictor->counter_bits == 1)
+        counter1_set(branch_predictor->pht, branch.pht_index, branch.direction);
+    else
+        counter2_update(branch_predictor->pht, branch.pht_index, branch.direction);
+}
+
+void delayed_branch_predictor_handle_result(struct branch_predictor *branch_predictor,
+                                            uint32_t address,
+                                            enum branch_direction branch_direction)
+{
+    // the newest in-flight branch is the one that was just predicted.
+    struct in_flight_branches *in_flight = branch_predictor->in_flight;
+    struct in_flight_branch *newest =
+        &in_flight->branches[(in_flight->head + in_flight->count - 1) %
+                             (branch_predictor->delay + 1)];
+    newest->direction = branch_direction;
+
+    if (newest->prediction != branch_direction) {
+        // repair the history: the newest bit is the only wrong one.
+        uint32_t hr = address & branch_predictor->history_register_mask;
+        branch_predictor->history_register[hr] =
+            (branch_predictor->history_register[hr] ^ 1) & branch_predictor->history_mask;
+    }
+    if (in_flight->count > branch_predictor->delay) delayed_resolve(branch_predictor);
+}
+
+uint32_t delayed_branch_predictor_state_regions(struct branch_predictor *branch_predictor,
+                                                struct branch_predictor_state_region *regions)
+{
+    uint32_t num_regions = two_level_branch_predictor_state_regions(branch_predictor, regions);
+    regions[num_regions].data = branch_predictor->in_flight;
+    regions[num_regions++].size =
+        sizeof(struct in_flight_branches) +
+        (branch_predictor->delay + 1) * sizeof(struct in_flight_branch);
+    return num_regions;
+}
+
+// Switch a two-level predictor to the delayed update if it has a delay. The
+// delayed predictor is not simulated in batches nor by the multi-config
+// engine.
+static struct branch_predictor *two_level_branch_predictor_delayed(
+    struct branch_predictor *branch_predictor)
+{
+    if (!branch_predictor->delay) return branch_predictor;
+    branch_predictor->predict = &delayed_branch_predictor_predict;
+    branch_predictor->handle_result = &delayed_branch_predictor_handle_result;
+    branch_predictor->simulate_batch = NULL;
+    branch_predictor->pht_index = &delayed_branch_predictor_pht_index;
+    branch_predictor->state_regions = &delayed_branch_predictor_state_regions;
+    return branch_predictor;
+}
+
+// LTG Branch Predictor
+// ============================================================================
+
+enum branch_direction ltg_branch_predictor_predict(struct branch_predictor *branch_predictor,
+                                                   uint32_t address)
+{
+    // return the last direction seen with the current global history.
+    return counter1_get(branch_predictor->pht, global_pht_index(branch_predictor));
 }
 
 void ltg_branch_predictor_handle_result(struct branch_predictor *branch_predictor, uint32_t address,
                                         enum branch_direction branch_direction)
 {
-    // use this function to update the state of the branch predictor
-    // given the most recent branch direction.
-    uint32_t index = branch_predictor->history_register;
-    if (branch_direction == TAKEN) {
-        branch_predictor->pht[index] = 1;
-        branch_predictor->history_register = (index << 1) | 0b00000000000000000000000000000001;
-        index = branch_predictor->history_register;
-        branch_predictor->history_register = index & 0b00000000000000000000000000011111;
-    } else {
-        branch_predictor->pht[index] = 0;
-        branch_predictor->history_register = (index << 1) & 0b00000000000000000000000000011111;
-    }
+    // remember the direction for this history and shift it into the GHR.
+    counter1_set(branch_predictor->pht, global_pht_index(branch_predictor), branch_direction);
+    shift_history(branch_predictor, 0, branch_direction);
 }
 
-void ltg_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+void ltg_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                         const uint32_t *addresses, const uint8_t *directions,
+                                         uint32_t n, uint64_t *correct)
 {
-    // cleanup
-    free(branch_predictor->pht);
+    uint64_t *pht = branch_predictor->pht;
+    uint32_t pht_mask = branch_predictor->pht_mask;
+    uint32_t history_mask = branch_predictor->history_mask;
+    uint32_t ghr = branch_predictor->history_register[0];
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t index = ghr & pht_mask;
+        count += counter1_get(pht, index) == directions[i];
+        counter1_set(pht, index, directions[i]);
+        ghr = ((ghr << 1) | directions[i]) & history_mask;
+    }
+    branch_predictor->history_register[0] = ghr;
+    *correct += count;
 }
 
-struct branch_predictor *ltg_branch_predictor_new(uint32_t num_branches,
-                                                  struct branch_metadata *branch_metadatas)
+static struct branch_predictor *ltg_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
 {
-    struct branch_predictor *ltg_bp = calloc(1, sizeof(struct branch_predictor));
-    ltg_bp->cleanup = &ltg_branch_predictor_cleanup;
+    struct branch_predictor *ltg_bp = two_level_branch_predictor_new(true, 1, 5, options);
+    if (!ltg_bp) return NULL;
     ltg_bp->predict = &ltg_branch_predictor_predict;
     ltg_bp->handle_result = &ltg_branch_predictor_handle_result;
+    ltg_bp->simulate_batch = &ltg_branch_predictor_simulate_batch;
 
-    // allocate storage for any data necessary for this branch predictor
-    ltg_bp->history_register = 0;
-    ltg_bp->pht = calloc(32, sizeof(uint32_t));
-    for(uint8_t i = 0; i < 32; i++) {
-        ltg_bp->pht[i] = 0;
-    }
+    return two_level_branch_predictor_delayed(ltg_bp);
+}
 
-    return ltg_bp;
+struct branch_predictor *ltg_branch_predictor_new(uint32_t num_branches,
+                                                  struct branch_metadata *branch_metadatas)
+{
+    return ltg_branch_predictor_new_from_options(NULL, NULL);
 }
 
 // LTL Branch Predictor
@@ -193,63 +504,58 @@ struct branch_predictor *ltg_branch_predictor_new(uint32_t num_branches,
 enum branch_direction ltl_branch_predictor_predict(struct branch_predictor *branch_predictor,
                                                    uint32_t address)
 {
-    // return this branch predictors prediction for the branch at the
-    // given address.
-    uint32_t index = address & 0b00000000000000000000000000001111;
-    printf("help\n");
-    printf("%d\n", index);
-    uint32_t value = branch_predictor->history_register[index];
-    if(branch_predictor->pht[(index*16) + value] == 0) {
-        return NOT_TAKEN;
-    } else {
-        return TAKEN;
-    }
+    // return the last direction seen with the current history of this
+    // branch's LHR.
+    uint32_t lhr = local_history_register(branch_predictor, address);
+    return counter1_get(branch_predictor->pht, local_pht_index(branch_predictor, lhr));
 }
 
 void ltl_branch_predictor_handle_result(struct branch_predictor *branch_predictor, uint32_t address,
                                         enum branch_direction branch_direction)
 {
-    // use this function to update the state of the branch predictor
-    // given the most recent branch direction.
-    uint32_t index = address & 0b00000000000000000000000000001111;
-    uint32_t value = branch_predictor->history_register[index];
-    if (branch_direction == TAKEN) {
-        branch_predictor->pht[(index*16) + value] = 1;
-        branch_predictor->history_register[index] = (value << 1) | 0b00000000000000000000000000000001;
-        value = branch_predictor->history_register[index];
-        branch_predictor->history_register[index] = value & 0b00000000000000000000000000001111;
-    } else {
-        branch_predictor->pht[(index*16) + value] = 0;
-        branch_predictor->history_register[index] = (value << 1) & 0b00000000000000000000000000001111;
-    }
+    // remember the direction for this history and shift it into the LHR.
+    uint32_t lhr = local_history_register(branch_predictor, address);
+    counter1_set(branch_predictor->pht, local_pht_index(branch_predictor, lhr), branch_direction);
+    shift_history(branch_predictor, lhr, branch_direction);
 }
 
-void ltl_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+void ltl_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                         const uint32_t *addresses, const uint8_t *directions,
+                                         uint32_t n, uint64_t *correct)
 {
-    // cleanup 
-    free(branch_predictor->pht);
-    free(branch_predictor->history_register);
+    uint64_t *pht = branch_predictor->pht;
+    uint32_t *lhrs = branch_predictor->history_register;
+    uint32_t pht_mask = branch_predictor->pht_mask;
+    uint32_t lhr_mask = branch_predictor->history_register_mask;
+    uint32_t history_bits = branch_predictor->history_bits;
+    uint32_t history_mask = branch_predictor->history_mask;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t lhr = addresses[i] & lhr_mask;
+        uint32_t index = ((lhr << history_bits) | lhrs[lhr]) & pht_mask;
+        count += counter1_get(pht, index) == directions[i];
+        counter1_set(pht, index, directions[i]);
+        lhrs[lhr] = ((lhrs[lhr] << 1) | directions[i]) & history_mask;
+    }
+    *correct += count;
 }
 
-struct branch_predictor *ltl_branch_predictor_new(uint32_t num_branches,
-                                                  struct branch_metadata *branch_metadatas)
+static struct branch_predictor *ltl_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
 {
-    struct branch_predictor *ltl_bp = calloc(1, sizeof(struct branch_predictor));
-    ltl_bp->cleanup = &ltl_branch_predictor_cleanup;
+    struct branch_predictor *ltl_bp = two_level_branch_predictor_new(false, 1, 4, options);
+    if (!ltl_bp) return NULL;
     ltl_bp->predict = &ltl_branch_predictor_predict;
     ltl_bp->handle_result = &ltl_branch_predictor_handle_result;
+    ltl_bp->simulate_batch = &ltl_branch_predictor_simulate_batch;
 
-    // allocate storage for any data necessary for this branch predictor
-    ltl_bp->history_register = calloc(16, sizeof(uint32_t));
-    ltl_bp->pht = calloc(256, sizeof(uint32_t));
-    for(uint32_t i = 0; i < 256; i++) {
-        if(i < 16) {
-            ltl_bp->history_register[i] = 0;
-        }
-        ltl_bp->pht[i] = 0;
-    }
+    return two_level_branch_predictor_delayed(ltl_bp);
+}
 
-    return ltl_bp;
+struct branch_predictor *ltl_branch_predictor_new(uint32_t num_branches,
+                                                  struct branch_metadata *branch_metadatas)
+{
+    return ltl_branch_predictor_new_from_options(NULL, NULL);
 }
 
 // 2BG Branch Predictor
@@ -258,59 +564,53 @@ struct branch_predictor *ltl_branch_predictor_new(uint32_t num_branches,
 enum branch_direction tbg_branch_predictor_predict(struct branch_predictor *branch_predictor,
                                                    uint32_t address)
 {
-    // return this branch predictors prediction for the branch at the
-    // given address.
-    uint32_t index = branch_predictor->history_register;
-    if(branch_predictor->pht[index] == 0 || branch_predictor->pht[index] == 1) {
-        return NOT_TAKEN;
-    } else {
-        return TAKEN;
-    }
+    // counters 2 and 3 predict taken, 0 and 1 predict not taken.
+    return counter2_get(branch_predictor->pht, global_pht_index(branch_predictor)) >> 1;
 }
 
 void tbg_branch_predictor_handle_result(struct branch_predictor *branch_predictor, uint32_t address,
                                         enum branch_direction branch_direction)
 {
-    // use this function to update the state of the branch predictor
-    // given the most recent branch direction.
-    uint32_t index = branch_predictor->history_register;
-    if (branch_direction == TAKEN) {
-        if(branch_predictor->pht[index] != 3) {
-            branch_predictor->pht[index]++;
-        }
-        branch_predictor->history_register = (index << 1) | 0b00000000000000000000000000000001;
-        index = branch_predictor->history_register;
-        branch_predictor->history_register = index & 0b00000000000000000000000000011111;
-    } else {
-        if(branch_predictor->pht[index] != 0) {
-            branch_predictor->pht[index]--;
-        }
-        branch_predictor->history_register = (index << 1) & 0b00000000000000000000000000011111;
-    }
+    // saturate the counter for this history and shift the GHR.
+    counter2_update(branch_predictor->pht, global_pht_index(branch_predictor), branch_direction);
+    shift_history(branch_predictor, 0, branch_direction);
 }
 
-void tbg_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+void tbg_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                         const uint32_t *addresses, const uint8_t *directions,
+                                         uint32_t n, uint64_t *correct)
 {
-    // TODO cleanup if necessary
-    free(branch_predictor->pht);
+    uint64_t *pht = branch_predictor->pht;
+    uint32_t pht_mask = branch_predictor->pht_mask;
+    uint32_t history_mask = branch_predictor->history_mask;
+    uint32_t ghr = branch_predictor->history_register[0];
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t index = ghr & pht_mask;
+        count += (counter2_get(pht, index) >> 1) == directions[i];
+        counter2_update(pht, index, directions[i]);
+        ghr = ((ghr << 1) | directions[i]) & history_mask;
+    }
+    branch_predictor->history_register[0] = ghr;
+    *correct += count;
 }
 
-struct branch_predictor *tbg_branch_predictor_new(uint32_t num_branches,
-                                                  struct branch_metadata *branch_metadatas)
+static struct branch_predictor *tbg_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
 {
-    struct branch_predictor *tbg_bp = calloc(1, sizeof(struct branch_predictor));
-    tbg_bp->cleanup = &tbg_branch_predictor_cleanup;
+    struct branch_predictor *tbg_bp = two_level_branch_predictor_new(true, 2, 5, options);
+    if (!tbg_bp) return NULL;
     tbg_bp->predict = &tbg_branch_predictor_predict;
     tbg_bp->handle_result = &tbg_branch_predictor_handle_result;
+    tbg_bp->simulate_batch = &tbg_branch_predictor_simulate_batch;
 
-    // allocate storage for any data necessary for this branch predictor
-    tbg_bp->history_register = 0;
-    tbg_bp->pht = calloc(32, sizeof(uint32_t));
-    for(uint8_t i = 0; i < 32; i++) {
-        tbg_bp->pht[i] = 0;
-    }
+    return two_level_branch_predictor_delayed(tbg_bp);
+}
 
-    return tbg_bp;
+struct branch_predictor *tbg_branch_predictor_new(uint32_t num_branches,
+                                                  struct branch_metadata *branch_metadatas)
+{
+    return tbg_branch_predictor_new_from_options(NULL, NULL);
 }
 
 // 2BL Branch Predictor
@@ -319,63 +619,1302 @@ struct branch_predictor *tbg_branch_predictor_new(uint32_t num_branches,
 enum branch_direction tbl_branch_predictor_predict(struct branch_predictor *branch_predictor,
                                                    uint32_t address)
 {
-    // return this branch predictors prediction for the branch at the
-    // given address.
-    uint32_t index = address & 0b00000000000000000000000000001111;
-    uint32_t value = branch_predictor->history_register[index];
-    if(branch_predictor->pht[(index*16) + value] == 0 || branch_predictor->pht[(index*16) + value] == 1) {
-        return NOT_TAKEN;
-    } else {
-        return TAKEN;
-    }
+    // counters 2 and 3 predict taken, 0 and 1 predict not taken.
+    uint32_t lhr = local_history_register(branch_predictor, address);
+    return counter2_get(branch_predictor->pht, local_pht_index(branch_predictor, lhr)) >> 1;
 }
 
 void tbl_branch_predictor_handle_result(struct branch_predictor *branch_predictor, uint32_t address,
                                         enum branch_direction branch_direction)
 {
-    // use this function to update the state of the branch predictor
-    // given the most recent branch direction.
-    uint32_t index = address & 0b00000000000000000000000000001111;
-    uint32_t value = branch_predictor->history_register[index];
-    if (branch_direction == TAKEN) {
-        if(branch_predictor->pht[(index*16) + value] != 3) {
-            branch_predictor->pht[(index*16) + value]++;
-        }
-        branch_predictor->history_register[index] = (value << 1) | 0b00000000000000000000000000000001;
-        value = branch_predictor->history_register[index];
-        branch_predictor->history_register[index] = value & 0b00000000000000000000000000001111;
-    } else {
-        if(branch_predictor->pht[(index*16) + value] != 0) {
-            branch_predictor->pht[(index*16) + value]--;
-        }
-        branch_predictor->history_register[index] = (value << 1) & 0b00000000000000000000000000001111;
+    // saturate the counter for this history and shift the LHR.
+    uint32_t lhr = local_history_register(branch_predictor, address);
+    counter2_update(branch_predictor->pht, local_pht_index(branch_predictor, lhr),
+                    branch_direction);
+    shift_history(branch_predictor, lhr, branch_direction);
+}
+
+void tbl_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                         const uint32_t *addresses, const uint8_t *directions,
+                                         uint32_t n, uint64_t *correct)
+{
+    uint64_t *pht = branch_predictor->pht;
+    uint32_t *lhrs = branch_predictor->history_register;
+    uint32_t pht_mask = branch_predictor->pht_mask;
+    uint32_t lhr_mask = branch_predictor->history_register_mask;
+    uint32_t history_bits = branch_predictor->history_bits;
+    uint32_t history_mask = branch_predictor->history_mask;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t lhr = addresses[i] & lhr_mask;
+        uint32_t index = ((lhr << history_bits) | lhrs[lhr]) & pht_mask;
+        count += (counter2_get(pht, index) >> 1) == directions[i];
+        counter2_update(pht, index, directions[i]);
+        lhrs[lhr] = ((lhrs[lhr] << 1) | directions[i]) & history_mask;
     }
+    *correct += count;
 }
 
-void tbl_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+static struct branch_predictor *tbl_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
 {
-    // cleanup
-    free(branch_predictor->history_register);
-    free(branch_predictor->pht);
+    struct branch_predictor *tbl_bp = two_level_branch_predictor_new(false, 2, 4, options);
+    if (!tbl_bp) return NULL;
+    tbl_bp->predict = &tbl_branch_predictor_predict;
+    tbl_bp->handle_result = &tbl_branch_predictor_handle_result;
+    tbl_bp->simulate_batch = &tbl_branch_predictor_simulate_batch;
+
+    return two_level_branch_predictor_delayed(tbl_bp);
 }
 
 struct branch_predictor *tbl_branch_predictor_new(uint32_t num_branches,
                                                   struct branch_metadata *branch_metadatas)
 {
-    struct branch_predictor *tbl_bp = calloc(1, sizeof(struct branch_predictor));
-    tbl_bp->cleanup = &tbl_branch_predictor_cleanup;
-    tbl_bp->predict = &tbl_branch_predictor_predict;
-    tbl_bp->handle_result = &tbl_branch_predictor_handle_result;
+    return tbl_branch_predictor_new_from_options(NULL, NULL);
+}
 
-    // allocate storage for any data necessary for this branch predictor
-    tbl_bp->history_register = calloc(16, sizeof(uint32_t));
-    tbl_bp->pht = calloc(256, sizeof(uint32_t));
-    for(uint32_t i = 0; i < 256; i++) {
-        if(i < 16) {
-            tbl_bp->history_register[i] = 0;
+// GSHARE Branch Predictor
+// ============================================================================
+//
+// A 2BG whose PHT index is the GHR XORed with the branch address, so that
+// branches with the same history use different counters.
+
+static inline uint32_t gshare_pht_index(struct branch_predictor *branch_predictor,
+                                        uint32_t address)
+{
+    return (branch_predictor->history_register[0] ^ address) & branch_predictor->pht_mask;
+}
+
+uint32_t gshare_branch_predictor_pht_index(struct branch_predictor *branch_predictor,
+                                           uint32_t address)
+{
+    return gshare_pht_index(branch_predictor, address);
+}
+
+enum branch_direction gshare_branch_predictor_predict(struct branch_predictor *branch_predictor,
+                                                      uint32_t address)
+{
+    // counters 2 and 3 predict taken, 0 and 1 predict not taken.
+    return counter2_get(branch_predictor->pht, gshare_pht_index(branch_predictor, address)) >> 1;
+}
+
+void gshare_branch_predictor_handle_result(struct branch_predictor *branch_predictor,
+                                           uint32_t address,
+                                           enum branch_direction branch_direction)
+{
+    // saturate the counter for this address and history and shift the GHR.
+    counter2_update(branch_predictor->pht, gshare_pht_index(branch_predictor, address),
+                    branch_direction);
+    shift_history(branch_predictor, 0, branch_direction);
+}
+
+void gshare_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                            const uint32_t *addresses, const uint8_t *directions,
+                                            uint32_t n, uint64_t *correct)
+{
+    uint64_t *pht = branch_predictor->pht;
+    uint32_t pht_mask = branch_predictor->pht_mask;
+    uint32_t history_mask = branch_predictor->history_mask;
+    uint32_t ghr = branch_predictor->history_register[0];
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t index = (ghr ^ addresses[i]) & pht_mask;
+        count += (counter2_get(pht, index) >> 1) == directions[i];
+        counter2_update(pht, index, directions[i]);
+        ghr = ((ghr << 1) | directions[i]) & history_mask;
+    }
+    branch_predictor->history_register[0] = ghr;
+    *correct += count;
+}
+
+static struct branch_predictor *gshare_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    struct branch_predictor *gshare_bp = two_level_branch_predictor_new(true, 2, 12, options);
+    if (!gshare_bp) return NULL;
+    gshare_bp->predict = &gshare_branch_predictor_predict;
+    gshare_bp->handle_result = &gshare_branch_predictor_handle_result;
+    gshare_bp->simulate_batch = &gshare_branch_predictor_simulate_batch;
+    gshare_bp->pht_index = &gshare_branch_predictor_pht_index;
+    gshare_bp->pht_address_mask = UINT32_MAX;
+
+    return two_level_branch_predictor_delayed(gshare_bp);
+}
+
+struct branch_predictor *gshare_branch_predictor_new(uint32_t num_branches,
+                                                     struct branch_metadata *branch_metadatas)
+{
+    return gshare_branch_predictor_new_from_options(NULL, NULL);
+}
+
+// PERCEPTRON Branch Predictor
+// ============================================================================
+//
+// A table of perceptrons selected by the low bits of the branch address
+// (Jimenez and Lin, "Dynamic Branch Prediction with Perceptrons"). Each
+// perceptron has a signed 8-bit weight per global history bit plus a bias
+// weight. The prediction is taken if the dot product of the weights with the
+// inputs (1 for the bias, then 1 for a taken and -1 for a not taken history
+// bit) is not negative. The weights are trained when the prediction was wrong
+// or the output was within the threshold, and saturate at +-127.
+//
+// Each row of weights and the inputs are zero-padded to a multiple of 32
+// bytes, so the AVX2 kernels handle 32 weights per instruction and the padding
+// contributes nothing to the output or the training.
+
+static int32_t perceptron_output_scalar(const int8_t *weights, const int8_t *inputs,
+                                        uint32_t stride)
+{
+    int32_t output = 0;
+    for (uint32_t i = 0; i < stride; i++) output += weights[i] * inputs[i];
+    return output;
+}
+
+static void perceptron_train_scalar(int8_t *weights, const int8_t *inputs, uint32_t stride,
+                                    bool taken)
+{
+    for (uint32_t i = 0; i < stride; i++) {
+        int32_t weight = weights[i] + (taken ? inputs[i] : -inputs[i]);
+        weights[i] = weight > PERCEPTRON_MAX_WEIGHT    ? PERCEPTRON_MAX_WEIGHT
+                     : weight < -PERCEPTRON_MAX_WEIGHT ? -PERCEPTRON_MAX_WEIGHT
+                                                       : weight;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The input signs are applied to the weights with a sign instruction and the
+// products are summed pairwise up to 32-bit lanes.
+__attribute__((target("avx2"))) static int32_t perceptron_output_avx2(const int8_t *weights,
+                                                                      const int8_t *inputs,
+                                                                      uint32_t stride)
+{
+    __m256i sum = _mm256_setzero_si256();
+    for (uint32_t i = 0; i < stride; i += PERCEPTRON_ALIGNMENT) {
+        __m256i products =
+            _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *)(weights + i)),
+                             _mm256_loadu_si256((const __m256i *)(inputs + i)));
+        __m256i pairs = _mm256_maddubs_epi16(_mm256_set1_epi8(1), products);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+    return _mm_cvtsi128_si32(half);
+}
+
+__attribute__((target("avx2"))) static void perceptron_train_avx2(int8_t *weights,
+                                                                  const int8_t *inputs,
+                                                                  uint32_t stride, bool taken)
+{
+    __m256i direction = _mm256_set1_epi8(taken ? 1 : -1);
+    __m256i min_weight = _mm256_set1_epi8(-PERCEPTRON_MAX_WEIGHT);
+    for (uint32_t i = 0; i < stride; i += PERCEPTRON_ALIGNMENT) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)(weights + i));
+        __m256i delta =
+            _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *)(inputs + i)), direction);
+        w = _mm256_max_epi8(_mm256_adds_epi8(w, delta), min_weight);
+        _mm256_storeu_si256((__m256i *)(weights + i), w);
+    }
+}
+#endif
+
+static inline int32_t perceptron_output(struct branch_predictor *branch_predictor,
+                                        const int8_t *weights)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (branch_predictor->perceptron_avx2)
+        return perceptron_output_avx2(weights, branch_predictor->perceptron_inputs,
+                                      branch_predictor->perceptron_stride);
+#endif
+    return perceptron_output_scalar(weights, branch_predictor->perceptron_inputs,
+                                    branch_predictor->perceptron_stride);
+}
+
+static inline void perceptron_train(struct branch_predictor *branch_predictor, int8_t *weights,
+                                    bool taken)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (branch_predictor->perceptron_avx2) {
+        perceptron_train_avx2(weights, branch_predictor->perceptron_inputs,
+                              branch_predictor->perceptron_stride, taken);
+        return;
+    }
+#endif
+    perceptron_train_scalar(weights, branch_predictor->perceptron_inputs,
+                            branch_predictor->perceptron_stride, taken);
+}
+
+static inline int8_t *perceptron_weights(struct branch_predictor *branch_predictor,
+                                         uint32_t address)
+{
+    return branch_predictor->perceptron_weights +
+           (size_t)(address & branch_predictor->pht_mask) * branch_predictor->perceptron_stride;
+}
+
+// Train the perceptron if needed and shift the direction into the history.
+static inline void perceptron_update(struct branch_predictor *branch_predictor,
+                                     int8_t *weights, int32_t output,
+                                     enum branch_direction branch_direction)
+{
+    bool taken = branch_direction == TAKEN;
+    if ((output >= 0) != taken || abs(output) <= branch_predictor->perceptron_threshold)
+        perceptron_train(branch_predictor, weights, taken);
+
+    int8_t *inputs = branch_predictor->perceptron_inputs;
+    memmove(inputs + 2, inputs + 1, branch_predictor->history_bits - 1);
+    inputs[1] = taken ? 1 : -1;
+}
+
+uint32_t perceptron_branch_predictor_pht_index(struct branch_predictor *branch_predictor,
+                                               uint32_t address)
+{
+    return address & branch_predictor->pht_mask;
+}
+
+enum branch_direction perceptron_branch_predictor_predict(
+    struct branch_predictor *branch_predictor, uint32_t address)
+{
+    // predict taken if the output is not negative.
+    return perceptron_output(branch_predictor, perceptron_weights(branch_predictor, address)) >= 0
+               ? TAKEN
+               : NOT_TAKEN;
+}
+
+void perceptron_branch_predictor_handle_result(struct branch_predictor *branch_predictor,
+                                               uint32_t address,
+                                               enum branch_direction branch_direction)
+{
+    int8_t *weights = perceptron_weights(branch_predictor, address);
+    perceptron_update(branch_predictor, weights, perceptron_output(branch_predictor, weights),
+                      branch_direction);
+}
+
+void perceptron_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                                const uint32_t *addresses,
+                                                const uint8_t *directions, uint32_t n,
+                                                uint64_t *correct)
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        int8_t *weights = perceptron_weights(branch_predictor, addresses[i]);
+        int32_t output = perceptron_output(branch_predictor, weights);
+        count += (output >= 0) == directions[i];
+        perceptron_update(branch_predictor, weights, output, directions[i]);
+    }
+    *correct += count;
+}
+
+uint32_t perceptron_branch_predictor_state_regions(struct branch_predictor *branch_predictor,
+                                                   struct branch_predictor_state_region *regions)
+{
+    regions[0].data = branch_predictor->perceptron_weights;
+    regions[0].size = ((size_t)branch_predictor->pht_mask + 1) * branch_predictor->perceptron_stride;
+    regions[1].data = branch_predictor->perceptron_inputs;
+    regions[1].size = branch_predictor->perceptron_stride;
+    return 2;
+}
+
+void perceptron_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+{
+    arena_free(branch_predictor->arena, branch_predictor->arena_size);
+}
+
+static struct branch_predictor *perceptron_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    uint64_t history_bits = branch_predictor_option(options, "ghr", 32);
+    uint64_t num_perceptrons = branch_predictor_option(options, "perceptrons", 1024);
+    uint64_t threshold =
+        branch_predictor_option(options, "threshold", (uint64_t)(1.93 * history_bits + 14));
+    if (history_bits == 0 || history_bits > PERCEPTRON_MAX_HISTORY ||
+        !is_power_of_two(num_perceptrons) || num_perceptrons > (1u << 24) ||
+        threshold > INT32_MAX) {
+        fprintf(stderr, "Invalid geometry: ghr must be between 1 and %d and perceptrons must be "
+                        "a power of two no larger than 2^24\n",
+                PERCEPTRON_MAX_HISTORY);
+        return NULL;
+    }
+
+    struct branch_predictor *perceptron_bp = calloc(1, sizeof(struct branch_predictor));
+    perceptron_bp->cleanup = &perceptron_branch_predictor_cleanup;
+    perceptron_bp->predict = &perceptron_branch_predictor_predict;
+    perceptron_bp->handle_result = &perceptron_branch_predictor_handle_result;
+    perceptron_bp->simulate_batch = &perceptron_branch_predictor_simulate_batch;
+    perceptron_bp->pht_index = &perceptron_branch_predictor_pht_index;
+    perceptron_bp->state_regions = &perceptron_branch_predictor_state_regions;
+
+    // one bias weight and one weight per history bit, padded for the kernels.
+    perceptron_bp->history_bits = history_bits;
+    perceptron_bp->pht_mask = num_perceptrons - 1;
+    perceptron_bp->perceptron_threshold = threshold;
+    perceptron_bp->perceptron_stride = (history_bits + 1 + PERCEPTRON_ALIGNMENT - 1) /
+                                       PERCEPTRON_ALIGNMENT * PERCEPTRON_ALIGNMENT;
+    struct arena_layout layout = {0};
+    size_t inputs_offset = arena_layout_add(&layout, perceptron_bp->perceptron_stride);
+    size_t weights_offset =
+        arena_layout_add(&layout, num_perceptrons * perceptron_bp->perceptron_stride);
+    char *arena = arena_new(layout.size);
+    if (!arena) {
+        fprintf(stderr, "Cannot allocate %zu bytes for the predictor state\n", layout.size);
+        free(perceptron_bp);
+        return NULL;
+    }
+    perceptron_bp->arena = arena;
+    perceptron_bp->arena_size = layout.size;
+    perceptron_bp->perceptron_inputs = (int8_t *)(arena + inputs_offset);
+    perceptron_bp->perceptron_weights = (int8_t *)(arena + weights_offset);
+    perceptron_bp->perceptron_avx2 = simd_has_avx2();
+
+    // the history starts out as all not taken.
+    perceptron_bp->perceptron_inputs[0] = 1;
+    memset(perceptron_bp->perceptron_inputs + 1, -1, history_bits);
+
+    return perceptron_bp;
+}
+
+struct branch_predictor *perceptron_branch_predictor_new(uint32_t num_branches,
+                                                         struct branch_metadata *branch_metadatas)
+{
+    return perceptron_branch_predictor_new_from_options(NULL, NULL);
+}
+
+// TAGE Branch Predictor
+// ============================================================================
+//
+// A bimodal table of 2-bit counters (the PHT) backed by tables of tagged
+// 3-bit counters, each indexed by a hash of the branch address and a longer
+// slice of the global history than the one before it (Seznec and Michaud, "A
+// case for (partially) TAgged GEometric history length branch prediction").
+// The prediction comes from the matching table with the longest history (the
+// provider), or from the bimodal table if no tagged entry matches. The
+// history lengths grow geometrically from min to max.
+//
+// The histories are far longer than an index, so each table hashes them
+// through folded histories: registers of the index (or tag) width that hold
+// the history XORed onto itself, updated with the bit that comes in and the
+// bit that falls out on every branch instead of being recomputed.
+//
+// On a misprediction a new entry is allocated in a table with a longer
+// history than the provider, in an entry whose useful counter is 0. The
+// useful counters go up when the provider was right and the next best
+// prediction (the alternate) was wrong, and every reset branches all of them
+// are halved so that stale entries can be replaced.
+
+// Whether a counter is in one of the two weak states new entries start in.
+static inline bool tage_weak(int8_t counter)
+{
+    return counter == 0 || counter == -1;
+}
+
+static inline int8_t tage_saturate(int32_t value, int32_t min, int32_t max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+static inline uint32_t tage_history_bit(const struct tage_state *state, uint32_t age)
+{
+    return state->history[(state->history_position - age) & (TAGE_HISTORY_BUFFER - 1)];
+}
+
+// Shift a bit into a folded history of width bits. The outgoing bit is the
+// one that leaves the unfolded history, which lands at outgoing_shift.
+static inline uint32_t tage_fold(uint32_t folded, uint32_t width, uint32_t outgoing_shift,
+                                 uint32_t incoming, uint32_t outgoing)
+{
+    folded = (folded << 1) | incoming;
+    folded ^= outgoing << outgoing_shift;
+    folded ^= folded >> width;
+    return folded & ((1u << width) - 1);
+}
+
+static inline enum branch_direction tage_predict(struct branch_predictor *branch_predictor,
+                                                 uint32_t address)
+{
+    struct tage_state *state = branch_predictor->tage_state;
+    uint32_t num_tables = branch_predictor->tage_num_tables;
+    uint32_t index_bits = branch_predictor->tage_index_bits;
+    uint32_t index_mask = (1u << index_bits) - 1;
+    uint32_t tag_mask = (1u << branch_predictor->tage_tag_bits) - 1;
+
+    state->base_index = address & branch_predictor->pht_mask;
+    state->provider = -1;
+    state->alternate = -1;
+    for (int32_t t = num_tables - 1; t >= 0; t--) {
+        uint32_t index = (address ^ (address >> state->address_shifts[t]) ^
+                          state->folded_index[t]) &
+                         index_mask;
+        uint16_t tag = (address ^ state->folded_tag[0][t] ^ (state->folded_tag[1][t] << 1)) &
+                       tag_mask;
+        state->indices[t] = ((uint32_t)t << index_bits) | index;
+        state->tags[t] = tag;
+        if (branch_predictor->tage_tags[state->indices[t]] != tag) continue;
+        if (state->provider < 0)
+            state->provider = t;
+        else if (state->alternate < 0)
+            state->alternate = t;
+    }
+
+    bool base_prediction = counter2_get(branch_predictor->pht, state->base_index) >> 1;
+    state->alternate_prediction =
+        state->alternate >= 0
+            ? branch_predictor->tage_counters[state->indices[state->alternate]] >= 0
+            : base_prediction;
+    if (state->provider < 0) {
+        state->provider_prediction = base_prediction;
+        state->prediction = base_prediction;
+        return base_prediction;
+    }
+
+    uint32_t entry = state->indices[state->provider];
+    int8_t counter = branch_predictor->tage_counters[entry];
+    state->provider_prediction = counter >= 0;
+    // a new entry has not proven itself yet, so the alternate may be better.
+    bool new_entry = tage_weak(counter) && branch_predictor->tage_useful[entry] == 0;
+    state->prediction = new_entry && state->use_alternate >= 0 ? state->alternate_prediction
+                                                               : state->provider_prediction;
+    return state->prediction;
+}
+
+// Allocate an entry for the last branch in a table with a longer history
+// than the provider.
+static void tage_allocate(struct branch_predictor *branch_predictor, bool taken)
+{
+    struct tage_state *state = branch_predictor->tage_state;
+    uint32_t num_tables = branch_predictor->tage_num_tables;
+
+    // start one table further half of the time, so that allocations spread
+    // over the tables.
+    uint32_t first = state->provider + 1;
+    state->random ^= state->random << 13;
+    state->random ^= state->random >> 7;
+    state->random ^= state->random << 17;
+    if ((state->random & 1) && first + 1 < num_tables) first++;
+
+    for (uint32_t t = first; t < num_tables; t++) {
+        uint32_t entry = state->indices[t];
+        if (branch_predictor->tage_useful[entry]) continue;
+        branch_predictor->tage_tags[entry] = state->tags[t];
+        branch_predictor->tage_counters[entry] = taken ? 0 : -1;
+        branch_predictor->tage_allocations++;
+        return;
+    }
+
+    // every candidate is useful: make them a little less so.
+    branch_predictor->tage_allocation_failures++;
+    for (uint32_t t = state->provider + 1; t < num_tables; t++)
+        if (branch_predictor->tage_useful[state->indices[t]])
+            branch_predictor->tage_useful[state->indices[t]]--;
+}
+
+static inline void tage_update(struct branch_predictor *branch_predictor, bool taken)
+{
+    struct tage_state *state = branch_predictor->tage_state;
+    uint32_t num_tables = branch_predictor->tage_num_tables;
+
+    if (state->provider >= 0) {
+        uint32_t entry = state->indices[state->provider];
+        int8_t *counter = &branch_predictor->tage_counters[entry];
+        uint8_t *useful = &branch_predictor->tage_useful[entry];
+
+        // learn whether the alternate beats new entries.
+        if (tage_weak(*counter) && *useful == 0 &&
+            state->provider_prediction != state->alternate_prediction)
+            state->use_alternate = tage_saturate(
+                state->use_alternate + (state->alternate_prediction == taken ? 1 : -1), -8, 7);
+
+        if (state->provider_prediction != state->alternate_prediction)
+            *useful = tage_saturate(*useful + (state->provider_prediction == taken ? 1 : -1), 0,
+                                    3);
+        *counter = tage_saturate(*counter + (taken ? 1 : -1), -4, 3);
+    } else {
+        branch_predictor->tage_base_predictions++;
+        counter2_update(branch_predictor->pht, state->base_index, taken);
+    }
+
+    if (state->prediction != taken && state->provider + 1 < (int32_t)num_tables)
+        tage_allocate(branch_predictor, taken);
+
+    // age the useful counters.
+    if (--state->until_reset == 0) {
+        state->until_reset = branch_predictor->tage_reset_period;
+        size_t num_entries = (size_t)num_tables << branch_predictor->tage_index_bits;
+        for (size_t i = 0; i < num_entries; i++) branch_predictor->tage_useful[i] >>= 1;
+    }
+
+    // shift the branch into the global history and every folded history.
+    state->history_position = (state->history_position + 1) & (TAGE_HISTORY_BUFFER - 1);
+    state->history[state->history_position] = taken;
+    uint32_t index_bits = branch_predictor->tage_index_bits;
+    uint32_t tag_bits = branch_predictor->tage_tag_bits;
+    for (uint32_t t = 0; t < num_tables; t++) {
+        uint32_t outgoing = tage_history_bit(state, state->history_lengths[t]);
+        state->folded_index[t] = tage_fold(state->folded_index[t], index_bits,
+                                           state->outgoing_shifts[0][t], taken, outgoing);
+        state->folded_tag[0][t] = tage_fold(state->folded_tag[0][t], tag_bits,
+                                            state->outgoing_shifts[1][t], taken, outgoing);
+        state->folded_tag[1][t] = tage_fold(state->folded_tag[1][t], tag_bits - 1,
+                                            state->outgoing_shifts[2][t], taken, outgoing);
+    }
+}
+
+enum branch_direction tage_branch_predictor_predict(struct branch_predictor *branch_predictor,
+                                                    uint32_t address)
+{
+    return tage_predict(branch_predictor, address);
+}
+
+void tage_branch_predictor_handle_result(struct branch_predictor *branch_predictor,
+                                         uint32_t address, enum branch_direction branch_direction)
+{
+    // the indices and tags were computed by predict for this branch.
+    tage_update(branch_predictor, branch_direction == TAKEN);
+}
+
+void tage_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                          const uint32_t *addresses, const uint8_t *directions,
+                                          uint32_t n, uint64_t *correct)
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        count += tage_predict(branch_predictor, addresses[i]) == directions[i];
+        tage_update(branch_predictor, directions[i]);
+    }
+    *correct += count;
+}
+
+uint32_t tage_branch_predictor_state_regions(struct branch_predictor *branch_predictor,
+                                             struct branch_predictor_state_region *regions)
+{
+    // everything, including the folded histories, is in the arena.
+    regions[0].data = branch_predictor->arena;
+    regions[0].size = branch_predictor->arena_size;
+    return 1;
+}
+
+uint32_t tage_branch_predictor_counters(struct branch_predictor *branch_predictor,
+                                        struct branch_predictor_counter *counters)
+{
+    strcpy(counters[0].name, "TAGE BASE PREDICTIONS");
+    counters[0].value = &branch_predictor->tage_base_predictions;
+    strcpy(counters[1].name, "TAGE ALLOCATIONS");
+    counters[1].value = &branch_predictor->tage_allocations;
+    strcpy(counters[2].name, "TAGE ALLOCATION FAILURES");
+    counters[2].value = &branch_predictor->tage_allocation_failures;
+    return 3;
+}
+
+void tage_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+{
+    arena_free(branch_predictor->arena, branch_predictor->arena_size);
+}
+
+static struct branch_predictor *tage_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    uint64_t num_tables = branch_predictor_option(options, "tables", 7);
+    uint64_t base_entries = branch_predictor_option(options, "base", 8192);
+    uint64_t entries = branch_predictor_option(options, "entries", 1024);
+    uint64_t tag_bits = branch_predictor_option(options, "tag", 9);
+    uint64_t min_history = branch_predictor_option(options, "min", 4);
+    uint64_t max_history = branch_predictor_option(options, "max", 200);
+    uint64_t reset_period = branch_predictor_option(options, "reset", 1 << 18);
+    if (num_tables == 0 || num_tables > TAGE_MAX_TABLES || !is_power_of_two(base_entries) ||
+        base_entries > (1ull << 32) || !is_power_of_two(entries) || entries < 2 ||
+        entries > (1u << 24) || tag_bits < 2 || tag_bits > 16 || min_history == 0 ||
+        min_history > max_history || max_history > TAGE_MAX_HISTORY || reset_period == 0) {
+        fprintf(stderr, "Invalid geometry: tables must be between 1 and %d, base and entries "
+                        "powers of two (entries at most 2^24), tag between 2 and 16 bits and "
+                        "min <= max <= %d\n",
+                TAGE_MAX_TABLES, TAGE_MAX_HISTORY);
+        return NULL;
+    }
+
+    struct branch_predictor *tage_bp = calloc(1, sizeof(struct branch_predictor));
+    tage_bp->cleanup = &tage_branch_predictor_cleanup;
+    tage_bp->predict = &tage_branch_predictor_predict;
+    tage_bp->handle_result = &tage_branch_predictor_handle_result;
+    tage_bp->simulate_batch = &tage_branch_predictor_simulate_batch;
+    tage_bp->state_regions = &tage_branch_predictor_state_regions;
+    tage_bp->counters = &tage_branch_predictor_counters;
+
+    tage_bp->tage_num_tables = num_tables;
+    tage_bp->tage_tag_bits = tag_bits;
+    tage_bp->tage_reset_period = reset_period;
+    while ((1ull << tage_bp->tage_index_bits) < entries) tage_bp->tage_index_bits++;
+    tage_bp->pht_mask = base_entries - 1;
+    tage_bp->pht_size = counter_table_words(base_entries, 2) * sizeof(uint64_t);
+
+    // one array per field of the tagged entries, the tables one after the
+    // other.
+    size_t num_entries = num_tables * entries;
+    struct arena_layout layout = {0};
+    size_t state_offset = arena_layout_add(&layout, sizeof(struct tage_state));
+    size_t pht_offset = arena_layout_add(&layout, tage_bp->pht_size);
+    size_t tags_offset = arena_layout_add(&layout, num_entries * sizeof(uint16_t));
+    size_t counters_offset = arena_layout_add(&layout, num_entries * sizeof(int8_t));
+    size_t useful_offset = arena_layout_add(&layout, num_entries * sizeof(uint8_t));
+    char *arena = arena_new(layout.size);
+    if (!arena) {
+        fprintf(stderr, "Cannot allocate %zu bytes for the predictor state\n", layout.size);
+        free(tage_bp);
+        return NULL;
+    }
+    tage_bp->arena = arena;
+    tage_bp->arena_size = layout.size;
+    tage_bp->tage_state = (struct tage_state *)(arena + state_offset);
+    tage_bp->pht = (uint64_t *)(arena + pht_offset);
+    tage_bp->tage_tags = (uint16_t *)(arena + tags_offset);
+    tage_bp->tage_counters = (int8_t *)(arena + counters_offset);
+    tage_bp->tage_useful = (uint8_t *)(arena + useful_offset);
+
+    // the history lengths grow geometrically from min to max.
+    struct tage_state *state = tage_bp->tage_state;
+    for (uint32_t t = 0; t < num_tables; t++) {
+        double ratio = num_tables > 1 ? (double)t / (num_tables - 1) : 0;
+        uint32_t length =
+            (uint32_t)(min_history * pow((double)max_history / min_history, ratio) + 0.5);
+        state->history_lengths[t] = length;
+        state->outgoing_shifts[0][t] = length % tage_bp->tage_index_bits;
+        state->outgoing_shifts[1][t] = length % tag_bits;
+        state->outgoing_shifts[2][t] = length % (tag_bits - 1);
+        state->address_shifts[t] = tage_bp->tage_index_bits - t % tage_bp->tage_index_bits;
+    }
+    state->until_reset = reset_period;
+    state->random = 0x2545f4914f6cdd1dull;
+
+    return tage_bp;
+}
+
+struct branch_predictor *tage_branch_predictor_new(uint32_t num_branches,
+                                                   struct branch_metadata *branch_metadatas)
+{
+    return tage_branch_predictor_new_from_options(NULL, NULL);
+}
+
+// TOURN Branch Predictor
+// ============================================================================
+//
+// Two component predictors and a table of 2-bit chooser counters selected by
+// the low bits of the branch address. Both components are updated on every
+// branch, and the chooser counter moves towards the component that was right
+// whenever the two disagree.
+//
+// The components do not depend on the chooser, so simulate_batch runs each
+// component over the whole block on its own, recording its predictions, and
+// then makes the choices for the block in a single loop.
+
+// The number of branches that TOURN and BTB hand to their components at once.
+#define COMPONENT_CHUNK_RECORDS 1024
+
+static bool parse_branch_predictor_spec(char *spec, char **name,
+                                        struct branch_predictor_options *options);
+static bool check_branch_predictor_options(const char *name,
+                                           const struct branch_predictor_options *options);
+
+// Simulate a chunk of branches on a component, recording its predictions.
+static void component_predict_block(struct branch_predictor *component,
+                                    const uint32_t *addresses, const uint8_t *directions,
+                                    uint32_t n, uint8_t *predictions)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        predictions[i] = component->predict(component, addresses[i]);
+        component->handle_result(component, addresses[i], directions[i]);
+    }
+}
+
+static inline uint32_t tourn_chooser_index(struct branch_predictor *branch_predictor,
+                                           uint32_t address)
+{
+    return address & branch_predictor->pht_mask;
+}
+
+// Record the outcome of a branch in the statistics and the chooser.
+static inline enum branch_direction tourn_choose(struct branch_predictor *branch_predictor,
+                                                 uint32_t address,
+                                                 enum branch_direction first,
+                                                 enum branch_direction second,
+                                                 enum branch_direction branch_direction)
+{
+    uint32_t index = tourn_chooser_index(branch_predictor, address);
+    uint32_t choice = counter2_get(branch_predictor->pht, index) >> 1;
+    branch_predictor->component_chosen[choice]++;
+    branch_predictor->component_correct[0] += first == branch_direction;
+    branch_predictor->component_correct[1] += second == branch_direction;
+    if (first != second)
+        counter2_update(branch_predictor->pht, index, second == branch_direction);
+    return choice ? second : first;
+}
+
+uint32_t tourn_branch_predictor_pht_index(struct branch_predictor *branch_predictor,
+                                          uint32_t address)
+{
+    return tourn_chooser_index(branch_predictor, address);
+}
+
+enum branch_direction tourn_branch_predictor_predict(struct branch_predictor *branch_predictor,
+                                                     uint32_t address)
+{
+    // ask both components, and use the one picked by the chooser.
+    for (uint32_t c = 0; c < 2; c++) {
+        struct branch_predictor *component = branch_predictor->components[c];
+        branch_predictor->component_predictions[c] = component->predict(component, address);
+    }
+    uint32_t choice =
+        counter2_get(branch_predictor->pht, tourn_chooser_index(branch_predictor, address)) >> 1;
+    return branch_predictor->component_predictions[choice];
+}
+
+void tourn_branch_predictor_handle_result(struct branch_predictor *branch_predictor,
+                                          uint32_t address,
+                                          enum branch_direction branch_direction)
+{
+    struct branch_predictor *first = branch_predictor->components[0];
+    struct branch_predictor *second = branch_predictor->components[1];
+    tourn_choose(branch_predictor, address, branch_predictor->component_predictions[0],
+                 branch_predictor->component_predictions[1], branch_direction);
+    first->handle_result(first, address, branch_direction);
+    second->handle_result(second, address, branch_direction);
+}
+
+void tourn_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                           const uint32_t *addresses, const uint8_t *directions,
+                                           uint32_t n, uint64_t *correct)
+{
+    uint8_t predictions[2][COMPONENT_CHUNK_RECORDS];
+    uint64_t count = 0;
+    for (uint32_t start = 0; start < n; start += COMPONENT_CHUNK_RECORDS) {
+        uint32_t chunk = n - start < COMPONENT_CHUNK_RECORDS ? n - start : COMPONENT_CHUNK_RECORDS;
+        const uint32_t *chunk_addresses = addresses + start;
+        const uint8_t *chunk_directions = directions + start;
+
+        for (uint32_t c = 0; c < 2; c++)
+            component_predict_block(branch_predictor->components[c], chunk_addresses,
+                                    chunk_directions, chunk, predictions[c]);
+
+        for (uint32_t i = 0; i < chunk; i++) {
+            enum branch_direction prediction =
+                tourn_choose(branch_predictor, chunk_addresses[i], predictions[0][i],
+                             predictions[1][i], chunk_directions[i]);
+            count += prediction == chunk_directions[i];
         }
-        tbl_bp->pht[i] = 0;
     }
+    *correct += count;
+}
+
+uint32_t tourn_branch_predictor_state_regions(struct branch_predictor *branch_predictor,
+                                              struct branch_predictor_state_region *regions)
+{
+    uint32_t n = 0;
+    regions[n].data = branch_predictor->pht;
+    regions[n++].size = branch_predictor->pht_size;
+    for (uint32_t c = 0; c < 2; c++) {
+        struct branch_predictor *component = branch_predictor->components[c];
+        if (component->state_regions) n += component->state_regions(component, regions + n);
+    }
+    return n;
+}
 
-    return tbl_bp;
+uint32_t tourn_branch_predictor_counters(struct branch_predictor *branch_predictor,
+                                         struct branch_predictor_counter *counters)
+{
+    for (uint32_t c = 0; c < 2; c++) {
+        snprintf(counters[2 * c].name, sizeof(counters[2 * c].name), "COMPONENT %s CHOSEN",
+                 branch_predictor->component_specs[c]);
+        counters[2 * c].value = &branch_predictor->component_chosen[c];
+        snprintf(counters[2 * c + 1].name, sizeof(counters[2 * c + 1].name),
+                 "COMPONENT %s CORRECT", branch_predictor->component_specs[c]);
+        counters[2 * c + 1].value = &branch_predictor->component_correct[c];
+    }
+    return 4;
+}
+
+void tourn_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+{
+    for (uint32_t c = 0; c < 2; c++) {
+        struct branch_predictor *component = branch_predictor->components[c];
+        if (component) {
+            component->cleanup(component);
+            free(component);
+        }
+        free(branch_predictor->component_specs[c]);
+    }
+    arena_free(branch_predictor->arena, branch_predictor->arena_size);
+}
+
+struct branch_predictor *tourn_branch_predictor_new(const char *components,
+                                                    struct branch_index *branch_index)
+{
+    // split "FIRST+SECOND[+options]".
+    char buffer[256];
+    if (strlen(components) >= sizeof(buffer)) return NULL;
+    strcpy(buffer, components);
+    char *rest = buffer;
+    char *parts[3];
+    uint32_t num_parts = 0;
+    for (char *part; num_parts < 3 && (part = strsep(&rest, "+"));) parts[num_parts++] = part;
+    if (num_parts < 2 || rest) {
+        fprintf(stderr, "Malformed tournament %s, expected TOURN:FIRST+SECOND[+chooser=N]\n",
+                components);
+        return NULL;
+    }
+
+    char option_spec[sizeof(buffer) + 8];
+    snprintf(option_spec, sizeof(option_spec), "TOURN%s%s", num_parts == 3 ? ":" : "",
+             num_parts == 3 ? parts[2] : "");
+    char *name;
+    struct branch_predictor_options options;
+    if (!parse_branch_predictor_spec(option_spec, &name, &options)) {
+        fprintf(stderr, "Malformed branch predictor options in %s\n", parts[2]);
+        return NULL;
+    }
+    uint64_t chooser_entries = branch_predictor_option(&options, "chooser", 4096);
+    if (!check_branch_predictor_options("TOURN", &options)) return NULL;
+    if (!is_power_of_two(chooser_entries) || chooser_entries > (1ull << 32)) {
+        fprintf(stderr, "Invalid geometry: chooser must be a power of two no larger than 2^32\n");
+        return NULL;
+    }
+
+    // the state regions of nested tournaments and BTBs do not all fit.
+    for (uint32_t c = 0; c < 2; c++) {
+        size_t length = strcspn(parts[c], ":");
+        if ((length == 5 && !strncmp(parts[c], "TOURN", 5)) ||
+            (length == 3 && !strncmp(parts[c], "BTB", 3))) {
+            fprintf(stderr, "Invalid tournament component %s, it cannot be TOURN or BTB\n",
+                    parts[c]);
+            return NULL;
+        }
+    }
+
+    struct branch_predictor *tourn_bp = calloc(1, sizeof(struct branch_predictor));
+    tourn_bp->cleanup = &tourn_branch_predictor_cleanup;
+    tourn_bp->predict = &tourn_branch_predictor_predict;
+    tourn_bp->handle_result = &tourn_branch_predictor_handle_result;
+    tourn_bp->simulate_batch = &tourn_branch_predictor_simulate_batch;
+    tourn_bp->pht_index = &tourn_branch_predictor_pht_index;
+    tourn_bp->state_regions = &tourn_branch_predictor_state_regions;
+    tourn_bp->counters = &tourn_branch_predictor_counters;
+
+    for (uint32_t c = 0; c < 2; c++) {
+        tourn_bp->component_specs[c] = strdup(parts[c]);
+        tourn_bp->components[c] = branch_predictor_new(parts[c], branch_index);
+        if (!tourn_bp->components[c]) {
+            fprintf(stderr, "Invalid tournament component %s\n", parts[c]);
+            tourn_branch_predictor_cleanup(tourn_bp);
+            free(tourn_bp);
+            return NULL;
+        }
+    }
+
+    // the chooser starts out strongly preferring the first component.
+    tourn_bp->pht_mask = chooser_entries - 1;
+    tourn_bp->pht_size = counter_table_words(chooser_entries, 2) * sizeof(uint64_t);
+    tourn_bp->arena = arena_new(tourn_bp->pht_size);
+    if (!tourn_bp->arena) {
+        fprintf(stderr, "Cannot allocate %zu bytes for the predictor state\n",
+                tourn_bp->pht_size);
+        tourn_branch_predictor_cleanup(tourn_bp);
+        free(tourn_bp);
+        return NULL;
+    }
+    tourn_bp->arena_size = tourn_bp->pht_size;
+    tourn_bp->pht = tourn_bp->arena;
+
+    return tourn_bp;
+}
+
+// BTB Branch Predictor
+// ============================================================================
+//
+// A finite BTB (see btb.h) in front of a direction predictor. A branch that
+// misses in the BTB is not recognized as a branch in time, so it is predicted
+// not taken whatever the direction predictor says. The direction predictor is
+// still trained with every branch. Only the direction is counted as the
+// prediction: hits on the entry of another branch (possible with short tags)
+// are counted separately as wrong targets.
+
+static inline uint32_t btb_branch_target(struct branch_predictor *branch_predictor,
+                                         uint32_t address)
+{
+    return branch_index_target(branch_predictor->branch_index, address);
+}
+
+enum branch_direction btb_branch_predictor_predict(struct branch_predictor *branch_predictor,
+                                                   uint32_t address)
+{
+    // the direction predictor sees every branch, but a BTB miss falls
+    // through.
+    struct branch_predictor *component = branch_predictor->components[0];
+    enum branch_direction prediction = component->predict(component, address);
+    return btb_find(branch_predictor->btb, address) ? prediction : NOT_TAKEN;
+}
+
+void btb_branch_predictor_handle_result(struct branch_predictor *branch_predictor,
+                                        uint32_t address, enum branch_direction branch_direction)
+{
+    btb_access(branch_predictor->btb, address, btb_branch_target(branch_predictor, address),
+               branch_direction == TAKEN);
+    struct branch_predictor *component = branch_predictor->components[0];
+    component->handle_result(component, address, branch_direction);
+}
+
+void btb_branch_predictor_simulate_batch(struct branch_predictor *branch_predictor,
+                                         const uint32_t *addresses, const uint8_t *directions,
+                                         uint32_t n, uint64_t *correct)
+{
+    uint8_t predictions[COMPONENT_CHUNK_RECORDS];
+    uint64_t count = 0;
+    for (uint32_t start = 0; start < n; start += COMPONENT_CHUNK_RECORDS) {
+        uint32_t chunk =
+            n - start < COMPONENT_CHUNK_RECORDS ? n - start : COMPONENT_CHUNK_RECORDS;
+        const uint32_t *chunk_addresses = addresses + start;
+        const uint8_t *chunk_directions = directions + start;
+
+        component_predict_block(branch_predictor->components[0], chunk_addresses,
+                                chunk_directions, chunk, predictions);
+
+        for (uint32_t i = 0; i < chunk; i++) {
+            uint32_t address = chunk_addresses[i];
+            enum btb_result result =
+                btb_access(branch_predictor->btb, address,
+                           btb_branch_target(branch_predictor, address), chunk_directions[i]);
+            enum branch_direction prediction = result == BTB_MISS ? NOT_TAKEN : predictions[i];
+            count += prediction == chunk_directions[i];
+        }
+    }
+    *correct += count;
+}
+
+uint32_t btb_branch_predictor_state_regions(struct branch_predictor *branch_predictor,
+                                            struct branch_predictor_state_region *regions)
+{
+    uint32_t n = 0;
+    regions[n].data = branch_predictor->btb->ways;
+    regions[n++].size = btb_size(branch_predictor->btb);
+    regions[n].data = &branch_predictor->btb->random_state;
+    regions[n++].size = sizeof(branch_predictor->btb->random_state);
+    struct branch_predictor *component = branch_predictor->components[0];
+    if (component->state_regions) n += component->state_regions(component, regions + n);
+    return n;
+}
+
+uint32_t btb_branch_predictor_counters(struct branch_predictor *branch_predictor,
+                                       struct branch_predictor_counter *counters)
+{
+    struct btb *btb = branch_predictor->btb;
+    static const char *const names[] = {"BTB HITS", "BTB MISSES", "BTB TAKEN MISSES",
+                                        "BTB WRONG TARGETS"};
+    uint64_t *values[] = {&btb->hits, &btb->misses, &btb->taken_misses, &btb->wrong_targets};
+    uint32_t n = 0;
+    for (; n < sizeof(names) / sizeof(names[0]); n++) {
+        snprintf(counters[n].name, sizeof(counters[n].name), "%s", names[n]);
+        counters[n].value = values[n];
+    }
+
+    // the statistics of the direction predictor follow.
+    struct branch_predictor *component = branch_predictor->components[0];
+    if (component->counters) n += component->counters(component, counters + n);
+    return n;
+}
+
+void btb_branch_predictor_cleanup(struct branch_predictor *branch_predictor)
+{
+    struct branch_predictor *component = branch_predictor->components[0];
+    if (component) {
+        component->cleanup(component);
+        free(component);
+    }
+    free(branch_predictor->component_specs[0]);
+    if (branch_predictor->btb) btb_free(branch_predictor->btb);
+    if (branch_predictor->branch_index) branch_index_free(branch_predictor->branch_index);
+}
+
+struct branch_predictor *btb_branch_predictor_new(const char *spec,
+                                                  struct branch_index *branch_index)
+{
+    // split "BTB[:options]+PREDICTOR".
+    char buffer[256];
+    if (strlen(spec) >= sizeof(buffer)) return NULL;
+    strcpy(buffer, spec);
+    char *component_spec = buffer;
+    char *btb_spec = strsep(&component_spec, "+");
+    if (!component_spec || *component_spec == '\0') {
+        fprintf(stderr, "Malformed BTB %s, expected BTB[:key=value...]+PREDICTOR\n", spec);
+        return NULL;
+    }
+
+    char *name;
+    struct branch_predictor_options options;
+    if (!parse_branch_predictor_spec(btb_spec, &name, &options)) {
+        fprintf(stderr, "Malformed branch predictor options in %s\n", spec);
+        return NULL;
+    }
+    uint64_t num_entries = branch_predictor_option(&options, "entries", 2048);
+    uint64_t num_ways = branch_predictor_option(&options, "ways", 4);
+    const char *policy_name = branch_predictor_option_string(&options, "policy", "lru");
+    enum btb_policy policy;
+    if (!btb_policy_parse(policy_name, &policy)) {
+        fprintf(stderr, "Unknown BTB policy %s, expected lru, fifo or random\n", policy_name);
+        return NULL;
+    }
+    if (!is_power_of_two(num_entries) || num_entries > (1u << 28) ||
+        !is_power_of_two(num_ways) || num_ways > num_entries) {
+        fprintf(stderr, "Invalid geometry: entries and ways must be powers of two, with ways "
+                        "no larger than entries and entries no larger than 2^28\n");
+        return NULL;
+    }
+    uint32_t index_bits = 0;
+    while ((1ull << index_bits) < num_entries / num_ways) index_bits++;
+    uint64_t default_tag_bits = 32 - index_bits < BTB_MAX_TAG_BITS ? 32 - index_bits
+                                                                   : BTB_MAX_TAG_BITS;
+    uint64_t tag_bits = branch_predictor_option(&options, "tag", default_tag_bits);
+    if (!check_branch_predictor_options("BTB", &options)) return NULL;
+    if (tag_bits > BTB_MAX_TAG_BITS) {
+        fprintf(stderr, "Invalid geometry: tag must be at most %d\n", BTB_MAX_TAG_BITS);
+        return NULL;
+    }
+
+    struct branch_predictor *btb_bp = calloc(1, sizeof(struct branch_predictor));
+    btb_bp->cleanup = &btb_branch_predictor_cleanup;
+    btb_bp->predict = &btb_branch_predictor_predict;
+    btb_bp->handle_result = &btb_branch_predictor_handle_result;
+    btb_bp->simulate_batch = &btb_branch_predictor_simulate_batch;
+    btb_bp->state_regions = &btb_branch_predictor_state_regions;
+    btb_bp->counters = &btb_branch_predictor_counters;
+
+    btb_bp->component_specs[0] = strdup(component_spec);
+    btb_bp->components[0] = branch_predictor_new(component_spec, branch_index);
+    if (!btb_bp->components[0]) {
+        fprintf(stderr, "Invalid BTB direction predictor %s\n", component_spec);
+        btb_branch_predictor_cleanup(btb_bp);
+        free(btb_bp);
+        return NULL;
+    }
+    btb_bp->btb = btb_new(num_entries, num_ways, policy, tag_bits);
+    if (!btb_bp->btb) {
+        fprintf(stderr, "Cannot allocate %zu bytes for the predictor state\n",
+                (size_t)num_entries * sizeof(struct btb_way));
+        btb_branch_predictor_cleanup(btb_bp);
+        free(btb_bp);
+        return NULL;
+    }
+    btb_bp->branch_index = branch_index_ref(branch_index);
+
+    return btb_bp;
+}
+
+// Branch Predictor Lookup
+// ============================================================================
+
+static struct branch_predictor *ant_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    return ant_branch_predictor_new(0, NULL);
+}
+
+static struct branch_predictor *at_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    return at_branch_predictor_new(0, NULL);
+}
+
+static struct branch_predictor *btfnt_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    return btfnt_branch_predictor_new_from_index(branch_index);
+}
+
+// "TOURN" without components. Specs with components are handled by
+// branch_predictor_new before the options are parsed.
+static struct branch_predictor *tourn_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    return tourn_branch_predictor_new("2BG+2BL", branch_index);
+}
+
+// "BTB" without a direction predictor.
+static struct branch_predictor *btb_branch_predictor_new_from_options(
+    struct branch_index *branch_index, struct branch_predictor_options *options)
+{
+    return btb_branch_predictor_new("BTB+2BG", branch_index);
+}
+
+const struct branch_predictor_type branch_predictor_types[] = {
+    {"ANT", &ant_branch_predictor_new_from_options},
+    {"AT", &at_branch_predictor_new_from_options},
+    {"BTFNT", &btfnt_branch_predictor_new_from_options},
+    {"LTG", &ltg_branch_predictor_new_from_options},
+    {"LTL", &ltl_branch_predictor_new_from_options},
+    {"2BG", &tbg_branch_predictor_new_from_options},
+    {"2BL", &tbl_branch_predictor_new_from_options},
+    {"GSHARE", &gshare_branch_predictor_new_from_options},
+    {"PERCEPTRON", &perceptron_branch_predictor_new_from_options},
+    {"TAGE", &tage_branch_predictor_new_from_options},
+    {"TOURN", &tourn_branch_predictor_new_from_options},
+    {"BTB", &btb_branch_predictor_new_from_options},
+};
+
+const uint32_t num_branch_predictor_types =
+    sizeof(branch_predictor_types) / sizeof(branch_predictor_types[0]);
+
+uint64_t branch_predictor_option(struct branch_predictor_options *options, const char *key,
+                                 uint64_t default_value)
+{
+    if (!options) return default_value;
+    for (uint32_t i = 0; i < options->count; i++) {
+        if (!strcmp(options->keys[i], key)) {
+            options->used[i] = true;
+            if (!options->numeric[i]) {
+                fprintf(stderr, "Invalid value %s for option %s\n", options->texts[i], key);
+                options->invalid = true;
+                return default_value;
+            }
+            return options->values[i];
+        }
+    }
+    return default_value;
+}
+
+const char *branch_predictor_option_string(struct branch_predictor_options *options,
+                                           const char *key, const char *default_value)
+{
+    if (!options) return default_value;
+    for (uint32_t i = 0; i < options->count; i++) {
+        if (!strcmp(options->keys[i], key)) {
+            options->used[i] = true;
+            return options->texts[i];
+        }
+    }
+    return default_value;
+}
+
+// Check that every option was used and had a valid value, printing an error
+// for the first one that was not.
+static bool check_branch_predictor_options(const char *name,
+                                           const struct branch_predictor_options *options)
+{
+    for (uint32_t o = 0; o < options->count; o++) {
+        if (!options->used[o]) {
+            fprintf(stderr, "Unknown option %s for %s\n", options->keys[o], name);
+            return false;
+        }
+    }
+    return !options->invalid;
+}
+
+// Split "NAME:key=value:key=value" into the name and the options. The spec is
+// modified in place.
+static bool parse_branch_predictor_spec(char *spec, char **name,
+                                        struct branch_predictor_options *options)
+{
+    options->count = 0;
+    options->invalid = false;
+    *name = strsep(&spec, ":");
+    for (char *option; (option = strsep(&spec, ":"));) {
+        char *key = strsep(&option, "=");
+        char *end;
+        if (!option || *option == '\0' || options->count == MAX_BRANCH_PREDICTOR_OPTIONS)
+            return false;
+        errno = 0;
+        uint64_t value = strtoull(option, &end, 0);
+
+        // A value is only a number if all of it is, without a sign and in
+        // range.
+        options->keys[options->count] = key;
+        options->texts[options->count] = option;
+        options->values[options->count] = value;
+        options->numeric[options->count] =
+            isdigit((unsigned char)*option) && *end == '\0' && errno == 0;
+        options->used[options->count] = false;
+        options->count++;
+    }
+    return true;
+}
+
+struct branch_predictor *branch_predictor_new(const char *spec,
+                                              struct branch_index *branch_index)
+{
+    // The components of a tournament or a BTB are specs themselves.
+    if (!strncmp(spec, "TOURN:", strlen("TOURN:")))
+        return tourn_branch_predictor_new(spec + strlen("TOURN:"), branch_index);
+    if (!strncmp(spec, "BTB:", strlen("BTB:")) || !strncmp(spec, "BTB+", strlen("BTB+")))
+        return btb_branch_predictor_new(spec, branch_index);
+
+    char buffer[256];
+    if (strlen(spec) >= sizeof(buffer)) return NULL;
+    strcpy(buffer, spec);
+
+    char *name;
+    struct branch_predictor_options options;
+    if (!parse_branch_predictor_spec(buffer, &name, &options)) {
+        fprintf(stderr, "Malformed branch predictor options in %s\n", spec);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < num_branch_predictor_types; i++) {
+        if (strcmp(branch_predictor_types[i].name, name)) continue;
+
+        struct branch_predictor *branch_predictor =
+            branch_predictor_types[i].new(branch_index, &options);
+        if (!branch_predictor) return NULL;
+
+        if (!check_branch_predictor_options(name, &options)) {
+            branch_predictor->cleanup(branch_predictor);
+            free(branch_predictor);
+            return NULL;
+        }
+        return branch_predictor;
+    }
+    return NULL;
+}
+
+// Move a pointer into the arena of a predictor to the same offset in the
+// arena of its copy.
+static void *rebase(void *pointer, const struct branch_predictor *from,
+                    const struct branch_predictor *to)
+{
+    if (!pointer) return NULL;
+    return (char *)to->arena + ((char *)pointer - (char *)from->arena);
+}
+
+struct branch_predictor *branch_predictor_clone(const struct branch_predictor *branch_predictor)
+{
+    // the BTB and the branch index live outside of the arena.
+    if (branch_predictor->btb || branch_predictor->branch_index) return NULL;
+
+    struct branch_predictor *clone = malloc(sizeof(struct branch_predictor));
+    if (!clone) return NULL;
+    *clone = *branch_predictor;
+    for (uint32_t c = 0; c < 2; c++) {
+        clone->components[c] = NULL;
+        clone->component_specs[c] = NULL;
+    }
+    clone->arena = NULL;
+    if (branch_predictor->arena) {
+        clone->arena = arena_copy(branch_predictor->arena, branch_predictor->arena_size);
+        if (!clone->arena) {
+            free(clone);
+            return NULL;
+        }
+    }
+    clone->pht = rebase(branch_predictor->pht, branch_predictor, clone);
+    clone->history_register = rebase(branch_predictor->history_register, branch_predictor, clone);
+    clone->in_flight = rebase(branch_predictor->in_flight, branch_predictor, clone);
+    clone->perceptron_weights =
+        rebase(branch_predictor->perceptron_weights, branch_predictor, clone);
+    clone->perceptron_inputs = rebase(branch_predictor->perceptron_inputs, branch_predictor, clone);
+    clone->tage_state = rebase(branch_predictor->tage_state, branch_predictor, clone);
+    clone->tage_tags = rebase(branch_predictor->tage_tags, branch_predictor, clone);
+    clone->tage_counters = rebase(branch_predictor->tage_counters, branch_predictor, clone);
+    clone->tage_useful = rebase(branch_predictor->tage_useful, branch_predictor, clone);
+
+    for (uint32_t c = 0; c < 2 && branch_predictor->components[c]; c++) {
+        clone->component_specs[c] = strdup(branch_predictor->component_specs[c]);
+        clone->components[c] = branch_predictor_clone(branch_predictor->components[c]);
+        if (!clone->component_specs[c] || !clone->components[c]) {
+            clone->cleanup(clone);
+            free(clone);
+            return NULL;
+        }
+    }
+    return clone;
 }
@@ -9,14 +9,88 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "arena.h"
+#include "branch_index.h"
 #include "branch_metadata.h"
+#include "btb.h"
 #include "util.h"
 
+#define MAX_BRANCH_PREDICTOR_STATE_REGIONS 16
+
+// A block of memory that holds part of the state of a branch predictor.
+struct branch_predictor_state_region {
+    void *data;
+    size_t size;
+};
+
+#define MAX_BRANCH_PREDICTOR_COUNTERS 16
+
+// The most tagged tables and the longest history of TAGE.
+#define TAGE_MAX_TABLES 16
+#define TAGE_MAX_HISTORY 1024
+// The global history of TAGE is kept in a ring of this many bits.
+#define TAGE_HISTORY_BUFFER 2048
+
+// The history state of TAGE, and the lookup of the last prediction, which
+// handle_result updates the tables with.
+struct tage_state {
+    uint32_t history_lengths[TAGE_MAX_TABLES];
+    // The folded histories of each tagged table: one of the index width and
+    // two of the tag width (and the tag width minus one) for the tag.
+    uint32_t folded_index[TAGE_MAX_TABLES];
+    uint32_t folded_tag[2][TAGE_MAX_TABLES];
+    // Where the bit leaving each history lands in its folded histories
+    // (the history length modulo the width), and the shift that mixes the
+    // address into each index.
+    uint8_t outgoing_shifts[3][TAGE_MAX_TABLES];
+    uint8_t address_shifts[TAGE_MAX_TABLES];
+    // One direction per byte, the newest at history_position.
+    uint8_t history[TAGE_HISTORY_BUFFER];
+    uint32_t history_position;
+    // Positive when new entries should defer to the alternate prediction.
+    int32_t use_alternate;
+    // Branches left until the useful counters are aged.
+    uint64_t until_reset;
+    uint64_t random;
+
+    uint32_t base_index;
+    uint32_t indices[TAGE_MAX_TABLES];
+    uint16_t tags[TAGE_MAX_TABLES];
+    int32_t provider;
+    int32_t alternate;
+    bool provider_prediction;
+    bool alternate_prediction;
+    bool prediction;
+};
+
+// A branch that has been predicted but not resolved yet, in the delayed
+// update mode of the two-level predictors (see delay below).
+struct in_flight_branch {
+    // The PHT entry that the prediction was read from, which is the entry
+    // that is trained when the branch resolves.
+    uint32_t pht_index;
+    uint8_t prediction;
+    uint8_t direction;
+};
+
+// A ring of in-flight branches, oldest first.
+struct in_flight_branches {
+    uint32_t head;
+    uint32_t count;
+    struct in_flight_branch branches[];
+};
+
+// An extra statistic kept by a branch predictor, printed as
+// "OUTPUT <name> <value>".
+struct branch_predictor_counter {
+    char name[64];
+    uint64_t *value;
+};
+
 // This struct describes the functionality of a branch predictor. The function
 // pointers describe the three functions that every branch predictor must
-// implement. Arbitrary data can be stored in the data pointer and can be used
-// to store the state of the branch predictor between calls to predict and
-// handle_result.
+// implement. The fields after the function pointers are used to store the
+// state of the branch predictor between calls to predict and handle_result.
 //
 // For those of you who are unfamiliar with function pointers, they take the
 // form:
@@ -47,20 +121,146 @@ struct branch_predictor {
 
     // This function is called right before the branch predictor is
     // deallocated. You should perform any necessary cleanup operations here.
-    // (This is where you should free the branch_predictor->data, for example.)
+    // (This is where you should free the branch_predictor->pht, for example.)
     //
     // Arguments:
     //  * branch_predictor: the instance of branch_predictor to clean up.
     void (*cleanup)(struct branch_predictor *branch_predictor);
 
-    // Use for BTFNT.
-    struct branch_metadata *data;
+    // This function is optional (it may be NULL). It simulates a block of
+    // branches in one call, which must be equivalent to calling predict and
+    // then handle_result for each of them in order. Implementing it avoids two
+    // indirect calls per branch and lets the compiler optimize the whole loop.
+    //
+    // Arguments
+    //  * branch_predictor: the instance of branch_predictor to simulate.
+    //  * addresses: the branch instruction addresses.
+    //  * directions: the actual direction that each branch went.
+    //  * n: the number of branches.
+    //  * correct: incremented by the number of correct predictions.
+    void (*simulate_batch)(struct branch_predictor *branch_predictor, const uint32_t *addresses,
+                           const uint8_t *directions, uint32_t n, uint64_t *correct);
+
+    // This function is optional (it may be NULL). It returns the PHT entry
+    // that predict would use for the branch in the current state. It is only
+    // used for profiling.
+    //
+    // Arguments
+    //  * branch_predictor: the instance of branch_predictor.
+    //  * address: the branch instruction address.
+    //
+    // Returns (uint32_t): an index into the PHT (at most pht_mask).
+    uint32_t (*pht_index)(struct branch_predictor *branch_predictor, uint32_t address);
+
+    // This function is optional (it may be NULL if the predictor has no
+    // state). It lists the memory regions that hold all of the state that
+    // changes during a simulation, such as the PHT and the history registers.
+    // Copying these regions out and back in again saves and restores the
+    // predictor, which is how checkpoints work.
+    //
+    // Arguments
+    //  * branch_predictor: the instance of branch_predictor.
+    //  * regions: filled with at most MAX_BRANCH_PREDICTOR_STATE_REGIONS
+    //    regions.
+    //
+    // Returns (uint32_t): the number of regions.
+    uint32_t (*state_regions)(struct branch_predictor *branch_predictor,
+                              struct branch_predictor_state_region *regions);
+
+    // This function is optional (it may be NULL). It lists the extra
+    // statistics that the predictor keeps, which are printed after the
+    // prediction statistics. The values are pointers so that they can be
+    // reset after a warm-up and added up across shards.
+    //
+    // Arguments
+    //  * branch_predictor: the instance of branch_predictor.
+    //  * counters: filled with at most MAX_BRANCH_PREDICTOR_COUNTERS counters.
+    //
+    // Returns (uint32_t): the number of counters.
+    uint32_t (*counters)(struct branch_predictor *branch_predictor,
+                         struct branch_predictor_counter *counters);
+
+    // The tables of the predictor (the PHT, the history registers and so on)
+    // point into this arena, which is owned by the predictor (see arena.h).
+    void *arena;
+    size_t arena_size;
 
-    // Pattern History Table
-    uint32_t *pht;
+    // Use for BTFNT and BTB.
+    struct branch_index *branch_index;
 
-    // Use for history registers
+    // Pattern History Table. The counters are packed into 64-bit words, see
+    // counter_table.h.
+    uint64_t *pht;
+    uint32_t pht_mask;
+    size_t pht_size;
+    // The width of the PHT counters (1 or 2) of the two-level predictors, 0
+    // for the other predictors.
+    uint32_t counter_bits;
+    // The address bits that are XORed into the PHT index (gshare), 0 for the
+    // two-level predictors.
+    uint32_t pht_address_mask;
+
+    // Use for history registers. The global predictors have a single history
+    // register, the local ones have history_register_mask + 1 of them.
     uint32_t *history_register;
+    uint32_t history_register_mask;
+    uint32_t history_bits;
+    uint32_t history_mask;
+
+    // Use for the delayed update of the two-level predictors and GSHARE
+    // (delay=N). A branch only trains its PHT entry once N younger branches
+    // have been predicted. history_register holds the speculative history,
+    // which includes the predicted direction of each branch. It is repaired
+    // as soon as a branch turns out to be mispredicted, since the younger
+    // branches of the trace are fetched after the flush.
+    uint32_t delay;
+    struct in_flight_branches *in_flight;
+
+    // Use for PERCEPTRON. Row i of perceptron_weights holds the bias weight
+    // and the history weights of perceptron i. perceptron_inputs holds the
+    // matching inputs: 1 for the bias, then 1 (taken) or -1 (not taken) for
+    // each history bit, newest first. Both are zero-padded to
+    // perceptron_stride bytes. pht_mask selects the perceptron.
+    int8_t *perceptron_weights;
+    int8_t *perceptron_inputs;
+    uint32_t perceptron_stride;
+    int32_t perceptron_threshold;
+    bool perceptron_avx2;
+
+    // Use for TAGE. The bimodal base table is the PHT. Entry i of tagged
+    // table t is element (t << tage_index_bits) | i of the tags, counters
+    // (3-bit, signed) and useful (2-bit) arrays.
+    uint32_t tage_num_tables;
+    uint32_t tage_index_bits;
+    uint32_t tage_tag_bits;
+    uint64_t tage_reset_period;
+    struct tage_state *tage_state;
+    uint16_t *tage_tags;
+    int8_t *tage_counters;
+    uint8_t *tage_useful;
+    uint64_t tage_base_predictions;
+    uint64_t tage_allocations;
+    uint64_t tage_allocation_failures;
+
+    // Use for TOURN and BTB: the predictors they are made of. TOURN has two
+    // components and BTB has one, the direction predictor behind the BTB.
+    struct branch_predictor *components[2];
+    char *component_specs[2];
+
+    // Use for TOURN. The chooser counters are kept in the PHT (see above) and
+    // counter 2 or 3 picks the second component. The statistics count, for
+    // each component, the branches it was chosen for and the branches it
+    // predicted correctly (whether it was chosen or not).
+    uint64_t component_chosen[2];
+    uint64_t component_correct[2];
+    // The predictions of both components for the branch that predict was
+    // last called for, which handle_result trains the chooser with. Each
+    // component predicts every branch once, like in simulate_batch, since the
+    // predict function of a delayed predictor pushes the branch in flight.
+    uint8_t component_predictions[2];
+
+    // Use for BTB. The targets of the branches are found in branch_index.
+    struct btb *btb;
 };
 
 struct branch_predictor *ant_branch_predictor_new(uint32_t num_branches,
@@ -77,5 +277,128 @@ struct branch_predictor *tbg_branch_predictor_new(uint32_t num_branches,
                                                   struct branch_metadata *branch_metadatas);
 struct branch_predictor *tbl_branch_predictor_new(uint32_t num_branches,
                                                   struct branch_metadata *branch_metadatas);
+struct branch_predictor *gshare_branch_predictor_new(uint32_t num_branches,
+                                                     struct branch_metadata *branch_metadatas);
+struct branch_predictor *perceptron_branch_predictor_new(uint32_t num_branches,
+                                                         struct branch_metadata *branch_metadatas);
+struct branch_predictor *tage_branch_predictor_new(uint32_t num_branches,
+                                                   struct branch_metadata *branch_metadatas);
+struct branch_predictor *tourn_branch_predictor_new(const char *components,
+                                                    struct branch_index *branch_index);
+struct branch_predictor *btb_branch_predictor_new(const char *spec,
+                                                  struct branch_index *branch_index);
+
+#define MAX_BRANCH_PREDICTOR_OPTIONS 16
+
+// The key=value options from a branch predictor spec such as "2BG:ghr=16".
+// Values that are not numbers, such as "policy=lru", are only kept as text.
+struct branch_predictor_options {
+    uint32_t count;
+    const char *keys[MAX_BRANCH_PREDICTOR_OPTIONS];
+    const char *texts[MAX_BRANCH_PREDICTOR_OPTIONS];
+    uint64_t values[MAX_BRANCH_PREDICTOR_OPTIONS];
+    bool numeric[MAX_BRANCH_PREDICTOR_OPTIONS];
+    bool used[MAX_BRANCH_PREDICTOR_OPTIONS];
+    // Set when an option had a value of the wrong kind.
+    bool invalid;
+};
+
+//
+// Get the value of a branch predictor option and mark it as used.
+//
+// Arguments
+//  * options: the options to search, may be NULL.
+//  * key: the name of the option.
+//  * default_value: the value to return if the option was not given.
+//
+// Returns (uint64_t): the value of the option.
+uint64_t branch_predictor_option(struct branch_predictor_options *options, const char *key,
+                                 uint64_t default_value);
+
+//
+// Get the text of a branch predictor option and mark it as used.
+//
+// Arguments
+//  * options: the options to search, may be NULL.
+//  * key: the name of the option.
+//  * default_value: the value to return if the option was not given.
+//
+// Returns (const char *): the text of the option.
+const char *branch_predictor_option_string(struct branch_predictor_options *options,
+                                           const char *key, const char *default_value);
+
+// A branch predictor constructor and the name that selects it. The
+// constructor returns NULL if the options are invalid.
+struct branch_predictor_type {
+    const char *name;
+    struct branch_predictor *(*new)(struct branch_index *branch_index,
+                                    struct branch_predictor_options *options);
+};
+
+// All of the branch predictors that branch_predictor_new knows about, in the
+// order that they are simulated by "ALL".
+extern const struct branch_predictor_type branch_predictor_types[];
+extern const uint32_t num_branch_predictor_types;
+
+//
+// Create a branch predictor from a spec. The spec is the name of the
+// predictor, optionally followed by colon-separated options, for example
+// "2BG" or "2BL:lhrs=64:lhr=8". The two-level predictors accept:
+//
+//  * LTG, 2BG: ghr (history bits, default 5) and pht (entries, default
+//    2^ghr).
+//  * LTL, 2BL: lhrs (number of LHRs, default 16), lhr (history bits, default
+//    4) and pht (entries, default lhrs * 2^lhr).
+//  * GSHARE: ghr (history bits, default 12) and pht (entries, default 2^ghr).
+//
+// All of these also accept delay (default 0): the number of younger branches
+// that are predicted before a branch updates the predictor, as in a pipeline
+// that resolves branches late (see delay in struct branch_predictor).
+//  * PERCEPTRON: ghr (history bits, default 32, at most 256), perceptrons
+//    (number of perceptrons, default 1024) and threshold (training
+//    threshold, default 1.93 * ghr + 14).
+//  * TAGE: tables (tagged tables, default 7, at most 16), base (bimodal
+//    entries, default 8192), entries (entries per tagged table, default
+//    1024), tag (tag bits, default 9), min and max (the shortest and longest
+//    history, default 4 and 200, at most 1024) and reset (branches between
+//    two agings of the useful counters, default 2^18).
+//
+// The tournament predictor is written "TOURN:FIRST+SECOND" or
+// "TOURN:FIRST+SECOND+chooser=N", where FIRST and SECOND are the specs of any
+// other two predictors, for example "TOURN:2BG:ghr=8+2BL" or
+// "TOURN:GSHARE+PERCEPTRON+chooser=1024". chooser is the number of chooser
+// counters (default 4096). "TOURN" alone is "TOURN:2BG+2BL". The components
+// cannot be tournaments or BTBs themselves.
+//
+// A finite BTB can be put in front of any predictor with
+// "BTB[:key=value...]+PREDICTOR", for example "BTB+2BG" or
+// "BTB:entries=1024:ways=8:policy=fifo:tag=8+TOURN:2BG+2BL". A branch that
+// misses in the BTB is predicted not taken. The options are entries (default
+// 2048), ways (default 4), policy (lru, fifo or random, default lru) and tag
+// (tag bits, default all of the address bits above the set index, at most
+// 31). "BTB" alone is "BTB+2BG".
+//
+// Arguments
+//  * spec: the branch predictor spec.
+//  * branch_index: the unique branches of the trace (see branch_index.h).
+//    BTFNT and BTB keep a reference to it, so branches that are added to it
+//    later are seen by them too.
+//
+// Returns (struct branch_predictor *): the new branch predictor, or NULL if
+// the spec is invalid.
+struct branch_predictor *branch_predictor_new(const char *spec,
+                                              struct branch_index *branch_index);
+
+//
+// Copy a branch predictor with all of its state. The tables of a predictor
+// are in its arena, so this is mostly a single memcpy.
+//
+// Arguments
+//  * branch_predictor: the branch predictor to copy.
+//
+// Returns (struct branch_predictor *): the copy, or NULL for predictors that
+// keep state outside of their arena (BTFNT and BTB) and if the copy cannot be
+// allocated.
+struct branch_predictor *branch_predictor_clone(const struct branch_predictor *branch_predictor);
 
 #endif
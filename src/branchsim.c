@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "branch_predictors.h"
+#include "branchsim.h"
+#include "simulation.h"
+#include "trace.h"
+
+struct branchsim_trace {
+    struct trace *trace;
+    // The file descriptor opened by branchsim_trace_open, -1 otherwise.
+    int fd;
+    // Set once a trace that cannot be re-read has been simulated.
+    bool consumed;
+};
+
+struct branchsim_predictor {
+    struct simulation simulation;
+};
+
+struct branchsim_trace *branchsim_trace_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct branchsim_trace *trace = branchsim_trace_open_fd(fd);
+    if (!trace) {
+        close(fd);
+        return NULL;
+    }
+    trace->fd = fd;
+    return trace;
+}
+
+struct branchsim_trace *branchsim_trace_open_fd(int fd)
+{
+    struct trace *reader = trace_open(fd);
+    if (!reader) return NULL;
+    struct branchsim_trace *trace = calloc(1, sizeof(struct branchsim_trace));
+    if (!trace) {
+        trace_close(reader);
+        return NULL;
+    }
+    trace->trace = reader;
+    trace->fd = -1;
+    return trace;
+}
+
+uint32_t branchsim_trace_num_branches(const struct branchsim_trace *trace)
+{
+    return trace->trace->branch_index->num_branches;
+}
+
+void branchsim_trace_close(struct branchsim_trace *trace)
+{
+    trace_close(trace->trace);
+    if (trace->fd >= 0) close(trace->fd);
+    free(trace);
+}
+
+struct branchsim_predictor *branchsim_predictor_new(const char *spec,
+                                                    const struct branchsim_trace *trace)
+{
+    struct branch_predictor *branch_predictor =
+        branch_predictor_new(spec, trace->trace->branch_index);
+    if (!branch_predictor) return NULL;
+
+    struct branchsim_predictor *predictor = calloc(1, sizeof(struct branchsim_predictor));
+    predictor->simulation.name = strdup(spec);
+    predictor->simulation.branch_predictor = branch_predictor;
+    return predictor;
+}
+
+void branchsim_predictor_free(struct branchsim_predictor *predictor)
+{
+    struct branch_predictor *branch_predictor = predictor->simulation.branch_predictor;
+    branch_predictor->cleanup(branch_predictor);
+    free(branch_predictor);
+    free((char *)predictor->simulation.name);
+    free(predictor);
+}
+
+uint32_t branchsim_num_predictor_types(void)
+{
+    return num_branch_predictor_types;
+}
+
+const char *branchsim_predictor_type_name(uint32_t i)
+{
+    return i < num_branch_predictor_types ? branch_predictor_types[i].name : NULL;
+}
+
+int branchsim_simulate(struct branchsim_trace *trace, struct branchsim_predictor *const *predictors,
+                       uint32_t num_predictors)
+{
+    if (num_predictors > MAX_SIMULATIONS) return BRANCHSIM_ERROR_TOO_MANY_PREDICTORS;
+
+    // Memory-mapped traces are read through a fresh cursor every time.
+    struct trace cursor;
+    struct trace *reader = &cursor;
+    if (!trace_cursor(trace->trace, &cursor)) {
+        if (trace->consumed) return BRANCHSIM_ERROR_TRACE_CONSUMED;
+        trace->consumed = true;
+        reader = trace->trace;
+    }
+
+    struct simulation simulations[MAX_SIMULATIONS];
+    for (uint32_t p = 0; p < num_predictors; p++) {
+        simulations[p] = predictors[p]->simulation;
+        simulations[p].lockstep = false;
+    }
+    struct multi_config *multi_config =
+        simulations_multi_config_new(simulations, num_predictors);
+
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+    uint32_t count;
+    while ((count = reader->next_block(reader, addresses, directions, TRACE_BLOCK_RECORDS)))
+        simulate_blocks(simulations, num_predictors, multi_config, addresses, directions, count);
+
+    if (multi_config) multi_config_free(multi_config);
+    for (uint32_t p = 0; p < num_predictors; p++) predictors[p]->simulation = simulations[p];
+    return reader->error ? BRANCHSIM_ERROR_MALFORMED_TRACE : BRANCHSIM_OK;
+}
+
+void branchsim_predictor_stats(const struct branchsim_predictor *predictor,
+                               struct branchsim_stats *stats)
+{
+    const struct simulation *sim = &predictor->simulation;
+    memset(stats, 0, sizeof(*stats));
+    stats->predictions = sim->prediction_count;
+    stats->correct = sim->correct_prediction_count;
+    stats->incorrect = sim->prediction_count - sim->correct_prediction_count;
+    stats->rate = sim->prediction_count
+                      ? (double)sim->correct_prediction_count / sim->prediction_count
+                      : 0;
+
+    struct branch_predictor *branch_predictor = sim->branch_predictor;
+    struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+    if (branch_predictor->counters)
+        stats->num_counters = branch_predictor->counters(branch_predictor, counters);
+    for (uint32_t c = 0; c < stats->num_counters; c++) {
+        memcpy(stats->counters[c].name, counters[c].name, sizeof(stats->counters[c].name));
+        stats->counters[c].value = *counters[c].value;
+    }
+}
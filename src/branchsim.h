@@ -0,0 +1,130 @@
+//
+// This file defines the public API of libbranchsim, the simulator as a
+// library. It lets other programs (and Python, through ctypes) simulate
+// traces in-process instead of running ./branchsim and parsing its output.
+//
+// A typical use is:
+//
+//      struct branchsim_trace *trace = branchsim_trace_open("inputs/trace1");
+//      struct branchsim_predictor *predictor = branchsim_predictor_new("2BG", trace);
+//      branchsim_simulate(trace, &predictor, 1);
+//      struct branchsim_stats stats;
+//      branchsim_predictor_stats(predictor, &stats);
+//      branchsim_predictor_free(predictor);
+//      branchsim_trace_close(trace);
+//
+// Build with `make libbranchsim.a` or `make libbranchsim.so`. The ./branchsim
+// command line tool is itself linked against libbranchsim.a.
+//
+
+#ifndef BRANCHSIM_H
+#define BRANCHSIM_H
+
+#include <stdint.h>
+
+#define BRANCHSIM_OK 0
+// The trace was read from a pipe and has already been simulated.
+#define BRANCHSIM_ERROR_TRACE_CONSUMED 1
+// More predictors were passed to branchsim_simulate than it can run at once.
+#define BRANCHSIM_ERROR_TOO_MANY_PREDICTORS 2
+// A record of the trace is malformed. The predictors have simulated the
+// records before it.
+#define BRANCHSIM_ERROR_MALFORMED_TRACE 3
+
+#define BRANCHSIM_MAX_COUNTERS 16
+
+// An extra statistic of a predictor, such as "BTB HITS".
+struct branchsim_counter {
+    char name[64];
+    uint64_t value;
+};
+
+struct branchsim_stats {
+    uint64_t predictions;
+    uint64_t correct;
+    uint64_t incorrect;
+    double rate;
+    uint32_t num_counters;
+    struct branchsim_counter counters[BRANCHSIM_MAX_COUNTERS];
+};
+
+struct branchsim_trace;
+struct branchsim_predictor;
+
+//
+// Open a trace file in the text, the stream or the binary format, which is
+// detected from its first bytes like trace_open does. A gzip-compressed trace
+// of any of these formats is decompressed as it is read. Uncompressed traces
+// opened from a regular file are memory-mapped and can be simulated any number
+// of times; compressed traces can only be simulated once.
+//
+// Arguments
+//  * path: the path of the trace.
+//
+// Returns (struct branchsim_trace *): the trace, or NULL if it cannot be
+// opened or is malformed.
+struct branchsim_trace *branchsim_trace_open(const char *path);
+
+//
+// Open a trace from a file descriptor, which is not closed by the library.
+// A trace read from a pipe can only be simulated once.
+//
+// Returns (struct branchsim_trace *): the trace, or NULL if it is malformed.
+struct branchsim_trace *branchsim_trace_open_fd(int fd);
+
+//
+// The number of unique branches of a trace that are known: those in its
+// metadata, and for a trace without metadata those discovered by the
+// simulations so far.
+uint32_t branchsim_trace_num_branches(const struct branchsim_trace *trace);
+
+//
+// Close a trace. Its predictors must be freed first.
+void branchsim_trace_close(struct branchsim_trace *trace);
+
+//
+// Create a predictor for a trace from a spec, such as "2BG", "2BL:lhr=8" or
+// "TOURN:2BG+2BL" (see branch_predictors.h for the full syntax).
+//
+// Arguments
+//  * spec: the predictor spec.
+//  * trace: the trace whose branch metadata the predictor may use.
+//
+// Returns (struct branchsim_predictor *): the predictor, or NULL if the spec
+// is invalid.
+struct branchsim_predictor *branchsim_predictor_new(const char *spec,
+                                                    const struct branchsim_trace *trace);
+
+//
+// Free a predictor.
+void branchsim_predictor_free(struct branchsim_predictor *predictor);
+
+//
+// The number of predictor types, and the name of each of them.
+uint32_t branchsim_num_predictor_types(void);
+const char *branchsim_predictor_type_name(uint32_t i);
+
+//
+// Simulate a whole trace on several predictors in a single pass over it. The
+// predictors keep their state and statistics, so simulating the trace again
+// continues from where the last simulation stopped.
+//
+// Arguments
+//  * trace: the trace.
+//  * predictors: the predictors, created for this trace.
+//  * num_predictors: the number of predictors.
+//
+// Returns (int): BRANCHSIM_OK or one of the BRANCHSIM_ERROR codes.
+int branchsim_simulate(struct branchsim_trace *trace, struct branchsim_predictor *const *predictors,
+                       uint32_t num_predictors);
+
+//
+// Get the statistics of a predictor.
+//
+// Arguments
+//  * predictor: the predictor.
+//  * stats: filled with the statistics.
+void branchsim_predictor_stats(const struct branchsim_predictor *predictor,
+                               struct branchsim_stats *stats);
+
+#endif
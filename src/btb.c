@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include "branch_index.h"
+#include "btb.h"
+
+bool btb_policy_parse(const char *name, enum btb_policy *policy)
+{
+    if (!strcmp(name, "lru"))
+        *policy = BTB_POLICY_LRU;
+    else if (!strcmp(name, "fifo"))
+        *policy = BTB_POLICY_FIFO;
+    else if (!strcmp(name, "random"))
+        *policy = BTB_POLICY_RANDOM;
+    else
+        return false;
+    return true;
+}
+
+struct btb *btb_new(uint32_t num_entries, uint32_t num_ways, enum btb_policy policy,
+                    uint32_t tag_bits)
+{
+    struct btb *btb = calloc(1, sizeof(struct btb));
+    if (!btb) return NULL;
+    uint32_t num_sets = num_entries / num_ways;
+    btb->set_mask = num_sets - 1;
+    while ((1ull << btb->index_bits) < num_sets) btb->index_bits++;
+    btb->num_ways = num_ways;
+    btb->tag_mask = (1u << tag_bits) - 1;
+    btb->policy = policy;
+    btb->random_state = 0x9e3779b97f4a7c15ull;
+    btb->ways = calloc(num_entries, sizeof(struct btb_way));
+    if (!btb->ways) {
+        free(btb);
+        return NULL;
+    }
+    return btb;
+}
+
+// Move way w of a set to the front, shifting the ways before it back.
+static inline void btb_move_to_front(struct btb_way *set, uint32_t w, struct btb_way way)
+{
+    memmove(&set[1], &set[0], w * sizeof(struct btb_way));
+    set[0] = way;
+}
+
+enum btb_result btb_access(struct btb *btb, uint32_t address, uint32_t target, bool taken)
+{
+    struct btb_way *set = &btb->ways[(size_t)(address & btb->set_mask) * btb->num_ways];
+    uint32_t tag = ((address >> btb->index_bits) & btb->tag_mask) | BTB_VALID;
+
+    for (uint32_t w = 0; w < btb->num_ways; w++) {
+        if (set[w].tag != tag) continue;
+
+        // A target that is not known on either side cannot be wrong.
+        bool known = set[w].target != BRANCH_TARGET_UNKNOWN && target != BRANCH_TARGET_UNKNOWN;
+        enum btb_result result = !known || set[w].target == target ? BTB_HIT : BTB_WRONG_TARGET;
+        if (result == BTB_HIT)
+            btb->hits++;
+        else
+            btb->wrong_targets++;
+        if (taken && target != BRANCH_TARGET_UNKNOWN) set[w].target = target;
+        if (btb->policy == BTB_POLICY_LRU) btb_move_to_front(set, w, set[w]);
+        return result;
+    }
+
+    btb->misses++;
+    if (!taken) return BTB_MISS;
+    btb->taken_misses++;
+
+    // Insert the branch in place of the last way, or of an empty or random
+    // way for the random policy.
+    struct btb_way way = {.tag = tag, .target = target};
+    if (btb->policy == BTB_POLICY_RANDOM) {
+        uint32_t w = 0;
+        while (w < btb->num_ways && (set[w].tag & BTB_VALID)) w++;
+        if (w == btb->num_ways) {
+            // xorshift64
+            btb->random_state ^= btb->random_state << 13;
+            btb->random_state ^= btb->random_state >> 7;
+            btb->random_state ^= btb->random_state << 17;
+            w = btb->random_state & (btb->num_ways - 1);
+        }
+        set[w] = way;
+    } else {
+        btb_move_to_front(set, btb->num_ways - 1, way);
+    }
+    return BTB_MISS;
+}
+
+void btb_free(struct btb *btb)
+{
+    free(btb->ways);
+    free(btb);
+}
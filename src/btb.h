@@ -0,0 +1,120 @@
+//
+// This file defines a finite set-associative branch target buffer (BTB).
+//
+// The BTB is a table of sets selected by the low bits of the branch address.
+// Each set holds a fixed number of ways, and each way holds a tag made from
+// the next address bits and the target of the branch. When fewer tag bits are
+// kept than the address has, different branches can share an entry and a
+// lookup can hit with the target of another branch.
+//
+// The ways of a set are stored next to each other (8 bytes per way, so an
+// 8-way set is a single cache line) and are kept in replacement order: the
+// first way is the most recently used (LRU) or most recently inserted (FIFO)
+// and the last way is the next to be replaced. The random policy replaces a
+// random way.
+//
+
+#ifndef BTB_H
+#define BTB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Set in the tag of a valid way.
+#define BTB_VALID (1u << 31)
+// The most tag bits a way can keep.
+#define BTB_MAX_TAG_BITS 31
+
+enum btb_policy { BTB_POLICY_LRU, BTB_POLICY_FIFO, BTB_POLICY_RANDOM };
+
+struct btb_way {
+    uint32_t tag;
+    uint32_t target;
+};
+
+// The result of a BTB lookup.
+enum btb_result { BTB_MISS, BTB_HIT, BTB_WRONG_TARGET };
+
+struct btb {
+    struct btb_way *ways;
+    uint32_t set_mask;
+    uint32_t index_bits;
+    uint32_t num_ways;
+    uint32_t tag_mask;
+    enum btb_policy policy;
+    // The state of the random number generator of the random policy.
+    uint64_t random_state;
+
+    // Statistics. Every lookup is a hit, a miss or a hit with the wrong target.
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t wrong_targets;
+    // The misses on taken branches, which need a target.
+    uint64_t taken_misses;
+};
+
+//
+// Parse the name of a replacement policy.
+//
+// Arguments
+//  * name: "lru", "fifo" or "random".
+//  * policy: filled with the policy.
+//
+// Returns (bool): false if the name is not a policy.
+bool btb_policy_parse(const char *name, enum btb_policy *policy);
+
+//
+// Create an empty BTB.
+//
+// Arguments
+//  * num_entries: the total number of ways, a power of two.
+//  * num_ways: the associativity, a power of two no larger than num_entries.
+//  * policy: the replacement policy.
+//  * tag_bits: the number of tag bits per way, at most BTB_MAX_TAG_BITS.
+//
+// Returns (struct btb *): the new BTB, or NULL if it cannot be allocated.
+struct btb *btb_new(uint32_t num_entries, uint32_t num_ways, enum btb_policy policy,
+                    uint32_t tag_bits);
+
+//
+// The size of the table of a BTB in bytes.
+static inline size_t btb_size(const struct btb *btb)
+{
+    return ((size_t)btb->set_mask + 1) * btb->num_ways * sizeof(struct btb_way);
+}
+
+//
+// Find the way that a branch hits in, without changing the BTB.
+//
+// Returns (const struct btb_way *): the way, or NULL on a miss.
+static inline const struct btb_way *btb_find(const struct btb *btb, uint32_t address)
+{
+    const struct btb_way *set = &btb->ways[(size_t)(address & btb->set_mask) * btb->num_ways];
+    uint32_t tag = ((address >> btb->index_bits) & btb->tag_mask) | BTB_VALID;
+    for (uint32_t w = 0; w < btb->num_ways; w++)
+        if (set[w].tag == tag) return &set[w];
+    return NULL;
+}
+
+//
+// Look up a branch, update the statistics and then update the BTB with the
+// outcome of the branch: a hit is moved to the front of its set (LRU) and
+// has its target corrected, and a taken branch that missed is inserted.
+//
+// Arguments
+//  * btb: the BTB.
+//  * address: the branch instruction address.
+//  * target: the target of the branch, or BRANCH_TARGET_UNKNOWN. A hit is
+//    only counted as a wrong target if both it and the stored target are
+//    known.
+//  * taken: whether the branch was taken.
+//
+// Returns (enum btb_result): the result of the lookup.
+enum btb_result btb_access(struct btb *btb, uint32_t address, uint32_t target, bool taken);
+
+//
+// Free a BTB.
+void btb_free(struct btb *btb);
+
+#endif
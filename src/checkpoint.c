@@ -0,0 +1,99 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+static uint32_t get_state_regions(struct branch_predictor *branch_predictor,
+                                  struct branch_predictor_state_region *regions)
+{
+    if (!branch_predictor->state_regions) return 0;
+    return branch_predictor->state_regions(branch_predictor, regions);
+}
+
+static uint64_t align(uint64_t offset)
+{
+    return (offset + CHECKPOINT_ALIGNMENT - 1) & ~(uint64_t)(CHECKPOINT_ALIGNMENT - 1);
+}
+
+bool checkpoint_save(const char *path, struct branch_predictor *branch_predictor,
+                     const char *spec, struct checkpoint_header *header)
+{
+    struct branch_predictor_state_region regions[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+    uint32_t num_regions = get_state_regions(branch_predictor, regions);
+
+    if (strlen(spec) >= CHECKPOINT_SPEC_SIZE) return false;
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version = CHECKPOINT_VERSION;
+    header->num_regions = num_regions;
+    memset(header->spec, 0, sizeof(header->spec));
+    strcpy(header->spec, spec);
+
+    struct checkpoint_region descriptors[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+    uint64_t offset = sizeof(*header) + num_regions * sizeof(struct checkpoint_region);
+    for (uint32_t i = 0; i < num_regions; i++) {
+        offset = align(offset);
+        descriptors[i].offset = offset;
+        descriptors[i].size = regions[i].size;
+        offset += regions[i].size;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    bool ok = fwrite(header, sizeof(*header), 1, file) == 1 &&
+              fwrite(descriptors, sizeof(struct checkpoint_region), num_regions, file) ==
+                  num_regions;
+    for (uint32_t i = 0; ok && i < num_regions; i++) {
+        ok = fseek(file, descriptors[i].offset, SEEK_SET) == 0 &&
+             fwrite(regions[i].data, 1, regions[i].size, file) == regions[i].size;
+    }
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+bool checkpoint_load(const char *path, struct branch_predictor *branch_predictor,
+                     const char *spec, struct checkpoint_header *header)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*header)) {
+        close(fd);
+        return false;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    memcpy(header, map, sizeof(*header));
+    bool ok = !memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    if (ok && header->version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "Unsupported checkpoint version %u\n", header->version);
+        ok = false;
+    }
+    if (ok && strncmp(header->spec, spec, CHECKPOINT_SPEC_SIZE)) {
+        fprintf(stderr, "Checkpoint is for %.*s, not %s\n", CHECKPOINT_SPEC_SIZE, header->spec,
+                spec);
+        ok = false;
+    }
+
+    struct branch_predictor_state_region regions[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+    uint32_t num_regions = get_state_regions(branch_predictor, regions);
+    ok = ok && header->num_regions == num_regions &&
+         sizeof(*header) + num_regions * sizeof(struct checkpoint_region) <= (uint64_t)st.st_size;
+
+    for (uint32_t i = 0; ok && i < num_regions; i++) {
+        struct checkpoint_region descriptor;
+        memcpy(&descriptor, map + sizeof(*header) + i * sizeof(descriptor), sizeof(descriptor));
+        // descriptor.offset + descriptor.size could wrap around.
+        ok = descriptor.size == regions[i].size && descriptor.offset <= (uint64_t)st.st_size &&
+             descriptor.size <= (uint64_t)st.st_size - descriptor.offset;
+        if (ok) memcpy(regions[i].data, map + descriptor.offset, descriptor.size);
+    }
+
+    munmap(map, st.st_size);
+    return ok;
+}
@@ -0,0 +1,84 @@
+//
+// This file defines predictor checkpoints. A checkpoint holds the full state
+// of a branch predictor after a number of branches of a trace, so that a
+// later run can resume from that point of the trace without re-simulating the
+// branches before it.
+//
+// Checkpoint File Format
+// ======================
+//
+// The header and the region descriptors are written in the byte order of the
+// host, and the data of the regions are raw copies of the predictor state
+// (packed counter words, history registers and so on). A checkpoint can only
+// be resumed on a host with the same byte order; on another one its version
+// does not match.
+//
+//      struct checkpoint_header
+//      struct checkpoint_region[num_regions]
+//      the data of each region, each starting at a multiple of
+//      CHECKPOINT_ALIGNMENT bytes
+//
+// The regions are the state regions reported by the predictor (see
+// state_regions in branch_predictors.h). Since the regions are page-aligned
+// the file is loaded by memory-mapping it.
+//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "branch_predictors.h"
+
+#define CHECKPOINT_MAGIC "BRSIMCK"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGNMENT 4096
+#define CHECKPOINT_SPEC_SIZE 256
+
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_regions;
+    // The number of branches of the trace simulated before the checkpoint.
+    uint64_t trace_offset;
+    uint64_t prediction_count;
+    uint64_t correct_prediction_count;
+    // The predictor spec, which must match when the checkpoint is loaded.
+    char spec[CHECKPOINT_SPEC_SIZE];
+};
+
+struct checkpoint_region {
+    uint64_t offset;
+    uint64_t size;
+};
+
+//
+// Write a checkpoint of a branch predictor.
+//
+// Arguments
+//  * path: the file to write.
+//  * branch_predictor: the branch predictor to save.
+//  * spec: the spec the branch predictor was created with.
+//  * header: the trace offset and the statistics at the checkpoint. The
+//    rest of the header is filled in.
+//
+// Returns (bool): false on an I/O error.
+bool checkpoint_save(const char *path, struct branch_predictor *branch_predictor,
+                     const char *spec, struct checkpoint_header *header);
+
+//
+// Restore the state of a branch predictor from a checkpoint.
+//
+// Arguments
+//  * path: the file to read.
+//  * branch_predictor: a branch predictor created with the same spec.
+//  * spec: the spec the branch predictor was created with.
+//  * header: filled with the header of the checkpoint.
+//
+// Returns (bool): false if the checkpoint cannot be read or does not match
+// the branch predictor.
+bool checkpoint_load(const char *path, struct branch_predictor *branch_predictor,
+                     const char *spec, struct checkpoint_header *header);
+
+#endif
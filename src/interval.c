@@ -0,0 +1,123 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "interval.h"
+
+static bool ends_with(const char *s, const char *suffix)
+{
+    size_t length = strlen(s), suffix_length = strlen(suffix);
+    return length >= suffix_length && !strcmp(s + length - suffix_length, suffix);
+}
+
+// Write a predictor spec as a JSON string. Specs never contain control
+// characters, but they may contain anything else.
+static void write_json_string(FILE *file, const char *s)
+{
+    fputc('"', file);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', file);
+        fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+// Write a predictor spec as a CSV field, quoting it if it contains a comma
+// or a quote.
+static void write_csv_string(FILE *file, const char *s)
+{
+    if (!strpbrk(s, ",\"")) {
+        fputs(s, file);
+        return;
+    }
+    fputc('"', file);
+    for (; *s; s++) {
+        if (*s == '"') fputc('"', file);
+        fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+static void start_window(struct interval_writer *writer, const struct simulation *simulations,
+                         uint64_t trace_position)
+{
+    writer->window_start = trace_position;
+    for (uint32_t s = 0; s < writer->num_simulations; s++) {
+        writer->start_predictions[s] = simulations[s].prediction_count;
+        writer->start_correct[s] = simulations[s].correct_prediction_count;
+    }
+}
+
+struct interval_writer *interval_writer_open(const char *path, uint64_t window,
+                                             const struct simulation *simulations,
+                                             uint32_t num_simulations, uint64_t trace_position)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) return NULL;
+
+    struct interval_writer *writer = calloc(1, sizeof(struct interval_writer));
+    if (!writer) {
+        fclose(file);
+        return NULL;
+    }
+    writer->file = file;
+    writer->format = ends_with(path, ".json") || ends_with(path, ".jsonl")
+                         ? INTERVAL_FORMAT_JSON
+                         : INTERVAL_FORMAT_CSV;
+    writer->window = window;
+    writer->window_index = trace_position / window;
+    writer->num_simulations = num_simulations;
+    start_window(writer, simulations, trace_position);
+
+    if (writer->format == INTERVAL_FORMAT_CSV)
+        fprintf(file, "window,start,end,predictor,predictions,correct,mispredictions,rate,"
+                      "mispredictions_per_kilobranch\n");
+    fflush(file);
+    return writer;
+}
+
+bool interval_writer_flush(struct interval_writer *writer, const struct simulation *simulations,
+                           uint64_t trace_position)
+{
+    if (trace_position == writer->window_start) return true;
+
+    FILE *file = writer->file;
+    for (uint32_t s = 0; s < writer->num_simulations; s++) {
+        const struct simulation *sim = &simulations[s];
+        uint64_t predictions = sim->prediction_count - writer->start_predictions[s];
+        uint64_t correct = sim->correct_prediction_count - writer->start_correct[s];
+        uint64_t mispredictions = predictions - correct;
+        double rate = predictions ? (double)correct / predictions : 0;
+        double per_kilobranch = predictions ? 1000.0 * mispredictions / predictions : 0;
+
+        if (writer->format == INTERVAL_FORMAT_JSON) {
+            fprintf(file, "{\"window\": %" PRIu64 ", \"start\": %" PRIu64 ", \"end\": %" PRIu64
+                          ", \"predictor\": ",
+                    writer->window_index, writer->window_start, trace_position);
+            write_json_string(file, sim->name);
+            fprintf(file, ", \"predictions\": %" PRIu64 ", \"correct\": %" PRIu64
+                          ", \"mispredictions\": %" PRIu64
+                          ", \"rate\": %.8f, \"mispredictions_per_kilobranch\": %.4f}\n",
+                    predictions, correct, mispredictions, rate, per_kilobranch);
+        } else {
+            fprintf(file, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",", writer->window_index,
+                    writer->window_start, trace_position);
+            write_csv_string(file, sim->name);
+            fprintf(file, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.8f,%.4f\n", predictions,
+                    correct, mispredictions, rate, per_kilobranch);
+        }
+    }
+
+    writer->window_index++;
+    start_window(writer, simulations, trace_position);
+    return fflush(file) == 0 && !ferror(file);
+}
+
+bool interval_writer_close(struct interval_writer *writer, const struct simulation *simulations,
+                           uint64_t trace_position)
+{
+    bool ok = interval_writer_flush(writer, simulations, trace_position);
+    if (fclose(writer->file) != 0) ok = false;
+    free(writer);
+    return ok;
+}
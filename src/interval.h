@@ -0,0 +1,89 @@
+//
+// This file defines the interval statistics that are enabled with
+// --interval=N --interval-file=FILE. The trace is cut into windows of N
+// branches and, at the end of every window, one row per predictor is written
+// to the file with the predictions and mispredictions made in that window, so
+// that phases of a long trace show up and a long run can be watched while it
+// is running.
+//
+// The file is CSV unless its name ends in .json or .jsonl, in which case every
+// row is a JSON object on a line of its own (JSON Lines). Rows are flushed at
+// the end of every window, and only the counts at the start of the current
+// window are kept, so the memory used does not grow with the trace.
+//
+
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "simulation.h"
+
+enum interval_format { INTERVAL_FORMAT_CSV, INTERVAL_FORMAT_JSON };
+
+struct interval_writer {
+    FILE *file;
+    enum interval_format format;
+    // The number of branches in a window.
+    uint64_t window;
+    uint64_t window_index;
+    // The trace position of the first branch of the current window.
+    uint64_t window_start;
+    // The counts of every simulation at the start of the current window.
+    uint32_t num_simulations;
+    uint64_t start_predictions[MAX_SIMULATIONS];
+    uint64_t start_correct[MAX_SIMULATIONS];
+};
+
+//
+// Create the interval file and write its header.
+//
+// Arguments
+//  * path: the path of the file.
+//  * window: the number of branches in a window.
+//  * simulations: the simulations, with their counts at trace_position.
+//  * num_simulations: the number of simulations.
+//  * trace_position: the position in the trace of the first branch that will
+//    be simulated. Windows are aligned to multiples of the window size.
+//
+// Returns (struct interval_writer *): the writer, or NULL if the file cannot
+// be created or the writer cannot be allocated.
+struct interval_writer *interval_writer_open(const char *path, uint64_t window,
+                                             const struct simulation *simulations,
+                                             uint32_t num_simulations, uint64_t trace_position);
+
+//
+// The number of branches left in the current window.
+//
+// Arguments
+//  * writer: the writer.
+//  * trace_position: the position in the trace of the next branch.
+static inline uint64_t interval_remaining(const struct interval_writer *writer,
+                                          uint64_t trace_position)
+{
+    return writer->window - trace_position % writer->window;
+}
+
+//
+// Write the rows of the current window and start the next one.
+//
+// Arguments
+//  * writer: the writer.
+//  * simulations: the simulations.
+//  * trace_position: the position in the trace of the first branch after the
+//    window.
+//
+// Returns (bool): false on an I/O error.
+bool interval_writer_flush(struct interval_writer *writer, const struct simulation *simulations,
+                           uint64_t trace_position);
+
+//
+// Write the last (possibly partial) window and close the file.
+//
+// Returns (bool): false on an I/O error.
+bool interval_writer_close(struct interval_writer *writer, const struct simulation *simulations,
+                           uint64_t trace_position);
+
+#endif
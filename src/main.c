@@ -6,103 +6,645 @@
 // branches from the trace and then calls the active branch predictor for each
 // of the branch instructions.
 //
+// Several branch predictors can be simulated in a single pass over the trace
+// by passing a comma-separated list of names (or ALL) as the predictor.
+//
+// By default only the statistics are printed. Passing --trace-log prints the
+// parameters, the branch metadata and the prediction for every branch (or
+// for every Nth branch with --trace-log=N). Passing --profile[=N] prints the N
+// branches with the most mispredictions after the statistics.
+//
+// --checkpoint=FILE --checkpoint-at=N saves the predictor state after the
+// first N branches of the trace, and --resume=FILE restores it and continues
+// the trace from branch N. The statistics of a resumed run only cover the
+// branches after the checkpoint.
+//
+// --parallel=K splits the trace into K shards that are simulated at the same
+// time (see parallel.h). --warmup=N sets the number of branches replayed
+// before each shard, and --parallel-check also runs the serial simulation and
+// prints how far the parallel results are from it.
+//
+// --interval=N --interval-file=FILE writes the statistics of every window of
+// N branches to FILE while the trace is simulated (see interval.h).
+//
+// --sample=P only simulates a sample of the trace: in every period of P
+// branches, --sample-warmup=W branches are simulated without being counted
+// and then --sample-size=M branches are measured (see sample.h). The
+// estimated rate and its confidence interval are printed as SAMPLE lines.
+//
+// --perf measures the time (and, where the kernel allows it, the hardware
+// counters) that the simulator spends decoding the trace and simulating the
+// predictors, and prints them as PERF lines (see perf.h).
+//
+// When more than one CPU is online, the trace is decoded by a reader thread
+// while the predictors are simulated (see trace_start_reader), except in
+// parallel and sampling mode, which read the trace in their own way.
+// --no-reader decodes it on the main thread instead. --trace-format=NAME reads
+// a trace in a format that cannot be detected from its first bytes, such as
+// champsim.
+//
+// Traces in the stream and champsim formats have no branch metadata; their
+// branches are discovered as the trace is read (see trace.h).
+// --branch-targets=FILE reads the targets of the branches from a side file
+// before the trace is simulated.
+//
+// --server=PATH serves simulation jobs on a Unix domain socket with a pool of
+// --server-workers=N threads instead of simulating a trace from stdin (see
+// server.h).
+//
+// --huge-pages backs the large tables of the predictors with huge pages (see
+// arena.h).
+//
+// When several 2BG, 2BL or GSHARE configurations are simulated they are
+// advanced together with SIMD instructions (see multi_config.h). --no-simd
+// uses the scalar versions of the SIMD kernels instead.
+//
 
+#include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "branch_metadata.h"
 #include "branch_predictors.h"
+#include "checkpoint.h"
+#include "interval.h"
+#include "parallel.h"
+#include "perf.h"
+#include "profile.h"
+#include "sample.h"
+#include "server.h"
+#include "simulation.h"
+#include "trace.h"
+#include "util.h"
+
+// All output goes through a single large stdout buffer.
+#define OUTPUT_BUFFER_SIZE (4 << 20)
+
+// The default number of branches replayed before each shard in parallel mode.
+#define DEFAULT_PARALLEL_WARMUP 100000
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--quiet] [--trace-log[=N]] [--profile[=N]] [--checkpoint=FILE "
+            "--checkpoint-at=N] [--resume=FILE] [--parallel=K [--warmup=N] [--parallel-check]] "
+            "[--interval=N --interval-file=FILE] [--sample=P [--sample-warmup=W] [--sample-size=M]] "
+            "[--no-simd] [--huge-pages] [--perf] [--no-reader] [--trace-format=FORMAT] "
+            "[--branch-targets=FILE] PREDICTOR[,PREDICTOR...]|ALL < TRACE\n"
+            "       %s --server=PATH [--server-workers=N]\n"
+            "       %s --list-predictors\n",
+            program, program, program);
+}
+
+// Simulate a block of branches on every predictor, printing every Nth branch
+// and its predictions. A profiled predictor is simulated through its profile
+// one branch at a time, which tells whether its prediction was correct.
+static void trace_log_block(struct simulation *simulations, uint32_t num_simulations,
+                            const uint32_t *addresses, const uint8_t *directions,
+                            uint32_t count, uint64_t trace_log_rate)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t address = addresses[i];
+        bool log = simulations[0].prediction_count % trace_log_rate == 0;
+
+        if (log) printf("Branch at 0x%x\n", address);
+        for (uint32_t s = 0; s < num_simulations; s++) {
+            struct simulation *sim = &simulations[s];
+            struct branch_predictor *branch_predictor = sim->branch_predictor;
+            sim->prediction_count++;
+
+            enum branch_direction prediction;
+            if (sim->profile) {
+                uint64_t correct = 0;
+                branch_profile_simulate_batch(sim->profile, branch_predictor, &addresses[i],
+                                              &directions[i], 1, &correct);
+                prediction = correct ? directions[i] : !directions[i];
+            } else {
+                prediction = branch_predictor->predict(branch_predictor, address);
+                branch_predictor->handle_result(branch_predictor, address, directions[i]);
+            }
+            if (prediction == directions[i]) sim->correct_prediction_count++;
+
+            if (log && num_simulations > 1)
+                printf("  Predicted (%s): %s\n", sim->name,
+                       (prediction == TAKEN ? "TAKEN" : "NOT_TAKEN"));
+            else if (log)
+                printf("  Predicted: %s\n", (prediction == TAKEN ? "TAKEN" : "NOT_TAKEN"));
+        }
+        if (log) printf("  Actual:    %s\n", (directions[i] == TAKEN ? "TAKEN" : "NOT_TAKEN"));
+    }
+}
+
+// Save the predictor state at the current position of the trace. The
+// statistics in the checkpoint include those of the checkpoint that this run
+// was resumed from.
+static bool write_checkpoint(struct simulation *sim, const char *path, uint64_t trace_position,
+                             const struct checkpoint_header *resume_header)
+{
+    struct checkpoint_header header = {
+        .trace_offset = trace_position,
+        .prediction_count = resume_header->prediction_count + sim->prediction_count,
+        .correct_prediction_count =
+            resume_header->correct_prediction_count + sim->correct_prediction_count,
+    };
+    if (!checkpoint_save(path, sim->branch_predictor, sim->name, &header)) {
+        fprintf(stderr, "Cannot write checkpoint %s\n", path);
+        return false;
+    }
+    return true;
+}
 
 int main(int argc, char **argv)
 {
     // Parse the arguments.
-    if (argc != 2) {
+    static const struct option long_options[] = {
+        {"quiet", no_argument, NULL, 'q'},
+        {"trace-log", optional_argument, NULL, 'l'},
+        {"list-predictors", no_argument, NULL, 'p'},
+        {"profile", optional_argument, NULL, 'P'},
+        {"checkpoint", required_argument, NULL, 'c'},
+        {"checkpoint-at", required_argument, NULL, 'C'},
+        {"resume", required_argument, NULL, 'r'},
+        {"parallel", required_argument, NULL, 'j'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"parallel-check", no_argument, NULL, 'k'},
+        {"no-simd", no_argument, NULL, 'S'},
+        {"huge-pages", no_argument, NULL, 'H'},
+        {"perf", no_argument, NULL, 'f'},
+        {"interval", required_argument, NULL, 'i'},
+        {"interval-file", required_argument, NULL, 'I'},
+        {"sample", required_argument, NULL, 's'},
+        {"sample-warmup", required_argument, NULL, 'W'},
+        {"sample-size", required_argument, NULL, 'M'},
+        {"no-reader", no_argument, NULL, 'R'},
+        {"trace-format", required_argument, NULL, 'F'},
+        {"branch-targets", required_argument, NULL, 'T'},
+        {"server", required_argument, NULL, 'u'},
+        {"server-workers", required_argument, NULL, 'n'},
+        {0},
+    };
+    uint64_t trace_log_rate = 0;
+    uint32_t profile_top_n = 0;
+    const char *checkpoint_path = NULL;
+    uint64_t checkpoint_at = 0;
+    const char *resume_path = NULL;
+    uint32_t num_shards = 0;
+    uint64_t warmup = DEFAULT_PARALLEL_WARMUP;
+    bool parallel_check = false;
+    uint64_t interval = 0;
+    const char *interval_path = NULL;
+    uint64_t sample_period = 0;
+    uint64_t sample_warmup = DEFAULT_SAMPLE_WARMUP;
+    uint64_t sample_size = DEFAULT_SAMPLE_SIZE;
+    bool perf_enabled = false;
+    bool reader_enabled = true;
+    const char *trace_format = NULL;
+    const char *branch_targets_path = NULL;
+    const char *server_path = NULL;
+    long server_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        uint64_t value;
+        switch (opt) {
+        case 'q':
+            trace_log_rate = 0;
+            break;
+        case 'l':
+            trace_log_rate = 1;
+            if (optarg && (!parse_number(optarg, &trace_log_rate) || trace_log_rate == 0)) {
+                fprintf(stderr, "Invalid trace log rate %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'P':
+            value = 10;
+            if (optarg && (!parse_number(optarg, &value) || value == 0 || value > UINT32_MAX)) {
+                fprintf(stderr, "Invalid profile size %s\n", optarg);
+                return 1;
+            }
+            profile_top_n = value;
+            break;
+        case 'c':
+            checkpoint_path = optarg;
+            break;
+        case 'C':
+            if (!parse_number(optarg, &checkpoint_at)) {
+                fprintf(stderr, "Invalid checkpoint position %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            resume_path = optarg;
+            break;
+        case 'j':
+            if (!parse_number(optarg, &value) || value == 0 || value > MAX_PARALLEL_SHARDS) {
+                fprintf(stderr, "Invalid number of shards %s\n", optarg);
+                return 1;
+            }
+            num_shards = value;
+            break;
+        case 'w':
+            if (!parse_number(optarg, &warmup)) {
+                fprintf(stderr, "Invalid warmup %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'k':
+            parallel_check = true;
+            break;
+        case 'S':
+            simd_enabled = false;
+            break;
+        case 'H':
+            arena_huge_pages = true;
+            break;
+        case 'f':
+            perf_enabled = true;
+            break;
+        case 'R':
+            reader_enabled = false;
+            break;
+        case 'F':
+            trace_format = optarg;
+            break;
+        case 'T':
+            branch_targets_path = optarg;
+            break;
+        case 'u':
+            server_path = optarg;
+            break;
+        case 'n':
+            if (!parse_number(optarg, &value) || value == 0 || value > INT32_MAX) {
+                fprintf(stderr, "Invalid number of workers %s\n", optarg);
+                return 1;
+            }
+            server_workers = value;
+            break;
+        case 'i':
+            if (!parse_number(optarg, &interval) || interval == 0) {
+                fprintf(stderr, "Invalid interval %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'I':
+            interval_path = optarg;
+            break;
+        case 's':
+            if (!parse_number(optarg, &sample_period) || sample_period == 0) {
+                fprintf(stderr, "Invalid sample period %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'W':
+            if (!parse_number(optarg, &sample_warmup)) {
+                fprintf(stderr, "Invalid sample warmup %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'M':
+            if (!parse_number(optarg, &sample_size) || sample_size == 0) {
+                fprintf(stderr, "Invalid sample size %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            for (uint32_t i = 0; i < num_branch_predictor_types; i++)
+                printf("%s\n", branch_predictor_types[i].name);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (server_path) {
+        if (argc != optind) {
+            fprintf(stderr, "--server takes the predictor of each job from its request\n");
+            return 1;
+        }
+        return server_run(server_path, server_workers > 0 ? server_workers : 1) ? 0 : 1;
+    }
+    if (argc - optind != 1) {
         fprintf(stderr, "Incorrect number of arguments.\n");
+        usage(argv[0]);
+        return 1;
+    }
+    char *branch_predictor_str = argv[optind];
+    if (num_shards && (trace_log_rate || profile_top_n || checkpoint_path || resume_path)) {
+        fprintf(stderr, "--parallel cannot be used with --trace-log, --profile or checkpoints\n");
+        return 1;
+    }
+    if (!interval != !interval_path) {
+        fprintf(stderr, "--interval and --interval-file must be used together\n");
+        return 1;
+    }
+    if (num_shards && interval) {
+        fprintf(stderr, "--parallel cannot be used with --interval\n");
+        return 1;
+    }
+    if (sample_period && (num_shards || trace_log_rate || profile_top_n || checkpoint_path ||
+                          resume_path || interval)) {
+        fprintf(stderr, "--sample cannot be used with --parallel, --trace-log, --profile, "
+                        "checkpoints or --interval\n");
+        return 1;
+    }
+    if (sample_period && sample_warmup + sample_size > sample_period) {
+        fprintf(stderr, "The sample period must be at least the sample warm-up plus size\n");
+        return 1;
+    }
+    if (perf_enabled && (num_shards || sample_period)) {
+        fprintf(stderr, "--perf cannot be used with --parallel or --sample\n");
         return 1;
     }
-    char *branch_predictor_str = argv[1];
+    if (parallel_check && !num_shards) {
+        fprintf(stderr, "--parallel-check needs --parallel\n");
+        return 1;
+    }
+
+    static char output_buffer[OUTPUT_BUFFER_SIZE];
+    setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
 
     // Print out some parameter info
-    printf("Parameter Info\n");
-    printf("==============\n");
-    printf("Branch Predictor: %s\n", branch_predictor_str);
+    if (trace_log_rate) {
+        printf("Parameter Info\n");
+        printf("==============\n");
+        printf("Branch Predictor: %s\n", branch_predictor_str);
+    }
 
     // Read in the branch metadata
-    uint32_t num_branches;
-    struct branch_metadata *branch_metadatas;
-    {
-        if (scanf("%u", &num_branches) == 0) return 2;
-
-        branch_metadatas = calloc(num_branches, sizeof(struct branch_metadata));
+    struct trace *trace = trace_open_format(STDIN_FILENO, trace_format);
+    if (!trace) {
+        fprintf(stderr, "Malformed trace.\n");
+        return 2;
+    }
+    if (branch_targets_path) {
+        FILE *file = fopen(branch_targets_path, "r");
+        bool ok = file && trace_read_targets(trace, file);
+        if (file) fclose(file);
+        if (!ok) {
+            fprintf(stderr, "Malformed branch targets %s\n", branch_targets_path);
+            trace_close(trace);
+            return 2;
+        }
+    }
+    struct branch_index *branch_index = trace->branch_index;
 
-        uint32_t address, target;
+    // The branches that are discovered later are not listed.
+    if (trace_log_rate) {
         printf("\n\nBranch Metadata\n");
         printf("===============\n");
-        for (int i = 0; i < num_branches; i++) {
-            if (scanf("%x %x", &address, &target) == 0) return 3;
-            printf("Branch at 0x%x targets 0x%x\n", address, target);
-            branch_metadatas[i].address = address;
-            branch_metadatas[i].target = target;
-        }
-    }
-
-    // Instantiate the branch predictor
-    struct branch_predictor *branch_predictor;
-    if (!strcmp("ANT", branch_predictor_str)) {
-        branch_predictor = ant_branch_predictor_new(num_branches, branch_metadatas);
-    } else if (!strcmp("AT", branch_predictor_str)) {
-        branch_predictor = at_branch_predictor_new(num_branches, branch_metadatas);
-    } else if (!strcmp("BTFNT", branch_predictor_str)) {
-        branch_predictor = btfnt_branch_predictor_new(num_branches, branch_metadatas);
-    } else if (!strcmp("LTG", branch_predictor_str)) {
-        branch_predictor = ltg_branch_predictor_new(num_branches, branch_metadatas);
-    } else if (!strcmp("LTL", branch_predictor_str)) {
-        branch_predictor = ltl_branch_predictor_new(num_branches, branch_metadatas);
-    } else if (!strcmp("2BG", branch_predictor_str)) {
-        branch_predictor = tbg_branch_predictor_new(num_branches, branch_metadatas);
-    } else if (!strcmp("2BL", branch_predictor_str)) {
-        branch_predictor = tbl_branch_predictor_new(num_branches, branch_metadatas);
+        for (uint32_t i = 0; i < branch_index->num_branches; i++) {
+            printf("Branch at 0x%x targets 0x%x\n", branch_index->branches[i].address,
+                   branch_index->branches[i].target);
+        }
+    }
+
+    // Instantiate the branch predictors
+    struct simulation simulations[MAX_SIMULATIONS];
+    uint32_t num_simulations = 0;
+    if (!strcmp("ALL", branch_predictor_str)) {
+        for (uint32_t i = 0; i < num_branch_predictor_types; i++)
+            simulations[num_simulations++].name = branch_predictor_types[i].name;
     } else {
-        fprintf(stderr, "Unknown branch predictor %s", branch_predictor_str);
+        for (char *name = strtok(branch_predictor_str, ","); name; name = strtok(NULL, ",")) {
+            if (num_simulations == MAX_SIMULATIONS) {
+                fprintf(stderr, "Too many branch predictors\n");
+                return 1;
+            }
+            simulations[num_simulations++].name = name;
+        }
+    }
+    if (num_simulations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if ((checkpoint_path || resume_path) && num_simulations > 1) {
+        fprintf(stderr, "Checkpoints need a single branch predictor\n");
+        return 1;
+    }
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        struct simulation *sim = &simulations[s];
+        sim->branch_predictor = branch_predictor_new(sim->name, branch_index);
+        if (!sim->branch_predictor) {
+            fprintf(stderr, "Invalid branch predictor %s\n", sim->name);
+            return 1;
+        }
+        sim->prediction_count = 0;
+        sim->correct_prediction_count = 0;
+        sim->lockstep = false;
+        sim->profile =
+            profile_top_n ? branch_profile_new(sim->branch_predictor, branch_index) : NULL;
+        if (profile_top_n && !sim->profile) {
+            fprintf(stderr, "Cannot allocate the profile of %s\n", sim->name);
+            return 1;
+        }
+    }
+
+    // Restore the predictor from a checkpoint and continue the trace from
+    // where the checkpoint was taken.
+    uint64_t trace_position = 0;
+    struct checkpoint_header resume_header = {0};
+    if (resume_path) {
+        if (!checkpoint_load(resume_path, simulations[0].branch_predictor, simulations[0].name,
+                             &resume_header)) {
+            fprintf(stderr, "Cannot load checkpoint %s\n", resume_path);
+            return 4;
+        }
+        trace_position = trace_skip(trace, resume_header.trace_offset);
+        if (trace->error) {
+            fprintf(stderr, "Malformed trace: %s\n", trace->error);
+            return 2;
+        }
+        if (trace_position != resume_header.trace_offset) {
+            fprintf(stderr, "The trace is shorter than the checkpoint offset\n");
+            return 4;
+        }
+    }
+
+    // Decode the rest of the trace on a thread of its own. With a single CPU
+    // the two threads would only take turns.
+    if (reader_enabled && !num_shards && !sample_period && sysconf(_SC_NPROCESSORS_ONLN) > 1)
+        trace_start_reader(trace);
+
+    // In parallel mode the whole trace is simulated by the shard threads.
+    uint64_t serial_correct[MAX_SIMULATIONS];
+    if (num_shards) {
+        if (!parallel_simulate(trace, simulations, num_simulations, num_shards, warmup,
+                               parallel_check ? serial_correct : NULL))
+            return 1;
+    }
+
+    struct sample_stats sample_stats[MAX_SIMULATIONS];
+    struct multi_config *multi_config =
+        num_shards ? NULL : simulations_multi_config_new(simulations, num_simulations);
+    if (sample_period)
+        sample_simulate(trace, simulations, num_simulations, multi_config, sample_period,
+                        sample_warmup, sample_size, sample_stats);
+
+    // Read the input and call the branch predictors for each branch. Each
+    // block of the trace is decoded once and then run through every
+    // predictor.
+    // Configurations of the same predictor family are advanced together by a
+    // multi-configuration engine.
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+    uint32_t count;
+    struct interval_writer *interval_writer = NULL;
+    if (interval) {
+        interval_writer = interval_writer_open(interval_path, interval, simulations,
+                                               num_simulations, trace_position);
+        if (!interval_writer) {
+            fprintf(stderr, "Cannot write %s\n", interval_path);
+            return 1;
+        }
+    }
+    struct perf perf;
+    uint64_t perf_start_position = trace_position;
+    if (perf_enabled) perf_start(&perf);
+    while (!num_shards && !sample_period) {
+        // Blocks end at window boundaries, where the window is written out.
+        uint32_t max = TRACE_BLOCK_RECORDS;
+        if (interval_writer) {
+            if (trace_position % interval == 0 &&
+                !interval_writer_flush(interval_writer, simulations, trace_position)) {
+                fprintf(stderr, "Cannot write %s\n", interval_path);
+                return 1;
+            }
+            if (interval_remaining(interval_writer, trace_position) < max)
+                max = interval_remaining(interval_writer, trace_position);
+        }
+
+        // Stop at the checkpoint, if there is one.
+        if (checkpoint_path && trace_position <= checkpoint_at) {
+            if (checkpoint_at - trace_position == 0) {
+                if (!write_checkpoint(&simulations[0], checkpoint_path, trace_position,
+                                      &resume_header))
+                    return 4;
+            } else if (checkpoint_at - trace_position < max) {
+                max = checkpoint_at - trace_position;
+            }
+        }
+
+        if (perf_enabled && (interval_writer || checkpoint_path))
+            perf_mark(&perf, PERF_PHASE_OTHER);
+
+        count = trace->next_block(trace, addresses, directions, max);
+        if (perf_enabled) perf_mark(&perf, PERF_PHASE_DECODE);
+        if (count == 0) break;
+
+        if (trace_log_rate) {
+            trace_log_block(simulations, num_simulations, addresses, directions, count,
+                            trace_log_rate);
+        } else {
+            simulate_blocks(simulations, num_simulations, multi_config, addresses, directions,
+                            count);
+        }
+        if (perf_enabled) perf_mark(&perf, PERF_PHASE_SIMULATE);
+        trace_position += count;
+    }
+
+    // A malformed record ends the trace early, so the statistics would only
+    // cover part of it.
+    if (trace->error) {
+        fprintf(stderr, "Malformed trace: %s\n", trace->error);
+        return 2;
+    }
+
+    if (interval_writer &&
+        !interval_writer_close(interval_writer, simulations, trace_position)) {
+        fprintf(stderr, "Cannot write %s\n", interval_path);
         return 1;
     }
 
-    // Read the input and call the cache system mem_access function.
-    uint32_t prediction_count = 0;
-    uint32_t correct_prediction_count = 0;
-    uint32_t address = 0;
-    char branch_result[32];
-    while (scanf("%x %s\n", &address, branch_result) >= 0) {
-        prediction_count++;
+    if (checkpoint_path && trace_position < checkpoint_at) {
+        fprintf(stderr, "The trace ended before branch %" PRIu64 "\n", checkpoint_at);
+        return 4;
+    }
+
+    // Print the statistics. When more than one predictor is simulated, each
+    // line is prefixed with the name of its predictor.
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        struct simulation *sim = &simulations[s];
+        const char *prefix = num_simulations > 1 ? sim->name : "";
+        const char *separator = num_simulations > 1 ? " " : "";
 
-        printf("Branch at 0x%x\n", address);
-        enum branch_direction prediction = branch_predictor->predict(branch_predictor, address);
-        printf("  Predicted: %s\n", (prediction == TAKEN ? "TAKEN" : "NOT_TAKEN"));
+        if (num_simulations > 1)
+            printf("\n\nStatistics (%s)\n", sim->name);
+        else
+            printf("\n\nStatistics\n");
+        printf("==========\n");
+        printf("%s%sOUTPUT PREDICTIONS %" PRIu64 "\n", prefix, separator, sim->prediction_count);
+        printf("%s%sOUTPUT CORRECT %" PRIu64 "\n", prefix, separator,
+               sim->correct_prediction_count);
+        printf("%s%sOUTPUT INCORRECT %" PRIu64 "\n", prefix, separator,
+               sim->prediction_count - sim->correct_prediction_count);
+        printf("%s%sOUTPUT BRANCH PREDICTION RATE %.8f\n", prefix, separator,
+               sim->prediction_count
+                   ? (double)sim->correct_prediction_count / sim->prediction_count
+                   : 0);
 
-        bool actual_result = !strcmp(branch_result, "TAKEN");
-        printf("  Actual:    %s\n", (actual_result ? "TAKEN" : "NOT_TAKEN"));
+        struct branch_predictor *branch_predictor = sim->branch_predictor;
+        struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+        uint32_t num_counters =
+            branch_predictor->counters ? branch_predictor->counters(branch_predictor, counters)
+                                       : 0;
+        for (uint32_t c = 0; c < num_counters; c++)
+            printf("%s%sOUTPUT %s %" PRIu64 "\n", prefix, separator, counters[c].name,
+                   *counters[c].value);
 
-        if ((actual_result && prediction == TAKEN) || (!actual_result && prediction == NOT_TAKEN))
-            correct_prediction_count++;
+        if (sample_period) {
+            printf("%s%sSAMPLE PERIOD %" PRIu64 " WARMUP %" PRIu64 " SIZE %" PRIu64 "\n", prefix,
+                   separator, sample_period, sample_warmup, sample_size);
+            printf("%s%sSAMPLES %" PRIu64 "\n", prefix, separator,
+                   sample_stats[s].num_samples);
+            printf("%s%sSAMPLE ESTIMATED RATE %.8f\n", prefix, separator, sample_stats[s].mean);
+            double low, high;
+            if (sample_confidence_interval(&sample_stats[s], &low, &high))
+                printf("%s%sSAMPLE CONFIDENCE INTERVAL 95%% %.8f %.8f\n", prefix, separator,
+                       low, high);
+        }
+
+        if (parallel_check) {
+            int64_t error = (int64_t)(sim->correct_prediction_count - serial_correct[s]);
+            printf("%s%sPARALLEL SHARDS %u WARMUP %" PRIu64 "\n", prefix, separator, num_shards,
+                   warmup);
+            printf("%s%sPARALLEL SERIAL CORRECT %" PRIu64 "\n", prefix, separator,
+                   serial_correct[s]);
+            printf("%s%sPARALLEL ERROR %" PRId64 "\n", prefix, separator, error);
+            printf("%s%sPARALLEL RATE ERROR %.8f\n", prefix, separator,
+                   sim->prediction_count ? (double)error / sim->prediction_count : 0);
+        }
 
-        branch_predictor->handle_result(branch_predictor, address, actual_result);
+        if (sim->profile) {
+            if (num_simulations > 1)
+                printf("\n\nWorst Branches (%s)\n", sim->name);
+            else
+                printf("\n\nWorst Branches\n");
+            printf("==============\n");
+            char profile_prefix[300];
+            snprintf(profile_prefix, sizeof(profile_prefix), "%s%s", prefix, separator);
+            branch_profile_print(sim->profile, profile_prefix, profile_top_n);
+        }
     }
 
-    // Print the statistics
-    printf("\n\nStatistics\n");
-    printf("==========\n");
-    printf("OUTPUT PREDICTIONS %d\n", prediction_count);
-    printf("OUTPUT CORRECT %d\n", correct_prediction_count);
-    printf("OUTPUT INCORRECT %d\n", prediction_count - correct_prediction_count);
-    printf("OUTPUT BRANCH PREDICTION RATE %.8f\n",
-           (double)correct_prediction_count / prediction_count);
+    if (perf_enabled) {
+        printf("\n\nSimulator Performance\n");
+        printf("=====================\n");
+        perf_finish(&perf, trace_position - perf_start_position);
+    }
 
     // Clean everything up.
-    branch_predictor->cleanup(branch_predictor);
-    free(branch_predictor);
+    if (multi_config) multi_config_free(multi_config);
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        if (simulations[s].profile) branch_profile_free(simulations[s].profile);
+        simulations[s].branch_predictor->cleanup(simulations[s].branch_predictor);
+        free(simulations[s].branch_predictor);
+    }
+    trace_close(trace);
 
     return 0;
 }
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MULTI_CONFIG_X86 1
+#endif
+
+#include "counter_table.h"
+#include "multi_config.h"
+
+// Advance each group of lanes over the whole block, one lane after the other
+// for each branch.
+static void multi_config_simulate_block_scalar(struct multi_config *multi_config,
+                                               const uint32_t *addresses,
+                                               const uint8_t *directions, uint32_t n,
+                                               uint64_t *correct)
+{
+    for (uint32_t g = 0; g < multi_config->num_configs; g += MULTI_CONFIG_GROUP_LANES) {
+        uint32_t end = g + MULTI_CONFIG_GROUP_LANES < multi_config->num_configs
+                           ? g + MULTI_CONFIG_GROUP_LANES
+                           : multi_config->num_configs;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t address = addresses[i];
+            bool taken = directions[i];
+            for (uint32_t l = g; l < end; l++) {
+                uint64_t *pht = (uint64_t *)(uintptr_t)multi_config->pht[l];
+                uint32_t *history_register =
+                    (uint32_t *)(uintptr_t)multi_config->history_register[l];
+                uint32_t hr = address & multi_config->history_register_mask[l];
+                uint32_t index =
+                    (((hr << multi_config->history_bits[l]) | history_register[hr]) ^
+                     (address & multi_config->pht_address_mask[l])) &
+                    multi_config->pht_mask[l];
+
+                correct[l] += (counter2_get(pht, index) >> 1) == taken;
+                counter2_update(pht, index, taken);
+                history_register[hr] =
+                    ((history_register[hr] << 1) | taken) & multi_config->history_mask[l];
+            }
+        }
+    }
+}
+
+#ifdef MULTI_CONFIG_X86
+// Advance each group of four lanes over the whole block. The geometry of the
+// group stays in registers for the block. The table addresses in the lanes are
+// absolute, so the gathers use a null base.
+__attribute__((target("avx2"))) static void multi_config_simulate_block_avx2(
+    struct multi_config *multi_config, const uint32_t *addresses, const uint8_t *directions,
+    uint32_t n, uint64_t *correct)
+{
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i three = _mm256_set1_epi64x(3);
+    const __m256i slot_mask = _mm256_set1_epi64x(31);
+
+    for (uint32_t g = 0; g < multi_config->num_lanes; g += MULTI_CONFIG_GROUP_LANES) {
+        __m256i pht = _mm256_loadu_si256((const __m256i *)&multi_config->pht[g]);
+        __m256i history_register =
+            _mm256_loadu_si256((const __m256i *)&multi_config->history_register[g]);
+        __m128i pht_mask = _mm_loadu_si128((const __m128i *)&multi_config->pht_mask[g]);
+        __m128i pht_address_mask =
+            _mm_loadu_si128((const __m128i *)&multi_config->pht_address_mask[g]);
+        __m128i history_register_mask =
+            _mm_loadu_si128((const __m128i *)&multi_config->history_register_mask[g]);
+        __m128i history_bits = _mm_loadu_si128((const __m128i *)&multi_config->history_bits[g]);
+        __m128i history_mask = _mm_loadu_si128((const __m128i *)&multi_config->history_mask[g]);
+        __m256i count = _mm256_setzero_si256();
+
+        for (uint32_t i = 0; i < n; i++) {
+            __m128i taken32 = _mm_set1_epi32(directions[i]);
+            __m256i taken = _mm256_set1_epi64x(directions[i]);
+
+            // Fetch the history register of each lane and compute the PHT index.
+            __m128i address = _mm_set1_epi32(addresses[i]);
+            __m128i hr = _mm_and_si128(address, history_register_mask);
+            __m256i history_address = _mm256_add_epi64(
+                history_register, _mm256_slli_epi64(_mm256_cvtepu32_epi64(hr), 2));
+            __m128i history = _mm256_i64gather_epi32(NULL, history_address, 1);
+            __m128i index32 = _mm_or_si128(_mm_sllv_epi32(hr, history_bits), history);
+            index32 = _mm_and_si128(
+                _mm_xor_si128(index32, _mm_and_si128(address, pht_address_mask)), pht_mask);
+
+            // Fetch the word that holds each counter and extract the counter.
+            __m256i index = _mm256_cvtepu32_epi64(index32);
+            __m256i word_address =
+                _mm256_add_epi64(pht, _mm256_slli_epi64(_mm256_srli_epi64(index, 5), 3));
+            __m256i word = _mm256_i64gather_epi64(NULL, word_address, 1);
+            __m256i shift = _mm256_slli_epi64(_mm256_and_si256(index, slot_mask), 1);
+            __m256i counter = _mm256_and_si256(_mm256_srlv_epi64(word, shift), three);
+
+            // Counters 2 and 3 predict taken. A matching lane compares to -1.
+            count = _mm256_sub_epi64(
+                count, _mm256_cmpeq_epi64(_mm256_srli_epi64(counter, 1), taken));
+
+            // Saturate the counter towards the direction.
+            __m256i up = _mm256_andnot_si256(_mm256_cmpeq_epi64(counter, three), one);
+            __m256i down =
+                _mm256_andnot_si256(_mm256_cmpeq_epi64(counter, _mm256_setzero_si256()), one);
+            __m256i updated = _mm256_blendv_epi8(_mm256_sub_epi64(counter, down),
+                                                 _mm256_add_epi64(counter, up),
+                                                 _mm256_sub_epi64(_mm256_setzero_si256(), taken));
+            word = _mm256_or_si256(_mm256_andnot_si256(_mm256_sllv_epi64(three, shift), word),
+                                   _mm256_sllv_epi64(updated, shift));
+            history = _mm_and_si128(_mm_or_si128(_mm_slli_epi32(history, 1), taken32),
+                                    history_mask);
+
+            // Store the updated words and history registers lane by lane.
+            uint64_t word_addresses[MULTI_CONFIG_GROUP_LANES];
+            uint64_t words[MULTI_CONFIG_GROUP_LANES];
+            uint64_t history_addresses[MULTI_CONFIG_GROUP_LANES];
+            uint32_t histories[MULTI_CONFIG_GROUP_LANES];
+            _mm256_storeu_si256((__m256i *)word_addresses, word_address);
+            _mm256_storeu_si256((__m256i *)words, word);
+            _mm256_storeu_si256((__m256i *)history_addresses, history_address);
+            _mm_storeu_si128((__m128i *)histories, history);
+            for (uint32_t l = 0; l < MULTI_CONFIG_GROUP_LANES; l++) {
+                *(uint64_t *)(uintptr_t)word_addresses[l] = words[l];
+                *(uint32_t *)(uintptr_t)history_addresses[l] = histories[l];
+            }
+        }
+
+        uint64_t counts[MULTI_CONFIG_GROUP_LANES];
+        _mm256_storeu_si256((__m256i *)counts, count);
+        for (uint32_t l = 0; l < MULTI_CONFIG_GROUP_LANES; l++)
+            if (g + l < multi_config->num_configs) correct[g + l] += counts[l];
+    }
+}
+#endif
+
+struct multi_config *multi_config_new(struct branch_predictor **branch_predictors,
+                                      uint32_t num_configs)
+{
+    struct multi_config *multi_config = calloc(1, sizeof(struct multi_config));
+    if (!multi_config) return NULL;
+    uint32_t num_lanes = (num_configs + MULTI_CONFIG_GROUP_LANES - 1) /
+                         MULTI_CONFIG_GROUP_LANES * MULTI_CONFIG_GROUP_LANES;
+    multi_config->num_configs = num_configs;
+    multi_config->num_lanes = num_lanes;
+    multi_config->pht = calloc(num_lanes, sizeof(uint64_t));
+    multi_config->history_register = calloc(num_lanes, sizeof(uint64_t));
+    multi_config->pht_mask = calloc(num_lanes, sizeof(uint32_t));
+    multi_config->pht_address_mask = calloc(num_lanes, sizeof(uint32_t));
+    multi_config->history_register_mask = calloc(num_lanes, sizeof(uint32_t));
+    multi_config->history_bits = calloc(num_lanes, sizeof(uint32_t));
+    multi_config->history_mask = calloc(num_lanes, sizeof(uint32_t));
+    if (!multi_config->pht || !multi_config->history_register || !multi_config->pht_mask ||
+        !multi_config->pht_address_mask || !multi_config->history_register_mask ||
+        !multi_config->history_bits || !multi_config->history_mask) {
+        multi_config_free(multi_config);
+        return NULL;
+    }
+
+    for (uint32_t l = 0; l < num_lanes; l++) {
+        if (l >= num_configs) {
+            multi_config->pht[l] = (uintptr_t)&multi_config->scratch_pht;
+            multi_config->history_register[l] =
+                (uintptr_t)&multi_config->scratch_history_register;
+            continue;
+        }
+        struct branch_predictor *branch_predictor = branch_predictors[l];
+        multi_config->pht[l] = (uintptr_t)branch_predictor->pht;
+        multi_config->history_register[l] = (uintptr_t)branch_predictor->history_register;
+        multi_config->pht_mask[l] = branch_predictor->pht_mask;
+        multi_config->pht_address_mask[l] = branch_predictor->pht_address_mask;
+        multi_config->history_register_mask[l] = branch_predictor->history_register_mask;
+        multi_config->history_bits[l] = branch_predictor->history_bits;
+        multi_config->history_mask[l] = branch_predictor->history_mask;
+    }
+
+    multi_config->simulate_block = &multi_config_simulate_block_scalar;
+#ifdef MULTI_CONFIG_X86
+    if (simd_has_avx2())
+        multi_config->simulate_block = &multi_config_simulate_block_avx2;
+#endif
+    return multi_config;
+}
+
+void multi_config_free(struct multi_config *multi_config)
+{
+    free(multi_config->pht);
+    free(multi_config->history_register);
+    free(multi_config->pht_mask);
+    free(multi_config->pht_address_mask);
+    free(multi_config->history_register_mask);
+    free(multi_config->history_bits);
+    free(multi_config->history_mask);
+    free(multi_config);
+}
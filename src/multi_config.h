@@ -0,0 +1,100 @@
+//
+// This file defines the multi-configuration engine, which advances several
+// predictors with 2-bit counters (2BG, 2BL and GSHARE with any geometry)
+// together over each branch of a block, instead of running each of them over
+// the whole block in turn.
+//
+// 2BG is handled as a 2BL with a single history register, and GSHARE as a 2BG
+// that XORs the address into the index, so every configuration runs the same
+// steps for each branch:
+//
+//      hr = address & history_register_mask
+//      index = ((hr << history_bits) | history_register[hr]) ^
+//              (address & pht_address_mask)
+//      index &= pht_mask
+//      predict with, then saturate, the counter at index
+//      shift the branch direction into history_register[hr]
+//
+// The configurations are split into groups of four lanes. Where the CPU
+// supports AVX2, each group is advanced with vector instructions: the history
+// registers and the PHT words are fetched with gathers and the prediction and
+// the saturating update are computed for all four lanes at once. AVX2 has no
+// scatter, so the updated words are stored back one lane at a time. On other
+// CPUs (or with --no-simd) a scalar loop does the same work.
+//
+// The engine keeps no state of its own: it reads and writes the tables of the
+// predictors it was created with, so their checkpoints and cleanup are not
+// affected.
+//
+
+#ifndef MULTI_CONFIG_H
+#define MULTI_CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "branch_predictors.h"
+
+// The number of configurations advanced by one group of SIMD lanes.
+#define MULTI_CONFIG_GROUP_LANES 4
+
+struct multi_config {
+    // Simulate a block of branches on every configuration.
+    //
+    // Arguments
+    //  * multi_config: the engine.
+    //  * addresses: the branch instruction addresses.
+    //  * directions: the actual direction that each branch went.
+    //  * n: the number of branches.
+    //  * correct: correct[i] is incremented by the number of correct
+    //    predictions of configuration i.
+    void (*simulate_block)(struct multi_config *multi_config, const uint32_t *addresses,
+                           const uint8_t *directions, uint32_t n, uint64_t *correct);
+
+    uint32_t num_configs;
+    // num_configs rounded up to a whole number of groups. The lanes past
+    // num_configs point at the scratch tables.
+    uint32_t num_lanes;
+
+    // The geometry of each lane. The table addresses are stored as integers so
+    // that they can be loaded into vector registers.
+    uint64_t *pht;
+    uint64_t *history_register;
+    uint32_t *pht_mask;
+    uint32_t *pht_address_mask;
+    uint32_t *history_register_mask;
+    uint32_t *history_bits;
+    uint32_t *history_mask;
+
+    uint64_t scratch_pht;
+    uint32_t scratch_history_register;
+};
+
+//
+// Whether a branch predictor can be simulated by the engine.
+//
+// Arguments
+//  * branch_predictor: the branch predictor.
+static inline bool multi_config_supports(const struct branch_predictor *branch_predictor)
+{
+    return branch_predictor->counter_bits == 2 && !branch_predictor->delay;
+}
+
+//
+// Create an engine for a set of branch predictors.
+//
+// Arguments
+//  * branch_predictors: the branch predictors, which must all be supported
+//    (see multi_config_supports).
+//  * num_configs: the number of branch predictors.
+//
+// Returns (struct multi_config *): the new engine, or NULL if it cannot be
+// allocated.
+struct multi_config *multi_config_new(struct branch_predictor **branch_predictors,
+                                      uint32_t num_configs);
+
+//
+// Free an engine. The branch predictors are not freed.
+void multi_config_free(struct multi_config *multi_config);
+
+#endif
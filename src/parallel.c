@@ -0,0 +1,238 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parallel.h"
+
+// The records of the trace, shared by all of the threads.
+struct parallel_records {
+    // The trace, if the threads read it through their own cursors.
+    const struct trace *trace;
+    // Otherwise, the whole trace decoded into memory.
+    uint32_t *addresses;
+    uint8_t *directions;
+    uint64_t num_records;
+};
+
+struct parallel_worker {
+    pthread_t thread;
+    const struct parallel_records *records;
+    // The worker replays [warmup_start, start) and counts [start, end).
+    uint64_t warmup_start;
+    uint64_t start;
+    uint64_t end;
+    struct simulation *simulations;
+    uint32_t num_simulations;
+    struct multi_config *multi_config;
+    // Whether the worker created its own predictors.
+    bool owns_simulations;
+};
+
+// Decode a whole trace into memory. The records decoded so far are left in
+// records, which the caller frees, also when this fails.
+//
+// Returns (bool): false if the records do not fit in memory.
+static bool load_records(struct trace *trace, struct parallel_records *records)
+{
+    uint64_t capacity = 1 << 20;
+    records->addresses = malloc(capacity * sizeof(uint32_t));
+    records->directions = malloc(capacity);
+    if (!records->addresses || !records->directions) return false;
+    for (;;) {
+        uint64_t n = records->num_records;
+        if (capacity - n < TRACE_BLOCK_RECORDS) {
+            capacity *= 2;
+            uint32_t *addresses = realloc(records->addresses, capacity * sizeof(uint32_t));
+            if (!addresses) return false;
+            records->addresses = addresses;
+            uint8_t *directions = realloc(records->directions, capacity);
+            if (!directions) return false;
+            records->directions = directions;
+        }
+        uint32_t count = trace->next_block(trace, records->addresses + n,
+                                           records->directions + n, TRACE_BLOCK_RECORDS);
+        if (count == 0) break;
+        records->num_records += count;
+    }
+    return true;
+}
+
+// Simulate the branches [start, end) of the trace on every predictor of a
+// worker.
+static void worker_run(struct parallel_worker *worker, uint64_t start, uint64_t end)
+{
+    const struct parallel_records *records = worker->records;
+    if (!records->trace) {
+        while (start < end) {
+            uint32_t count = end - start < TRACE_BLOCK_RECORDS ? end - start : TRACE_BLOCK_RECORDS;
+            simulate_blocks(worker->simulations, worker->num_simulations,
+                            worker->multi_config, records->addresses + start,
+                            records->directions + start, count);
+            start += count;
+        }
+        return;
+    }
+
+    struct trace cursor;
+    trace_cursor(records->trace, &cursor);
+    trace_skip(&cursor, start);
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+    while (start < end) {
+        uint32_t max = end - start < TRACE_BLOCK_RECORDS ? end - start : TRACE_BLOCK_RECORDS;
+        uint32_t count = cursor.next_block(&cursor, addresses, directions, max);
+        if (count == 0) break;
+        simulate_blocks(worker->simulations, worker->num_simulations, worker->multi_config,
+                        addresses, directions, count);
+        start += count;
+    }
+}
+
+static uint32_t get_counters(struct branch_predictor *branch_predictor,
+                             struct branch_predictor_counter *counters)
+{
+    if (!branch_predictor->counters) return 0;
+    return branch_predictor->counters(branch_predictor, counters);
+}
+
+static void *worker_main(void *arg)
+{
+    struct parallel_worker *worker = arg;
+    worker->multi_config =
+        simulations_multi_config_new(worker->simulations, worker->num_simulations);
+    if (worker->warmup_start < worker->start) {
+        worker_run(worker, worker->warmup_start, worker->start);
+        for (uint32_t s = 0; s < worker->num_simulations; s++) {
+            struct simulation *sim = &worker->simulations[s];
+            sim->prediction_count = 0;
+            sim->correct_prediction_count = 0;
+
+            struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+            uint32_t num_counters = get_counters(sim->branch_predictor, counters);
+            for (uint32_t c = 0; c < num_counters; c++) *counters[c].value = 0;
+        }
+    }
+    worker_run(worker, worker->start, worker->end);
+    if (worker->multi_config) multi_config_free(worker->multi_config);
+    return NULL;
+}
+
+// Give a worker its own instance of every predictor.
+static bool worker_new_simulations(struct parallel_worker *worker, const struct trace *trace,
+                                   const struct simulation *simulations,
+                                   uint32_t num_simulations)
+{
+    worker->simulations = calloc(num_simulations, sizeof(struct simulation));
+    if (!worker->simulations) return false;
+    worker->num_simulations = num_simulations;
+    worker->owns_simulations = true;
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        struct simulation *sim = &worker->simulations[s];
+        sim->name = simulations[s].name;
+        // the predictors have not been used yet, so a copy is a fresh one.
+        sim->branch_predictor = branch_predictor_clone(simulations[s].branch_predictor);
+        if (!sim->branch_predictor)
+            sim->branch_predictor = branch_predictor_new(sim->name, trace->branch_index);
+        if (!sim->branch_predictor) return false;
+    }
+    return true;
+}
+
+static void worker_free_simulations(struct parallel_worker *worker)
+{
+    if (!worker->owns_simulations) return;
+    for (uint32_t s = 0; s < worker->num_simulations; s++) {
+        struct branch_predictor *branch_predictor = worker->simulations[s].branch_predictor;
+        if (!branch_predictor) continue;
+        branch_predictor->cleanup(branch_predictor);
+        free(branch_predictor);
+    }
+    free(worker->simulations);
+}
+
+bool parallel_simulate(struct trace *trace, struct simulation *simulations,
+                       uint32_t num_simulations, uint32_t num_shards, uint64_t warmup,
+                       uint64_t *serial_correct)
+{
+    struct parallel_records records = {0};
+    struct trace cursor;
+    if (trace->format == TRACE_FORMAT_BINARY && trace_cursor(trace, &cursor)) {
+        records.trace = trace;
+        records.num_records = trace->num_records;
+    } else if (!load_records(trace, &records)) {
+        fprintf(stderr, "Cannot allocate the records of the trace after %" PRIu64 " records\n",
+                records.num_records);
+        free(records.addresses);
+        free(records.directions);
+        return false;
+    }
+
+    // One worker per shard, plus one for the serial run.
+    uint32_t num_workers = num_shards + (serial_correct != NULL);
+    struct parallel_worker *workers = calloc(num_workers, sizeof(struct parallel_worker));
+    if (!workers) {
+        free(records.addresses);
+        free(records.directions);
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i < num_workers; i++) {
+        struct parallel_worker *worker = &workers[i];
+        worker->records = &records;
+        if (i < num_shards) {
+            worker->start = records.num_records * i / num_shards;
+            worker->end = records.num_records * (i + 1) / num_shards;
+            worker->warmup_start = worker->start > warmup ? worker->start - warmup : 0;
+        } else {
+            worker->start = 0;
+            worker->end = records.num_records;
+        }
+
+        if (i == 0) {
+            worker->simulations = simulations;
+            worker->num_simulations = num_simulations;
+        } else if (!worker_new_simulations(worker, trace, simulations, num_simulations)) {
+            ok = false;
+            break;
+        }
+    }
+
+    uint32_t num_started = 0;
+    for (; ok && num_started < num_workers; num_started++) {
+        struct parallel_worker *worker = &workers[num_started];
+        if (pthread_create(&worker->thread, NULL, &worker_main, worker) != 0) {
+            fprintf(stderr, "Cannot start thread %u\n", num_started);
+            ok = false;
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < num_started; i++) pthread_join(workers[i].thread, NULL);
+
+    // Merge the statistics of the shards.
+    for (uint32_t i = 1; ok && i < num_shards; i++) {
+        for (uint32_t s = 0; s < num_simulations; s++) {
+            struct simulation *shard = &workers[i].simulations[s];
+            simulations[s].prediction_count += shard->prediction_count;
+            simulations[s].correct_prediction_count += shard->correct_prediction_count;
+
+            struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+            struct branch_predictor_counter shard_counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+            uint32_t num_counters = get_counters(simulations[s].branch_predictor, counters);
+            get_counters(shard->branch_predictor, shard_counters);
+            for (uint32_t c = 0; c < num_counters; c++)
+                *counters[c].value += *shard_counters[c].value;
+        }
+    }
+    if (ok && serial_correct) {
+        for (uint32_t s = 0; s < num_simulations; s++)
+            serial_correct[s] = workers[num_shards].simulations[s].correct_prediction_count;
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) worker_free_simulations(&workers[i]);
+    free(workers);
+    free(records.addresses);
+    free(records.directions);
+    return ok;
+}
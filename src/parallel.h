@@ -0,0 +1,52 @@
+//
+// This file defines the parallel mode that is enabled with --parallel=K.
+//
+// The trace is split into K shards of consecutive branches and each shard is
+// simulated by its own thread with its own instance of every predictor. A
+// fresh predictor has not seen the branches before its shard, so each thread
+// first replays a warm-up window of the branches just before its shard
+// without counting them. The statistics of the shards are then added up.
+//
+// The stateless predictors (ANT, AT and BTFNT) give exactly the serial
+// results. The others start each shard from a state that is only as good as
+// the warm-up window, so their results differ slightly from a serial run. The
+// difference can be measured by also running the serial simulation.
+//
+// Memory-mapped binary traces are read by every thread directly from the
+// mapping. Other traces are first decoded into memory.
+//
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "simulation.h"
+#include "trace.h"
+
+// The maximum number of shards.
+#define MAX_PARALLEL_SHARDS 1024
+
+//
+// Simulate a whole trace in parallel shards.
+//
+// Arguments
+//  * trace: a trace that has not been read from yet.
+//  * simulations: the predictors to simulate. Their predictors are used for
+//    the first shard and the statistics of all the shards are added to them.
+//  * num_simulations: the number of simulations.
+//  * num_shards: the number of shards (and threads).
+//  * warmup: the number of branches before each shard that are replayed
+//    without being counted.
+//  * serial_correct: if not NULL, filled with the number of correct
+//    predictions of each predictor in a serial run of the whole trace. The
+//    serial run is done by another thread at the same time as the shards.
+//
+// Returns (bool): false if the trace does not fit in memory, or the workers
+// cannot be allocated or started.
+bool parallel_simulate(struct trace *trace, struct simulation *simulations,
+                       uint32_t num_simulations, uint32_t num_shards, uint64_t warmup,
+                       uint64_t *serial_correct);
+
+#endif
@@ -0,0 +1,104 @@
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+static const struct {
+    uint64_t config;
+    const char *name;
+} perf_counters[PERF_NUM_COUNTERS] = {
+    [PERF_CYCLES] = {PERF_COUNT_HW_CPU_CYCLES, "CYCLES"},
+    [PERF_INSTRUCTIONS] = {PERF_COUNT_HW_INSTRUCTIONS, "INSTRUCTIONS"},
+    [PERF_CACHE_MISSES] = {PERF_COUNT_HW_CACHE_MISSES, "CACHE MISSES"},
+    [PERF_BRANCH_MISSES] = {PERF_COUNT_HW_BRANCH_MISSES, "BRANCH MISSES"},
+};
+
+static const char *perf_phase_names[PERF_NUM_PHASES] = {
+    [PERF_PHASE_DECODE] = "DECODE",
+    [PERF_PHASE_SIMULATE] = "SIMULATE",
+    [PERF_PHASE_OTHER] = "OTHER",
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int open_counter(uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// Read the current value of every available counter.
+static void read_counters(struct perf *perf, uint64_t *values)
+{
+    uint64_t buffer[1 + PERF_NUM_COUNTERS];
+    if (!perf->num_open || read(perf->group_fd, buffer, sizeof(buffer)) <= 0) return;
+    for (uint32_t c = 0; c < PERF_NUM_COUNTERS; c++)
+        if (perf->fds[c] >= 0) values[c] = buffer[1 + perf->positions[c]];
+}
+
+void perf_start(struct perf *perf)
+{
+    memset(perf, 0, sizeof(*perf));
+    perf->group_fd = -1;
+    for (uint32_t c = 0; c < PERF_NUM_COUNTERS; c++) {
+        perf->fds[c] = open_counter(perf_counters[c].config, perf->group_fd);
+        if (perf->fds[c] < 0) continue;
+        if (perf->group_fd < 0) perf->group_fd = perf->fds[c];
+        perf->positions[c] = perf->num_open++;
+    }
+    read_counters(perf, perf->mark_values);
+    perf->mark_ns = now_ns();
+}
+
+void perf_mark(struct perf *perf, enum perf_phase phase)
+{
+    uint64_t ns = now_ns();
+    perf->ns[phase] += ns - perf->mark_ns;
+    perf->mark_ns = ns;
+
+    if (!perf->num_open) return;
+    // a failed read leaves the values of the last mark, adding nothing.
+    uint64_t values[PERF_NUM_COUNTERS];
+    memcpy(values, perf->mark_values, sizeof(values));
+    read_counters(perf, values);
+    for (uint32_t c = 0; c < PERF_NUM_COUNTERS; c++) {
+        perf->values[phase][c] += values[c] - perf->mark_values[c];
+        perf->mark_values[c] = values[c];
+    }
+}
+
+void perf_finish(struct perf *perf, uint64_t num_branches)
+{
+    double branches = num_branches ? num_branches : 1;
+    for (uint32_t p = 0; p < PERF_NUM_PHASES; p++) {
+        if (p == PERF_PHASE_OTHER && !perf->ns[p]) continue;
+        printf("PERF %s NS/BRANCH %.3f\n", perf_phase_names[p], perf->ns[p] / branches);
+        for (uint32_t c = 0; c < PERF_NUM_COUNTERS; c++) {
+            if (perf->fds[c] < 0) continue;
+            printf("PERF %s %s/BRANCH %.3f\n", perf_phase_names[p], perf_counters[c].name,
+                   perf->values[p][c] / branches);
+        }
+    }
+    printf("PERF BRANCHES %" PRIu64 "\n", num_branches);
+    if (!perf->num_open) printf("PERF COUNTERS UNAVAILABLE\n");
+
+    for (uint32_t c = 0; c < PERF_NUM_COUNTERS; c++)
+        if (perf->fds[c] >= 0) close(perf->fds[c]);
+}
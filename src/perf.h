@@ -0,0 +1,77 @@
+//
+// This file defines the self-measurement that is enabled with --perf. The
+// main loop alternates between decoding a block of the trace and simulating
+// it, and the time spent in each of the two phases is added up separately.
+//
+// The time is measured with clock_gettime. Where the kernel allows it, the
+// host's hardware counters are also read with perf_event_open: cycles,
+// instructions, cache misses and branch misses, counted in user space for
+// this thread only. Counters that cannot be opened (for example in a
+// container or a VM without a PMU) are left out, so --perf always works.
+//
+// The results are printed as PERF lines, per simulated branch:
+//
+//      PERF DECODE NS/BRANCH 0.812
+//      PERF DECODE CYCLES/BRANCH 2.950
+//      PERF SIMULATE NS/BRANCH 3.104
+//      ...
+//
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum perf_phase { PERF_PHASE_DECODE, PERF_PHASE_SIMULATE, PERF_PHASE_OTHER, PERF_NUM_PHASES };
+
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NUM_COUNTERS
+};
+
+struct perf {
+    // The file descriptors of the counter group, -1 for counters that are
+    // not available. The first available counter leads the group.
+    int fds[PERF_NUM_COUNTERS];
+    int group_fd;
+    // The position of each available counter in a read of the group.
+    uint32_t positions[PERF_NUM_COUNTERS];
+    uint32_t num_open;
+
+    // The time and the counter values at the last mark.
+    uint64_t mark_ns;
+    uint64_t mark_values[PERF_NUM_COUNTERS];
+
+    // The totals of each phase.
+    uint64_t ns[PERF_NUM_PHASES];
+    uint64_t values[PERF_NUM_PHASES][PERF_NUM_COUNTERS];
+};
+
+//
+// Open the counters and start measuring.
+//
+// Arguments
+//  * perf: filled with the measurement state.
+void perf_start(struct perf *perf);
+
+//
+// Add the time and the counts since the last mark (or the start) to a phase.
+//
+// Arguments
+//  * perf: the measurement state.
+//  * phase: the phase that has just ended.
+void perf_mark(struct perf *perf, enum perf_phase phase);
+
+//
+// Print the PERF lines and close the counters.
+//
+// Arguments
+//  * perf: the measurement state.
+//  * num_branches: the number of branches simulated.
+void perf_finish(struct perf *perf, uint64_t num_branches);
+
+#endif
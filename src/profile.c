@@ -0,0 +1,148 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+struct branch_profile *branch_profile_new(struct branch_predictor *branch_predictor,
+                                          struct branch_index *branch_index)
+{
+    struct branch_profile *profile = calloc(1, sizeof(struct branch_profile));
+    if (!profile) return NULL;
+    profile->branch_index = branch_index_ref(branch_index);
+    profile->num_counters = branch_index->num_branches + 1;
+    profile->counters = calloc(profile->num_counters, sizeof(struct branch_profile_counters));
+    if (branch_predictor->pht_index)
+        profile->pht_owner = calloc((uint64_t)branch_predictor->pht_mask + 1, sizeof(uint32_t));
+    if (!profile->counters || (branch_predictor->pht_index && !profile->pht_owner)) {
+        branch_profile_free(profile);
+        return NULL;
+    }
+    return profile;
+}
+
+// Make room for the counters of the branches that were added to the index
+// since the last block. If there is no room, the profile is incomplete.
+static void branch_profile_grow(struct branch_profile *profile)
+{
+    uint32_t num_counters = profile->branch_index->num_branches + 1;
+    if (num_counters <= profile->num_counters || profile->incomplete) return;
+
+    struct branch_profile_counters *counters =
+        realloc(profile->counters, (size_t)num_counters * sizeof(struct branch_profile_counters));
+    if (!counters) {
+        fprintf(stderr, "Cannot allocate the profile of %u branches, the ones after the "
+                        "first %u are profiled as unknown\n",
+                num_counters - 1, profile->num_counters - 1);
+        profile->incomplete = true;
+        return;
+    }
+    profile->counters = counters;
+    memset(profile->counters + profile->num_counters, 0,
+           (num_counters - profile->num_counters) * sizeof(struct branch_profile_counters));
+    profile->num_counters = num_counters;
+}
+
+void branch_profile_simulate_batch(struct branch_profile *profile,
+                                   struct branch_predictor *branch_predictor,
+                                   const uint32_t *addresses, const uint8_t *directions,
+                                   uint32_t n, uint64_t *correct)
+{
+    // The branches of a block are in the index before it is simulated.
+    branch_profile_grow(profile);
+
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t address = addresses[i];
+        uint32_t value = branch_index_lookup(profile->branch_index, address);
+        uint32_t position = value == BRANCH_INDEX_NONE ? 0 : (value >> 1) + 1;
+        if (position >= profile->num_counters) position = 0;
+        struct branch_profile_counters *counters = &profile->counters[position];
+
+        if (profile->pht_owner) {
+            uint32_t pht_index = branch_predictor->pht_index(branch_predictor, address);
+            uint32_t owner = profile->pht_owner[pht_index];
+            if (owner && owner != position + 1) {
+                counters->aliased++;
+                counters->last_alias =
+                    owner > 1 ? profile->branch_index->branches[owner - 2].address : 0;
+            }
+            profile->pht_owner[pht_index] = position + 1;
+            counters->last_pht_index = pht_index;
+        }
+
+        enum branch_direction prediction = branch_predictor->predict(branch_predictor, address);
+        bool hit = prediction == directions[i];
+        count += hit;
+        counters->predictions++;
+        counters->mispredictions += !hit;
+        counters->taken += directions[i];
+
+        branch_predictor->handle_result(branch_predictor, address, directions[i]);
+    }
+    *correct += count;
+}
+
+static const struct branch_profile_counters *sort_counters;
+
+static int compare_mispredictions(const void *a, const void *b)
+{
+    uint32_t ia = *(const uint32_t *)a;
+    uint32_t ib = *(const uint32_t *)b;
+    uint64_t ma = sort_counters[ia].mispredictions;
+    uint64_t mb = sort_counters[ib].mispredictions;
+    if (ma != mb) return ma < mb ? 1 : -1;
+
+    // Ties are in index order, with the unknown addresses (entry 0) last.
+    ia--;
+    ib--;
+    return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+void branch_profile_print(const struct branch_profile *profile, const char *prefix,
+                          uint32_t top_n)
+{
+    uint32_t num_entries = profile->num_counters;
+    uint32_t *order = malloc((size_t)num_entries * sizeof(uint32_t));
+    if (!order) {
+        fprintf(stderr, "Cannot allocate the profile of %u branches for sorting\n",
+                num_entries - 1);
+        return;
+    }
+    for (uint32_t i = 0; i < num_entries; i++) order[i] = i;
+    sort_counters = profile->counters;
+    qsort(order, num_entries, sizeof(uint32_t), &compare_mispredictions);
+
+    // Branches that were never predicted sort among the ones without
+    // mispredictions, so they are skipped rather than ending the list.
+    for (uint32_t i = 0, printed = 0; i < num_entries && printed < top_n; i++) {
+        const struct branch_profile_counters *c = &profile->counters[order[i]];
+        if (c->predictions == 0) continue;
+        printed++;
+
+        if (order[i] > 0)
+            printf("%sPROFILE 0x%x", prefix, profile->branch_index->branches[order[i] - 1].address);
+        else
+            printf("%sPROFILE unknown", prefix);
+        printf(" predictions=%" PRIu64 " mispredictions=%" PRIu64, c->predictions,
+               c->mispredictions);
+        printf(" mispredict_rate=%.6f bias=%.6f", (double)c->mispredictions / c->predictions,
+               (double)c->taken / c->predictions);
+        if (profile->pht_owner) {
+            printf(" pht=0x%x aliased=%.6f", c->last_pht_index,
+                   (double)c->aliased / c->predictions);
+            if (c->aliased) printf(" last_alias=0x%x", c->last_alias);
+        }
+        printf("\n");
+    }
+    free(order);
+}
+
+void branch_profile_free(struct branch_profile *profile)
+{
+    branch_index_free(profile->branch_index);
+    free(profile->counters);
+    free(profile->pht_owner);
+    free(profile);
+}
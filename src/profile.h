@@ -0,0 +1,93 @@
+//
+// This file defines the per-branch misprediction profiler that is enabled
+// with --profile.
+//
+// The profiler keeps a few counters for every unique branch in the branch
+// index of the trace, which grow with the index when the branches of a trace
+// are discovered as it is read. For predictors that report the PHT
+// entry they use (see pht_index in branch_predictors.h), it also remembers
+// which branch last used each PHT entry so that it can tell how often a
+// branch hits an entry that another branch has touched since (aliasing).
+//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "branch_index.h"
+#include "branch_metadata.h"
+#include "branch_predictors.h"
+
+struct branch_profile_counters {
+    uint64_t predictions;
+    uint64_t mispredictions;
+    uint64_t taken;
+    // Predictions made with a PHT entry that was last used by another branch.
+    uint64_t aliased;
+    uint32_t last_pht_index;
+    // The address of the other branch seen in the last aliased PHT entry.
+    uint32_t last_alias;
+};
+
+struct branch_profile {
+    struct branch_index *branch_index;
+
+    // Entry 0 is for addresses that are not in the index, entry n + 1 for the
+    // branch at position n of the index.
+    uint32_t num_counters;
+    struct branch_profile_counters *counters;
+    // Set once the counters could not grow with the index. The branches that
+    // have no counters are counted in entry 0 from then on.
+    bool incomplete;
+
+    // For each PHT entry, the counters entry of the branch that last used it
+    // plus one (0 if unused). NULL if the predictor does not report PHT
+    // indices.
+    uint32_t *pht_owner;
+};
+
+//
+// Create a profile for a branch predictor.
+//
+// Arguments
+//  * branch_predictor: the branch predictor that will be profiled.
+//  * branch_index: the unique branches of the trace. The profile keeps a
+//    reference to it.
+//
+// Returns (struct branch_profile *): the new profile, or NULL if it cannot be
+// allocated.
+struct branch_profile *branch_profile_new(struct branch_predictor *branch_predictor,
+                                          struct branch_index *branch_index);
+
+//
+// Simulate a block of branches on a branch predictor while profiling it.
+//
+// Arguments
+//  * profile: the profile to update.
+//  * branch_predictor: the branch predictor to simulate.
+//  * addresses: the branch instruction addresses.
+//  * directions: the actual direction that each branch went.
+//  * n: the number of branches.
+//  * correct: incremented by the number of correct predictions.
+void branch_profile_simulate_batch(struct branch_profile *profile,
+                                   struct branch_predictor *branch_predictor,
+                                   const uint32_t *addresses, const uint8_t *directions,
+                                   uint32_t n, uint64_t *correct);
+
+//
+// Print the branches with the most mispredictions.
+//
+// Arguments
+//  * profile: the profile to print.
+//  * prefix: printed at the start of each line, may be empty.
+//  * top_n: the number of branches to print.
+void branch_profile_print(const struct branch_profile *profile, const char *prefix,
+                          uint32_t top_n);
+
+//
+// Free a profile.
+void branch_profile_free(struct branch_profile *profile);
+
+#endif
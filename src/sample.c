@@ -0,0 +1,118 @@
+#include <math.h>
+#include <string.h>
+
+#include "sample.h"
+
+// The two-sided 95% quantile of the standard normal distribution.
+#define SAMPLE_Z_95 1.959964
+
+// The counts of a simulation, saved so that a window can be left out of its
+// statistics.
+struct sample_counts {
+    uint64_t prediction_count;
+    uint64_t correct_prediction_count;
+    uint32_t num_counters;
+    uint64_t counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+};
+
+static uint32_t get_counters(struct branch_predictor *branch_predictor,
+                             struct branch_predictor_counter *counters)
+{
+    if (!branch_predictor->counters) return 0;
+    return branch_predictor->counters(branch_predictor, counters);
+}
+
+static void save_counts(const struct simulation *simulations, uint32_t num_simulations,
+                        struct sample_counts *counts)
+{
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        const struct simulation *sim = &simulations[s];
+        counts[s].prediction_count = sim->prediction_count;
+        counts[s].correct_prediction_count = sim->correct_prediction_count;
+
+        struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+        counts[s].num_counters = get_counters(sim->branch_predictor, counters);
+        for (uint32_t c = 0; c < counts[s].num_counters; c++)
+            counts[s].counters[c] = *counters[c].value;
+    }
+}
+
+static void restore_counts(struct simulation *simulations, uint32_t num_simulations,
+                           const struct sample_counts *counts)
+{
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        struct simulation *sim = &simulations[s];
+        sim->prediction_count = counts[s].prediction_count;
+        sim->correct_prediction_count = counts[s].correct_prediction_count;
+
+        struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+        get_counters(sim->branch_predictor, counters);
+        for (uint32_t c = 0; c < counts[s].num_counters; c++)
+            *counters[c].value = counts[s].counters[c];
+    }
+}
+
+// Simulate up to n branches of the trace.
+//
+// Returns (uint64_t): the number of branches simulated, less than n at the
+// end of the trace.
+static uint64_t simulate(struct trace *trace, struct simulation *simulations,
+                         uint32_t num_simulations, struct multi_config *multi_config, uint64_t n)
+{
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+    uint64_t done = 0;
+    while (done < n) {
+        uint32_t max = n - done < TRACE_BLOCK_RECORDS ? n - done : TRACE_BLOCK_RECORDS;
+        uint32_t count = trace->next_block(trace, addresses, directions, max);
+        if (count == 0) break;
+        simulate_blocks(simulations, num_simulations, multi_config, addresses, directions,
+                        count);
+        done += count;
+    }
+    return done;
+}
+
+void sample_simulate(struct trace *trace, struct simulation *simulations,
+                     uint32_t num_simulations, struct multi_config *multi_config,
+                     uint64_t period, uint64_t warmup, uint64_t size, struct sample_stats *stats)
+{
+    memset(stats, 0, num_simulations * sizeof(struct sample_stats));
+    struct sample_counts counts[MAX_SIMULATIONS];
+
+    for (;;) {
+        if (trace_skip(trace, period - warmup - size) < period - warmup - size) break;
+
+        save_counts(simulations, num_simulations, counts);
+        uint64_t warmed = simulate(trace, simulations, num_simulations, multi_config, warmup);
+        restore_counts(simulations, num_simulations, counts);
+        if (warmed < warmup) break;
+
+        save_counts(simulations, num_simulations, counts);
+        if (simulate(trace, simulations, num_simulations, multi_config, size) < size) {
+            restore_counts(simulations, num_simulations, counts);
+            break;
+        }
+
+        for (uint32_t s = 0; s < num_simulations; s++) {
+            struct sample_stats *sample = &stats[s];
+            double rate =
+                (double)(simulations[s].correct_prediction_count -
+                         counts[s].correct_prediction_count) / size;
+            double delta = rate - sample->mean;
+            sample->num_samples++;
+            sample->mean += delta / sample->num_samples;
+            sample->m2 += delta * (rate - sample->mean);
+        }
+    }
+}
+
+bool sample_confidence_interval(const struct sample_stats *stats, double *low, double *high)
+{
+    if (stats->num_samples < 2) return false;
+    double variance = stats->m2 / (stats->num_samples - 1);
+    double margin = SAMPLE_Z_95 * sqrt(variance / stats->num_samples);
+    *low = stats->mean - margin;
+    *high = stats->mean + margin;
+    return true;
+}
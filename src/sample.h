@@ -0,0 +1,71 @@
+//
+// This file defines the sampled simulation mode that is enabled with
+// --sample=P. Instead of simulating every branch, the trace is cut into
+// periods of P branches (systematic sampling, as in SMARTS). Each period
+// starts with a fast-forward over most of its branches, which the predictors
+// never see, followed by a warm-up window that is simulated but not counted,
+// and ends with a measured window whose predictions are counted:
+//
+//      | fast-forward ... | warm-up W | measured M | fast-forward ... | ...
+//      '------------------ P --------------------' '----------- P ---
+//
+// Fast-forwarding a memory-mapped binary trace takes constant time (see
+// trace_skip), so the run time only depends on W + M per period.
+//
+// The statistics only cover the measured windows. The prediction rate of the
+// whole trace is estimated by the rate over the measured windows, and the
+// spread of the rates of the individual windows gives a confidence interval
+// for it. A measured window that is cut short by the end of the trace is not
+// counted.
+//
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "simulation.h"
+#include "trace.h"
+
+// The number of branches measured and warmed up in every period by default.
+#define DEFAULT_SAMPLE_SIZE 10000
+#define DEFAULT_SAMPLE_WARMUP 20000
+
+// The rates of the measured windows of a simulation.
+struct sample_stats {
+    uint64_t num_samples;
+    // The running mean and sum of squared deviations of the rates (Welford).
+    double mean;
+    double m2;
+};
+
+//
+// Simulate the sampled windows of the rest of a trace.
+//
+// Arguments
+//  * trace: the trace.
+//  * simulations: the simulations. Only the measured branches are added to
+//    their statistics.
+//  * num_simulations: the number of simulations.
+//  * multi_config: the multi-configuration engine of the simulations, or
+//    NULL.
+//  * period: the number of branches in a period.
+//  * warmup: the number of branches warmed up in every period.
+//  * size: the number of branches measured in every period.
+//  * stats: filled with the sample statistics of every simulation.
+void sample_simulate(struct trace *trace, struct simulation *simulations,
+                     uint32_t num_simulations, struct multi_config *multi_config,
+                     uint64_t period, uint64_t warmup, uint64_t size, struct sample_stats *stats);
+
+//
+// Get the confidence interval of the estimated prediction rate.
+//
+// Arguments
+//  * stats: the sample statistics of a simulation.
+//  * low, high: filled with the bounds of the 95% confidence interval.
+//
+// Returns (bool): false if there are fewer than two samples.
+bool sample_confidence_interval(const struct sample_stats *stats, double *low, double *high);
+
+#endif
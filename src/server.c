@@ -0,0 +1,531 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "simulation.h"
+#include "trace.h"
+
+// The initial size of the input buffer of a connection.
+#define SERVER_BUFFER_SIZE (64 << 10)
+
+// A predictor kept by a worker, with the snapshot of its initial state.
+struct server_pool_entry {
+    char *spec;
+    struct branch_predictor *branch_predictor;
+    char *snapshot;
+    uint64_t last_used;
+};
+
+struct server_worker {
+    pthread_t thread;
+    struct server *server;
+    struct server_pool_entry pool[SERVER_POOL_SIZE];
+    uint64_t clock;
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+};
+
+struct server_connection {
+    int fd;
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    size_t position;
+};
+
+struct server {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    // The connections with a request to serve, in the order they got one.
+    struct server_connection *queue[SERVER_MAX_CONNECTIONS];
+    uint32_t queue_head;
+    uint32_t queue_count;
+    // The connections that the workers handed back after a request, for the
+    // main thread to poll until their next one, and the pipe that wakes it.
+    struct server_connection *idle[SERVER_MAX_CONNECTIONS];
+    uint32_t idle_count;
+    int wake_fds[2];
+    uint32_t num_connections;
+};
+
+static volatile sig_atomic_t server_stopping;
+
+static void server_stop(int signal)
+{
+    server_stopping = 1;
+}
+
+// Connections
+// ============================================================================
+
+// Make sure that at least `needed` unread bytes of a connection are buffered.
+//
+// Returns (bool): false if the connection was closed or failed first.
+static bool connection_fill(struct server_connection *connection, size_t needed)
+{
+    if (connection->size - connection->position >= needed) return true;
+
+    memmove(connection->buffer, connection->buffer + connection->position,
+            connection->size - connection->position);
+    connection->size -= connection->position;
+    connection->position = 0;
+    if (connection->capacity < needed) {
+        char *buffer = realloc(connection->buffer, needed);
+        if (!buffer) return false;
+        connection->buffer = buffer;
+        connection->capacity = needed;
+    }
+
+    while (connection->size < needed) {
+        ssize_t n = read(connection->fd, connection->buffer + connection->size,
+                         connection->capacity - connection->size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        connection->size += n;
+    }
+    return true;
+}
+
+// Read the next request line of a connection, without its newline.
+//
+// Returns (char *): the line, which stays valid until the next read from the
+// connection, or NULL if the connection was closed or the line is too long.
+static char *connection_read_line(struct server_connection *connection)
+{
+    size_t scanned = 0;
+    for (;;) {
+        char *start = connection->buffer + connection->position;
+        char *newline = memchr(start + scanned, '\n', connection->size - connection->position -
+                                                          scanned);
+        if (newline) {
+            *newline = '\0';
+            connection->position = newline + 1 - connection->buffer;
+            return start;
+        }
+        scanned = connection->size - connection->position;
+        if (scanned >= SERVER_MAX_LINE || !connection_fill(connection, scanned + 1)) return NULL;
+    }
+}
+
+static bool connection_write(struct server_connection *connection, const char *data,
+                             size_t size)
+{
+    while (size > 0) {
+        ssize_t n = send(connection->fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static struct server_connection *connection_new(int fd)
+{
+    struct server_connection *connection = calloc(1, sizeof(struct server_connection));
+    if (!connection) return NULL;
+    connection->fd = fd;
+    connection->capacity = SERVER_BUFFER_SIZE;
+    connection->buffer = malloc(connection->capacity);
+    if (!connection->buffer) {
+        free(connection);
+        return NULL;
+    }
+    return connection;
+}
+
+static void connection_free(struct server_connection *connection)
+{
+    close(connection->fd);
+    free(connection->buffer);
+    free(connection);
+}
+
+// Predictor Pool
+// ============================================================================
+
+static bool uses_metadata(const struct branch_predictor *branch_predictor)
+{
+    if (branch_predictor->branch_index) return true;
+    for (uint32_t c = 0; c < 2; c++)
+        if (branch_predictor->components[c] && uses_metadata(branch_predictor->components[c]))
+            return true;
+    return false;
+}
+
+static uint32_t get_state_regions(struct branch_predictor *branch_predictor,
+                                  struct branch_predictor_state_region *regions)
+{
+    if (!branch_predictor->state_regions) return 0;
+    return branch_predictor->state_regions(branch_predictor, regions);
+}
+
+// Copy the state regions of a predictor to or from a snapshot.
+//
+// Returns (size_t): the size of the snapshot.
+static size_t pool_copy_state(struct branch_predictor *branch_predictor, char *snapshot,
+                              bool restore)
+{
+    struct branch_predictor_state_region regions[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+    uint32_t num_regions = get_state_regions(branch_predictor, regions);
+    size_t offset = 0;
+    for (uint32_t i = 0; i < num_regions; i++) {
+        if (snapshot && restore)
+            memcpy(regions[i].data, snapshot + offset, regions[i].size);
+        else if (snapshot)
+            memcpy(snapshot + offset, regions[i].data, regions[i].size);
+        offset += regions[i].size;
+    }
+    return offset;
+}
+
+static void pool_zero_counters(struct branch_predictor *branch_predictor)
+{
+    struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+    uint32_t num_counters =
+        branch_predictor->counters ? branch_predictor->counters(branch_predictor, counters) : 0;
+    for (uint32_t c = 0; c < num_counters; c++) *counters[c].value = 0;
+    for (uint32_t c = 0; c < 2; c++)
+        if (branch_predictor->components[c]) pool_zero_counters(branch_predictor->components[c]);
+}
+
+static void pool_free_predictor(struct branch_predictor *branch_predictor)
+{
+    branch_predictor->cleanup(branch_predictor);
+    free(branch_predictor);
+}
+
+static void pool_evict(struct server_pool_entry *entry)
+{
+    if (!entry->branch_predictor) return;
+    pool_free_predictor(entry->branch_predictor);
+    free(entry->spec);
+    free(entry->snapshot);
+    memset(entry, 0, sizeof(*entry));
+}
+
+// Get a predictor in its initial state for a job.
+//
+// Returns (struct branch_predictor *): the predictor, or NULL if the spec is
+// invalid. *pooled is set if the predictor belongs to the pool.
+static struct branch_predictor *pool_get(struct server_worker *worker, const char *spec,
+                                         struct trace *trace, bool *pooled)
+{
+    struct server_pool_entry *oldest = &worker->pool[0];
+    for (uint32_t i = 0; i < SERVER_POOL_SIZE; i++) {
+        struct server_pool_entry *entry = &worker->pool[i];
+        if (entry->branch_predictor && !strcmp(entry->spec, spec)) {
+            pool_copy_state(entry->branch_predictor, entry->snapshot, true);
+            pool_zero_counters(entry->branch_predictor);
+            entry->last_used = ++worker->clock;
+            *pooled = true;
+            return entry->branch_predictor;
+        }
+        if (entry->last_used < oldest->last_used) oldest = entry;
+    }
+
+    struct branch_predictor *branch_predictor = branch_predictor_new(spec, trace->branch_index);
+    *pooled = branch_predictor && !uses_metadata(branch_predictor);
+    if (!*pooled) return branch_predictor;
+
+    pool_evict(oldest);
+    oldest->spec = strdup(spec);
+    oldest->branch_predictor = branch_predictor;
+    oldest->snapshot = malloc(pool_copy_state(branch_predictor, NULL, false));
+    pool_copy_state(branch_predictor, oldest->snapshot, false);
+    oldest->last_used = ++worker->clock;
+    return branch_predictor;
+}
+
+// Jobs
+// ============================================================================
+
+// Simulate a trace and format the response.
+static void run_job(struct server_worker *worker, const char *spec, struct trace *trace,
+                    char *response, size_t response_size)
+{
+    bool pooled;
+    struct branch_predictor *branch_predictor = pool_get(worker, spec, trace, &pooled);
+    if (!branch_predictor) {
+        snprintf(response, response_size, "ERROR Invalid branch predictor %s\n", spec);
+        return;
+    }
+
+    struct simulation sim = {.name = spec, .branch_predictor = branch_predictor};
+    uint32_t count;
+    while ((count = trace->next_block(trace, worker->addresses, worker->directions,
+                                      TRACE_BLOCK_RECORDS)))
+        simulate_block(&sim, worker->addresses, worker->directions, count);
+    if (trace->error) {
+        snprintf(response, response_size, "ERROR Malformed trace: %s\n", trace->error);
+        if (!pooled) pool_free_predictor(branch_predictor);
+        return;
+    }
+
+    int n = snprintf(response, response_size,
+                     "OK PREDICTIONS=%" PRIu64 " CORRECT=%" PRIu64 " INCORRECT=%" PRIu64
+                     " RATE=%.8f",
+                     sim.prediction_count, sim.correct_prediction_count,
+                     sim.prediction_count - sim.correct_prediction_count,
+                     sim.prediction_count
+                         ? (double)sim.correct_prediction_count / sim.prediction_count
+                         : 0);
+    struct branch_predictor_counter counters[MAX_BRANCH_PREDICTOR_COUNTERS];
+    uint32_t num_counters =
+        branch_predictor->counters ? branch_predictor->counters(branch_predictor, counters) : 0;
+    for (uint32_t c = 0; c < num_counters && n < (int)response_size; c++) {
+        for (char *p = counters[c].name; *p; p++)
+            if (*p == ' ') *p = '_';
+        n += snprintf(response + n, response_size - n, " %s=%" PRIu64, counters[c].name,
+                      *counters[c].value);
+    }
+    if (n < (int)response_size) snprintf(response + n, response_size - n, "\n");
+
+    if (!pooled) pool_free_predictor(branch_predictor);
+}
+
+// Answer the next request of a connection.
+//
+// Returns (bool): false if the connection is to be closed: the client closed
+// it or sent something that is not a request.
+static bool serve_request(struct server_worker *worker, struct server_connection *connection)
+{
+    // Room for every counter of the largest predictor.
+    char response[SERVER_MAX_LINE + MAX_BRANCH_PREDICTOR_COUNTERS * 96];
+
+    char *line = connection_read_line(connection);
+    if (!line) return false;
+    char *saveptr;
+    char *command = strtok_r(line, " ", &saveptr);
+    char *spec_str = strtok_r(NULL, " ", &saveptr);
+    char *path = strtok_r(NULL, " ", &saveptr);
+    char *size_str = strtok_r(NULL, " ", &saveptr);
+
+    if (!command || strcmp(command, "RUN") || !spec_str || !path ||
+        (!strcmp(path, "-") != !!size_str)) {
+        // The rest of the connection cannot be trusted to be requests.
+        static const char malformed[] = "ERROR Malformed request\n";
+        connection_write(connection, malformed, sizeof(malformed) - 1);
+        return false;
+    }
+
+    // Reading an inline trace moves the line.
+    char spec[SERVER_MAX_LINE];
+    strcpy(spec, spec_str);
+    struct trace *trace;
+    uint64_t size = 0;
+    int trace_fd = -1;
+    if (size_str) {
+        char *end;
+        errno = 0;
+        size = strtoull(size_str, &end, 10);
+        if (!isdigit((unsigned char)size_str[0]) || *end || errno ||
+            size > SERVER_MAX_INLINE_SIZE) {
+            // Without its size, the trace cannot be skipped to the next
+            // request.
+            snprintf(response, sizeof(response),
+                     "ERROR Invalid trace size %s, expected at most %llu bytes\n", size_str,
+                     SERVER_MAX_INLINE_SIZE);
+            connection_write(connection, response, strlen(response));
+            return false;
+        }
+        if (!connection_fill(connection, size)) return false;
+        trace = trace_open_memory(connection->buffer + connection->position, size);
+    } else {
+        trace_fd = open(path, O_RDONLY);
+        trace = trace_fd >= 0 ? trace_open(trace_fd) : NULL;
+    }
+
+    if (trace) {
+        run_job(worker, spec, trace, response, sizeof(response));
+        trace_close(trace);
+    } else if (trace_fd < 0 && !size_str) {
+        snprintf(response, sizeof(response), "ERROR Cannot open %s: %s\n", path,
+                 strerror(errno));
+    } else {
+        snprintf(response, sizeof(response), "ERROR Malformed trace\n");
+    }
+    if (trace_fd >= 0) close(trace_fd);
+    connection->position += size;
+
+    return connection_write(connection, response, strlen(response));
+}
+
+// Queue a connection for the next free worker. The lock must be held.
+static void server_queue(struct server *server, struct server_connection *connection)
+{
+    server->queue[(server->queue_head + server->queue_count) % SERVER_MAX_CONNECTIONS] =
+        connection;
+    server->queue_count++;
+    pthread_cond_signal(&server->ready);
+}
+
+// Serve one request at a time, so that a connection only holds a worker while
+// a request is being answered.
+static void *worker_main(void *argument)
+{
+    struct server_worker *worker = argument;
+    struct server *server = worker->server;
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->queue_count == 0) pthread_cond_wait(&server->ready, &server->lock);
+        struct server_connection *connection = server->queue[server->queue_head];
+        server->queue_head = (server->queue_head + 1) % SERVER_MAX_CONNECTIONS;
+        server->queue_count--;
+        pthread_mutex_unlock(&server->lock);
+
+        bool open = serve_request(worker, connection);
+
+        // A request that was sent before the response is already buffered,
+        // so the connection goes to the back of the queue. Otherwise the main
+        // thread waits for the next request.
+        bool idle = open && connection->position == connection->size;
+        pthread_mutex_lock(&server->lock);
+        if (!open)
+            server->num_connections--;
+        else if (idle)
+            server->idle[server->idle_count++] = connection;
+        else
+            server_queue(server, connection);
+        pthread_mutex_unlock(&server->lock);
+
+        if (!open) connection_free(connection);
+        if (idle) {
+            // A full pipe wakes the main thread up just as well.
+            ssize_t n = write(server->wake_fds[1], "", 1);
+            (void)n;
+        }
+    }
+    return NULL;
+}
+
+// Server
+// ============================================================================
+
+bool server_run(const char *path, uint32_t num_workers)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        perror(path);
+        if (listen_fd >= 0) close(listen_fd);
+        return false;
+    }
+
+    // Only this thread handles the signals, so that they interrupt poll.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    struct server server = {0};
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    struct server_worker *workers = calloc(num_workers, sizeof(struct server_worker));
+    bool ok = workers && pipe(server.wake_fds) == 0 &&
+              fcntl(server.wake_fds[0], F_SETFL, O_NONBLOCK) == 0 &&
+              fcntl(server.wake_fds[1], F_SETFL, O_NONBLOCK) == 0;
+    for (uint32_t i = 0; ok && i < num_workers; i++) {
+        workers[i].server = &server;
+        if (pthread_create(&workers[i].thread, NULL, &worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "Cannot start thread %u\n", i);
+            ok = false;
+        }
+    }
+
+    struct sigaction action = {.sa_handler = &server_stop};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+    // The main thread accepts the connections and polls the idle ones, which
+    // are polled[i] at fds[2 + i], until they have a request for a worker.
+    struct pollfd fds[2 + SERVER_MAX_CONNECTIONS];
+    struct server_connection *polled[SERVER_MAX_CONNECTIONS];
+    uint32_t num_polled = 0;
+    fds[0] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+    fds[1] = (struct pollfd){.fd = server.wake_fds[0], .events = POLLIN};
+    if (ok) fprintf(stderr, "Listening on %s with %u workers\n", path, num_workers);
+    while (ok && !server_stopping) {
+        for (uint32_t i = 0; i < num_polled; i++)
+            fds[2 + i] = (struct pollfd){.fd = polled[i]->fd, .events = POLLIN};
+        if (poll(fds, 2 + num_polled, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+                ok = false;
+            }
+            continue;
+        }
+
+        // The pipe is emptied first, so that a connection that is handed back
+        // from now on wakes the next poll up.
+        char wake[64];
+        if (fds[1].revents) while (read(server.wake_fds[0], wake, sizeof(wake)) > 0);
+
+        // A closed connection is readable too, and its worker closes it.
+        pthread_mutex_lock(&server.lock);
+        for (uint32_t i = num_polled; i-- > 0;) {
+            if (!fds[2 + i].revents) continue;
+            server_queue(&server, polled[i]);
+            polled[i] = polled[--num_polled];
+        }
+        while (server.idle_count) polled[num_polled++] = server.idle[--server.idle_count];
+        pthread_mutex_unlock(&server.lock);
+
+        if (!(fds[0].revents & POLLIN)) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+                ok = false;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&server.lock);
+        bool busy = server.num_connections == SERVER_MAX_CONNECTIONS;
+        if (!busy) server.num_connections++;
+        pthread_mutex_unlock(&server.lock);
+        struct server_connection *connection = busy ? NULL : connection_new(fd);
+        if (!connection) {
+            static const char busy_error[] = "ERROR busy\n";
+            send(fd, busy_error, sizeof(busy_error) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            if (!busy) {
+                pthread_mutex_lock(&server.lock);
+                server.num_connections--;
+                pthread_mutex_unlock(&server.lock);
+            }
+            continue;
+        }
+        // Nothing has been sent yet, so the connection waits for its first
+        // request like an idle one.
+        polled[num_polled++] = connection;
+    }
+
+    // The workers are stopped with the process, possibly in the middle of a
+    // connection.
+    close(listen_fd);
+    unlink(path);
+    return ok;
+}
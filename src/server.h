@@ -0,0 +1,78 @@
+//
+// This file defines the server mode that is enabled with --server=PATH.
+//
+// The server listens on a Unix domain socket at PATH and simulates one job
+// per request, so that many short traces can be simulated without paying for
+// a process, the allocation of the predictor tables and the output formatting
+// every time. Each request is answered by the next free thread of a pool of
+// workers. Between requests the main thread polls the idle connections, so a
+// connection only holds a worker while one of its requests is read and
+// answered, and idle clients cannot starve the others. The requests of one
+// connection are answered in order.
+//
+// Every worker keeps the predictors of its most recent specs. A predictor
+// that is used again is put back into its initial state by copying a snapshot
+// of its state regions (see state_regions in branch_predictors.h) over them
+// and zeroing its counters, instead of being allocated again. Predictors that
+// depend on the branch metadata of the trace (BTFNT and BTB) are created for
+// every job.
+//
+// Protocol
+// ========
+//
+// Requests and responses are lines of text. A request is one of
+//
+//      RUN SPEC PATH
+//      RUN SPEC - SIZE
+//
+// where SPEC is a branch predictor spec and PATH the path of a trace file as
+// the server sees it, or - for a trace of SIZE bytes that follows the request
+// line. The trace may be in any format that trace_open detects. The response
+// is either
+//
+//      OK PREDICTIONS=n CORRECT=n INCORRECT=n RATE=x [NAME=n...]
+//
+// with one NAME=n for every counter of the predictor (the counter name with
+// underscores for spaces), or
+//
+//      ERROR message
+//
+// A client can send any number of requests on one connection, and may send
+// the next one before the previous response arrives. After a request that
+// is not RUN or has an invalid SIZE, the server responds with an ERROR and
+// closes the connection, since it cannot find the next request. A connection
+// that arrives while SERVER_MAX_CONNECTIONS are open gets
+// "ERROR busy" and is closed.
+//
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The maximum length of a request line.
+#define SERVER_MAX_LINE 4096
+
+// The number of predictors that each worker keeps for reuse.
+#define SERVER_POOL_SIZE 16
+
+// The most connections that are open at once. Each of them is waiting for a
+// worker, served by one, or idle until its next request arrives.
+#define SERVER_MAX_CONNECTIONS 256
+
+// The largest trace that can be sent inline.
+#define SERVER_MAX_INLINE_SIZE (1ull << 30)
+
+//
+// Serve simulation jobs on a Unix domain socket until SIGINT or SIGTERM.
+//
+// Arguments
+//  * path: the path of the socket. An existing socket at this path is
+//    replaced, and the socket is removed when the server stops.
+//  * num_workers: the number of worker threads.
+//
+// Returns (bool): false if the socket or the workers cannot be set up.
+bool server_run(const char *path, uint32_t num_workers);
+
+#endif
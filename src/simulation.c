@@ -0,0 +1,68 @@
+#include "simulation.h"
+
+void simulate_block(struct simulation *sim, const uint32_t *addresses,
+                    const uint8_t *directions, uint32_t count)
+{
+    struct branch_predictor *branch_predictor = sim->branch_predictor;
+    uint64_t correct_prediction_count = 0;
+    if (sim->profile) {
+        branch_profile_simulate_batch(sim->profile, branch_predictor, addresses, directions,
+                                      count, &correct_prediction_count);
+    } else if (branch_predictor->simulate_batch) {
+        branch_predictor->simulate_batch(branch_predictor, addresses, directions, count,
+                                         &correct_prediction_count);
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            enum branch_direction prediction =
+                branch_predictor->predict(branch_predictor, addresses[i]);
+            correct_prediction_count += prediction == directions[i];
+            branch_predictor->handle_result(branch_predictor, addresses[i], directions[i]);
+        }
+    }
+    sim->prediction_count += count;
+    sim->correct_prediction_count += correct_prediction_count;
+}
+
+struct multi_config *simulations_multi_config_new(struct simulation *simulations,
+                                                  uint32_t num_simulations)
+{
+    struct branch_predictor *branch_predictors[MAX_SIMULATIONS];
+    uint32_t num_configs = 0;
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        if (!simulations[s].profile && multi_config_supports(simulations[s].branch_predictor))
+            branch_predictors[num_configs++] = simulations[s].branch_predictor;
+    }
+    if (num_configs < 2) return NULL;
+
+    uint32_t lane = 0;
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        struct simulation *sim = &simulations[s];
+        sim->lockstep = !sim->profile && multi_config_supports(sim->branch_predictor);
+        if (sim->lockstep) sim->lane = lane++;
+    }
+    struct multi_config *multi_config = multi_config_new(branch_predictors, num_configs);
+    if (!multi_config) {
+        // Without the engine every simulation takes the scalar path.
+        for (uint32_t s = 0; s < num_simulations; s++) simulations[s].lockstep = false;
+    }
+    return multi_config;
+}
+
+void simulate_blocks(struct simulation *simulations, uint32_t num_simulations,
+                     struct multi_config *multi_config, const uint32_t *addresses,
+                     const uint8_t *directions, uint32_t count)
+{
+    uint64_t correct[MAX_SIMULATIONS] = {0};
+    if (multi_config)
+        multi_config->simulate_block(multi_config, addresses, directions, count, correct);
+
+    for (uint32_t s = 0; s < num_simulations; s++) {
+        struct simulation *sim = &simulations[s];
+        if (multi_config && sim->lockstep) {
+            sim->prediction_count += count;
+            sim->correct_prediction_count += correct[sim->lane];
+        } else {
+            simulate_block(sim, addresses, directions, count);
+        }
+    }
+}
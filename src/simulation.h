@@ -0,0 +1,71 @@
+//
+// This file defines a simulation: a branch predictor that is being run over a
+// trace together with its statistics. Main runs one simulation per predictor
+// named on the command line, and the parallel mode runs one per predictor in
+// every shard.
+//
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdint.h>
+
+#include "branch_predictors.h"
+#include "multi_config.h"
+#include "profile.h"
+
+// The maximum number of branch predictors that can be simulated at once.
+#define MAX_SIMULATIONS 64
+
+struct simulation {
+    const char *name;
+    struct branch_predictor *branch_predictor;
+    uint64_t prediction_count;
+    uint64_t correct_prediction_count;
+    struct branch_profile *profile;
+    // Set if the predictor is run by a multi-configuration engine, as the
+    // lane-th configuration of the engine.
+    bool lockstep;
+    uint32_t lane;
+};
+
+//
+// Simulate a block of branches on one predictor and update its statistics.
+//
+// Arguments
+//  * sim: the simulation.
+//  * addresses: the branch instruction addresses.
+//  * directions: the actual direction that each branch went.
+//  * count: the number of branches.
+void simulate_block(struct simulation *sim, const uint32_t *addresses,
+                    const uint8_t *directions, uint32_t count);
+
+//
+// Create a multi-configuration engine for the simulations that it can run, if
+// there are at least two of them, and mark those simulations as lockstep.
+// Simulations with a profile are not included.
+//
+// Arguments
+//  * simulations: the simulations.
+//  * num_simulations: the number of simulations.
+//
+// Returns (struct multi_config *): the engine, or NULL if it is not used or
+// cannot be allocated, in which case no simulation is marked as lockstep.
+struct multi_config *simulations_multi_config_new(struct simulation *simulations,
+                                                  uint32_t num_simulations);
+
+//
+// Simulate a block of branches on every simulation.
+//
+// Arguments
+//  * simulations: the simulations.
+//  * num_simulations: the number of simulations.
+//  * multi_config: the engine for the lockstep simulations, may be NULL.
+//  * addresses: the branch instruction addresses.
+//  * directions: the actual direction that each branch went.
+//  * count: the number of branches.
+void simulate_blocks(struct simulation *simulations, uint32_t num_simulations,
+                     struct multi_config *multi_config, const uint32_t *addresses,
+                     const uint8_t *directions, uint32_t count);
+
+#endif
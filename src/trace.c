@@ -0,0 +1,941 @@
+//
+// This file contains the implementation of the trace reader and writer
+// declared in trace.h.
+//
+
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "trace.h"
+
+// Size of the input buffer used when the trace cannot be memory-mapped.
+#define TRACE_READ_CHUNK (1 << 20)
+
+// No line of a well-formed text trace is longer than this, so having this
+// many bytes buffered is always enough to parse one record.
+#define TRACE_TEXT_LOOKAHEAD 4096
+
+// The number of ChampSim records buffered at a time.
+#define TRACE_CHAMPSIM_LOOKAHEAD (TRACE_BLOCK_RECORDS * sizeof(struct champsim_record))
+
+// The first bytes of a gzip stream.
+#define GZIP_MAGIC "\x1f\x8b"
+
+// How many times a reader thread (or the simulation) polls the ring before it
+// goes to sleep until the other side moves on.
+#define TRACE_READER_SPINS 256
+
+// Input Buffer
+// ============================================================================
+
+struct trace_gzip {
+    z_stream stream;
+    // Set while a gzip member has been started but not finished, so that a
+    // truncated one is not mistaken for the end of the trace.
+    bool in_member;
+    unsigned char input[TRACE_READ_CHUNK];
+};
+
+// Read the next bytes of the input, decompressing them if it is compressed.
+//
+// Returns (ssize_t): the number of bytes read, 0 at the end of the input or -1
+// on an error.
+static ssize_t trace_read(struct trace *trace, char *data, size_t size)
+{
+    ssize_t n;
+    if (!trace->gzip) {
+        do n = read(trace->fd, data, size);
+        while (n < 0 && errno == EINTR);
+        return n;
+    }
+
+    struct trace_gzip *gzip = trace->gzip;
+    z_stream *stream = &gzip->stream;
+    stream->next_out = (unsigned char *)data;
+    stream->avail_out = size;
+    while (stream->avail_out == size) {
+        if (stream->avail_in == 0) {
+            // Compressed memory is handed to zlib all at once.
+            n = 0;
+            if (trace->fd >= 0) n = read(trace->fd, gzip->input, sizeof(gzip->input));
+            if (n < 0 && errno == EINTR) continue;
+            if (n == 0 && gzip->in_member) {
+                fprintf(stderr, "Corrupt compressed trace: unexpected end of input\n");
+                return -1;
+            }
+            if (n <= 0) return n;
+            stream->next_in = gzip->input;
+            stream->avail_in = n;
+        }
+
+        gzip->in_member = true;
+        int status = inflate(stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            // Concatenated gzip members are decompressed one after the other.
+            inflateReset(stream);
+            gzip->in_member = false;
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            fprintf(stderr, "Corrupt compressed trace: %s\n", stream->msg ? stream->msg : "");
+            return -1;
+        }
+    }
+    return size - stream->avail_out;
+}
+
+// Switch a trace that starts with the gzip magic to decompressing its input.
+// The compressed bytes that are already buffered are handed to zlib.
+static bool trace_start_gzip(struct trace *trace)
+{
+    struct trace_gzip *gzip = calloc(1, sizeof(struct trace_gzip));
+    if (!gzip) return false;
+    if (inflateInit2(&gzip->stream, 16 + MAX_WBITS) != Z_OK) {
+        free(gzip);
+        return false;
+    }
+    trace->gzip = gzip;
+
+    // Compressed memory is inflated straight from where it is.
+    if (trace->borrowed) {
+        if (trace->buffer_size > UINT32_MAX) return false;
+        gzip->stream.next_in = (unsigned char *)trace->buffer;
+        gzip->stream.avail_in = trace->buffer_size;
+        trace->mapped = trace->borrowed = false;
+        trace->buffer_capacity = TRACE_READ_CHUNK;
+        trace->buffer = malloc(trace->buffer_capacity);
+        trace->position = trace->buffer_size = 0;
+        return trace->buffer != NULL;
+    }
+
+    // A compressed file is read rather than mapped, from the start.
+    if (trace->mapped) {
+        munmap(trace->buffer, trace->buffer_capacity);
+        trace->mapped = false;
+        trace->buffer_capacity = TRACE_READ_CHUNK;
+        trace->buffer = malloc(trace->buffer_capacity);
+        trace->position = trace->buffer_size = 0;
+        return trace->buffer && lseek(trace->fd, 0, SEEK_SET) == 0;
+    }
+
+    // The first fill read at most TRACE_READ_CHUNK bytes.
+    size_t available = trace->buffer_size - trace->position;
+    memcpy(gzip->input, trace->buffer + trace->position, available);
+    gzip->stream.next_in = gzip->input;
+    gzip->stream.avail_in = available;
+    trace->position = trace->buffer_size = 0;
+    trace->eof = false;
+    return true;
+}
+
+// Stop decoding a trace that turned out to be malformed. The first error is
+// the one that is reported.
+static void trace_fail(struct trace *trace, const char *error)
+{
+    if (!trace->error) trace->error = error;
+}
+
+// Make sure that at least `needed` unread bytes are in the buffer, unless the
+// end of the input is reached first.
+//
+// Returns (size_t): the number of unread bytes in the buffer.
+static size_t trace_fill(struct trace *trace, size_t needed)
+{
+    size_t available = trace->buffer_size - trace->position;
+    if (available >= needed || trace->mapped || trace->eof) return available;
+
+    memmove(trace->buffer, trace->buffer + trace->position, available);
+    trace->buffer_size = available;
+    trace->position = 0;
+
+    if (trace->buffer_capacity < needed) {
+        char *buffer = realloc(trace->buffer, needed + TRACE_READ_CHUNK);
+        if (!buffer) {
+            trace_fail(trace, "out of memory");
+            trace->eof = true;
+            return available;
+        }
+        trace->buffer = buffer;
+        trace->buffer_capacity = needed + TRACE_READ_CHUNK;
+    }
+
+    while (trace->buffer_size < needed) {
+        ssize_t n = trace_read(trace, trace->buffer + trace->buffer_size,
+                               trace->buffer_capacity - trace->buffer_size);
+        if (n <= 0) {
+            if (n < 0) trace_fail(trace, "cannot read the input");
+            trace->eof = true;
+            break;
+        }
+        trace->buffer_size += n;
+    }
+
+    return trace->buffer_size - trace->position;
+}
+
+// Text Format
+// ============================================================================
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+static inline const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+// Parse a 32-bit hexadecimal number with an optional 0x prefix. A number with
+// more than 8 significant digits does not fit and fails the record rather than
+// being truncated to its low bits.
+static bool parse_hex(const char **cursor, const char *end, uint32_t *value)
+{
+    const char *p = skip_space(*cursor, end);
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+
+    const char *start = p;
+    uint32_t result = 0;
+    uint32_t digits = 0;
+    for (; p < end; p++) {
+        char c = *p;
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            digit = (c | 0x20) - 'a' + 10;
+        else
+            break;
+        if (result != 0 || digit != 0) digits++;
+        if (digits > 8) return false;
+        result = (result << 4) | digit;
+    }
+    if (p == start) return false;
+
+    *cursor = p;
+    *value = result;
+    return true;
+}
+
+// Parse the direction of a record, which is either TAKEN or NOT_TAKEN.
+static bool parse_direction(const char **cursor, const char *end, uint8_t *direction)
+{
+    const char *p = skip_space(*cursor, end);
+    const char *word = p;
+    while (p < end && !is_space(*p)) p++;
+
+    if (p - word == 5 && !memcmp(word, "TAKEN", 5))
+        *direction = TAKEN;
+    else if (p - word == 9 && !memcmp(word, "NOT_TAKEN", 9))
+        *direction = NOT_TAKEN;
+    else
+        return false;
+
+    *cursor = p;
+    return true;
+}
+
+static bool parse_decimal(const char **cursor, const char *end, uint32_t *value)
+{
+    const char *p = skip_space(*cursor, end);
+    const char *start = p;
+    uint32_t result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) result = result * 10 + (*p - '0');
+    if (p == start) return false;
+
+    *cursor = p;
+    *value = result;
+    return true;
+}
+
+static inline const char *skip_blank(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+// Parse a target from the branch metadata, a stream record or a side file.
+// BRANCH_TARGET_UNKNOWN is reserved, so it is rejected like a malformed one.
+static bool parse_target(const char **cursor, const char *end, uint32_t *target)
+{
+    const char *p = *cursor;
+    if (!parse_hex(&p, end, target) || *target == BRANCH_TARGET_UNKNOWN) return false;
+    *cursor = p;
+    return true;
+}
+
+// Decode the records of the text and the stream formats, which are lines of
+// an address and a direction. If targets is set, a record may also have a
+// target on the same line, which is stored there (BRANCH_TARGET_UNKNOWN if the
+// record has none). A malformed record fails the trace.
+static uint32_t trace_text_records(struct trace *trace, uint32_t *addresses,
+                                   uint8_t *directions, uint32_t *targets, uint32_t max)
+{
+    uint32_t n = 0;
+    while (n < max && trace_fill(trace, TRACE_TEXT_LOOKAHEAD) > 0) {
+        const char *p = trace->buffer + trace->position;
+        const char *end = trace->buffer + trace->buffer_size;
+
+        // Blank space at the end of the input is not a record.
+        p = skip_space(p, end);
+        if (p == end) {
+            trace->position = p - trace->buffer;
+            continue;
+        }
+
+        if (!parse_hex(&p, end, &addresses[n]) || !parse_direction(&p, end, &directions[n])) {
+            trace_fail(trace, "malformed record");
+            break;
+        }
+        if (targets) {
+            targets[n] = BRANCH_TARGET_UNKNOWN;
+            p = skip_blank(p, end);
+            if (p < end && *p != '\n' && *p != '\r' && !parse_target(&p, end, &targets[n])) {
+                trace_fail(trace, "malformed target");
+                break;
+            }
+        }
+        n++;
+
+        trace->position = p - trace->buffer;
+    }
+    return n;
+}
+
+static uint32_t trace_text_next_block(struct trace *trace, uint32_t *addresses,
+                                      uint8_t *directions, uint32_t max)
+{
+    return trace_text_records(trace, addresses, directions, NULL, max);
+}
+
+static bool trace_text_detect(const char *data, size_t size)
+{
+    // Anything that is not in another format is read as text.
+    return true;
+}
+
+static bool trace_text_read_metadata(struct trace *trace)
+{
+    trace_fill(trace, TRACE_TEXT_LOOKAHEAD);
+    const char *p = trace->buffer + trace->position;
+    uint32_t num_branches;
+    if (!parse_decimal(&p, trace->buffer + trace->buffer_size, &num_branches)) return false;
+    trace->position = p - trace->buffer;
+
+    for (uint32_t i = 0; i < num_branches; i++) {
+        trace_fill(trace, TRACE_TEXT_LOOKAHEAD);
+        const char *end = trace->buffer + trace->buffer_size;
+        p = trace->buffer + trace->position;
+        struct branch_metadata branch;
+        if (!parse_hex(&p, end, &branch.address) || !parse_target(&p, end, &branch.target) ||
+            branch_index_insert(trace->branch_index, branch.address, branch.target) ==
+                BRANCH_INDEX_NONE)
+            return false;
+        trace->position = p - trace->buffer;
+    }
+    trace->records_start = trace->position;
+    return true;
+}
+
+// Stream Format
+// ============================================================================
+
+static uint32_t trace_stream_next_block(struct trace *trace, uint32_t *addresses,
+                                        uint8_t *directions, uint32_t max)
+{
+    return trace_text_records(trace, addresses, directions, trace->targets, max);
+}
+
+static bool trace_stream_detect(const char *data, size_t size)
+{
+    // The first line is a record rather than the number of branches.
+    const char *p = data;
+    const char *end = data + size;
+    uint32_t address;
+    if (!parse_hex(&p, end, &address)) return false;
+    p = skip_blank(p, end);
+    return (end - p >= 5 && !memcmp(p, "TAKEN", 5)) ||
+           (end - p >= 9 && !memcmp(p, "NOT_TAKEN", 9));
+}
+
+static bool trace_stream_read_metadata(struct trace *trace)
+{
+    // There is no header and no branch metadata.
+    trace->records_start = trace->position;
+    return true;
+}
+
+// Binary Format
+// ============================================================================
+
+static uint32_t trace_binary_next_block(struct trace *trace, uint32_t *addresses,
+                                        uint8_t *directions, uint32_t max)
+{
+    uint32_t n = 0;
+    while (n < max && trace->records_read < trace->num_records) {
+        if (trace_fill(trace, sizeof(struct trace_file_block)) <
+            sizeof(struct trace_file_block)) {
+            trace_fail(trace, "truncated block");
+            break;
+        }
+
+        const char *block = trace->buffer + trace->position;
+        uint32_t first = trace->records_read % TRACE_FILE_BLOCK_RECORDS;
+        uint64_t count = TRACE_FILE_BLOCK_RECORDS - first;
+        if (count > trace->num_records - trace->records_read)
+            count = trace->num_records - trace->records_read;
+        if (count > max - n) count = max - n;
+
+        uint64_t bits;
+        memcpy(&bits, block + offsetof(struct trace_file_block, directions), sizeof(bits));
+        memcpy(addresses + n, block + first * sizeof(uint32_t), count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < count; i++) addresses[n + i] = le32toh(addresses[n + i]);
+        bits = le64toh(bits) >> first;
+        for (uint32_t i = 0; i < count; i++) directions[n + i] = (bits >> i) & 1;
+
+        n += count;
+        trace->records_read += count;
+        if (trace->records_read % TRACE_FILE_BLOCK_RECORDS == 0)
+            trace->position += sizeof(struct trace_file_block);
+    }
+    return n;
+}
+
+static bool trace_binary_detect(const char *data, size_t size)
+{
+    return size >= sizeof(TRACE_FILE_MAGIC) &&
+           !memcmp(data, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC));
+}
+
+static bool trace_binary_read_metadata(struct trace *trace)
+{
+    struct trace_file_header header;
+    if (trace_fill(trace, sizeof(header)) < sizeof(header)) return false;
+    memcpy(&header, trace->buffer + trace->position, sizeof(header));
+    trace->position += sizeof(header);
+
+    uint32_t version = le32toh(header.version);
+    if (version != TRACE_FILE_VERSION) {
+        fprintf(stderr, "Unsupported binary trace version %u\n", version);
+        return false;
+    }
+    if (le32toh(header.block_records) != TRACE_FILE_BLOCK_RECORDS) return false;
+
+    trace->num_records = le64toh(header.num_records);
+
+    // The metadata is read one branch at a time, so that a header that claims
+    // more branches than the input holds is found out before it is buffered.
+    uint32_t num_branches = le32toh(header.num_branches);
+    for (uint32_t i = 0; i < num_branches; i++) {
+        struct branch_metadata branch;
+        if (trace_fill(trace, sizeof(branch)) < sizeof(branch)) return false;
+        memcpy(&branch, trace->buffer + trace->position, sizeof(branch));
+        if (branch_index_insert(trace->branch_index, le32toh(branch.address),
+                                le32toh(branch.target)) == BRANCH_INDEX_NONE)
+            return false;
+        trace->position += sizeof(branch);
+    }
+    trace->records_start = trace->position;
+
+    // The blocks of a mapped trace are checked up front, so that its cursors
+    // never run into a truncated block.
+    uint64_t num_blocks = trace->num_records / TRACE_FILE_BLOCK_RECORDS +
+                          (trace->num_records % TRACE_FILE_BLOCK_RECORDS != 0);
+    if (trace->mapped &&
+        (trace->buffer_size - trace->position) / sizeof(struct trace_file_block) < num_blocks)
+        return false;
+
+    return true;
+}
+
+// ChampSim Format
+// ============================================================================
+
+static uint32_t trace_champsim_next_block(struct trace *trace, uint32_t *addresses,
+                                          uint8_t *directions, uint32_t max)
+{
+    uint32_t n = 0;
+    while (n < max) {
+        size_t available = trace_fill(trace, TRACE_CHAMPSIM_LOOKAHEAD);
+        if (available < sizeof(struct champsim_record)) {
+            if (available) trace_fail(trace, "truncated record");
+            break;
+        }
+
+        const char *p = trace->buffer + trace->position;
+        const char *end = p + available / sizeof(struct champsim_record) *
+                                  sizeof(struct champsim_record);
+        for (; p < end && n < max; p += sizeof(struct champsim_record)) {
+            if (!p[offsetof(struct champsim_record, is_branch)]) continue;
+
+            uint64_t ip;
+            memcpy(&ip, p + offsetof(struct champsim_record, ip), sizeof(ip));
+            addresses[n] = (uint32_t)ip;
+            directions[n] = p[offsetof(struct champsim_record, branch_taken)] ? TAKEN : NOT_TAKEN;
+
+            // A taken branch jumps to the next instruction of the trace. If
+            // that is not buffered yet, a later execution will tell.
+            trace->targets[n] = BRANCH_TARGET_UNKNOWN;
+            if (directions[n] == TAKEN && end - p > (ptrdiff_t)sizeof(struct champsim_record)) {
+                memcpy(&ip, p + sizeof(struct champsim_record), sizeof(ip));
+                trace->targets[n] = (uint32_t)ip;
+            }
+            n++;
+        }
+        trace->position = p - trace->buffer;
+    }
+    return n;
+}
+
+static bool trace_champsim_read_metadata(struct trace *trace)
+{
+    // There is no header and no branch metadata.
+    trace->records_start = trace->position;
+    return true;
+}
+
+// Decoders
+// ============================================================================
+
+const struct trace_decoder trace_decoders[] = {
+    {"binary", TRACE_FORMAT_BINARY, &trace_binary_detect, &trace_binary_read_metadata,
+     &trace_binary_next_block, false},
+    {"stream", TRACE_FORMAT_STREAM, &trace_stream_detect, &trace_stream_read_metadata,
+     &trace_stream_next_block, true},
+    {"text", TRACE_FORMAT_TEXT, &trace_text_detect, &trace_text_read_metadata,
+     &trace_text_next_block, false},
+    {"champsim", TRACE_FORMAT_CHAMPSIM, NULL, &trace_champsim_read_metadata,
+     &trace_champsim_next_block, true},
+};
+
+const uint32_t num_trace_decoders = sizeof(trace_decoders) / sizeof(trace_decoders[0]);
+
+// Discovery
+// ============================================================================
+
+// Add the branches of decoded records to the branch index of a trace. The
+// trace fails if the index cannot hold them.
+static void trace_discover(struct trace *trace, const uint32_t *addresses,
+                           const uint32_t *targets, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (branch_index_insert(trace->branch_index, addresses[i], targets[i]) ==
+            BRANCH_INDEX_NONE) {
+            trace_fail(trace, "out of memory");
+            return;
+        }
+    }
+}
+
+// The next_block function of the traces whose decoder discovers the branches.
+static uint32_t trace_discover_next_block(struct trace *trace, uint32_t *addresses,
+                                          uint8_t *directions, uint32_t max)
+{
+    uint32_t n = trace->decoder->next_block(trace, addresses, directions, max);
+    trace_discover(trace, addresses, trace->targets, n);
+    return n;
+}
+
+bool trace_read_targets(struct trace *trace, FILE *file)
+{
+    uint32_t address, target;
+    int matched;
+    while ((matched = fscanf(file, "%" SCNx32 " %" SCNx32, &address, &target)) == 2) {
+        if (target == BRANCH_TARGET_UNKNOWN ||
+            branch_index_insert(trace->branch_index, address, target) == BRANCH_INDEX_NONE)
+            return false;
+    }
+    return matched == EOF && !ferror(file);
+}
+
+// Reader Thread
+// ============================================================================
+//
+// The reader thread (the producer) decodes blocks into a ring and the
+// simulation (the consumer) copies them out in next_block. head is the number
+// of blocks ever filled and tail the number ever emptied; each is only
+// written by one side, so handing a block over is a single release store.
+// Whichever side finds the ring full (or empty) polls it for a while and then
+// sleeps on a futex until the other side moves its index.
+
+struct trace_reader_block {
+    uint32_t count;
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+    // The branch index belongs to the simulation, so the targets of a trace
+    // that discovers its branches are added to it as the block is copied out.
+    uint32_t targets[TRACE_BLOCK_RECORDS];
+};
+
+struct trace_reader {
+    pthread_t thread;
+    uint32_t (*decode)(struct trace *trace, uint32_t *addresses, uint8_t *directions,
+                       uint32_t max);
+
+    // The indices live in cache lines of their own so that the two threads
+    // do not keep stealing each other's line.
+    _Alignas(64) _Atomic uint32_t head;
+    _Atomic uint32_t consumer_waiting;
+    _Alignas(64) _Atomic uint32_t tail;
+    _Atomic uint32_t producer_waiting;
+    _Atomic bool stop;
+
+    // The number of records of the block at tail that were already copied out
+    // (consumer only).
+    _Alignas(64) uint32_t offset;
+
+    struct trace_reader_block blocks[TRACE_READER_BLOCKS];
+};
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Wait until an index of the ring is no longer value.
+//
+// Returns (uint32_t): the new value of the index.
+static uint32_t trace_reader_wait(_Atomic uint32_t *index, _Atomic uint32_t *waiting,
+                                  uint32_t value)
+{
+    for (uint32_t i = 0; i < TRACE_READER_SPINS; i++) {
+        uint32_t current = atomic_load_explicit(index, memory_order_acquire);
+        if (current != value) return current;
+        cpu_relax();
+    }
+
+    // The other side either sees the flag and wakes us up, or has already
+    // moved the index, which the check (or the futex itself) notices.
+    for (;;) {
+        atomic_store(waiting, 1);
+        uint32_t current = atomic_load(index);
+        if (current != value) {
+            atomic_store_explicit(waiting, 0, memory_order_relaxed);
+            return current;
+        }
+        syscall(SYS_futex, index, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+    }
+}
+
+// Move an index of the ring, waking the other side if it is asleep.
+static void trace_reader_publish(_Atomic uint32_t *index, _Atomic uint32_t *waiting,
+                                 uint32_t value)
+{
+    atomic_store(index, value);
+    if (atomic_load(waiting)) {
+        atomic_store_explicit(waiting, 0, memory_order_relaxed);
+        syscall(SYS_futex, index, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static void *trace_reader_main(void *argument)
+{
+    struct trace *trace = argument;
+    struct trace_reader *reader = trace->reader;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    for (;;) {
+        while (head - tail == TRACE_READER_BLOCKS)
+            tail = trace_reader_wait(&reader->tail, &reader->producer_waiting, tail);
+        if (atomic_load_explicit(&reader->stop, memory_order_relaxed)) break;
+
+        // An empty block marks the end of the trace.
+        struct trace_reader_block *block = &reader->blocks[head % TRACE_READER_BLOCKS];
+        block->count =
+            reader->decode(trace, block->addresses, block->directions, TRACE_BLOCK_RECORDS);
+        if (trace->targets)
+            memcpy(block->targets, trace->targets, block->count * sizeof(uint32_t));
+        trace_reader_publish(&reader->head, &reader->consumer_waiting, ++head);
+        if (block->count == 0) break;
+    }
+    return NULL;
+}
+
+static uint32_t trace_reader_next_block(struct trace *trace, uint32_t *addresses,
+                                        uint8_t *directions, uint32_t max)
+{
+    struct trace_reader *reader = trace->reader;
+    uint32_t tail = atomic_load_explicit(&reader->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&reader->head, memory_order_acquire) == tail)
+        trace_reader_wait(&reader->head, &reader->consumer_waiting, tail);
+
+    struct trace_reader_block *block = &reader->blocks[tail % TRACE_READER_BLOCKS];
+    uint32_t count = block->count - reader->offset;
+    if (count > max) count = max;
+    memcpy(addresses, block->addresses + reader->offset, count * sizeof(uint32_t));
+    memcpy(directions, block->directions + reader->offset, count);
+    if (trace->targets)
+        trace_discover(trace, addresses, block->targets + reader->offset, count);
+    reader->offset += count;
+
+    // The end marker is never handed back, so every later call returns 0 too.
+    if (block->count != 0 && reader->offset == block->count) {
+        reader->offset = 0;
+        trace_reader_publish(&reader->tail, &reader->producer_waiting, tail + 1);
+    }
+    return count;
+}
+
+bool trace_start_reader(struct trace *trace)
+{
+    struct trace_reader *reader = aligned_alloc(64, sizeof(struct trace_reader));
+    if (!reader) return false;
+    memset(reader, 0, sizeof(*reader));
+    reader->decode = trace->decoder->next_block;
+    trace->reader = reader;
+    if (pthread_create(&reader->thread, NULL, &trace_reader_main, trace) != 0) {
+        trace->reader = NULL;
+        free(reader);
+        return false;
+    }
+    trace->next_block = &trace_reader_next_block;
+    return true;
+}
+
+static void trace_stop_reader(struct trace *trace)
+{
+    struct trace_reader *reader = trace->reader;
+
+    // Move tail so that a thread waiting for room wakes up and sees stop.
+    atomic_store_explicit(&reader->stop, true, memory_order_relaxed);
+    trace_reader_publish(&reader->tail, &reader->producer_waiting,
+                         atomic_load_explicit(&reader->tail, memory_order_relaxed) +
+                             TRACE_READER_BLOCKS);
+    pthread_join(reader->thread, NULL);
+
+    trace->next_block = trace->targets ? &trace_discover_next_block : reader->decode;
+    trace->reader = NULL;
+    free(reader);
+}
+
+// Reader
+// ============================================================================
+
+// Pick the decoder of a trace whose input is set up, and read the metadata.
+//
+// Returns (struct trace *): the trace, or NULL (after closing it) if the input
+// is malformed.
+static struct trace *trace_start(struct trace *trace, const struct trace_decoder *decoder)
+{
+    if (trace_fill(trace, sizeof(GZIP_MAGIC) - 1) >= sizeof(GZIP_MAGIC) - 1 &&
+        !memcmp(trace->buffer + trace->position, GZIP_MAGIC, sizeof(GZIP_MAGIC) - 1) &&
+        !trace_start_gzip(trace)) {
+        trace_close(trace);
+        return NULL;
+    }
+
+    // Enough for the magic of a binary trace and the first line of a text one.
+    size_t available = trace_fill(trace, TRACE_TEXT_LOOKAHEAD);
+    for (uint32_t i = 0; !decoder && i < num_trace_decoders; i++) {
+        if (trace_decoders[i].detect &&
+            trace_decoders[i].detect(trace->buffer + trace->position, available))
+            decoder = &trace_decoders[i];
+    }
+    trace->format = decoder->format;
+    trace->decoder = decoder;
+    trace->next_block = decoder->next_block;
+    trace->branch_index = branch_index_new(0, NULL);
+    bool ok = trace->branch_index != NULL;
+    if (decoder->discovers) {
+        trace->targets = malloc(TRACE_BLOCK_RECORDS * sizeof(uint32_t));
+        trace->next_block = &trace_discover_next_block;
+        ok = ok && trace->targets;
+    }
+    ok = ok && decoder->read_metadata(trace);
+
+    if (!ok) {
+        trace_close(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+struct trace *trace_open(int fd)
+{
+    return trace_open_format(fd, NULL);
+}
+
+struct trace *trace_open_format(int fd, const char *format)
+{
+    const struct trace_decoder *decoder = NULL;
+    for (uint32_t i = 0; format && !decoder && i < num_trace_decoders; i++)
+        if (!strcmp(trace_decoders[i].name, format)) decoder = &trace_decoders[i];
+    if (format && !decoder) {
+        fprintf(stderr, "Unknown trace format %s\n", format);
+        return NULL;
+    }
+
+    struct trace *trace = calloc(1, sizeof(struct trace));
+    if (!trace) return NULL;
+    trace->fd = fd;
+
+    // Memory-map regular files, read everything else through a buffer.
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            trace->mapped = true;
+            trace->buffer = map;
+            trace->buffer_size = st.st_size;
+            trace->buffer_capacity = st.st_size;
+        }
+    }
+    if (!trace->mapped) {
+        trace->buffer_capacity = TRACE_READ_CHUNK;
+        trace->buffer = malloc(trace->buffer_capacity);
+        if (!trace->buffer) {
+            free(trace);
+            return NULL;
+        }
+    }
+    return trace_start(trace, decoder);
+}
+
+struct trace *trace_open_memory(const void *data, size_t size)
+{
+    struct trace *trace = calloc(1, sizeof(struct trace));
+    if (!trace) return NULL;
+    trace->fd = -1;
+    trace->mapped = true;
+    trace->borrowed = true;
+    trace->buffer = (char *)data;
+    trace->buffer_size = size;
+    trace->buffer_capacity = size;
+    return trace_start(trace, NULL);
+}
+
+uint64_t trace_skip(struct trace *trace, uint64_t n)
+{
+    if (trace->format == TRACE_FORMAT_BINARY && trace->mapped && !trace->reader) {
+        uint64_t remaining = trace->num_records - trace->records_read;
+        if (n > remaining) n = remaining;
+        trace->records_read += n;
+        trace->position = trace->records_start + (trace->records_read / TRACE_FILE_BLOCK_RECORDS) *
+                                                     sizeof(struct trace_file_block);
+        return n;
+    }
+
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+    uint64_t skipped = 0;
+    while (skipped < n) {
+        uint32_t max = n - skipped < TRACE_BLOCK_RECORDS ? n - skipped : TRACE_BLOCK_RECORDS;
+        uint32_t count = trace->next_block(trace, addresses, directions, max);
+        if (count == 0) break;
+        skipped += count;
+    }
+    return skipped;
+}
+
+bool trace_cursor(const struct trace *trace, struct trace *cursor)
+{
+    if (!trace->mapped || trace->reader) return false;
+    *cursor = *trace;
+    cursor->records_read = 0;
+    cursor->position = trace->records_start;
+    return true;
+}
+
+void trace_close(struct trace *trace)
+{
+    if (trace->reader) trace_stop_reader(trace);
+    if (trace->gzip) {
+        inflateEnd(&trace->gzip->stream);
+        free(trace->gzip);
+    }
+    if (!trace->mapped)
+        free(trace->buffer);
+    else if (!trace->borrowed)
+        munmap(trace->buffer, trace->buffer_capacity);
+    if (trace->branch_index) branch_index_free(trace->branch_index);
+    free(trace->targets);
+    free(trace);
+}
+
+// Writer
+// ============================================================================
+
+bool trace_write_header(FILE *file, uint32_t num_branches,
+                        const struct branch_metadata *branch_metadatas, uint64_t num_records)
+{
+    struct trace_file_header header = {
+        .magic = TRACE_FILE_MAGIC,
+        .version = htole32(TRACE_FILE_VERSION),
+        .num_branches = htole32(num_branches),
+        .num_records = htole64(num_records),
+        .block_records = htole32(TRACE_FILE_BLOCK_RECORDS),
+    };
+    if (fwrite(&header, sizeof(header), 1, file) != 1) return false;
+    for (uint32_t i = 0; i < num_branches; i++) {
+        struct branch_metadata branch = {
+            .address = htole32(branch_metadatas[i].address),
+            .target = htole32(branch_metadatas[i].target),
+        };
+        if (fwrite(&branch, sizeof(branch), 1, file) != 1) return false;
+    }
+    return true;
+}
+
+struct trace_writer *trace_writer_open(FILE *file, uint32_t num_branches,
+                                       const struct branch_metadata *branch_metadatas)
+{
+    if (!trace_write_header(file, num_branches, branch_metadatas, 0)) return NULL;
+
+    struct trace_writer *writer = calloc(1, sizeof(struct trace_writer));
+    if (!writer) return NULL;
+    writer->file = file;
+    return writer;
+}
+
+// Write out the block that is being filled.
+static bool trace_writer_flush(struct trace_writer *writer)
+{
+    writer->block.directions = htole64(writer->block.directions);
+    bool ok = fwrite(&writer->block, sizeof(writer->block), 1, writer->file) == 1;
+    memset(&writer->block, 0, sizeof(writer->block));
+    return ok;
+}
+
+bool trace_writer_append(struct trace_writer *writer, uint32_t address,
+                         enum branch_direction branch_direction)
+{
+    writer->block.addresses[writer->block_fill] = htole32(address);
+    if (branch_direction == TAKEN) writer->block.directions |= 1ull << writer->block_fill;
+    writer->num_records++;
+
+    if (++writer->block_fill == TRACE_FILE_BLOCK_RECORDS) {
+        writer->block_fill = 0;
+        return trace_writer_flush(writer);
+    }
+    return true;
+}
+
+bool trace_writer_close(struct trace_writer *writer)
+{
+    bool ok = true;
+    if (writer->block_fill > 0) ok = trace_writer_flush(writer);
+
+    // Patch the record count into the header.
+    uint64_t num_records = htole64(writer->num_records);
+    ok = ok && fseek(writer->file, offsetof(struct trace_file_header, num_records), SEEK_SET) == 0;
+    ok = ok && fwrite(&num_records, sizeof(num_records), 1, writer->file) == 1;
+    ok = ok && fseek(writer->file, 0, SEEK_END) == 0;
+    ok = ok && fflush(writer->file) == 0;
+
+    free(writer);
+    return ok;
+}
@@ -0,0 +1,363 @@
+//
+// This file defines the trace reader that main uses to load the branch
+// metadata and the branch records from the input trace.
+//
+// Each trace format has a decoder in trace_decoders, and trace_open picks the
+// right one by looking at the first bytes of the input:
+//
+//  * text: the text format described in the README.
+//  * stream: the text format without the branch metadata at the start, see
+//    below.
+//  * binary: the binary format described below.
+//  * champsim: the instruction traces of the ChampSim simulator, described
+//    below. They cannot be told apart from other data, so this decoder is
+//    only used when it is asked for by name (see trace_open_format).
+//
+// The unique branches of a trace are kept in a branch index (see
+// branch_index.h). For the text and binary formats it holds the branch
+// metadata at the start of the trace. The stream and champsim formats have no
+// metadata: their branches are added to the index as the records are read,
+// before next_block returns them, together with any target that the records
+// carry. A side file can give the targets of the branches of any trace (see
+// trace_read_targets).
+//
+// Input of any format that starts with the gzip magic is decompressed with
+// zlib as it is read.
+//
+// When the input is a regular file it is memory-mapped, otherwise (for
+// example when the trace is piped in or compressed) it is read through a
+// large buffer.
+//
+// trace_start_reader moves the decoding to a thread of its own, which hands
+// blocks of decoded records to the simulation through a ring, so that the
+// input is decoded while the previous blocks are simulated.
+//
+// Binary Trace Format
+// ===================
+//
+// All integers are little-endian, whatever the byte order of the host.
+//
+//      struct trace_file_header            (32 bytes)
+//      struct branch_metadata[num_branches] (8 bytes each)
+//      struct trace_file_block[ceil(num_records / 64)]
+//
+// Each block holds the addresses of 64 consecutive branch records followed
+// by a 64-bit word whose bit i is set if record i of the block was TAKEN.
+// The last block is zero-padded; num_records in the header tells how many
+// of its records are valid. Since every block has the same size, record n
+// can be found without reading any of the records before it.
+//
+// Stream Trace Format
+// ===================
+//
+// One record per line and no header, so that a tracer can write the trace as
+// the program runs:
+//
+//      ADDRESS TAKEN|NOT_TAKEN [TARGET]
+//
+// where ADDRESS and TARGET are hexadecimal. A trace is in this format if its
+// first line is a record. A TARGET of 0xffffffff is reserved for unknown
+// targets (BRANCH_TARGET_UNKNOWN), so a record that gives it is malformed,
+// like the metadata of the text format that gives it.
+//
+// ChampSim Trace Format
+// =====================
+//
+// A sequence of 64-byte struct champsim_record, one per instruction and
+// without any header. Only the instructions whose is_branch is set are
+// branch records; the low 32 bits of ip are used as the branch address. The
+// records have no target, so the target of a branch is taken from the ip of
+// the instruction after it the first time it is taken. Until then BTFNT
+// predicts it not taken.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "branch_index.h"
+#include "branch_metadata.h"
+
+#define TRACE_FILE_MAGIC "BRSIMTR"
+#define TRACE_FILE_VERSION 1
+#define TRACE_FILE_BLOCK_RECORDS 64
+
+// The maximum number of records returned by a single call to next_block.
+#define TRACE_BLOCK_RECORDS 4096
+
+// The number of decoded blocks that a reader thread can be ahead of the
+// simulation.
+#define TRACE_READER_BLOCKS 16
+
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_branches;
+    uint64_t num_records;
+    uint32_t block_records;
+    uint32_t reserved;
+};
+
+struct trace_file_block {
+    uint32_t addresses[TRACE_FILE_BLOCK_RECORDS];
+    uint64_t directions;
+};
+
+struct champsim_record {
+    uint64_t ip;
+    uint8_t is_branch;
+    uint8_t branch_taken;
+    uint8_t destination_registers[2];
+    uint8_t source_registers[4];
+    uint64_t destination_memory[2];
+    uint64_t source_memory[4];
+};
+
+enum trace_format {
+    TRACE_FORMAT_TEXT,
+    TRACE_FORMAT_STREAM,
+    TRACE_FORMAT_BINARY,
+    TRACE_FORMAT_CHAMPSIM
+};
+
+struct trace;
+
+struct trace_decoder {
+    const char *name;
+    enum trace_format format;
+
+    // This function is called with the first bytes of the input to tell
+    // whether they are in this format. It is NULL for formats that are only
+    // used when asked for by name.
+    //
+    // Returns (bool): true if the input is in this format.
+    bool (*detect)(const char *data, size_t size);
+
+    // This function is called once to read the branch metadata at the start
+    // of the input into the branch index of the trace.
+    //
+    // Returns (bool): false if the input is malformed.
+    bool (*read_metadata)(struct trace *trace);
+
+    // The next_block function of the traces in this format.
+    uint32_t (*next_block)(struct trace *trace, uint32_t *addresses, uint8_t *directions,
+                           uint32_t max);
+
+    // Set for formats without branch metadata. next_block also fills
+    // trace->targets with the target of each record (BRANCH_TARGET_UNKNOWN
+    // if the record does not tell).
+    bool discovers;
+};
+
+// All of the trace decoders, in the order in which they are tried. The
+// decoders without a detect function come last.
+extern const struct trace_decoder trace_decoders[];
+extern const uint32_t num_trace_decoders;
+
+struct trace {
+    // This function is called to decode the next records of the trace.
+    //
+    // Arguments
+    //  * trace: the trace to read from.
+    //  * addresses: filled with the branch instruction addresses.
+    //  * directions: filled with the actual direction of each branch.
+    //  * max: the maximum number of records to decode (at most
+    //    TRACE_BLOCK_RECORDS).
+    //
+    // Returns (uint32_t): the number of records decoded, 0 at the end of the
+    // trace or after an error.
+    uint32_t (*next_block)(struct trace *trace, uint32_t *addresses, uint8_t *directions,
+                           uint32_t max);
+
+    // Set when the records turn out to be malformed or the input cannot be
+    // read, which ends the trace early, so every reader checks it once
+    // next_block returns 0. Otherwise NULL.
+    const char *error;
+
+    enum trace_format format;
+    const struct trace_decoder *decoder;
+
+    // The unique branches of the trace. It is shared with the predictors and
+    // the profiles that use it, and grows as the trace is read if the decoder
+    // discovers the branches.
+    struct branch_index *branch_index;
+
+    // The targets of the records of the last block, if the decoder discovers
+    // the branches.
+    uint32_t *targets;
+
+    // Input buffer. When the input is memory-mapped this is the whole file.
+    // When it is compressed, gzip holds the zlib stream that fills it. A
+    // borrowed buffer is memory that belongs to the caller of
+    // trace_open_memory, which is treated like a mapping.
+    int fd;
+    bool mapped;
+    bool borrowed;
+    bool eof;
+    struct trace_gzip *gzip;
+    char *buffer;
+    size_t buffer_size;
+    size_t buffer_capacity;
+    size_t position;
+
+    // The offset of the first record in the input.
+    size_t records_start;
+
+    // Binary format only.
+    uint64_t num_records;
+    uint64_t records_read;
+
+    // Set by trace_start_reader. From then on only the reader thread touches
+    // the input buffer and the decoder state above.
+    struct trace_reader *reader;
+};
+
+//
+// Open a trace and read its branch metadata.
+//
+// Arguments
+//  * fd: the file descriptor to read the trace from.
+//
+// Returns (struct trace *): the trace, or NULL if the input is malformed.
+struct trace *trace_open(int fd);
+
+//
+// Open a trace in the given format and read its branch metadata.
+//
+// Arguments
+//  * fd: the file descriptor to read the trace from.
+//  * format: the name of a decoder in trace_decoders, or NULL to detect the
+//    format like trace_open.
+//
+// Returns (struct trace *): the trace, or NULL if the format is unknown or the
+// input is malformed.
+struct trace *trace_open_format(int fd, const char *format);
+
+//
+// Open a trace that is already in memory and read its branch metadata. The
+// format is detected like trace_open. The memory must stay valid until the
+// trace is closed.
+//
+// Arguments
+//  * data: the trace.
+//  * size: the size of the trace in bytes.
+//
+// Returns (struct trace *): the trace, or NULL if the input is malformed.
+struct trace *trace_open_memory(const void *data, size_t size);
+
+//
+// Decode the rest of a trace on a thread of its own. Blocks of
+// TRACE_BLOCK_RECORDS records are decoded ahead into a ring of
+// TRACE_READER_BLOCKS blocks and next_block copies them out; the thread waits
+// whenever the ring is full. trace_skip and trace_cursor lose their fast
+// paths once the reader is started, so skip first.
+//
+// Arguments
+//  * trace: the trace, which must not be read from any other thread.
+//
+// Returns (bool): false if the thread could not be started, in which case the
+// trace is still read on the calling thread.
+bool trace_start_reader(struct trace *trace);
+
+//
+// Skip records of a trace without decoding them where possible. Skipping in a
+// memory-mapped binary trace takes constant time.
+//
+// Arguments
+//  * trace: the trace to skip records in.
+//  * n: the number of records to skip.
+//
+// Returns (uint64_t): the number of records skipped, less than n if the end
+// of the trace was reached.
+uint64_t trace_skip(struct trace *trace, uint64_t n);
+
+//
+// Make an independent read position into a memory-mapped trace, so that a
+// trace can be read several times, or by several threads at once. The cursor
+// shares the mapping and the metadata with the trace, and must not be closed
+// or used after the trace is closed. Skipping records in the cursor of a
+// binary trace takes constant time. The cursors of a trace that discovers its
+// branches add them to the branch index of the trace, so they must only be
+// read by one thread at a time.
+//
+// Arguments
+//  * trace: the trace.
+//  * cursor: filled with the cursor, positioned at the first record.
+//
+// Returns (bool): false if the trace is not memory-mapped or is read by a
+// reader thread.
+bool trace_cursor(const struct trace *trace, struct trace *cursor);
+
+//
+// Read the targets of branches from a side file into the branch index of a
+// trace. The file has one branch per line, "ADDRESS TARGET" in hexadecimal
+// like the branch metadata of the text format, and no count. Branches that
+// are not in the index yet are added to it.
+//
+// Arguments
+//  * trace: the trace.
+//  * file: the side file.
+//
+// Returns (bool): false if the file is malformed, gives the reserved target
+// BRANCH_TARGET_UNKNOWN or has more branches than the index can hold.
+bool trace_read_targets(struct trace *trace, FILE *file);
+
+//
+// Release all of the resources held by a trace.
+//
+// Arguments
+//  * trace: the trace to close.
+void trace_close(struct trace *trace);
+
+//
+// Write the header and the metadata of a binary trace.
+//
+// Arguments
+//  * file: the output file.
+//  * num_branches: the number of unique branches.
+//  * branch_metadatas: the metadata of each of the unique branches.
+//  * num_records: the number of records that follow.
+//
+// Returns (bool): false on an I/O error.
+bool trace_write_header(FILE *file, uint32_t num_branches,
+                        const struct branch_metadata *branch_metadatas, uint64_t num_records);
+
+// Writes a trace in the binary format. The output must be seekable because
+// the header is patched with the record count when the writer is closed.
+struct trace_writer {
+    FILE *file;
+    uint64_t num_records;
+    uint32_t block_fill;
+    struct trace_file_block block;
+};
+
+//
+// Start writing a binary trace by writing the header and the metadata.
+//
+// Arguments
+//  * file: the output file.
+//  * num_branches: the number of unique branches.
+//  * branch_metadatas: the metadata of each of the unique branches.
+//
+// Returns (struct trace_writer *): the writer, or NULL on an I/O error.
+struct trace_writer *trace_writer_open(FILE *file, uint32_t num_branches,
+                                       const struct branch_metadata *branch_metadatas);
+
+//
+// Append a branch record to a binary trace.
+//
+// Returns (bool): false on an I/O error.
+bool trace_writer_append(struct trace_writer *writer, uint32_t address,
+                         enum branch_direction branch_direction);
+
+//
+// Flush the last block, patch the header and free the writer. The file
+// itself is not closed.
+//
+// Returns (bool): false on an I/O error.
+bool trace_writer_close(struct trace_writer *writer);
+
+#endif
@@ -1,3 +1,7 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+
 #include "util.h"
 
 void print_n_lsb_as_binary(int number, int n_bits)
@@ -9,3 +13,23 @@ void print_n_lsb_as_binary(int number, int n_bits)
             printf("0");
     }
 }
+
+bool simd_enabled = true;
+
+bool simd_has_avx2(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return simd_enabled && __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+bool parse_number(const char *text, uint64_t *value)
+{
+    if (!isdigit((unsigned char)text[0])) return false;
+    char *end;
+    errno = 0;
+    *value = strtoull(text, &end, 10);
+    return *end == '\0' && errno == 0;
+}
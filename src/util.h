@@ -5,6 +5,8 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 //
@@ -15,4 +17,32 @@
 //  * n_bits: the number of bits to print.
 void print_n_lsb_as_binary(int number, int n_bits);
 
+// Whether the SIMD versions of the simulation kernels may be used. Cleared by
+// --no-simd to run the scalar versions instead.
+extern bool simd_enabled;
+
+//
+// Check whether the AVX2 kernels can be used.
+//
+// Returns (bool): true if SIMD is enabled and the CPU supports AVX2.
+bool simd_has_avx2(void);
+
+//
+// Parse the decimal number given to a command-line option.
+//
+// Arguments
+//  * text: the text of the option.
+//  * value: filled with the number.
+//
+// Returns (bool): false if the text is not a non-negative number, has
+// anything after the number, or is out of range.
+bool parse_number(const char *text, uint64_t *value);
+
+//
+// Check whether a number is a (non-zero) power of two.
+static inline bool is_power_of_two(uint64_t number)
+{
+    return number && !(number & (number - 1));
+}
+
 #endif
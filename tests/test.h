@@ -0,0 +1,56 @@
+//
+// This file defines the checks used by the unit tests in tests/. A test
+// program runs all of its checks, printing each one that fails, and returns
+// test_finish() from main, which is 1 if any of them failed.
+//
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static uint32_t test_checks;
+static uint32_t test_failures;
+
+// Check that a condition holds.
+#define CHECK(condition) test_check((condition), #condition, __FILE__, __LINE__)
+
+// Check that two integers are equal, and print both of them if they are not.
+#define CHECK_EQ(actual, expected)                                                         \
+    test_check_eq((uint64_t)(actual), (uint64_t)(expected), #actual, #expected, __FILE__, \
+                  __LINE__)
+
+static inline bool test_check(bool ok, const char *condition, const char *file, int line)
+{
+    test_checks++;
+    if (!ok) {
+        test_failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+    }
+    return ok;
+}
+
+static inline bool test_check_eq(uint64_t actual, uint64_t expected, const char *actual_str,
+                                 const char *expected_str, const char *file, int line)
+{
+    test_checks++;
+    if (actual != expected) {
+        test_failures++;
+        fprintf(stderr, "%s:%d: check failed: %s == %s (%" PRIu64 " != %" PRIu64 ")\n", file,
+                line, actual_str, expected_str, actual, expected);
+    }
+    return actual == expected;
+}
+
+// Print a summary of the checks.
+//
+// Returns (int): the exit status of the test program.
+static inline int test_finish(const char *name)
+{
+    printf("%s: %u checks, %u failed\n", name, test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,171 @@
+//
+// Tests of the branch index in src/branch_index.c and of BTFNT, which looks
+// its branches up in it.
+//
+
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "branch_index.h"
+#include "branch_predictors.h"
+#include "test.h"
+
+static void test_lookup(void)
+{
+    // The second entry for 0x100 is ignored like in a scan of the list.
+    struct branch_metadata branches[] = {
+        {0x100, 0x80}, {0x200, 0x300}, {0x300, 0x300}, {0x100, 0x400},
+    };
+    struct branch_index *branch_index = branch_index_new(4, branches);
+    if (!CHECK(branch_index)) return;
+    CHECK_EQ(branch_index->num_branches, 3);
+
+    CHECK_EQ(branch_index_lookup(branch_index, 0x100), (0 << 1) | BRANCH_INDEX_BACKWARD);
+    CHECK_EQ(branch_index_lookup(branch_index, 0x200), 1 << 1);
+    CHECK_EQ(branch_index_lookup(branch_index, 0x300), (2 << 1) | BRANCH_INDEX_BACKWARD);
+    CHECK_EQ(branch_index_lookup(branch_index, 0x104), BRANCH_INDEX_NONE);
+    CHECK_EQ(branch_index_target(branch_index, 0x100), 0x80);
+    CHECK_EQ(branch_index_target(branch_index, 0x104), BRANCH_TARGET_UNKNOWN);
+    branch_index_free(branch_index);
+}
+
+static void test_many_branches(void)
+{
+    // Addresses that only differ in their high bits all land in the same
+    // slot without a good hash.
+    uint32_t num_branches = 1 << 16;
+    struct branch_metadata *branches = malloc(num_branches * sizeof(struct branch_metadata));
+    for (uint32_t i = 0; i < num_branches; i++) {
+        branches[i].address = i << 16;
+        branches[i].target = i % 2 ? (i << 16) - 4 : (i << 16) + 4;
+    }
+    struct branch_index *branch_index = branch_index_new(num_branches, branches);
+    if (CHECK(branch_index)) {
+        CHECK(2ull * num_branches <= (uint64_t)branch_index->mask + 1);
+        bool ok = true;
+        for (uint32_t i = 1; i < num_branches; i++) {
+            uint32_t value = branch_index_lookup(branch_index, i << 16);
+            ok = ok && value == ((i << 1) | (i % 2 ? BRANCH_INDEX_BACKWARD : 0));
+            ok = ok && branch_index_lookup(branch_index, (i << 16) | 4) == BRANCH_INDEX_NONE;
+        }
+        CHECK(ok);
+        branch_index_free(branch_index);
+    }
+    free(branches);
+}
+
+static void test_limits(void)
+{
+    // Too many branches are rejected before anything is allocated.
+    CHECK(!branch_index_new(BRANCH_INDEX_MAX_BRANCHES + 1, NULL));
+    CHECK(!branch_index_new(UINT32_MAX, NULL));
+
+    struct branch_index *branch_index = branch_index_new(0, NULL);
+    if (!CHECK(branch_index)) return;
+    CHECK_EQ(branch_index->num_branches, 0);
+    CHECK_EQ(branch_index_lookup(branch_index, 0), BRANCH_INDEX_NONE);
+    branch_index_free(branch_index);
+}
+
+static void test_growth(void)
+{
+    // Branches that are discovered one at a time keep their positions while
+    // the table doubles, and a target that is found later is filled in.
+    struct branch_index *branch_index = branch_index_new(0, NULL);
+    if (!CHECK(branch_index)) return;
+    uint32_t num_branches = 1 << 17;
+    bool ok = true;
+    for (uint32_t i = 0; i < num_branches; i++)
+        ok = ok && branch_index_insert(branch_index, i << 12, BRANCH_TARGET_UNKNOWN) == i << 1;
+    CHECK(ok);
+    CHECK_EQ(branch_index->num_branches, num_branches);
+    CHECK(2ull * num_branches <= (uint64_t)branch_index->mask + 1);
+    CHECK(4ull * num_branches > (uint64_t)branch_index->mask + 1);
+
+    for (uint32_t i = 0; i < num_branches; i++) {
+        ok = ok && branch_index_lookup(branch_index, i << 12) == i << 1;
+        ok = ok && branch_index_lookup(branch_index, (i << 12) | 4) == BRANCH_INDEX_NONE;
+    }
+    CHECK(ok);
+
+    CHECK_EQ(branch_index_insert(branch_index, 5 << 12, 0x100), (5 << 1) | BRANCH_INDEX_BACKWARD);
+    CHECK_EQ(branch_index_target(branch_index, 5 << 12), 0x100);
+    // A known target is kept.
+    CHECK_EQ(branch_index_insert(branch_index, 5 << 12, 0x7000), (5 << 1) | BRANCH_INDEX_BACKWARD);
+    CHECK_EQ(branch_index_target(branch_index, 5 << 12), 0x100);
+    CHECK_EQ(branch_index->num_branches, num_branches);
+    branch_index_free(branch_index);
+}
+
+static void test_insert_failure(void)
+{
+    // An index that holds as many branches as it can takes no more, but its
+    // branches can still be looked up and given their targets.
+    struct branch_metadata branches[] = {{0x100, BRANCH_TARGET_UNKNOWN}};
+    struct branch_index *branch_index = branch_index_new(1, branches);
+    if (!CHECK(branch_index)) return;
+    branch_index->num_branches = BRANCH_INDEX_MAX_BRANCHES;
+    CHECK_EQ(branch_index_insert(branch_index, 0x200, 0x300), BRANCH_INDEX_NONE);
+    CHECK_EQ(branch_index_lookup(branch_index, 0x200), BRANCH_INDEX_NONE);
+    CHECK_EQ(branch_index_insert(branch_index, 0x100, 0x80), BRANCH_INDEX_BACKWARD);
+    branch_index->num_branches = 1;
+    branch_index_free(branch_index);
+
+    // When the branch list or the table cannot grow, the new branch is not
+    // added and the index is left as it was. The list of 2^24 branches fits
+    // in the lowered address space once doubled, the doubled table does not.
+    uint32_t num_branches = 1 << 24;
+    struct branch_metadata *many = malloc(num_branches * sizeof(struct branch_metadata));
+    if (!CHECK(many)) return;
+    for (uint32_t i = 0; i < num_branches; i++)
+        many[i] = (struct branch_metadata){i << 4, BRANCH_TARGET_UNKNOWN};
+    branch_index = branch_index_new(num_branches, many);
+    free(many);
+    if (!CHECK(branch_index)) return;
+    uint32_t mask = branch_index->mask;
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    struct rlimit lowered = {1ull << 30, limit.rlim_max};
+    if (CHECK(setrlimit(RLIMIT_AS, &lowered) == 0)) {
+        CHECK_EQ(branch_index_insert(branch_index, 0x8, 0x4), BRANCH_INDEX_NONE);
+        CHECK_EQ(branch_index->num_branches, num_branches);
+        CHECK_EQ(branch_index->mask, mask);
+        CHECK_EQ(branch_index_lookup(branch_index, 0x8), BRANCH_INDEX_NONE);
+        CHECK_EQ(branch_index_insert(branch_index, 0x10, 0x4), (1 << 1) | BRANCH_INDEX_BACKWARD);
+        setrlimit(RLIMIT_AS, &limit);
+    }
+
+    // With the address space back, it grows again.
+    CHECK_EQ(branch_index_insert(branch_index, 0x8, 0x4),
+             (num_branches << 1) | BRANCH_INDEX_BACKWARD);
+    CHECK(branch_index->mask > mask);
+    CHECK_EQ(branch_index_lookup(branch_index, 0x10), (1 << 1) | BRANCH_INDEX_BACKWARD);
+    CHECK_EQ(branch_index_lookup(branch_index, (num_branches - 1) << 4), (num_branches - 1) << 1);
+    branch_index_free(branch_index);
+}
+
+static void test_btfnt(void)
+{
+    struct branch_metadata branches[] = {{0x100, 0x80}, {0x200, 0x300}, {0x300, 0x300}};
+    struct branch_predictor *bp = btfnt_branch_predictor_new(3, branches);
+    if (!CHECK(bp)) return;
+    CHECK_EQ(bp->predict(bp, 0x100), TAKEN);
+    CHECK_EQ(bp->predict(bp, 0x200), NOT_TAKEN);
+    CHECK_EQ(bp->predict(bp, 0x300), TAKEN);
+    // A branch that is not in the metadata is predicted not taken.
+    CHECK_EQ(bp->predict(bp, 0x400), NOT_TAKEN);
+    bp->cleanup(bp);
+    free(bp);
+}
+
+int main(void)
+{
+    test_lookup();
+    test_many_branches();
+    test_limits();
+    test_growth();
+    test_insert_failure();
+    test_btfnt();
+    return test_finish("test_branch_index");
+}
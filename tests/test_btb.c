@@ -0,0 +1,166 @@
+//
+// Tests of the finite BTB in src/btb.c and of the BTB predictor that puts it
+// in front of a direction predictor.
+//
+
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "branch_index.h"
+#include "branch_predictors.h"
+#include "btb.h"
+#include "test.h"
+
+// Three branches in set 0 of a BTB with two sets of two ways and 8-bit tags,
+// with the tags 8, 16 and 24.
+#define A 0x10
+#define B 0x20
+#define C 0x30
+
+static uint32_t tag(uint32_t address)
+{
+    return ((address >> 1) & 0xff) | BTB_VALID;
+}
+
+// Run the same sequence through each policy. Only its results differ.
+static void test_policy(enum btb_policy policy, const enum btb_result *expected,
+                        uint32_t first, uint32_t second)
+{
+    static const struct {
+        uint32_t address;
+        bool taken;
+    } accesses[] = {{A, true}, {B, true}, {A, true}, {C, true}, {B, true}, {A, false}, {C, true}};
+
+    struct btb *btb = btb_new(4, 2, policy, 8);
+    bool ok = true;
+    for (uint32_t i = 0; i < 7; i++) {
+        uint32_t address = accesses[i].address;
+        ok = CHECK_EQ(btb_access(btb, address, address + 0x100, accesses[i].taken), expected[i]) &&
+             ok;
+    }
+    if (!ok) fprintf(stderr, "  policy %d\n", policy);
+
+    uint64_t hits = 0;
+    for (uint32_t i = 0; i < 7; i++) hits += expected[i] == BTB_HIT;
+    CHECK_EQ(btb->hits, hits);
+    CHECK_EQ(btb->misses, 7 - hits);
+    CHECK_EQ(btb->taken_misses, 6 - hits);
+    CHECK_EQ(btb->wrong_targets, 0);
+    // The ways of set 0 in replacement order, and the targets that were
+    // stored with them.
+    CHECK_EQ(btb->ways[0].tag, tag(first));
+    CHECK_EQ(btb->ways[1].tag, tag(second));
+    CHECK_EQ(btb->ways[0].target, first + 0x100);
+    // Set 1 was never used.
+    CHECK_EQ(btb->ways[2].tag, 0);
+    btb_free(btb);
+}
+
+static void test_policies(void)
+{
+    enum btb_result H = BTB_HIT, M = BTB_MISS;
+
+    // LRU: the hit on A moves it to the front, so C replaces B, and B then
+    // replaces A. The not-taken A is not inserted and the hit on C moves it
+    // back to the front.
+    enum btb_result lru[] = {M, M, H, M, M, M, H};
+    test_policy(BTB_POLICY_LRU, lru, C, B);
+
+    // FIFO: hits do not change the order, so C replaces A, the oldest, and B
+    // still hits.
+    enum btb_result fifo[] = {M, M, H, M, H, M, H};
+    test_policy(BTB_POLICY_FIFO, fifo, C, B);
+
+    // Random: A and B fill the empty ways in order, then the first two draws
+    // of the generator pick way 1 for C and way 0 for B.
+    enum btb_result random[] = {M, M, H, M, M, M, H};
+    test_policy(BTB_POLICY_RANDOM, random, B, C);
+}
+
+static void test_targets(void)
+{
+    // With a single tag bit, D shares the entry of A.
+    const uint32_t D = 0x14;
+    struct btb *btb = btb_new(4, 2, BTB_POLICY_LRU, 1);
+    CHECK_EQ(btb_access(btb, A, 0x100, true), BTB_MISS);
+    CHECK_EQ(btb_access(btb, D, 0x200, true), BTB_WRONG_TARGET);
+    // The taken D replaced the target, which a not-taken A does not.
+    CHECK_EQ(btb_access(btb, A, 0x100, false), BTB_WRONG_TARGET);
+    CHECK_EQ(btb_access(btb, D, 0x200, true), BTB_HIT);
+    // A branch whose target is not known cannot hit the wrong target.
+    CHECK_EQ(btb_access(btb, A, BRANCH_TARGET_UNKNOWN, true), BTB_HIT);
+    CHECK_EQ(btb->ways[0].target, 0x200);
+    CHECK_EQ(btb->wrong_targets, 2);
+    CHECK_EQ(btb->hits, 2);
+    btb_free(btb);
+
+    // Neither can a branch that was inserted before its target was known.
+    btb = btb_new(4, 2, BTB_POLICY_LRU, 8);
+    CHECK_EQ(btb_access(btb, A, BRANCH_TARGET_UNKNOWN, true), BTB_MISS);
+    CHECK_EQ(btb_access(btb, A, 0x100, true), BTB_HIT);
+    CHECK_EQ(btb->ways[0].target, 0x100);
+    CHECK_EQ(btb_access(btb, A, 0x100, true), BTB_HIT);
+    CHECK_EQ(btb->wrong_targets, 0);
+    btb_free(btb);
+}
+
+static void test_predictor(void)
+{
+    // A BTB miss is predicted not taken whatever the direction predictor
+    // says, and the BTB state regions are its ways and its random state.
+    struct branch_metadata branches[] = {{A, 0x110}, {B, 0x120}, {C, 0x130}};
+    struct branch_index *branch_index = branch_index_new(3, branches);
+    struct branch_predictor *bp =
+        branch_predictor_new("BTB:entries=4:ways=2:tag=8:policy=fifo+AT", branch_index);
+    if (CHECK(bp)) {
+        static const uint32_t addresses[] = {A, B, A, C, B};
+        enum branch_direction predictions[5];
+        for (uint32_t i = 0; i < 5; i++) {
+            predictions[i] = bp->predict(bp, addresses[i]);
+            bp->handle_result(bp, addresses[i], TAKEN);
+        }
+        CHECK_EQ(predictions[0], NOT_TAKEN);
+        CHECK_EQ(predictions[1], NOT_TAKEN);
+        CHECK_EQ(predictions[2], TAKEN);
+        CHECK_EQ(predictions[3], NOT_TAKEN);
+        CHECK_EQ(predictions[4], TAKEN);
+        CHECK_EQ(bp->btb->hits, 2);
+        CHECK_EQ(bp->btb->taken_misses, 3);
+
+        struct branch_predictor_state_region regions[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+        CHECK_EQ(bp->state_regions(bp, regions), 2);
+        CHECK(regions[0].data == bp->btb->ways);
+        CHECK_EQ(regions[0].size, 4 * sizeof(struct btb_way));
+        CHECK(regions[1].data == &bp->btb->random_state);
+        bp->cleanup(bp);
+        free(bp);
+    }
+    branch_index_free(branch_index);
+}
+
+static void test_allocation_failure(void)
+{
+    // A BTB that does not fit in the address space fails construction, and so
+    // does the predictor in front of which it is put.
+    struct branch_index *branch_index = branch_index_new(0, NULL);
+    if (!CHECK(branch_index)) return;
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    struct rlimit lowered = {1ull << 30, limit.rlim_max};
+    if (CHECK(setrlimit(RLIMIT_AS, &lowered) == 0)) {
+        CHECK(!btb_new(1u << 28, 4, BTB_POLICY_LRU, 8));
+        CHECK(!branch_predictor_new("BTB:entries=268435456:ways=4+2BG", branch_index));
+        setrlimit(RLIMIT_AS, &limit);
+    }
+    CHECK_EQ(branch_index->references, 1);
+    branch_index_free(branch_index);
+}
+
+int main(void)
+{
+    test_policies();
+    test_targets();
+    test_predictor();
+    test_allocation_failure();
+    return test_finish("test_btb");
+}
@@ -0,0 +1,593 @@
+#! /usr/bin/env python3
+#
+# Tests of the command line of branchsim. They are run by `make test` from the
+# root of the repository, after branchsim and the tools are built.
+#
+
+import csv
+import gzip
+import io
+import json
+import re
+import resource
+import struct
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+root = Path(__file__).resolve().parent.parent
+
+TRACE = "2\n0x4 0x8\n0x10 0x4\n" + "0x4 TAKEN\n0x10 NOT_TAKEN\n" * 8
+TRACE1 = (root / "inputs" / "trace1").read_text()
+
+
+def run(args, trace):
+    return subprocess.run(
+        [str(root / "branchsim"), *args],
+        input=trace.encode() if isinstance(trace, str) else trace,
+        capture_output=True,
+    )
+
+
+def outputs(stdout, prefix=""):
+    """The statistics lines of a run, without the prefix of a predictor."""
+    lines = stdout.decode().splitlines()
+    return [line[len(prefix) :] for line in lines if line.startswith(prefix + "OUTPUT")]
+
+
+def counts(stdout, prefix=""):
+    """The number of predictions and of correct predictions of a run."""
+    lines = outputs(stdout, prefix)
+    return [
+        int(line.split()[-1])
+        for line in lines
+        if line.startswith(("OUTPUT PREDICTIONS ", "OUTPUT CORRECT "))
+    ]
+
+
+def generate(path, *args):
+    """Write a synthetic trace with tools/tracegen and read it back."""
+    subprocess.run([str(root / "tools" / "tracegen"), *args, str(path)], check=True)
+    return path.read_bytes()
+
+
+class TestTraces(unittest.TestCase):
+    def test_malformed_record(self):
+        for record in ["0x4 taken", "0x4 TAKEN_", "xyz TAKEN", "0x4"]:
+            with self.subTest(record=record):
+                result = run(["2BG"], TRACE + record + "\n")
+                self.assertEqual(result.returncode, 2)
+                self.assertIn(b"Malformed trace", result.stderr)
+
+    def test_trailing_space(self):
+        result = run(["2BG"], TRACE + "\n \t\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("OUTPUT PREDICTIONS 16", outputs(result.stdout))
+
+    def test_binary_matches_text(self):
+        binary = root / "tests" / "test_cli.bin"
+        try:
+            conversion = subprocess.run(
+                [str(root / "tools" / "traceconv"), str(binary)], input=TRACE.encode()
+            )
+            self.assertEqual(conversion.returncode, 0)
+            for spec in ["2BG", "GSHARE", "TAGE"]:
+                with self.subTest(spec=spec):
+                    expected = outputs(run([spec], TRACE).stdout)
+                    self.assertIn("OUTPUT PREDICTIONS 16", expected)
+                    actual = outputs(run([spec], binary.read_bytes()).stdout)
+                    self.assertEqual(actual, expected)
+        finally:
+            binary.unlink(missing_ok=True)
+
+    def test_malformed_trace_is_not_converted(self):
+        binary = root / "tests" / "test_cli.bin"
+        conversion = subprocess.run(
+            [str(root / "tools" / "traceconv"), str(binary)],
+            input=(TRACE + "0x4 maybe\n").encode(),
+            capture_output=True,
+        )
+        self.assertEqual(conversion.returncode, 2)
+        self.assertFalse(binary.exists())
+
+
+
+class TestOutput(unittest.TestCase):
+    def test_quiet_by_default(self):
+        stdout = run(["AT"], TRACE1).stdout.decode()
+        self.assertNotIn("Branch at", stdout)
+        self.assertNotIn("Parameter Info", stdout)
+        self.assertIn("OUTPUT CORRECT 4", outputs(run(["AT"], TRACE1).stdout))
+
+    def test_trace_log(self):
+        stdout = run(["--trace-log", "AT"], TRACE1).stdout
+        lines = stdout.decode().splitlines()
+        self.assertEqual(lines.count("  Predicted: TAKEN"), 7)
+        actual = [line.split()[-1] for line in lines if line.startswith("  Actual:")]
+        expected = ["TAKEN", "NOT_TAKEN"] * 2 + ["TAKEN", "TAKEN", "NOT_TAKEN"]
+        self.assertEqual(actual, expected)
+        self.assertEqual(outputs(stdout), outputs(run(["AT"], TRACE1).stdout))
+
+    def test_trace_log_rate(self):
+        lines = run(["--trace-log=3", "AT"], TRACE1).stdout.decode().splitlines()
+        # The metadata lines are "Branch at ADDRESS targets TARGET".
+        pattern = re.compile(r"Branch at 0x[0-9a-f]+")
+        records = [line for line in lines if pattern.fullmatch(line)]
+        self.assertEqual(records, ["Branch at 0x4", "Branch at 0x40", "Branch at 0x4"])
+
+
+class TestMultiplePredictors(unittest.TestCase):
+    SPECS = [
+        "AT",
+        "BTFNT",
+        "2BG",
+        "2BL:lhrs=64",
+        "GSHARE:ghr=10",
+        "PERCEPTRON",
+        "TAGE",
+        "TOURN",
+        "BTB",
+    ]
+
+    def test_matches_single_runs(self):
+        with tempfile.TemporaryDirectory() as directory:
+            path = Path(directory, "trace.bin")
+            trace = generate(path, "--branches", "256", "--records", "20000")
+        combined = run([",".join(self.SPECS)], trace).stdout
+        for spec in self.SPECS:
+            with self.subTest(spec=spec):
+                expected = outputs(run([spec], trace).stdout)
+                self.assertIn("OUTPUT PREDICTIONS 20000", expected)
+                self.assertEqual(outputs(combined, spec + " "), expected)
+
+    def test_no_simd(self):
+        # The lockstep engine and the PERCEPTRON kernels give the same results
+        # with their scalar versions.
+        specs = "2BG:ghr=4,2BL:lhr=6,GSHARE,GSHARE:ghr=14,2BG,PERCEPTRON"
+        with tempfile.TemporaryDirectory() as directory:
+            trace = generate(Path(directory, "trace.bin"), "--records", "20000")
+        combined = run([specs], trace).stdout
+        self.assertEqual(run(["--no-simd", specs], trace).stdout, combined)
+        for spec in specs.split(","):
+            with self.subTest(spec=spec):
+                single = outputs(run(["--no-simd", spec], trace).stdout)
+                self.assertIn("OUTPUT PREDICTIONS 20000", single)
+                self.assertEqual(outputs(combined, spec + " "), single)
+
+    def test_all(self):
+        names = run(["--list-predictors"], "").stdout.decode().split()
+        combined = run(["ALL"], TRACE1).stdout
+        for name in names:
+            with self.subTest(name=name):
+                expected = outputs(run([name], TRACE1).stdout)
+                self.assertEqual(outputs(combined, name + " "), expected)
+
+
+class TestProfile(unittest.TestCase):
+    def profile(self, args, trace):
+        result = run(args, trace)
+        self.assertEqual(result.returncode, 0)
+        lines = result.stdout.decode().splitlines()
+        return result, [line.split() for line in lines if line.startswith("PROFILE")]
+
+    def test_worst_first(self):
+        result, lines = self.profile(["--profile", "2BG"], TRACE1)
+        self.assertEqual([line[1] for line in lines], ["0x4", "0x40"])
+        self.assertEqual(lines[0][2:4], ["predictions=4", "mispredictions=3"])
+        self.assertEqual(lines[1][2:4], ["predictions=3", "mispredictions=1"])
+        # Profiling does not change the statistics.
+        expected = outputs(run(["2BG"], TRACE1).stdout)
+        self.assertEqual(outputs(result.stdout), expected)
+        self.assertIn("OUTPUT INCORRECT 4", expected)
+
+    def test_trace_log(self):
+        # The trace log does not leave the profile empty.
+        _, expected = self.profile(["--profile", "2BG"], TRACE1)
+        result, lines = self.profile(["--trace-log=2", "--profile", "2BG"], TRACE1)
+        self.assertEqual(lines, expected)
+        self.assertEqual(outputs(result.stdout), outputs(run(["2BG"], TRACE1).stdout))
+
+    def test_top_n(self):
+        _, lines = self.profile(["--profile=1", "2BG"], TRACE1)
+        self.assertEqual(len(lines), 1)
+        self.assertEqual(lines[0][1], "0x4")
+
+    def test_sums(self):
+        with tempfile.TemporaryDirectory() as directory:
+            path = Path(directory, "trace.bin")
+            trace = generate(path, "--branches", "64", "--records", "5000")
+        result, lines = self.profile(["--profile=1000", "GSHARE"], trace)
+        self.assertLessEqual(len(lines), 64)
+        fields = [[int(field.split("=")[1]) for field in line[2:4]] for line in lines]
+        # Every prediction is listed, even after branches that never ran.
+        self.assertEqual(sum(field[0] for field in fields), 5000)
+        incorrect = sum(field[1] for field in fields)
+        self.assertIn(f"OUTPUT INCORRECT {incorrect}", outputs(result.stdout))
+        mispredictions = [field[1] for field in fields]
+        self.assertEqual(mispredictions, sorted(mispredictions, reverse=True))
+
+    def test_delayed_tournament(self):
+        # Profiling and the trace log simulate one branch at a time. The
+        # components of a tournament still predict each branch once, which
+        # matters for the delayed ones.
+        with tempfile.TemporaryDirectory() as directory:
+            trace = generate(Path(directory, "trace.bin"), "--records", "20000")
+        tourn = "TOURN:2BG:delay=4+GSHARE:delay=2"
+        for spec in [tourn, "BTB+" + tourn]:
+            expected = outputs(run([spec], trace).stdout)
+            self.assertIn("OUTPUT PREDICTIONS 20000", expected)
+            for option in ["--profile", "--trace-log"]:
+                with self.subTest(spec=spec, option=option):
+                    result = run([option, spec], trace)
+                    self.assertEqual(outputs(result.stdout), expected)
+
+
+class TestCheckpoint(unittest.TestCase):
+    SPECS = [
+        "AT",
+        "2BG",
+        "2BL:delay=2",
+        "GSHARE",
+        "PERCEPTRON",
+        "TAGE",
+        "TOURN",
+        "BTB",
+    ]
+
+    def test_resume_matches_full_run(self):
+        # The branches before the checkpoint plus the resumed run give the
+        # statistics of the full run, for a text trace and its binary form.
+        at = 12345
+        with tempfile.TemporaryDirectory() as directory:
+            text = Path(directory, "trace.txt")
+            binary = Path(directory, "trace.bin")
+            checkpoint = Path(directory, "checkpoint")
+            trace = generate(text, "--text", "--records", "20000").decode()
+            subprocess.run(
+                [str(root / "tools" / "traceconv"), str(binary)],
+                input=trace.encode(),
+                check=True,
+            )
+            lines = trace.splitlines(keepends=True)
+            num_branches = int(lines[0])
+            prefix = "".join(lines[: 1 + num_branches + at])
+
+            for spec in self.SPECS:
+                with self.subTest(spec=spec):
+                    options = [f"--checkpoint={checkpoint}", f"--checkpoint-at={at}"]
+                    full = counts(run([*options, spec], trace).stdout)
+                    before = counts(run([spec], prefix).stdout)
+                    self.assertEqual(before[0], at)
+                    for resumed_trace in [trace, binary.read_bytes()]:
+                        result = run([f"--resume={checkpoint}", spec], resumed_trace)
+                        resumed = counts(result.stdout)
+                        self.assertEqual([b + r for b, r in zip(before, resumed)], full)
+
+    def test_wrong_predictor(self):
+        with tempfile.TemporaryDirectory() as directory:
+            checkpoint = Path(directory, "checkpoint")
+            run([f"--checkpoint={checkpoint}", "--checkpoint-at=4", "2BG"], TRACE)
+            result = run([f"--resume={checkpoint}", "GSHARE"], TRACE)
+            self.assertNotEqual(result.returncode, 0)
+            self.assertIn(b"Checkpoint is for 2BG", result.stderr)
+
+    def test_corrupt_region(self):
+        # A region whose offset plus size wraps around is rejected rather than
+        # read out of bounds. The first descriptor follows the 296-byte header.
+        with tempfile.TemporaryDirectory() as directory:
+            checkpoint = Path(directory, "checkpoint")
+            run([f"--checkpoint={checkpoint}", "--checkpoint-at=4", "2BG"], TRACE)
+            data = bytearray(checkpoint.read_bytes())
+            offset, size = struct.unpack_from("=QQ", data, 296)
+            self.assertEqual(offset % 4096, 0)
+            struct.pack_into("=QQ", data, 296, 2**64 - size, size)
+            checkpoint.write_bytes(data)
+            result = run([f"--resume={checkpoint}", "2BG"], TRACE)
+            self.assertEqual(result.returncode, 4)
+            self.assertIn(b"Cannot load checkpoint", result.stderr)
+
+
+class TestParallel(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        with tempfile.TemporaryDirectory() as directory:
+            cls.trace = generate(Path(directory, "trace.bin"), "--records", "20000")
+
+    def test_stateless_predictors(self):
+        # Without history, the shards give the serial results without warmup.
+        for spec in ["ANT", "AT", "BTFNT"]:
+            with self.subTest(spec=spec):
+                expected = outputs(run([spec], self.trace).stdout)
+                result = run(["--parallel=4", "--warmup=0", spec], self.trace)
+                self.assertEqual(outputs(result.stdout), expected)
+
+    def test_full_warmup(self):
+        # With a warmup as long as the trace, every shard starts from the state
+        # that the serial run has at its first branch.
+        specs = ",".join(TestMultiplePredictors.SPECS)
+        expected = outputs(run([specs], self.trace).stdout)
+        for shards in [2, 3, 7]:
+            with self.subTest(shards=shards):
+                options = [f"--parallel={shards}", "--warmup=20000", specs]
+                self.assertEqual(outputs(run(options, self.trace).stdout), expected)
+
+    def test_text_trace(self):
+        # More shards than the 7 branches of the trace.
+        expected = outputs(run(["2BG,TAGE"], TRACE1).stdout)
+        result = run(["--parallel=16", "--warmup=100", "2BG,TAGE"], TRACE1)
+        self.assertEqual(outputs(result.stdout), expected)
+
+    def test_check(self):
+        options = ["--parallel=4", "--warmup=20000", "--parallel-check", "GSHARE"]
+        stdout = run(options, self.trace).stdout.decode()
+        self.assertIn("PARALLEL SHARDS 4 WARMUP 20000", stdout)
+        self.assertIn("PARALLEL ERROR 0", stdout)
+
+    def test_out_of_memory(self):
+        # A compressed trace is decoded into memory first. One whose records
+        # do not fit is an error rather than a crash.
+        with tempfile.TemporaryDirectory() as directory:
+            path = Path(directory, "trace.bin")
+            trace = gzip.compress(generate(path, "--records", "16000000"), 1)
+
+        def limit():
+            hard = resource.getrlimit(resource.RLIMIT_AS)[1]
+            resource.setrlimit(resource.RLIMIT_AS, (64 << 20, hard))
+
+        result = subprocess.run(
+            [str(root / "branchsim"), "--parallel=2", "AT"],
+            input=trace,
+            capture_output=True,
+            preexec_fn=limit,
+        )
+        self.assertEqual(result.returncode, 1)
+        self.assertIn(b"Cannot allocate the records of the trace", result.stderr)
+
+
+class TestInterval(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        with tempfile.TemporaryDirectory() as directory:
+            cls.trace = generate(Path(directory, "trace.bin"), "--records", "20000")
+
+    def windows(self, name, args):
+        """Run with an interval file and read its rows back."""
+        with tempfile.TemporaryDirectory() as directory:
+            path = Path(directory, name)
+            result = run([f"--interval-file={path}", *args], self.trace)
+            self.assertEqual(result.returncode, 0)
+            text = path.read_text()
+        if name.endswith(".csv"):
+            rows = list(csv.DictReader(io.StringIO(text)))
+            for row in rows:
+                for key in ["window", "start", "end", "predictions", "correct"]:
+                    row[key] = int(row[key])
+        else:
+            rows = [json.loads(line) for line in text.splitlines()]
+        return result, rows
+
+    def test_sums(self):
+        # The windows cover the trace without gaps, the last one is partial,
+        # and they add up to the statistics of the whole run.
+        specs = ["2BG", "GSHARE", "TAGE"]
+        result, rows = self.windows("windows.csv", ["--interval=3000", ",".join(specs)])
+        for spec in specs:
+            with self.subTest(spec=spec):
+                own = [row for row in rows if row["predictor"] == spec]
+                self.assertEqual([row["window"] for row in own], list(range(7)))
+                starts = [row["start"] for row in own]
+                self.assertEqual(starts, list(range(0, 20000, 3000)))
+                self.assertEqual(own[-1]["end"], 20000)
+                totals = [
+                    sum(row["predictions"] for row in own),
+                    sum(row["correct"] for row in own),
+                ]
+                self.assertEqual(totals, counts(result.stdout, spec + " "))
+
+    def test_json_lines(self):
+        _, csv_rows = self.windows("windows.csv", ["--interval=5000", "2BG,AT"])
+        _, json_rows = self.windows("windows.jsonl", ["--interval=5000", "2BG,AT"])
+        self.assertEqual(len(json_rows), 8)
+        for csv_row, json_row in zip(csv_rows, json_rows):
+            for key in ["window", "start", "end", "predictor", "correct"]:
+                self.assertEqual(csv_row[key], json_row[key])
+
+    def test_resume(self):
+        # After a resume, the windows stay aligned to the start of the trace.
+        with tempfile.TemporaryDirectory() as directory:
+            checkpoint = Path(directory, "checkpoint")
+            options = ["--interval=1000", "GSHARE"]
+            save = [f"--checkpoint={checkpoint}", "--checkpoint-at=4500"]
+            _, full = self.windows("full.jsonl", [*save, *options])
+            resume = [f"--resume={checkpoint}"]
+            _, resumed = self.windows("resumed.jsonl", [*resume, *options])
+        self.assertEqual((resumed[0]["window"], resumed[0]["start"]), (4, 4500))
+        self.assertEqual(resumed[0]["end"], 5000)
+        self.assertEqual(resumed[1:], full[5:])
+
+
+class TestSample(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        with tempfile.TemporaryDirectory() as directory:
+            text = Path(directory, "trace.txt")
+            cls.text = generate(text, "--text", "--records", "200000")
+            binary = Path(directory, "trace.bin")
+            traceconv = [str(root / "tools" / "traceconv"), str(binary)]
+            subprocess.run(traceconv, input=cls.text, check=True)
+            cls.binary = binary.read_bytes()
+
+    def sample(self, options, trace, spec):
+        """The OUTPUT and SAMPLE lines of a run, by name."""
+        stdout = run([*options, spec], trace).stdout.decode()
+        values = {}
+        for line in stdout.splitlines():
+            match = re.fullmatch(r"((?:OUTPUT|SAMPLE)[A-Z0-9 %]*?) ([-0-9. ]+)", line)
+            if match:
+                values[match[1]] = match[2]
+        return values
+
+    def test_whole_periods(self):
+        # Measuring all of every period is the full simulation.
+        options = ["--sample=10000", "--sample-warmup=0", "--sample-size=10000"]
+        stdout = run([*options, "2BG"], self.binary).stdout
+        self.assertEqual(outputs(stdout), outputs(run(["2BG"], self.binary).stdout))
+        self.assertIn("SAMPLES 20", stdout.decode().splitlines())
+
+    def test_measured_windows(self):
+        # AT has no state, so the sample counts exactly the branches at the
+        # end of each period, which are windows 9, 19, 29 and 39 of 5000.
+        with tempfile.TemporaryDirectory() as directory:
+            path = Path(directory, "windows.jsonl")
+            options = ["--interval=5000", f"--interval-file={path}", "AT"]
+            run(options, self.binary)
+            rows = [json.loads(line) for line in path.read_text().splitlines()]
+        measured = [row for row in rows if row["window"] % 10 == 9]
+        expected = [
+            sum(row["predictions"] for row in measured),
+            sum(row["correct"] for row in measured),
+        ]
+        options = ["--sample=50000", "--sample-warmup=5000", "--sample-size=5000"]
+        stdout = run([*options, "AT"], self.binary).stdout
+        self.assertEqual(counts(stdout), expected)
+        self.assertIn("SAMPLES 4", stdout.decode().splitlines())
+
+    def test_text_matches_binary(self):
+        # Skipping is constant-time for binary traces only, but the skipped
+        # branches are ignored either way.
+        options = ["--sample=30000", "--sample-warmup=2000", "--sample-size=3000"]
+        for spec in ["2BG", "TAGE"]:
+            with self.subTest(spec=spec):
+                expected = self.sample(options, self.binary, spec)
+                self.assertEqual(expected["OUTPUT PREDICTIONS"], "18000")
+                self.assertEqual(self.sample(options, self.text, spec), expected)
+                # The confidence interval is around the estimate.
+                interval = expected["SAMPLE CONFIDENCE INTERVAL 95%"]
+                low, high = map(float, interval.split())
+                estimate = float(expected["SAMPLE ESTIMATED RATE"])
+                self.assertLessEqual(low, estimate)
+                self.assertLessEqual(estimate, high)
+
+    def test_invalid(self):
+        for options in [
+            ["--sample=100", "--sample-warmup=90", "--sample-size=20"],
+            ["--sample=0"],
+            ["--sample=1000", "--sample-size=0", "--sample-warmup=0"],
+            ["--sample=100000", "--parallel=2"],
+            ["--sample=100000", "--profile"],
+        ]:
+            with self.subTest(options=options):
+                result = run([*options, "2BG"], TRACE)
+                self.assertEqual(result.returncode, 1)
+
+
+class TestPerf(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        with tempfile.TemporaryDirectory() as directory:
+            cls.trace = generate(Path(directory, "trace.bin"), "--records", "20000")
+
+    def perf(self, args):
+        """The statistics lines and the PERF values of a --perf run."""
+        result = run(["--perf", *args], self.trace)
+        self.assertEqual(result.returncode, 0)
+        values = {}
+        for line in result.stdout.decode().splitlines():
+            if line.startswith("PERF "):
+                name, _, value = line[len("PERF ") :].rpartition(" ")
+                values[name] = value
+        return outputs(result.stdout), values
+
+    def test_lines(self):
+        # --perf only adds PERF lines, per branch of the run, with the
+        # counters in both phases or a note that only the time was measured.
+        for args in [["2BG"], ["--no-reader", "TAGE"]]:
+            with self.subTest(args=args):
+                statistics, values = self.perf(args)
+                self.assertEqual(statistics, outputs(run(args, self.trace).stdout))
+                self.assertEqual(values.pop("BRANCHES"), "20000")
+                unavailable = values.pop("COUNTERS", None) == "UNAVAILABLE"
+                for name, value in values.items():
+                    self.assertRegex(name, r"^(DECODE|SIMULATE) [A-Z ]+/BRANCH$")
+                    self.assertGreaterEqual(float(value), 0)
+                phases = {}
+                for name in values:
+                    phase, _, measure = name.partition(" ")
+                    phases.setdefault(phase, set()).add(measure)
+                decode = phases["DECODE"]
+                self.assertEqual(decode, phases["SIMULATE"])
+                self.assertIn("NS/BRANCH", decode)
+                self.assertEqual(unavailable, decode == {"NS/BRANCH"})
+
+    def test_other(self):
+        # Writing intervals is measured apart from the two phases.
+        with tempfile.TemporaryDirectory() as directory:
+            path = Path(directory, "windows.csv")
+            options = ["--interval=1000", f"--interval-file={path}", "2BG"]
+            _, values = self.perf(options)
+        self.assertIn("OTHER NS/BRANCH", values)
+        self.assertNotIn("OTHER NS/BRANCH", self.perf(["2BG"])[1])
+
+    def test_resume(self):
+        # Only the branches simulated after the checkpoint are measured.
+        with tempfile.TemporaryDirectory() as directory:
+            checkpoint = Path(directory, "checkpoint")
+            save = [f"--checkpoint={checkpoint}", "--checkpoint-at=4500", "2BG"]
+            self.assertEqual(self.perf(save)[1]["BRANCHES"], "20000")
+            _, values = self.perf([f"--resume={checkpoint}", "2BG"])
+        self.assertEqual(values["BRANCHES"], "15500")
+
+    def test_invalid(self):
+        for options in [["--parallel=2"], ["--sample=1000000"]]:
+            with self.subTest(options=options):
+                result = run(["--perf", *options, "2BG"], self.trace)
+                self.assertEqual(result.returncode, 1)
+                self.assertIn(b"--perf cannot be used", result.stderr)
+
+
+class TestOptions(unittest.TestCase):
+    def test_invalid_numbers(self):
+        for option in [
+            "--trace-log=-1",
+            "--profile=3z",
+            "--checkpoint-at=1e3",
+            "--parallel=2x",
+            "--warmup=5k",
+            "--interval=0x10",
+            "--sample=10q",
+            "--sample-warmup=",
+            "--sample-size=1.5",
+        ]:
+            with self.subTest(option=option):
+                result = run([option, "2BG"], TRACE)
+                self.assertEqual(result.returncode, 1)
+                self.assertIn(b"Invalid", result.stderr)
+
+    def test_invalid_predictor_options(self):
+        too_large = "GSHARE:ghr=1" + "0" * 30
+        for spec in ["GSHARE:ghr=12abc", "GSHARE:ghr=-1", "GSHARE:ghr=+4", too_large]:
+            with self.subTest(spec=spec):
+                result = run([spec], TRACE)
+                self.assertEqual(result.returncode, 1)
+                self.assertIn(b"Invalid value", result.stderr)
+
+    def test_invalid_geometry(self):
+        # History lengths that a 32-bit register cannot hold, some of which
+        # used to be shifted by before they were checked.
+        for spec in ["2BG:ghr=32", "2BG:ghr=64", "2BL:lhr=100", "GSHARE:ghr=64"]:
+            with self.subTest(spec=spec):
+                result = run([spec], TRACE)
+                self.assertEqual(result.returncode, 1)
+                self.assertIn(b"Invalid geometry", result.stderr)
+
+    def test_valid_predictor_options(self):
+        # Hexadecimal and octal values are accepted like in C.
+        expected = outputs(run(["GSHARE:ghr=16"], TRACE).stdout)
+        self.assertTrue(expected)
+        self.assertEqual(outputs(run(["GSHARE:ghr=0x10"], TRACE).stdout), expected)
+        self.assertEqual(outputs(run(["GSHARE:ghr=020"], TRACE).stdout), expected)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,105 @@
+#! /usr/bin/env python3
+#
+# Tests of bin/branchsim.py, the Python wrapper around libbranchsim.so.
+#
+
+import gzip
+import subprocess
+import sys
+import tempfile
+import unittest
+from pathlib import Path
+
+root = Path(__file__).resolve().parent.parent
+sys.path.insert(0, str(root / "bin"))
+
+import branchsim  # noqa: E402
+
+
+def cli_stats(spec, path):
+    """The statistics of ./branchsim for a trace file, by name."""
+    with open(path, "rb") as trace:
+        stdout = subprocess.run(
+            [str(root / "branchsim"), spec],
+            stdin=trace,
+            capture_output=True,
+            check=True,
+        ).stdout.decode()
+    values = {}
+    for line in stdout.splitlines():
+        if line.startswith("OUTPUT "):
+            name, value = line[len("OUTPUT ") :].rsplit(" ", 1)
+            values[name] = value
+    return values
+
+
+class TestTrace(unittest.TestCase):
+    def test_matches_cli(self):
+        specs = ["AT", "2BG", "GSHARE:ghr=10", "TOURN", "BTB"]
+        path = root / "inputs" / "trace1"
+        with branchsim.Trace(path) as trace:
+            self.assertEqual(trace.num_branches, 4)
+            results = trace.simulate(specs)
+        self.assertEqual(list(results), specs)
+        for spec in specs:
+            with self.subTest(spec=spec):
+                expected = cli_stats(spec, path)
+                stats = results[spec]
+                self.assertEqual(str(stats["predictions"]), expected["PREDICTIONS"])
+                self.assertEqual(str(stats["correct"]), expected["CORRECT"])
+                for name, value in stats["counters"].items():
+                    self.assertEqual(str(value), expected[name])
+
+    def test_duplicate_specs(self):
+        # The results are keyed by spec, so the same spec twice would hide one
+        # of the predictors.
+        with branchsim.Trace(root / "inputs" / "trace1") as trace:
+            with self.assertRaisesRegex(ValueError, "duplicate predictor 2BG"):
+                trace.simulate(["2BG", "GSHARE", "2BG"])
+            # The trace is still unread.
+            self.assertIn("GSHARE", trace.simulate(["2BG", "GSHARE"]))
+
+    def test_invalid_spec(self):
+        with branchsim.Trace(root / "inputs" / "trace1") as trace:
+            with self.assertRaisesRegex(ValueError, "invalid predictor"):
+                trace.simulate(["2BG", "NOPE"])
+
+    def test_simulate_twice(self):
+        # A trace file is read again from the start by every simulation.
+        with branchsim.Trace(root / "inputs" / "trace1") as trace:
+            first = trace.simulate(["2BG", "TAGE"])
+            self.assertEqual(trace.simulate(["TAGE", "2BG"]), first)
+
+    def test_stream_and_gzip(self):
+        # The format of a trace file is detected, and compressed traces are
+        # read once as they are decompressed.
+        stream = "0x4 TAKEN\n0x10 NOT_TAKEN\n0x4 TAKEN\n0x10 TAKEN\n"
+        with tempfile.TemporaryDirectory() as directory:
+            text = Path(directory, "trace")
+            text.write_text(stream)
+            compressed = Path(directory, "trace.gz")
+            compressed.write_bytes(gzip.compress(stream.encode()))
+            with branchsim.Trace(text) as trace:
+                expected = trace.simulate(["2BG"])
+                self.assertEqual(expected["2BG"]["predictions"], 4)
+                self.assertEqual(trace.simulate(["2BG"]), expected)
+            with branchsim.Trace(compressed) as trace:
+                self.assertEqual(trace.simulate(["2BG"]), expected)
+                with self.assertRaisesRegex(RuntimeError, "already been read"):
+                    trace.simulate(["2BG"])
+
+    def test_malformed(self):
+        with tempfile.TemporaryDirectory() as directory:
+            path = Path(directory, "trace")
+            path.write_text("1\n0x4 0x8\n0x4 TAKEN\n0x4 maybe\n")
+            with branchsim.Trace(path) as trace:
+                with self.assertRaisesRegex(RuntimeError, "malformed"):
+                    trace.simulate(["2BG"])
+
+    def test_missing_file(self):
+        with self.assertRaises(ValueError):
+            branchsim.Trace(root / "inputs" / "no such trace")
+
+
+if __name__ == "__main__":
+    unittest.main()
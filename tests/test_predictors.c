@@ -0,0 +1,704 @@
+//
+// Tests of the branch predictors: their geometry options, the packed counter
+// tables in src/counter_table.h, batches, the lockstep engine, plain models
+// of GSHARE and PERCEPTRON, and the folded histories of TAGE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "branch_predictors.h"
+#include "counter_table.h"
+#include "multi_config.h"
+#include "simulation.h"
+#include "test.h"
+#include "util.h"
+
+// The number of branches and of records of the synthetic trace.
+#define NUM_BRANCHES 64
+#define NUM_RECORDS 20000
+
+// Specs that cover every predictor type and the options that change how
+// their batches are simulated.
+static const char *const specs[] = {
+    "ANT", "AT", "BTFNT", "LTG", "LTL", "2BG", "2BL", "2BG:delay=4", "2BL:delay=2", "GSHARE",
+    "GSHARE:ghr=8", "PERCEPTRON", "PERCEPTRON:ghr=12", "TAGE", "TAGE:tables=4", "TOURN", "BTB",
+    "BTB:entries=16:policy=fifo+GSHARE",
+};
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// A deterministic trace of loops, biased and correlated branches.
+static struct {
+    struct branch_metadata branches[NUM_BRANCHES];
+    uint32_t addresses[NUM_RECORDS];
+    uint8_t directions[NUM_RECORDS];
+} trace;
+
+static void make_trace(void)
+{
+    uint32_t seed = 0x12345678;
+    for (uint32_t b = 0; b < NUM_BRANCHES; b++) {
+        trace.branches[b].address = 0x1000 + 4 * b * 37;
+        trace.branches[b].target = trace.branches[b].address + (b % 2 ? 64 : -64);
+    }
+    uint8_t last = 0;
+    for (uint32_t i = 0; i < NUM_RECORDS; i++) {
+        uint32_t b = xorshift32(&seed) % NUM_BRANCHES;
+        trace.addresses[i] = trace.branches[b].address;
+        if (b % 4 == 0)
+            trace.directions[i] = i % 8 != 7;
+        else if (b % 4 == 1)
+            trace.directions[i] = xorshift32(&seed) % 10 < 8;
+        else if (b % 4 == 2)
+            trace.directions[i] = last;
+        else
+            trace.directions[i] = xorshift32(&seed) % 2;
+        last = trace.directions[i];
+    }
+}
+
+// Run a sequence of branches through a predictor.
+//
+// Returns (uint32_t): bit i is set if branch i was predicted taken.
+static uint32_t run(struct branch_predictor *bp, const uint32_t *addresses,
+                    const char *directions)
+{
+    uint32_t predictions = 0;
+    for (uint32_t i = 0; directions[i]; i++) {
+        enum branch_direction direction = directions[i] == 'T' ? TAKEN : NOT_TAKEN;
+        if (bp->predict(bp, addresses[i]) == TAKEN) predictions |= 1u << i;
+        bp->handle_result(bp, addresses[i], direction);
+    }
+    return predictions;
+}
+
+static void free_predictor(struct branch_predictor *bp)
+{
+    if (!bp) return;
+    bp->cleanup(bp);
+    free(bp);
+}
+
+static void test_counter_table(void)
+{
+    CHECK_EQ(counter_table_words(0, 2), 0);
+    CHECK_EQ(counter_table_words(32, 2), 1);
+    CHECK_EQ(counter_table_words(33, 2), 2);
+    CHECK_EQ(counter_table_words(65, 1), 2);
+
+    uint64_t table[2] = {0};
+    for (uint32_t i = 0; i < 64; i++) counter2_set(table, i, i % 4);
+    bool ok = true;
+    for (uint32_t i = 0; i < 64; i++) ok = ok && counter2_get(table, i) == i % 4;
+    CHECK(ok);
+
+    // The counters saturate and do not touch their neighbours.
+    counter2_update(table, 31, true);
+    CHECK_EQ(counter2_get(table, 31), 3);
+    counter2_update(table, 32, false);
+    CHECK_EQ(counter2_get(table, 32), 0);
+    counter2_update(table, 33, true);
+    CHECK_EQ(counter2_get(table, 33), 2);
+    CHECK_EQ(counter2_get(table, 34), 2);
+
+    uint64_t bits[2] = {0};
+    counter1_set(bits, 63, 1);
+    counter1_set(bits, 64, 1);
+    counter1_set(bits, 63, 0);
+    CHECK_EQ(bits[0], 0);
+    CHECK_EQ(bits[1], 1);
+}
+
+static void test_two_level(void)
+{
+    // With one history bit, an always-taken branch first trains the counter
+    // of history 0 and then has to move the counter of history 1 from 0 to
+    // 2 before it is predicted taken.
+    static const uint32_t same[8] = {0};
+    struct branch_predictor *bp = branch_predictor_new("2BG:ghr=1", NULL);
+    if (CHECK(bp)) {
+        CHECK_EQ(run(bp, same, "TTTTT"), 0x18);
+        free_predictor(bp);
+    }
+
+    // The 1-bit counters of LTG predict the last direction seen with the
+    // same history.
+    bp = branch_predictor_new("LTG:ghr=1", NULL);
+    if (CHECK(bp)) {
+        CHECK_EQ(run(bp, same, "TTNTTN"), 0x2c);
+        free_predictor(bp);
+    }
+
+    // Without history bits the two local history registers have a counter
+    // each by default, and share one when the PHT has a single entry.
+    static const uint32_t two_branches[3] = {0x0, 0x0, 0x1};
+    bp = branch_predictor_new("2BL:lhrs=2:lhr=0", NULL);
+    if (CHECK(bp)) {
+        CHECK_EQ(run(bp, two_branches, "TTT"), 0);
+        free_predictor(bp);
+    }
+    bp = branch_predictor_new("2BL:lhrs=2:lhr=0:pht=1", NULL);
+    if (CHECK(bp)) {
+        CHECK_EQ(run(bp, two_branches, "TTT"), 0x4);
+        free_predictor(bp);
+    }
+}
+
+static void test_invalid_geometry(void)
+{
+    static const char *const specs[] = {
+        "2BG:ghr=32", "2BG:ghr=64",        "2BL:lhrs=3", "2BL:pht=48",
+        "LTL:lhr=40", "LTG:delay=1000000", "2BG:bits=4",
+    };
+    for (uint32_t i = 0; i < sizeof(specs) / sizeof(specs[0]); i++)
+        CHECK(!branch_predictor_new(specs[i], NULL));
+}
+
+static void test_allocation_failure(void)
+{
+    // A state that does not fit in the address space fails construction
+    // instead of crashing on the first access.
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    struct rlimit lowered = {1ull << 30, limit.rlim_max};
+    if (!CHECK(setrlimit(RLIMIT_AS, &lowered) == 0)) return;
+    CHECK(!branch_predictor_new("2BL:lhrs=1073741824:lhr=2", NULL));
+    CHECK(!branch_predictor_new("2BL:lhrs=4:lhr=30", NULL));
+    CHECK(!branch_predictor_new("PERCEPTRON:perceptrons=16777216:ghr=256", NULL));
+    CHECK(!branch_predictor_new("TAGE:tables=16:entries=16777216", NULL));
+    CHECK(!branch_predictor_new("TAGE:base=4294967296", NULL));
+    // The components of a tournament fit, its chooser does not.
+    CHECK(!branch_predictor_new("TOURN:AT+ANT+chooser=4294967296", NULL));
+    CHECK(!branch_predictor_new("TOURN:2BG+GSHARE+chooser=4294967296", NULL));
+    setrlimit(RLIMIT_AS, &limit);
+}
+
+static void test_clone(void)
+{
+    // A clone of a fresh predictor predicts like it, and BTFNT and BTB,
+    // whose state is not all in their arena, are not cloned.
+    struct branch_index *branch_index = branch_index_new(NUM_BRANCHES, trace.branches);
+    static const char *const cloned[] = {"TOURN:GSHARE+2BL:delay=2", "TAGE", "PERCEPTRON"};
+    for (uint32_t i = 0; i < sizeof(cloned) / sizeof(cloned[0]); i++) {
+        struct branch_predictor *bp = branch_predictor_new(cloned[i], branch_index);
+        struct branch_predictor *clone = bp ? branch_predictor_clone(bp) : NULL;
+        if (CHECK(clone)) {
+            uint32_t expected = 0, correct = 0;
+            for (uint32_t r = 0; r < NUM_RECORDS; r++) {
+                expected += bp->predict(bp, trace.addresses[r]) == trace.directions[r];
+                bp->handle_result(bp, trace.addresses[r], trace.directions[r]);
+                correct += clone->predict(clone, trace.addresses[r]) == trace.directions[r];
+                clone->handle_result(clone, trace.addresses[r], trace.directions[r]);
+            }
+            CHECK_EQ(correct, expected);
+        }
+        free_predictor(clone);
+        free_predictor(bp);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        struct branch_predictor *bp = branch_predictor_new(i ? "BTB" : "BTFNT", branch_index);
+        if (CHECK(bp)) CHECK(!branch_predictor_clone(bp));
+        free_predictor(bp);
+    }
+    branch_index_free(branch_index);
+
+    // A clone whose arena, or the arena of a component, does not fit in the
+    // address space is not made.
+    struct branch_predictor *bp = branch_predictor_new("TOURN:2BG:ghr=30+AT", NULL);
+    if (!CHECK(bp)) return;
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    struct rlimit lowered = {1ull << 29, limit.rlim_max};
+    if (CHECK(setrlimit(RLIMIT_AS, &lowered) == 0)) {
+        CHECK(!branch_predictor_clone(bp->components[0]));
+        CHECK(!branch_predictor_clone(bp));
+        setrlimit(RLIMIT_AS, &limit);
+    }
+    free_predictor(bp);
+}
+
+// The number of branches of the synthetic trace a predictor gets right, or
+// -1 if it cannot be created.
+static int64_t count_correct(const char *spec)
+{
+    struct branch_index *branch_index = branch_index_new(NUM_BRANCHES, trace.branches);
+    struct branch_predictor *bp = branch_predictor_new(spec, branch_index);
+    int64_t correct = -1;
+    if (bp) {
+        correct = 0;
+        for (uint32_t r = 0; r < NUM_RECORDS; r++) {
+            correct += bp->predict(bp, trace.addresses[r]) == trace.directions[r];
+            bp->handle_result(bp, trace.addresses[r], trace.directions[r]);
+        }
+    }
+    free_predictor(bp);
+    branch_index_free(branch_index);
+    return correct;
+}
+
+static void test_delay(void)
+{
+    // With one history bit and delay=1, the counter of history 1 is only
+    // trained once the next branch has been predicted, so the third branch
+    // still sees it weakly not taken. The history itself is not delayed.
+    static const uint32_t same[8] = {0};
+    struct branch_predictor *bp = branch_predictor_new("2BG:ghr=1:delay=1", NULL);
+    if (CHECK(bp)) {
+        CHECK_EQ(run(bp, same, "TTTTTT"), 0x30);
+        free_predictor(bp);
+    }
+
+    // delay=0 is the same as no delay, and each branch of delay only costs a
+    // little accuracy (under 3% even for the 1-bit counters of LTG and LTL,
+    // which lose the most), since the predictions still use the actual
+    // history.
+    static const char *const predictors[] = {"LTG", "LTL", "2BG", "2BL", "GSHARE"};
+    for (uint32_t i = 0; i < sizeof(predictors) / sizeof(predictors[0]); i++) {
+        char spec[64];
+        int64_t undelayed = count_correct(predictors[i]);
+        snprintf(spec, sizeof(spec), "%s:delay=0", predictors[i]);
+        int64_t delay0 = count_correct(spec);
+        snprintf(spec, sizeof(spec), "%s:delay=1", predictors[i]);
+        int64_t delay1 = count_correct(spec);
+        snprintf(spec, sizeof(spec), "%s:delay=2", predictors[i]);
+        int64_t delay2 = count_correct(spec);
+        bool ok = CHECK(undelayed > 0);
+        ok = CHECK_EQ(delay0, undelayed) && ok;
+        ok = CHECK(llabs(delay1 - undelayed) < NUM_RECORDS * 3 / 100) && ok;
+        ok = CHECK(llabs(delay2 - undelayed) < 2 * NUM_RECORDS * 3 / 100) && ok;
+        if (!ok)
+            fprintf(stderr, "  %s: %lld %lld %lld %lld\n", predictors[i], (long long)undelayed,
+                    (long long)delay0, (long long)delay1, (long long)delay2);
+    }
+}
+
+// The predictions of simulate_batch must be the same as one predict and
+// handle_result per branch, and leave the same state behind.
+static void test_batch(void)
+{
+    struct branch_index *branch_index = branch_index_new(NUM_BRANCHES, trace.branches);
+    for (uint32_t i = 0; i < sizeof(specs) / sizeof(specs[0]); i++) {
+        struct branch_predictor *scalar = branch_predictor_new(specs[i], branch_index);
+        struct branch_predictor *batch = branch_predictor_new(specs[i], branch_index);
+        if (!CHECK(scalar && batch)) continue;
+
+        uint64_t correct = 0;
+        for (uint32_t r = 0; r < NUM_RECORDS; r++) {
+            correct += scalar->predict(scalar, trace.addresses[r]) == trace.directions[r];
+            scalar->handle_result(scalar, trace.addresses[r], trace.directions[r]);
+        }
+
+        // Uneven blocks, so that the batches start in the middle of things.
+        struct simulation sim = {.name = specs[i], .branch_predictor = batch};
+        for (uint32_t r = 0, n = 1; r < NUM_RECORDS; r += n, n = n * 3 % 997 + 1) {
+            if (n > NUM_RECORDS - r) n = NUM_RECORDS - r;
+            simulate_block(&sim, trace.addresses + r, trace.directions + r, n);
+        }
+        if (!CHECK_EQ(sim.correct_prediction_count, correct))
+            fprintf(stderr, "  %s\n", specs[i]);
+        CHECK_EQ(sim.prediction_count, NUM_RECORDS);
+
+        struct branch_predictor_state_region scalar_regions[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+        struct branch_predictor_state_region batch_regions[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+        uint32_t num_regions =
+            scalar->state_regions ? scalar->state_regions(scalar, scalar_regions) : 0;
+        if (num_regions) batch->state_regions(batch, batch_regions);
+        for (uint32_t g = 0; g < num_regions; g++) {
+            if (!CHECK(!memcmp(scalar_regions[g].data, batch_regions[g].data,
+                               scalar_regions[g].size)))
+                fprintf(stderr, "  %s region %u\n", specs[i], g);
+        }
+
+        free_predictor(scalar);
+        free_predictor(batch);
+    }
+    branch_index_free(branch_index);
+}
+
+// A plain model of GSHARE with a PHT of 2^pht_bits byte counters.
+struct gshare_model {
+    uint32_t history_bits, pht_bits, ghr;
+    uint8_t counters[1 << 14];
+};
+
+static bool gshare_model_predict(void *state, uint32_t address, bool taken)
+{
+    struct gshare_model *model = state;
+    uint32_t index = (model->ghr ^ address) & ((1u << model->pht_bits) - 1);
+    bool prediction = model->counters[index] >= 2;
+    if (taken && model->counters[index] < 3) model->counters[index]++;
+    if (!taken && model->counters[index] > 0) model->counters[index]--;
+    model->ghr = ((model->ghr << 1) | taken) & ((1u << model->history_bits) - 1);
+    return prediction;
+}
+
+// A plain model of PERCEPTRON, where history[0] is the most recent direction.
+struct perceptron_model {
+    uint32_t history_bits, num_perceptrons;
+    int32_t threshold;
+    int32_t weights[64][41];
+    int32_t history[40];
+};
+
+static bool perceptron_model_predict(void *state, uint32_t address, bool taken)
+{
+    struct perceptron_model *model = state;
+    int32_t *weights = model->weights[address % model->num_perceptrons];
+    int32_t output = weights[0];
+    for (uint32_t i = 0; i < model->history_bits; i++)
+        output += weights[i + 1] * model->history[i];
+    bool prediction = output >= 0;
+
+    int32_t t = taken ? 1 : -1;
+    if (prediction != taken || abs(output) <= model->threshold) {
+        for (uint32_t i = 0; i <= model->history_bits; i++) {
+            int32_t weight = weights[i] + t * (i ? model->history[i - 1] : 1);
+            weights[i] = weight > 127 ? 127 : weight < -127 ? -127 : weight;
+        }
+    }
+    memmove(model->history + 1, model->history, (model->history_bits - 1) * sizeof(int32_t));
+    model->history[0] = t;
+    return prediction;
+}
+
+// Compare the predictions of a predictor with a model over the whole trace,
+// one branch at a time.
+//
+// Returns (uint32_t): the number of branches where they differ.
+static uint32_t compare_with_model(struct branch_predictor *bp,
+                                   bool (*model_predict)(void *, uint32_t, bool), void *model)
+{
+    uint32_t differences = 0;
+    for (uint32_t r = 0; r < NUM_RECORDS; r++) {
+        bool expected = model_predict(model, trace.addresses[r], trace.directions[r]);
+        differences += (bp->predict(bp, trace.addresses[r]) == TAKEN) != expected;
+        bp->handle_result(bp, trace.addresses[r], trace.directions[r]);
+    }
+    return differences;
+}
+
+static void test_gshare_model(void)
+{
+    static const struct {
+        const char *spec;
+        uint32_t history_bits, pht_bits;
+    } configs[] = {
+        {"GSHARE", 12, 12},
+        {"GSHARE:ghr=4", 4, 4},
+        // More PHT bits than history bits take the rest from the address.
+        {"GSHARE:ghr=6:pht=16384", 6, 14},
+    };
+    for (uint32_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        struct branch_predictor *bp = branch_predictor_new(configs[i].spec, NULL);
+        if (!CHECK(bp)) continue;
+        static struct gshare_model model;
+        memset(&model, 0, sizeof(model));
+        model.history_bits = configs[i].history_bits;
+        model.pht_bits = configs[i].pht_bits;
+        if (!CHECK_EQ(compare_with_model(bp, &gshare_model_predict, &model), 0))
+            fprintf(stderr, "  %s\n", configs[i].spec);
+        free_predictor(bp);
+    }
+}
+
+static void test_perceptron_model(void)
+{
+    static const struct {
+        const char *spec;
+        uint32_t history_bits, num_perceptrons;
+        int32_t threshold;
+    } configs[] = {
+        {"PERCEPTRON:perceptrons=64", 32, 64, 75},
+        {"PERCEPTRON:ghr=12:perceptrons=16", 12, 16, 37},
+        // A history longer than one 32-byte row, and a threshold so high that
+        // every branch trains and the weights saturate.
+        {"PERCEPTRON:ghr=40:perceptrons=8:threshold=300", 40, 8, 300},
+        {"PERCEPTRON:ghr=5:perceptrons=1:threshold=0", 5, 1, 0},
+    };
+    for (uint32_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        // The SIMD and scalar kernels are chosen when a predictor is created.
+        for (uint32_t simd = 0; simd < 2; simd++) {
+            simd_enabled = simd;
+            struct branch_predictor *bp = branch_predictor_new(configs[i].spec, NULL);
+            simd_enabled = true;
+            if (!CHECK(bp)) continue;
+            static struct perceptron_model model;
+            memset(&model, 0, sizeof(model));
+            model.history_bits = configs[i].history_bits;
+            model.num_perceptrons = configs[i].num_perceptrons;
+            model.threshold = configs[i].threshold;
+            for (uint32_t h = 0; h < model.history_bits; h++) model.history[h] = -1;
+            if (!CHECK_EQ(compare_with_model(bp, &perceptron_model_predict, &model), 0))
+                fprintf(stderr, "  %s simd=%u\n", configs[i].spec, simd);
+            free_predictor(bp);
+        }
+    }
+}
+
+static void test_tournament(void)
+{
+    // The chooser starts out on the first component (AT) and moves one step
+    // towards the component that was right whenever the two disagree.
+    static const uint32_t same[8] = {0};
+    struct branch_predictor *bp = branch_predictor_new("TOURN:AT+ANT+chooser=1", NULL);
+    if (CHECK(bp)) {
+        CHECK_EQ(run(bp, same, "NNNTTT"), 0x23);
+        CHECK_EQ(bp->component_chosen[0], 3);
+        CHECK_EQ(bp->component_chosen[1], 3);
+        CHECK_EQ(bp->component_correct[0], 3);
+        CHECK_EQ(bp->component_correct[1], 3);
+        free_predictor(bp);
+    }
+
+    // The components see every branch as if they ran on their own, and two
+    // equal components never disagree.
+    struct branch_index *branch_index = branch_index_new(NUM_BRANCHES, trace.branches);
+    struct branch_predictor *tourn = branch_predictor_new("TOURN:GSHARE+2BL+chooser=64",
+                                                          branch_index);
+    struct branch_predictor *same_tourn = branch_predictor_new("TOURN:GSHARE+GSHARE",
+                                                               branch_index);
+    struct branch_predictor *gshare = branch_predictor_new("GSHARE", branch_index);
+    struct branch_predictor *two_level = branch_predictor_new("2BL", branch_index);
+    if (CHECK(tourn && same_tourn && gshare && two_level)) {
+        struct simulation sims[4] = {
+            {.branch_predictor = tourn},
+            {.branch_predictor = same_tourn},
+            {.branch_predictor = gshare},
+            {.branch_predictor = two_level},
+        };
+        for (uint32_t s = 0; s < 4; s++)
+            simulate_block(&sims[s], trace.addresses, trace.directions, NUM_RECORDS);
+        CHECK_EQ(tourn->component_correct[0], sims[2].correct_prediction_count);
+        CHECK_EQ(tourn->component_correct[1], sims[3].correct_prediction_count);
+        CHECK_EQ(tourn->component_chosen[0] + tourn->component_chosen[1], NUM_RECORDS);
+        CHECK_EQ(sims[1].correct_prediction_count, sims[2].correct_prediction_count);
+    }
+    free_predictor(tourn);
+    free_predictor(same_tourn);
+    free_predictor(gshare);
+    free_predictor(two_level);
+    branch_index_free(branch_index);
+
+    static const char *const invalid[] = {
+        "TOURN:2BG",
+        "TOURN:2BG+XYZ",
+        "TOURN:2BG+2BL+chooser=3",
+        "TOURN:2BG+2BL+foo=1",
+        "TOURN:2BG+2BL+chooser=4+2BG",
+        // The components cannot be tournaments or BTBs.
+        "TOURN:BTB+2BL",
+        "TOURN:2BG+TOURN",
+        "TOURN:TOURN:2BG+2BL",
+    };
+    for (uint32_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        CHECK(!branch_predictor_new(invalid[i], NULL));
+}
+
+// Fold the last length directions of the TAGE history into width bits the
+// slow way: the direction of age i lands on bit i modulo width.
+static uint32_t tage_fold_history(const struct tage_state *state, uint32_t length,
+                                  uint32_t width)
+{
+    uint32_t folded = 0;
+    for (uint32_t age = 0; age < length; age++) {
+        uint32_t bit = state->history[(state->history_position - age) & (TAGE_HISTORY_BUFFER - 1)];
+        folded ^= bit << (age % width);
+    }
+    return folded;
+}
+
+static void test_tage(void)
+{
+    // The history lengths grow geometrically from min to max.
+    struct branch_predictor *bp = branch_predictor_new("TAGE:tables=4:min=4:max=32", NULL);
+    if (CHECK(bp)) {
+        static const uint32_t lengths[] = {4, 8, 16, 32};
+        for (uint32_t t = 0; t < 4; t++) CHECK_EQ(bp->tage_state->history_lengths[t], lengths[t]);
+        free_predictor(bp);
+    }
+
+    // The folded histories that are updated with every branch are the ones
+    // recomputed from the whole history, also once the history ring wrapped
+    // and for lengths that are multiples of the widths.
+    bp = branch_predictor_new("TAGE:tables=8:entries=256:tag=9:min=8:max=1024", NULL);
+    if (CHECK(bp)) {
+        const struct tage_state *state = bp->tage_state;
+        bool ok = true;
+        for (uint32_t r = 0; r < 3 * TAGE_HISTORY_BUFFER; r++) {
+            bp->predict(bp, trace.addresses[r]);
+            bp->handle_result(bp, trace.addresses[r], trace.directions[r]);
+            if (r % 997 != 0 && r != 3 * TAGE_HISTORY_BUFFER - 1) continue;
+            for (uint32_t t = 0; t < 8; t++) {
+                uint32_t length = state->history_lengths[t];
+                ok = CHECK_EQ(state->folded_index[t], tage_fold_history(state, length, 8)) && ok;
+                ok = CHECK_EQ(state->folded_tag[0][t], tage_fold_history(state, length, 9)) && ok;
+                ok = CHECK_EQ(state->folded_tag[1][t], tage_fold_history(state, length, 8)) && ok;
+            }
+            if (!ok) {
+                fprintf(stderr, "  after branch %u\n", r);
+                break;
+            }
+        }
+        free_predictor(bp);
+    }
+
+    // Every reset branches, the useful counters are halved.
+    bp = branch_predictor_new("TAGE:tables=2:entries=16:reset=2", NULL);
+    if (CHECK(bp)) {
+        memset(bp->tage_useful, 3, 2 * 16);
+        bp->predict(bp, 0x40);
+        bp->handle_result(bp, 0x40, TAKEN);
+        // Only the entries that the branch looked up may have changed.
+        uint32_t unchanged = 0;
+        for (uint32_t i = 0; i < 2 * 16; i++) unchanged += bp->tage_useful[i] == 3;
+        CHECK(unchanged >= 2 * 16 - 2);
+        bp->predict(bp, 0x40);
+        bp->handle_result(bp, 0x40, TAKEN);
+        bool ok = true;
+        for (uint32_t i = 0; i < 2 * 16; i++) ok = ok && bp->tage_useful[i] <= 1;
+        CHECK(ok);
+        CHECK_EQ(bp->tage_state->until_reset, 2);
+        free_predictor(bp);
+    }
+
+    // A branch that repeats the direction of a branch 30 branches earlier,
+    // with an always taken loop in between, is beyond the reach of 2BG but
+    // not of the longer TAGE histories.
+    static uint32_t addresses[31];
+    static char directions[32];
+    uint32_t seed = 0x9abcdef0;
+    struct branch_predictor *tage = branch_predictor_new("TAGE", NULL);
+    struct branch_predictor *two_level = branch_predictor_new("2BG", NULL);
+    if (CHECK(tage && two_level)) {
+        uint32_t tage_correct = 0, two_level_correct = 0;
+        for (uint32_t iteration = 0; iteration < 2000; iteration++) {
+            char direction = xorshift32(&seed) % 2 ? 'T' : 'N';
+            for (uint32_t i = 0; i < 31; i++) {
+                addresses[i] = i == 0 ? 0x100 : i == 30 ? 0x300 : 0x200;
+                directions[i] = i == 0 || i == 30 ? direction : i == 29 ? 'N' : 'T';
+            }
+            bool taken = direction == 'T';
+            // Only the last 1000 iterations count, once both have learnt.
+            uint32_t last = 1u << 30;
+            bool tage_taken = run(tage, addresses, directions) & last;
+            bool two_level_taken = run(two_level, addresses, directions) & last;
+            tage_correct += iteration >= 1000 && tage_taken == taken;
+            two_level_correct += iteration >= 1000 && two_level_taken == taken;
+        }
+        if (!CHECK(tage_correct > 950 && two_level_correct < 600))
+            fprintf(stderr, "  TAGE %u, 2BG %u of 1000\n", tage_correct, two_level_correct);
+        CHECK(tage->tage_allocations > 0);
+    }
+    free_predictor(tage);
+    free_predictor(two_level);
+
+    static const char *const invalid[] = {
+        "TAGE:tables=0", "TAGE:tables=17", "TAGE:entries=1",   "TAGE:entries=33554432",
+        "TAGE:base=3",   "TAGE:tag=1",     "TAGE:tag=17",      "TAGE:min=0",
+        "TAGE:max=1025", "TAGE:reset=0",   "TAGE:min=9:max=8",
+    };
+    for (uint32_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        CHECK(!branch_predictor_new(invalid[i], NULL));
+}
+
+// Run the configurations in lockstep, with the SIMD kernels if simd is set.
+//
+// Arguments
+//  * correct: set to the number of correct predictions of each configuration.
+//  * regions: set to the first state region of each configuration, which the
+//    caller frees.
+static void run_multi_config(const char *const *configs, uint32_t num_configs,
+                             struct branch_index *branch_index, bool simd, uint64_t *correct,
+                             void **regions)
+{
+    simd_enabled = simd;
+    struct simulation simulations[MAX_SIMULATIONS] = {0};
+    for (uint32_t c = 0; c < num_configs; c++) {
+        simulations[c].name = configs[c];
+        simulations[c].branch_predictor = branch_predictor_new(configs[c], branch_index);
+    }
+    struct multi_config *multi_config = simulations_multi_config_new(simulations, num_configs);
+    CHECK(multi_config);
+    for (uint32_t r = 0, n = 1; r < NUM_RECORDS; r += n, n = n * 5 % 1009 + 1) {
+        if (n > NUM_RECORDS - r) n = NUM_RECORDS - r;
+        simulate_blocks(simulations, num_configs, multi_config, trace.addresses + r,
+                        trace.directions + r, n);
+    }
+    for (uint32_t c = 0; c < num_configs; c++) {
+        struct branch_predictor *bp = simulations[c].branch_predictor;
+        struct branch_predictor_state_region state[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+        bp->state_regions(bp, state);
+        correct[c] = simulations[c].correct_prediction_count;
+        regions[c] = malloc(state[0].size);
+        memcpy(regions[c], state[0].data, state[0].size);
+        free_predictor(bp);
+    }
+    if (multi_config) multi_config_free(multi_config);
+    simd_enabled = true;
+}
+
+// The lockstep engine gives every configuration the results that it has on
+// its own, with and without the SIMD kernels.
+static void test_multi_config(void)
+{
+    // Six configurations, so that the second group of lanes is partly empty.
+    static const char *const configs[] = {
+        "2BG:ghr=4", "2BL:lhr=6", "GSHARE", "GSHARE:ghr=14", "2BL:lhrs=2:lhr=0:pht=1", "2BG",
+    };
+    uint32_t num_configs = sizeof(configs) / sizeof(configs[0]);
+    struct branch_index *branch_index = branch_index_new(NUM_BRANCHES, trace.branches);
+
+    uint64_t simd_correct[6], scalar_correct[6];
+    void *simd_regions[6], *scalar_regions[6];
+    run_multi_config(configs, num_configs, branch_index, true, simd_correct, simd_regions);
+    run_multi_config(configs, num_configs, branch_index, false, scalar_correct, scalar_regions);
+
+    for (uint32_t c = 0; c < num_configs; c++) {
+        struct branch_predictor *bp = branch_predictor_new(configs[c], branch_index);
+        uint64_t correct = 0;
+        for (uint32_t r = 0; r < NUM_RECORDS; r++) {
+            correct += bp->predict(bp, trace.addresses[r]) == trace.directions[r];
+            bp->handle_result(bp, trace.addresses[r], trace.directions[r]);
+        }
+        struct branch_predictor_state_region state[MAX_BRANCH_PREDICTOR_STATE_REGIONS];
+        bp->state_regions(bp, state);
+
+        bool ok = CHECK_EQ(simd_correct[c], correct);
+        ok = CHECK_EQ(scalar_correct[c], correct) && ok;
+        ok = CHECK(!memcmp(simd_regions[c], state[0].data, state[0].size)) && ok;
+        ok = CHECK(!memcmp(scalar_regions[c], state[0].data, state[0].size)) && ok;
+        if (!ok) fprintf(stderr, "  %s\n", configs[c]);
+
+        free(simd_regions[c]);
+        free(scalar_regions[c]);
+        free_predictor(bp);
+    }
+    branch_index_free(branch_index);
+}
+
+int main(void)
+{
+    make_trace();
+    test_counter_table();
+    test_two_level();
+    test_invalid_geometry();
+    test_allocation_failure();
+    test_clone();
+    test_delay();
+    test_batch();
+    test_gshare_model();
+    test_perceptron_model();
+    test_tournament();
+    test_tage();
+    test_multi_config();
+    return test_finish("test_predictors");
+}
@@ -0,0 +1,156 @@
+//
+// Tests of the per-branch misprediction profiler in src/profile.c.
+//
+
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "branch_predictors.h"
+#include "profile.h"
+#include "test.h"
+
+#define A 0x100
+#define B 0x200
+#define UNKNOWN 0x300
+
+static void test_counts(void)
+{
+    struct branch_metadata branches[] = {{A, 0x80}, {B, 0x280}};
+    struct branch_index *branch_index = branch_index_new(2, branches);
+    struct branch_predictor *bp = branch_predictor_new("AT", branch_index);
+    struct branch_profile *profile = branch_profile_new(bp, branch_index);
+    if (!CHECK(profile)) return;
+
+    static const uint32_t addresses[] = {A, A, B, A, UNKNOWN, B, UNKNOWN};
+    static const uint8_t directions[] = {TAKEN, NOT_TAKEN, NOT_TAKEN, TAKEN, TAKEN, NOT_TAKEN, NOT_TAKEN};
+    uint64_t correct = 0;
+    branch_profile_simulate_batch(profile, bp, addresses, directions, 7, &correct);
+    CHECK_EQ(correct, 3);
+
+    // Entry 0 counts the branches that are not in the index.
+    const struct branch_profile_counters *a = &profile->counters[1];
+    const struct branch_profile_counters *b = &profile->counters[2];
+    const struct branch_profile_counters *unknown = &profile->counters[0];
+    CHECK_EQ(a->predictions, 3);
+    CHECK_EQ(a->mispredictions, 1);
+    CHECK_EQ(a->taken, 2);
+    CHECK_EQ(b->predictions, 2);
+    CHECK_EQ(b->mispredictions, 2);
+    CHECK_EQ(b->taken, 0);
+    CHECK_EQ(unknown->predictions, 2);
+    CHECK_EQ(unknown->mispredictions, 1);
+    // AT does not use a PHT.
+    CHECK(!profile->pht_owner);
+
+    branch_profile_free(profile);
+    bp->cleanup(bp);
+    free(bp);
+    branch_index_free(branch_index);
+}
+
+static void test_aliasing(void)
+{
+    // Without history bits and with a single LHR, every branch uses the one
+    // PHT entry, so each prediction after another branch is aliased.
+    struct branch_metadata branches[] = {{A, 0x80}, {B, 0x280}};
+    struct branch_index *branch_index = branch_index_new(2, branches);
+    struct branch_predictor *bp = branch_predictor_new("2BL:lhrs=1:lhr=0", branch_index);
+    struct branch_profile *profile = branch_profile_new(bp, branch_index);
+    if (!CHECK(profile && profile->pht_owner)) return;
+
+    static const uint32_t addresses[] = {A, B, A, A, B};
+    static const uint8_t directions[] = {TAKEN, TAKEN, TAKEN, TAKEN, TAKEN};
+    uint64_t correct = 0;
+    branch_profile_simulate_batch(profile, bp, addresses, directions, 5, &correct);
+
+    const struct branch_profile_counters *a = &profile->counters[1];
+    const struct branch_profile_counters *b = &profile->counters[2];
+    CHECK_EQ(a->aliased, 1);
+    CHECK_EQ(b->aliased, 2);
+    CHECK_EQ(b->last_alias, A);
+    CHECK_EQ(a->last_pht_index, 0);
+    // The shared counter is taken from the third branch on.
+    CHECK_EQ(correct, 3);
+
+    branch_profile_free(profile);
+    bp->cleanup(bp);
+    free(bp);
+    branch_index_free(branch_index);
+}
+
+static void test_growth(void)
+{
+    // Branches that are added to the index after the profile was created get
+    // counters of their own.
+    struct branch_index *branch_index = branch_index_new(0, NULL);
+    struct branch_predictor *bp = branch_predictor_new("ANT", branch_index);
+    struct branch_profile *profile = branch_profile_new(bp, branch_index);
+    if (!CHECK(profile)) return;
+
+    uint32_t addresses[100];
+    uint8_t directions[100];
+    for (uint32_t i = 0; i < 100; i++) {
+        addresses[i] = 0x1000 + 4 * i;
+        directions[i] = TAKEN;
+        branch_index_insert(branch_index, addresses[i], BRANCH_TARGET_UNKNOWN);
+    }
+    uint64_t correct = 0;
+    branch_profile_simulate_batch(profile, bp, addresses, directions, 100, &correct);
+    CHECK(profile->num_counters >= 101);
+    CHECK_EQ(profile->counters[0].predictions, 0);
+    CHECK_EQ(profile->counters[100].predictions, 1);
+    CHECK_EQ(profile->counters[100].mispredictions, 1);
+
+    branch_profile_free(profile);
+    bp->cleanup(bp);
+    free(bp);
+    branch_index_free(branch_index);
+}
+
+static void test_allocation_failure(void)
+{
+    // The PHT owners of 2^30 PHT entries take 4 GiB, and the counters of 2^24
+    // branches 640 MiB, neither of which fits in the lowered address space.
+    struct branch_index *branch_index = branch_index_new(0, NULL);
+    struct branch_predictor *big = branch_predictor_new("2BG:ghr=30", branch_index);
+    struct branch_predictor *bp = branch_predictor_new("ANT", branch_index);
+    struct branch_profile *profile = branch_profile_new(bp, branch_index);
+    if (!CHECK(big && profile)) return;
+    uint32_t num_branches = 1 << 24;
+    for (uint32_t i = 0; i < num_branches; i++)
+        branch_index_insert(branch_index, 0x1000 + 4 * i, BRANCH_TARGET_UNKNOWN);
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    struct rlimit lowered = {1ull << 30, limit.rlim_max};
+    if (CHECK(setrlimit(RLIMIT_AS, &lowered) == 0)) {
+        CHECK(!branch_profile_new(big, branch_index));
+
+        // A profile that cannot grow counts the new branches as unknown.
+        static const uint32_t addresses[] = {0x1000, 0x1004};
+        static const uint8_t directions[] = {TAKEN, NOT_TAKEN};
+        uint64_t correct = 0;
+        branch_profile_simulate_batch(profile, bp, addresses, directions, 2, &correct);
+        CHECK_EQ(correct, 1);
+        CHECK(profile->incomplete);
+        CHECK_EQ(profile->num_counters, 1);
+        CHECK_EQ(profile->counters[0].predictions, 2);
+        setrlimit(RLIMIT_AS, &limit);
+    }
+
+    branch_profile_free(profile);
+    bp->cleanup(bp);
+    free(bp);
+    big->cleanup(big);
+    free(big);
+    branch_index_free(branch_index);
+}
+
+int main(void)
+{
+    test_counts();
+    test_aliasing();
+    test_growth();
+    test_allocation_failure();
+    return test_finish("test_profile");
+}
@@ -0,0 +1,194 @@
+#! /usr/bin/env python3
+#
+# Tests of the server mode of branchsim (see src/server.h), through the client
+# in bin/branchsim_client.py. They are run by `make test` from the root of the
+# repository, after branchsim is built.
+#
+
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+from pathlib import Path
+
+from test_cli import TRACE, TRACE1, counts, root, run
+
+sys.path.insert(0, str(root / "bin"))
+import branchsim_client  # noqa: E402
+
+# SERVER_MAX_CONNECTIONS in src/server.h.
+MAX_CONNECTIONS = 256
+
+
+class TestServer(unittest.TestCase):
+    WORKERS = 2
+
+    @classmethod
+    def setUpClass(cls):
+        cls.directory = tempfile.TemporaryDirectory()
+        cls.path = str(Path(cls.directory.name, "branchsim.sock"))
+        cls.trace1 = str(root / "inputs" / "trace1")
+        options = [f"--server={cls.path}", f"--server-workers={cls.WORKERS}"]
+        cls.server = subprocess.Popen(
+            [str(root / "branchsim"), *options], stderr=subprocess.PIPE
+        )
+        # The server says when it listens.
+        cls.server.stderr.readline()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server.terminate()
+        cls.server.wait()
+        cls.server.stderr.close()
+        cls.directory.cleanup()
+
+    def client(self):
+        client = branchsim_client.Client(self.path)
+        client.socket.settimeout(10)
+        self.addCleanup(client.close)
+        return client
+
+    def raw(self, data):
+        """Send raw bytes on a new connection and read every response line."""
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as connection:
+            connection.settimeout(10)
+            connection.connect(self.path)
+            connection.sendall(data)
+            connection.shutdown(socket.SHUT_WR)
+            with connection.makefile("r") as responses:
+                return responses.read().splitlines()
+
+    def test_matches_cli(self):
+        # A file and an inline trace give the statistics of the command line,
+        # also when the pooled predictor is reused.
+        client = self.client()
+        data = Path(self.trace1).read_bytes()
+        for spec in ["2BG", "GSHARE", "TAGE", "TOURN", "BTFNT", "BTB"]:
+            with self.subTest(spec=spec):
+                expected = counts(run([spec], TRACE1).stdout)
+                for _ in range(2):
+                    for stats in [
+                        client.run(spec, path=self.trace1),
+                        client.run(spec, data=data),
+                    ]:
+                        actual = [stats["PREDICTIONS"], stats["CORRECT"]]
+                        self.assertEqual(actual, expected)
+
+    def test_counters(self):
+        client = self.client()
+        first = client.run("TAGE", data=TRACE.encode())
+        self.assertIn("TAGE_ALLOCATIONS", first)
+        self.assertEqual(client.run("TAGE", data=TRACE.encode()), first)
+
+    def test_empty_trace(self):
+        stats = self.client().run("2BG", data=b"0\n")
+        self.assertEqual(stats["PREDICTIONS"], 0)
+        self.assertEqual(stats["RATE"], 0)
+
+    def test_pipelined(self):
+        # Requests sent before the responses are answered in order.
+        requests = [
+            f"RUN 2BG {self.trace1}\n",
+            f"RUN AT - {len(TRACE)}\n{TRACE}",
+            f"RUN ANT {self.trace1}\n",
+        ]
+        lines = self.raw("".join(requests).encode())
+        self.assertEqual(len(lines), 3)
+        self.assertTrue(lines[0].startswith("OK PREDICTIONS=7 CORRECT=3 "))
+        self.assertTrue(lines[1].startswith("OK PREDICTIONS=16 CORRECT=8 "))
+        self.assertTrue(lines[2].startswith("OK PREDICTIONS=7 "))
+
+    def test_job_errors(self):
+        # A job that fails does not end the connection.
+        client = self.client()
+        errors = [
+            (["XYZ"], {"path": self.trace1}, "Invalid branch predictor XYZ"),
+            (["2BG"], {"path": "/nonexistent"}, "Cannot open /nonexistent"),
+            (["2BG"], {"data": b"1\n0x4 0x8\n0x4 maybe\n"}, "Malformed trace"),
+        ]
+        for args, kwargs, message in errors:
+            with self.subTest(message=message):
+                with self.assertRaises(branchsim_client.ServerError) as error:
+                    client.run(*args, **kwargs)
+                self.assertIn(message, str(error.exception))
+                self.assertEqual(client.run("AT", path=self.trace1)["PREDICTIONS"], 7)
+
+    def test_request_errors(self):
+        # After a request that cannot be parsed, or whose trace cannot be
+        # skipped, the server responds with an error and closes the
+        # connection.
+        for request in [
+            "STOP\n",
+            "RUN 2BG\n",
+            f"RUN 2BG {self.trace1} 5\n",
+            "RUN 2BG -\n",
+            "RUN 2BG - abc\n",
+            "RUN 2BG - 12x\n",
+            "RUN 2BG - -1\n",
+            "RUN 2BG - 99999999999999999999999\n",
+            f"RUN 2BG - {2**30 + 1}\n",
+        ]:
+            with self.subTest(request=request):
+                lines = self.raw(f"{request}RUN AT {self.trace1}\n".encode())
+                self.assertEqual(len(lines), 1)
+                self.assertTrue(lines[0].startswith("ERROR "))
+
+    def test_idle_connections(self):
+        # Idle connections, also ones that have been served, do not hold the
+        # workers: a new client is still answered.
+        idle = [self.client() for _ in range(2 * self.WORKERS)]
+        for client in idle[: self.WORKERS]:
+            client.run("AT", path=self.trace1)
+        self.assertEqual(self.client().run("2BG", path=self.trace1)["PREDICTIONS"], 7)
+        # And they can still send requests.
+        for client in idle:
+            self.assertEqual(client.run("ANT", path=self.trace1)["PREDICTIONS"], 7)
+
+    def test_busy(self):
+        # The server accepts the connections in order, so once as many are
+        # open as it allows, the next one is turned away. Connections of the
+        # other tests that the server has not seen closed yet can leave a few
+        # more.
+        connections = []
+        try:
+            for _ in range(MAX_CONNECTIONS + 10):
+                connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                connection.connect(self.path)
+                connections.append(connection)
+                if len(connections) <= MAX_CONNECTIONS:
+                    continue
+                connection.settimeout(0.5)
+                try:
+                    line = connection.makefile("r").readline()
+                except TimeoutError:
+                    continue
+                self.assertEqual(line, "ERROR busy\n")
+                break
+            else:
+                self.fail("no connection was turned away")
+        finally:
+            for connection in connections:
+                connection.close()
+
+        # Once the connections are closed, new ones are served again. Until
+        # the server has seen them closed, the request of a connection that is
+        # turned away may reset it.
+        for _ in range(100):
+            try:
+                lines = self.raw(f"RUN AT {self.trace1}\n".encode())
+                if lines != ["ERROR busy"]:
+                    break
+            except ConnectionResetError:
+                pass
+            time.sleep(0.05)
+        self.assertTrue(lines[0].startswith("OK "))
+
+
+class TestSingleWorker(TestServer):
+    WORKERS = 1
+
+
+if __name__ == "__main__":
+    unittest.main()
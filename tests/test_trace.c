@@ -0,0 +1,512 @@
+//
+// Tests of the trace reader and writer in src/trace.c.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "test.h"
+#include "trace.h"
+
+// Open a trace that is read through a pipe rather than mapped, in the given
+// format or (if it is NULL) the detected one.
+static struct trace *open_pipe(const void *data, size_t size, const char *format, int *fd)
+{
+    int fds[2];
+    if (pipe(fds) != 0) return NULL;
+    // The test traces fit in the pipe buffer.
+    if (write(fds[1], data, size) != (ssize_t)size) return NULL;
+    close(fds[1]);
+    *fd = fds[0];
+    return trace_open_format(fds[0], format);
+}
+
+// Read the rest of a trace, at most chunk records at a time.
+//
+// Returns (uint32_t): the number of records read.
+static uint32_t read_chunks(struct trace *trace, uint32_t *addresses, uint8_t *directions,
+                            uint32_t max, uint32_t chunk)
+{
+    uint32_t n = 0;
+    uint32_t count;
+    while (n < max && (count = trace->next_block(trace, addresses + n, directions + n,
+                                                 max - n < chunk ? max - n : chunk)))
+        n += count;
+    return n;
+}
+
+static uint32_t read_all(struct trace *trace, uint32_t *addresses, uint8_t *directions,
+                         uint32_t max)
+{
+    return read_chunks(trace, addresses, directions, max, TRACE_BLOCK_RECORDS);
+}
+
+static void test_text(void)
+{
+    static const char text[] = "2\n0x4 0x8\n0x10 0x4\n"
+                               "0x4 TAKEN\n0x10 NOT_TAKEN\n4 TAKEN\n\n  \n";
+    struct trace *trace = trace_open_memory(text, sizeof(text) - 1);
+    if (!CHECK(trace)) return;
+    CHECK_EQ(trace->format, TRACE_FORMAT_TEXT);
+    CHECK_EQ(trace->branch_index->num_branches, 2);
+    CHECK_EQ(trace->branch_index->branches[1].address, 0x10);
+    CHECK_EQ(trace->branch_index->branches[1].target, 0x4);
+
+    uint32_t addresses[8];
+    uint8_t directions[8];
+    CHECK_EQ(read_all(trace, addresses, directions, 8), 3);
+    CHECK_EQ(addresses[0], 0x4);
+    CHECK_EQ(directions[0], TAKEN);
+    CHECK_EQ(addresses[1], 0x10);
+    CHECK_EQ(directions[1], NOT_TAKEN);
+    CHECK_EQ(addresses[2], 0x4);
+    CHECK(!trace->error);
+    trace_close(trace);
+}
+
+static void test_text_malformed(void)
+{
+    // A direction that is neither TAKEN nor NOT_TAKEN, an address that is not
+    // hexadecimal, a record without a direction, and an address that does not
+    // fit in 32 bits.
+    static const char *const texts[] = {
+        "1\n0x4 0x8\n0x4 TAKEN\n0x4 taken\n0x4 TAKEN\n",
+        "1\n0x4 0x8\n0x4 TAKEN\nzz TAKEN\n",
+        "1\n0x4 0x8\n0x4 TAKEN\n0x4\n",
+        "1\n0x4 0x8\n0x4 TAKEN\n0x100000004 TAKEN\n",
+    };
+    for (uint32_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        struct trace *trace = trace_open_memory(texts[i], strlen(texts[i]));
+        if (!CHECK(trace)) continue;
+        uint32_t addresses[8];
+        uint8_t directions[8];
+        // The records before the malformed one are read.
+        CHECK_EQ(read_all(trace, addresses, directions, 8), 1);
+        CHECK(trace->error);
+        trace_close(trace);
+    }
+
+    // A header that lists more branches than the trace has.
+    static const char truncated[] = "3\n0x4 0x8\n0x4 TAKEN\n";
+    CHECK(!trace_open_memory(truncated, sizeof(truncated) - 1));
+
+    // Metadata whose address or target does not fit in 32 bits.
+    static const char address[] = "1\n0x100000004 0x8\n0x4 TAKEN\n";
+    CHECK(!trace_open_memory(address, sizeof(address) - 1));
+    static const char target[] = "1\n0x4 0xfffffffff0\n0x4 TAKEN\n";
+    CHECK(!trace_open_memory(target, sizeof(target) - 1));
+}
+
+static void test_stream(void)
+{
+    // The branches are discovered in order, with the targets that the
+    // records give, also on a later record of the branch.
+    static const char text[] = "0x4 TAKEN 0x0\n0x10 NOT_TAKEN\r\n0x4 TAKEN\n"
+                               "0x10 TAKEN\t0x20\n0x8 NOT_TAKEN\n";
+    struct trace *trace = trace_open_memory(text, sizeof(text) - 1);
+    if (!CHECK(trace)) return;
+    CHECK_EQ(trace->format, TRACE_FORMAT_STREAM);
+    uint32_t addresses[8];
+    uint8_t directions[8];
+    CHECK_EQ(read_all(trace, addresses, directions, 8), 5);
+    CHECK_EQ(addresses[3], 0x10);
+    CHECK_EQ(directions[3], TAKEN);
+    CHECK_EQ(directions[4], NOT_TAKEN);
+    CHECK(!trace->error);
+    const struct branch_index *branch_index = trace->branch_index;
+    CHECK_EQ(branch_index->num_branches, 3);
+    CHECK_EQ(branch_index_target(branch_index, 0x4), 0x0);
+    CHECK_EQ(branch_index_target(branch_index, 0x10), 0x20);
+    CHECK_EQ(branch_index_target(branch_index, 0x8), BRANCH_TARGET_UNKNOWN);
+    CHECK_EQ(branch_index->branches[2].address, 0x8);
+    trace_close(trace);
+
+    // A direction that is neither TAKEN nor NOT_TAKEN, an address that is not
+    // hexadecimal, a record without a direction, a target that is not
+    // hexadecimal, the reserved target, and an address or a target with more
+    // than 8 significant digits are errors after the records before them.
+    static const char *const malformed[] = {
+        "0x4 TAKEN\n0x4 taken\n0x4 TAKEN\n",
+        "0x4 TAKEN\nzz TAKEN\n",
+        "0x4 TAKEN\n0x4\n",
+        "0x4 TAKEN\n0x4 TAKEN zz\n",
+        "0x4 TAKEN\n0x8 TAKEN 0xffffffff\n",
+        "0x4 TAKEN\n0x100000004 TAKEN\n",
+        "0x4 TAKEN\n0x8 TAKEN 0xfffffffff0\n",
+    };
+    for (uint32_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        trace = trace_open_memory(malformed[i], strlen(malformed[i]));
+        if (!CHECK(trace)) continue;
+        CHECK_EQ(read_all(trace, addresses, directions, 8), 1);
+        CHECK(trace->error);
+        CHECK_EQ(trace->branch_index->num_branches, 1);
+        trace_close(trace);
+    }
+
+    // The reserved target is rejected in the metadata of the text format too.
+    static const char reserved[] = "1\n0x4 0xffffffff\n0x4 TAKEN\n";
+    CHECK(!trace_open_memory(reserved, sizeof(reserved) - 1));
+
+    // Leading zeros are not significant digits.
+    static const char zeros[] = "0x0000000004 TAKEN 0x00000000fffffff0\n";
+    trace = trace_open_memory(zeros, sizeof(zeros) - 1);
+    if (!CHECK(trace)) return;
+    CHECK_EQ(read_all(trace, addresses, directions, 8), 1);
+    CHECK_EQ(addresses[0], 0x4);
+    CHECK(!trace->error);
+    CHECK_EQ(branch_index_target(trace->branch_index, 0x4), 0xfffffff0);
+    trace_close(trace);
+}
+
+static void test_targets(void)
+{
+    // A side file gives known branches their targets and adds the others.
+    static const char text[] = "0x4 TAKEN\n0x8 NOT_TAKEN 0x40\n";
+    struct trace *trace = trace_open_memory(text, sizeof(text) - 1);
+    if (!CHECK(trace)) return;
+    uint32_t addresses[8];
+    uint8_t directions[8];
+    CHECK_EQ(read_all(trace, addresses, directions, 8), 2);
+
+    static char targets[] = "0x4 0x0\n0x8 0x80\n0x10 0x4\n";
+    FILE *file = fmemopen(targets, sizeof(targets) - 1, "r");
+    if (CHECK(file)) {
+        CHECK(trace_read_targets(trace, file));
+        fclose(file);
+    }
+    CHECK_EQ(trace->branch_index->num_branches, 3);
+    CHECK_EQ(branch_index_target(trace->branch_index, 0x4), 0x0);
+    CHECK_EQ(branch_index_target(trace->branch_index, 0x8), 0x40);
+    CHECK_EQ(branch_index_target(trace->branch_index, 0x10), 0x4);
+
+    // A malformed line and the reserved target are rejected.
+    static char malformed[] = "0x20 0x0\n0x24 zz\n";
+    static char reserved[] = "0x20 0x0\n0x24 0xffffffff\n";
+    char *files[] = {malformed, reserved};
+    for (uint32_t i = 0; i < 2; i++) {
+        file = fmemopen(files[i], strlen(files[i]), "r");
+        if (!CHECK(file)) continue;
+        CHECK(!trace_read_targets(trace, file));
+        fclose(file);
+    }
+    CHECK_EQ(branch_index_lookup(trace->branch_index, 0x24), BRANCH_INDEX_NONE);
+    trace_close(trace);
+}
+
+// Write a binary trace of n records to memory.
+//
+// Returns (char *): the trace, which the caller frees.
+static char *write_binary(uint32_t n, size_t *size)
+{
+    static const struct branch_metadata metadata[2] = {{0x1000, 0x0f00}, {0x2000, 0x2040}};
+    FILE *file = tmpfile();
+    struct trace_writer *writer = trace_writer_open(file, 2, metadata);
+    for (uint32_t i = 0; i < n; i++)
+        trace_writer_append(writer, metadata[i % 2].address, i % 3 == 0 ? TAKEN : NOT_TAKEN);
+    CHECK(trace_writer_close(writer));
+
+    *size = ftell(file);
+    char *data = malloc(*size);
+    rewind(file);
+    CHECK_EQ(fread(data, 1, *size, file), *size);
+    fclose(file);
+    return data;
+}
+
+static void test_binary(void)
+{
+    size_t size;
+    char *data = write_binary(100, &size);
+    CHECK_EQ(size, sizeof(struct trace_file_header) + 2 * sizeof(struct branch_metadata) +
+                       2 * sizeof(struct trace_file_block));
+
+    // The integers are little-endian whatever the host is.
+    const unsigned char *bytes = (const unsigned char *)data;
+    CHECK(!memcmp(bytes, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC)));
+    CHECK_EQ(bytes[8], TRACE_FILE_VERSION);
+    CHECK_EQ(bytes[12], 2);
+    CHECK_EQ(bytes[16], 100);
+    CHECK_EQ(bytes[24], TRACE_FILE_BLOCK_RECORDS);
+    CHECK_EQ(bytes[32], 0x00);
+    CHECK_EQ(bytes[33], 0x10);
+    const unsigned char *block = bytes + sizeof(struct trace_file_header) + 16;
+    CHECK_EQ(block[1], 0x10);
+    CHECK_EQ(block[4 * 64], 0x49);
+
+    struct trace *trace = trace_open_memory(data, size);
+    if (CHECK(trace)) {
+        CHECK_EQ(trace->format, TRACE_FORMAT_BINARY);
+        CHECK_EQ(trace->branch_index->num_branches, 2);
+        CHECK_EQ(trace->branch_index->branches[0].target, 0x0f00);
+
+        uint32_t addresses[128];
+        uint8_t directions[128];
+        CHECK_EQ(read_all(trace, addresses, directions, 128), 100);
+        bool ok = true;
+        for (uint32_t i = 0; i < 100; i++) {
+            ok = ok && addresses[i] == (i % 2 ? 0x2000 : 0x1000);
+            ok = ok && directions[i] == (i % 3 == 0 ? TAKEN : NOT_TAKEN);
+        }
+        CHECK(ok);
+        CHECK(!trace->error);
+        trace_close(trace);
+    }
+
+    // Without its last block, a mapped trace is rejected when it is opened
+    // and a piped one fails when the block is read.
+    size_t truncated = size - sizeof(struct trace_file_block);
+    CHECK(!trace_open_memory(data, truncated));
+    int fd;
+    trace = open_pipe(data, truncated, NULL, &fd);
+    if (CHECK(trace)) {
+        uint32_t addresses[128];
+        uint8_t directions[128];
+        CHECK_EQ(read_all(trace, addresses, directions, 128), 64);
+        CHECK(trace->error);
+        trace_close(trace);
+        close(fd);
+    }
+
+    // A header that claims far more branches than there are is rejected
+    // without buffering them.
+    memcpy(data + 12, "\x00\x00\x00\x40", 4);
+    CHECK(!open_pipe(data, size, NULL, &fd));
+    close(fd);
+    free(data);
+}
+
+// A stream trace of n records over 1000 branches, each with its target.
+//
+// Returns (char *): the trace, which the caller frees.
+static char *write_stream(uint32_t n, size_t *size)
+{
+    char *text = malloc((size_t)n * 32);
+    *size = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t address = 0x1000 + 4 * (i * 7 % 1000);
+        *size += sprintf(text + *size, "%#x %s %#x\n", address, i % 5 ? "TAKEN" : "NOT_TAKEN",
+                         address + 0x40);
+    }
+    return text;
+}
+
+static bool same_branches(const struct branch_index *a, const struct branch_index *b)
+{
+    if (!CHECK_EQ(a->num_branches, b->num_branches)) return false;
+    bool ok = true;
+    for (uint32_t i = 0; i < a->num_branches; i++) {
+        ok = ok && a->branches[i].address == b->branches[i].address;
+        ok = ok && a->branches[i].target == b->branches[i].target;
+    }
+    return CHECK(ok);
+}
+
+#define NUM_READER_RECORDS 100000
+
+static void test_reader(void)
+{
+    // The reader thread hands back the records and the discovered branches
+    // of a direct read, whatever the size of the requests.
+    static uint32_t expected_addresses[NUM_READER_RECORDS], addresses[NUM_READER_RECORDS];
+    static uint8_t expected_directions[NUM_READER_RECORDS], directions[NUM_READER_RECORDS];
+    size_t sizes[2];
+    char *data[2] = {write_binary(NUM_READER_RECORDS, &sizes[0]),
+                     write_stream(NUM_READER_RECORDS, &sizes[1])};
+    for (uint32_t d = 0; d < 2; d++) {
+        struct trace *direct = trace_open_memory(data[d], sizes[d]);
+        if (!CHECK(direct)) continue;
+        CHECK_EQ(read_all(direct, expected_addresses, expected_directions, NUM_READER_RECORDS),
+                 NUM_READER_RECORDS);
+        static const uint32_t chunks[] = {1000, TRACE_BLOCK_RECORDS};
+        for (uint32_t c = 0; c < 2; c++) {
+            struct trace *trace = trace_open_memory(data[d], sizes[d]);
+            if (!CHECK(trace && trace_start_reader(trace))) continue;
+            uint32_t n =
+                read_chunks(trace, addresses, directions, NUM_READER_RECORDS, chunks[c]);
+            CHECK_EQ(n, NUM_READER_RECORDS);
+            CHECK_EQ(trace->next_block(trace, addresses, directions, TRACE_BLOCK_RECORDS), 0);
+            CHECK(!memcmp(addresses, expected_addresses, sizeof(addresses)));
+            CHECK(!memcmp(directions, expected_directions, sizeof(directions)));
+            CHECK(!trace->error);
+            same_branches(trace->branch_index, direct->branch_index);
+            trace_close(trace);
+        }
+        trace_close(direct);
+    }
+
+    // A trace that is closed long before its end stops the reader, which is
+    // blocked on the full ring.
+    struct trace *trace = trace_open_memory(data[0], sizes[0]);
+    if (CHECK(trace && trace_start_reader(trace))) {
+        CHECK_EQ(read_chunks(trace, addresses, directions, 10, 10), 10);
+        trace_close(trace);
+    }
+    free(data[0]);
+    free(data[1]);
+
+    // An error of the reader thread is seen after the records before it.
+    data[0] = write_binary(100, &sizes[0]);
+    int fd;
+    trace = open_pipe(data[0], sizes[0] - sizeof(struct trace_file_block), NULL, &fd);
+    if (CHECK(trace && trace_start_reader(trace))) {
+        CHECK_EQ(read_all(trace, addresses, directions, 128), 64);
+        CHECK(trace->error);
+        trace_close(trace);
+    }
+    close(fd);
+    free(data[0]);
+}
+
+// Compress data as a gzip member.
+//
+// Returns (char *): the compressed data, which the caller frees.
+static char *gzip_compress(const void *data, size_t size, size_t *compressed_size)
+{
+    z_stream stream = {0};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                 Z_DEFAULT_STRATEGY);
+    size_t capacity = deflateBound(&stream, size);
+    char *compressed = malloc(capacity);
+    stream.next_in = (unsigned char *)data;
+    stream.avail_in = size;
+    stream.next_out = (unsigned char *)compressed;
+    stream.avail_out = capacity;
+    CHECK_EQ(deflate(&stream, Z_FINISH), Z_STREAM_END);
+    *compressed_size = stream.total_out;
+    deflateEnd(&stream);
+    return compressed;
+}
+
+static void test_gzip(void)
+{
+    static uint32_t expected_addresses[2000], addresses[2000];
+    static uint8_t expected_directions[2000], directions[2000];
+    size_t sizes[2];
+    char *data[2] = {write_binary(1000, &sizes[0]), write_stream(1000, &sizes[1])};
+    for (uint32_t d = 0; d < 2; d++) {
+        struct trace *direct = trace_open_memory(data[d], sizes[d]);
+        if (!CHECK(direct)) continue;
+        CHECK_EQ(read_all(direct, expected_addresses, expected_directions, 2000), 1000);
+
+        // Compressed memory, and a compressed pipe.
+        size_t compressed_size;
+        char *compressed = gzip_compress(data[d], sizes[d], &compressed_size);
+        for (uint32_t piped = 0; piped < 2; piped++) {
+            int fd = -1;
+            struct trace *trace = piped ? open_pipe(compressed, compressed_size, NULL, &fd)
+                                        : trace_open_memory(compressed, compressed_size);
+            if (CHECK(trace)) {
+                CHECK_EQ(trace->format, direct->format);
+                CHECK_EQ(read_all(trace, addresses, directions, 2000), 1000);
+                CHECK(!memcmp(addresses, expected_addresses, 1000 * sizeof(uint32_t)));
+                CHECK(!memcmp(directions, expected_directions, 1000));
+                CHECK(!trace->error);
+                same_branches(trace->branch_index, direct->branch_index);
+                trace_close(trace);
+            }
+            if (fd >= 0) close(fd);
+        }
+
+        // Without the end of its member, even if that is only the checksum,
+        // the compressed trace is an error rather than a shorter trace.
+        struct trace *trace = trace_open_memory(compressed, compressed_size - 20);
+        if (CHECK(trace)) {
+            CHECK(read_all(trace, addresses, directions, 2000) <= 1000);
+            CHECK(trace->error);
+            trace_close(trace);
+        }
+        free(compressed);
+        trace_close(direct);
+    }
+
+    // Concatenated members are read one after the other.
+    size_t half = sizes[1] / 2;
+    while (data[1][half - 1] != '\n') half++;
+    size_t first_size, second_size;
+    char *first = gzip_compress(data[1], half, &first_size);
+    char *second = gzip_compress(data[1] + half, sizes[1] - half, &second_size);
+    char *both = malloc(first_size + second_size);
+    memcpy(both, first, first_size);
+    memcpy(both + first_size, second, second_size);
+    struct trace *trace = trace_open_memory(both, first_size + second_size);
+    if (CHECK(trace)) {
+        CHECK_EQ(read_all(trace, addresses, directions, 2000), 1000);
+        CHECK_EQ(addresses[999], expected_addresses[999]);
+        CHECK(!trace->error);
+        trace_close(trace);
+    }
+    free(first);
+    free(second);
+    free(both);
+    free(data[0]);
+    free(data[1]);
+}
+
+static void test_champsim(void)
+{
+    // Two taken branches, which jump to the next instruction, a not taken
+    // one and instructions that are not branches. The last taken branch has
+    // no next instruction, so its target stays unknown.
+    static const struct {
+        uint64_t ip;
+        bool is_branch, taken;
+    } instructions[] = {
+        {0x100, true, true}, {0x200, false, false}, {0x204, true, false},
+        {0x208, false, false}, {0x500000300, true, true},
+    };
+    struct champsim_record records[5];
+    memset(records, 0, sizeof(records));
+    for (uint32_t i = 0; i < 5; i++) {
+        records[i].ip = instructions[i].ip;
+        records[i].is_branch = instructions[i].is_branch;
+        records[i].branch_taken = instructions[i].taken;
+    }
+
+    // A partial record at the end is a truncated trace.
+    char data[sizeof(records) + 10];
+    memcpy(data, records, sizeof(records));
+    memset(data + sizeof(records), 0xff, 10);
+    for (uint32_t truncated = 0; truncated < 2; truncated++) {
+        int fd;
+        size_t size = sizeof(records) + (truncated ? 10 : 0);
+        struct trace *trace = open_pipe(data, size, "champsim", &fd);
+        if (CHECK(trace)) {
+            CHECK_EQ(trace->format, TRACE_FORMAT_CHAMPSIM);
+            uint32_t addresses[8];
+            uint8_t directions[8];
+            CHECK_EQ(read_all(trace, addresses, directions, 8), 3);
+            CHECK_EQ(addresses[0], 0x100);
+            CHECK_EQ(directions[0], TAKEN);
+            CHECK_EQ(addresses[1], 0x204);
+            CHECK_EQ(directions[1], NOT_TAKEN);
+            // Only the low 32 bits of ip are kept.
+            CHECK_EQ(addresses[2], 0x300);
+            CHECK_EQ(directions[2], TAKEN);
+
+            const struct branch_index *branch_index = trace->branch_index;
+            CHECK_EQ(branch_index->num_branches, 3);
+            CHECK_EQ(branch_index_target(branch_index, 0x100), 0x200);
+            CHECK_EQ(branch_index_target(branch_index, 0x204), BRANCH_TARGET_UNKNOWN);
+            CHECK_EQ(branch_index_target(branch_index, 0x300), BRANCH_TARGET_UNKNOWN);
+            CHECK_EQ(trace->error != NULL, truncated);
+            trace_close(trace);
+        }
+        close(fd);
+    }
+}
+
+int main(void)
+{
+    test_text();
+    test_text_malformed();
+    test_stream();
+    test_targets();
+    test_binary();
+    test_reader();
+    test_gzip();
+    test_champsim();
+    return test_finish("test_trace");
+}
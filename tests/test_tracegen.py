@@ -0,0 +1,125 @@
+#! /usr/bin/env python3
+#
+# Tests of tools/tracegen, the synthetic trace generator used by the
+# benchmarks.
+#
+
+import struct
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+root = Path(__file__).resolve().parent.parent
+
+HEADER = struct.Struct("<8sIIQII")
+
+
+def generate(directory, name, *args):
+    path = Path(directory, name)
+    subprocess.run([str(root / "tools" / "tracegen"), *args, str(path)], check=True)
+    return path.read_bytes()
+
+
+def rate(spec, trace):
+    stdout = subprocess.run(
+        [str(root / "branchsim"), spec], input=trace, capture_output=True, check=True
+    ).stdout.decode()
+    for line in stdout.splitlines():
+        if line.startswith("OUTPUT BRANCH PREDICTION RATE"):
+            return float(line.split()[-1])
+    raise AssertionError(stdout)
+
+
+class TestTracegen(unittest.TestCase):
+    def setUp(self):
+        self.directory = tempfile.TemporaryDirectory()
+        self.addCleanup(self.directory.cleanup)
+
+    def generate(self, *args):
+        return generate(self.directory.name, "trace", *args)
+
+    def test_binary_header(self):
+        trace = self.generate("--branches", "100", "--records", "1000")
+        header = HEADER.unpack_from(trace)
+        magic, version, num_branches, num_records, block_records, _ = header
+        self.assertEqual(magic, b"BRSIMTR\0")
+        self.assertEqual((version, num_branches, num_records), (1, 100, 1000))
+        self.assertEqual(block_records, 64)
+        blocks = (1000 + 63) // 64
+        self.assertEqual(len(trace), HEADER.size + 100 * 8 + blocks * (64 * 4 + 8))
+
+    def test_deterministic(self):
+        args = ["--branches", "64", "--records", "5000"]
+        first = self.generate(*args, "--seed", "7")
+        self.assertEqual(self.generate(*args, "--seed", "7"), first)
+        self.assertNotEqual(self.generate(*args, "--seed", "8"), first)
+
+    def test_text_matches_binary(self):
+        args = ["--branches", "64", "--records", "5000", "--seed", "3"]
+        text = self.generate(*args, "--text")
+        lines = text.decode().splitlines()
+        self.assertEqual(lines[0], "64")
+        self.assertEqual(len(lines), 1 + 64 + 5000)
+
+        binary = self.generate(*args)
+        for spec in ["BTFNT", "2BG", "GSHARE"]:
+            with self.subTest(spec=spec):
+                self.assertEqual(rate(spec, text), rate(spec, binary))
+
+    def test_mix(self):
+        # Loops are backward branches that are mostly taken, random branches
+        # are taken half of the time.
+        args = ["--branches", "64", "--records", "20000"]
+        loops = self.generate(*args, "--mix", "1,0,0,0")
+        self.assertGreater(rate("BTFNT", loops), 0.8)
+        random = self.generate(*args, "--mix", "0,0,1,0")
+        self.assertAlmostEqual(rate("AT", random), 0.5, delta=0.02)
+
+    def test_invalid_arguments(self):
+        for args in [
+            ["--branches", "0", "out"],
+            ["--mix", "0,0,0,0", "out"],
+            ["--mix", "1,2", "out"],
+            ["out", "other"],
+            [],
+        ]:
+            with self.subTest(args=args):
+                result = subprocess.run(
+                    [str(root / "tools" / "tracegen"), *args],
+                    capture_output=True,
+                    cwd=self.directory.name,
+                )
+                self.assertEqual(result.returncode, 1)
+                self.assertFalse(Path(self.directory.name, "out").exists())
+
+    def test_invalid_numbers(self):
+        for args in [
+            ["--records", "10x"],
+            ["--records", "-1"],
+            ["--branches", "5x"],
+            ["--seed", "1.5"],
+            ["--mix", "1,2,3,x"],
+            ["--mix", "4294967295,1,0,0"],
+        ]:
+            with self.subTest(args=args):
+                result = subprocess.run(
+                    [str(root / "tools" / "tracegen"), *args, "out"],
+                    capture_output=True,
+                    cwd=self.directory.name,
+                )
+                self.assertEqual(result.returncode, 1)
+                self.assertIn(b"Invalid", result.stderr)
+                self.assertFalse(Path(self.directory.name, "out").exists())
+
+    def test_write_failure(self):
+        result = subprocess.run(
+            [str(root / "tools" / "tracegen"), "--records", "1000", "/dev/full"],
+            capture_output=True,
+        )
+        self.assertEqual(result.returncode, 1)
+        self.assertIn(b"Failed to write", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
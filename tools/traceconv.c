@@ -0,0 +1,94 @@
+//
+// This is the traceconv tool. It converts a trace in the text format read by
+// branchsim into the binary trace format described in src/trace.h.
+//
+// Usage:
+//
+//      ./tools/traceconv OUTPUT_FILE < TEXT_TRACE
+//
+// Traces without branch metadata (see trace.h) are converted in a single pass
+// too: their records go to a temporary file until all of the branches are
+// known, and are copied after the metadata.
+//
+
+#include <endian.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// Write the header and the metadata of a binary trace whose records were
+// written to a temporary file without metadata, followed by the records.
+static bool copy_with_metadata(FILE *records, FILE *output, const struct branch_index *branches)
+{
+    struct trace_file_header header;
+    if (fseek(records, 0, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, records) != 1)
+        return false;
+    if (!trace_write_header(output, branches->num_branches, branches->branches,
+                            le64toh(header.num_records)))
+        return false;
+
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), records)) > 0)
+        if (fwrite(buffer, 1, n, output) != n) return false;
+    return !ferror(records);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s OUTPUT_FILE < TEXT_TRACE\n", argv[0]);
+        return 1;
+    }
+
+    struct trace *trace = trace_open(STDIN_FILENO);
+    if (!trace) {
+        fprintf(stderr, "Malformed trace.\n");
+        return 2;
+    }
+
+    FILE *output = fopen(argv[1], "wb");
+    if (!output) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    const struct branch_index *branches = trace->branch_index;
+    FILE *records = trace->decoder->discovers ? tmpfile() : output;
+    struct trace_writer *writer =
+        records ? trace_writer_open(records, records == output ? branches->num_branches : 0,
+                                    branches->branches)
+                : NULL;
+    bool ok = writer != NULL;
+
+    uint32_t addresses[TRACE_BLOCK_RECORDS];
+    uint8_t directions[TRACE_BLOCK_RECORDS];
+    uint32_t count;
+    while (ok && (count = trace->next_block(trace, addresses, directions, TRACE_BLOCK_RECORDS))) {
+        for (uint32_t i = 0; ok && i < count; i++)
+            ok = trace_writer_append(writer, addresses[i], directions[i]);
+    }
+    if (trace->error) {
+        fprintf(stderr, "Malformed trace: %s\n", trace->error);
+        if (writer) trace_writer_close(writer);
+        if (records && records != output) fclose(records);
+        trace_close(trace);
+        fclose(output);
+        remove(argv[1]);
+        return 2;
+    }
+    if (writer) ok = trace_writer_close(writer) && ok;
+    if (records && records != output) {
+        ok = ok && copy_with_metadata(records, output, branches);
+        fclose(records);
+    }
+
+    trace_close(trace);
+    if (fclose(output) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
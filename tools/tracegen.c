@@ -0,0 +1,302 @@
+//
+// This is the tracegen tool. It generates deterministic synthetic branch
+// traces for benchmarking the simulator.
+//
+// Every static branch gets one of four behaviours:
+//
+//  * loop: a backward branch that is taken for a fixed trip count and then
+//    falls through once. The body of each iteration executes a few of the
+//    other branches.
+//  * biased: taken with a fixed probability that is close to 0 or 1.
+//  * random: taken with probability 0.5.
+//  * correlated: repeats (or inverts) the outcome of one of the last few
+//    branches in the global history.
+//
+// The same arguments always produce the same trace.
+//
+// Usage:
+//
+//      ./tools/tracegen [options] OUTPUT_FILE
+//
+// Options:
+//      --branches N    number of static branches (default 1024)
+//      --records N     number of dynamic branch records (default 10000000)
+//      --seed N        random seed (default 1)
+//      --mix L,B,R,C   relative weights of the loop, biased, random and
+//                      correlated behaviours (default 1,4,1,2)
+//      --text          write the text format instead of the binary format
+//
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "util.h"
+
+enum behaviour { LOOP, BIASED, RANDOM, CORRELATED, NUM_BEHAVIOURS };
+
+struct static_branch {
+    uint32_t address;
+    uint32_t target;
+    enum behaviour behaviour;
+    // LOOP: trip count. BIASED: probability of TAKEN in 1/65536ths.
+    // CORRELATED: distance into the global history, negative to invert.
+    int32_t parameter;
+    uint32_t iteration;
+};
+
+struct generator {
+    uint64_t state;
+    uint64_t history;
+    uint32_t num_branches;
+    struct static_branch *branches;
+    uint32_t num_non_loops;
+    uint32_t *non_loops;
+
+    FILE *file;
+    struct trace_writer *writer;
+    uint64_t written;
+    uint64_t num_records;
+};
+
+static uint64_t next_random(struct generator *g)
+{
+    // xorshift64*
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+    return g->state * 2685821657736338717ull;
+}
+
+static uint32_t random_below(struct generator *g, uint32_t bound)
+{
+    return (uint32_t)((next_random(g) >> 32) * bound >> 32);
+}
+
+static enum branch_direction execute(struct generator *g, struct static_branch *branch)
+{
+    enum branch_direction direction;
+    switch (branch->behaviour) {
+    case LOOP:
+        direction = ++branch->iteration < (uint32_t)branch->parameter ? TAKEN : NOT_TAKEN;
+        if (direction == NOT_TAKEN) branch->iteration = 0;
+        break;
+    case BIASED:
+        direction = random_below(g, 65536) < (uint32_t)branch->parameter ? TAKEN : NOT_TAKEN;
+        break;
+    case RANDOM:
+        direction = next_random(g) >> 63;
+        break;
+    default: {
+        int32_t distance = branch->parameter < 0 ? -branch->parameter : branch->parameter;
+        direction = (g->history >> (distance - 1)) & 1;
+        if (branch->parameter < 0) direction = !direction;
+        break;
+    }
+    }
+
+    g->history = (g->history << 1) | direction;
+    if (g->writer) {
+        trace_writer_append(g->writer, branch->address, direction);
+    } else {
+        fprintf(g->file, "0x%x %s\n", branch->address, direction == TAKEN ? "TAKEN" : "NOT_TAKEN");
+    }
+    g->written++;
+    return direction;
+}
+
+// Pick a branch with a skewed distribution so that some branches are hot.
+static uint32_t pick_hot(struct generator *g, uint32_t n)
+{
+    uint32_t a = random_below(g, n), b = random_below(g, n);
+    return a < b ? a : b;
+}
+
+static void generate(struct generator *g)
+{
+    while (g->written < g->num_records) {
+        struct static_branch *branch = &g->branches[pick_hot(g, g->num_branches)];
+        if (branch->behaviour != LOOP || g->num_non_loops == 0) {
+            execute(g, branch);
+            continue;
+        }
+
+        // Run the loop to completion, with a small body of other branches.
+        uint32_t body = 1 + random_below(g, 3);
+        uint32_t first = pick_hot(g, g->num_non_loops);
+        do {
+            for (uint32_t i = 0; i < body && g->written < g->num_records; i++)
+                execute(g, &g->branches[g->non_loops[(first + i) % g->num_non_loops]]);
+            if (g->written == g->num_records) break;
+        } while (execute(g, branch) == TAKEN);
+    }
+}
+
+// Parse the weights of --mix, four numbers separated by commas.
+//
+// Returns (bool): false if the text is not four weights.
+static bool parse_mix(const char *text, uint32_t *mix)
+{
+    char buffer[128];
+    if (strlen(text) >= sizeof(buffer)) return false;
+    strcpy(buffer, text);
+    char *rest = buffer;
+    uint32_t n = 0;
+    uint64_t total = 0;
+    for (char *part; (part = strsep(&rest, ","));) {
+        uint64_t value;
+        if (n == NUM_BEHAVIOURS || !parse_number(part, &value) || value > UINT32_MAX)
+            return false;
+        mix[n++] = value;
+        total += value;
+    }
+    // The behaviours are drawn from a single 32-bit random number.
+    return n == NUM_BEHAVIOURS && total > 0 && total <= UINT32_MAX;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--branches N] [--records N] [--seed N] [--mix L,B,R,C] [--text] "
+            "OUTPUT_FILE\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"branches", required_argument, NULL, 'b'},
+        {"records", required_argument, NULL, 'r'},
+        {"seed", required_argument, NULL, 's'},
+        {"mix", required_argument, NULL, 'm'},
+        {"text", no_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {0},
+    };
+    struct generator g = {.num_branches = 1024, .num_records = 10000000};
+    uint64_t seed = 1;
+    uint32_t mix[NUM_BEHAVIOURS] = {1, 4, 1, 2};
+    bool text = false;
+    uint64_t value;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            if (!parse_number(optarg, &value) || value == 0 || value > BRANCH_INDEX_MAX_BRANCHES) {
+                fprintf(stderr, "Invalid number of branches %s\n", optarg);
+                return 1;
+            }
+            g.num_branches = value;
+            break;
+        case 'r':
+            if (!parse_number(optarg, &g.num_records)) {
+                fprintf(stderr, "Invalid number of records %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            if (!parse_number(optarg, &seed)) {
+                fprintf(stderr, "Invalid seed %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (!parse_mix(optarg, mix)) {
+                fprintf(stderr, "Invalid mix %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            text = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    uint32_t total_mix = mix[LOOP] + mix[BIASED] + mix[RANDOM] + mix[CORRELATED];
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    g.state = seed * 0x9E3779B97F4A7C15ull + 1;
+
+    // Lay the static branches out at increasing addresses.
+    g.branches = calloc(g.num_branches, sizeof(struct static_branch));
+    g.non_loops = calloc(g.num_branches, sizeof(uint32_t));
+    struct branch_metadata *branch_metadatas =
+        calloc(g.num_branches, sizeof(struct branch_metadata));
+    if (!g.branches || !g.non_loops || !branch_metadatas) {
+        fprintf(stderr, "Cannot allocate %u branches\n", g.num_branches);
+        return 1;
+    }
+    uint32_t address = 0x400000;
+    for (uint32_t i = 0; i < g.num_branches; i++) {
+        struct static_branch *branch = &g.branches[i];
+        address += 4 + 4 * random_below(&g, 16);
+        branch->address = address;
+
+        uint32_t choice = random_below(&g, total_mix);
+        for (branch->behaviour = LOOP; choice >= mix[branch->behaviour]; branch->behaviour++)
+            choice -= mix[branch->behaviour];
+
+        switch (branch->behaviour) {
+        case LOOP:
+            branch->parameter = 2 + random_below(&g, 63);
+            branch->target = address - 4 * (1 + random_below(&g, 64));
+            break;
+        case BIASED: {
+            int32_t bias = 58982 + random_below(&g, 6554); // 90% to 100%
+            branch->parameter = random_below(&g, 2) ? bias : 65536 - bias;
+            branch->target = address + 4 * (1 + random_below(&g, 64));
+            break;
+        }
+        case RANDOM:
+            branch->target = address + 4 * (1 + random_below(&g, 64));
+            break;
+        default:
+            branch->parameter = 1 + random_below(&g, 8);
+            if (random_below(&g, 2)) branch->parameter = -branch->parameter;
+            branch->target = address + 4 * (1 + random_below(&g, 64));
+            break;
+        }
+        if (branch->behaviour != LOOP) g.non_loops[g.num_non_loops++] = i;
+
+        branch_metadatas[i].address = branch->address;
+        branch_metadatas[i].target = branch->target;
+    }
+
+    g.file = fopen(argv[optind], text ? "w" : "wb");
+    if (!g.file) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (text) {
+        fprintf(g.file, "%u\n", g.num_branches);
+        for (uint32_t i = 0; i < g.num_branches; i++)
+            fprintf(g.file, "0x%x 0x%x\n", branch_metadatas[i].address, branch_metadatas[i].target);
+    } else {
+        g.writer = trace_writer_open(g.file, g.num_branches, branch_metadatas);
+        if (!g.writer) {
+            fprintf(stderr, "Failed to write %s\n", argv[optind]);
+            fclose(g.file);
+            return 1;
+        }
+    }
+
+    generate(&g);
+
+    bool ok = !g.writer || trace_writer_close(g.writer);
+    if (fclose(g.file) != 0 || !ok) {
+        fprintf(stderr, "Failed to write %s\n", argv[optind]);
+        return 1;
+    }
+
+    free(branch_metadatas);
+    free(g.non_loops);
+    free(g.branches);
+    return 0;
+}